@@ -1,14 +1,17 @@
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <termios.h>
 #include <string.h>
+#include <errno.h>
 
 #include <stdexcept>
 
 class CharDeviceSerial : public IOwlSerial {
  public:
-  CharDeviceSerial(const char *device_path, int baudrate) {
+  CharDeviceSerial(const char *device_path, int baudrate, bool flow_control = false) : flow_control(flow_control) {
     fd = open(device_path, O_RDWR | O_NONBLOCK);
     if (fd < 0) {
       throw std::runtime_error("Cannot open serial device");
@@ -170,6 +173,9 @@ class CharDeviceSerial : public IOwlSerial {
     }
 
     options.c_cflag |= (CLOCAL | CREAD);
+    if (flow_control) {
+      options.c_cflag |= CRTSCTS;
+    }
     options.c_iflag &= ~(INLCR | IGNCR | ICRNL);
     options.c_oflag &= ~(ONLCR | OCRNL | ONOCR | ONLRET | OLCUC | OPOST);
     options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
@@ -194,9 +200,42 @@ class CharDeviceSerial : public IOwlSerial {
 
   int32_t write(const uint8_t *buf, uint32_t count) {
     ssize_t res = ::write(fd, buf, count);  // Standard library call
+    if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;  // output buffer full, e.g. the modem deasserted CTS
+    }
+    return res;
+  }
+
+  int32_t writev(const OwlSerialSegment *segments, int count) {
+    struct iovec iov[16];
+    int iovcnt = (count > 16) ? 16 : count;
+
+    for (int i = 0; i < iovcnt; i++) {
+      iov[i].iov_base = (void *)segments[i].buf;
+      iov[i].iov_len  = segments[i].len;
+    }
+
+    ssize_t res = ::writev(fd, iov, iovcnt);  // Standard library call
+    if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
+    }
     return res;
   }
 
+  bool flowControlEnabled() {
+    return flow_control;
+  }
+
+  bool waitReadable(uint32_t timeout_ms) {
+    struct pollfd pfd;
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+
+    int res = poll(&pfd, 1, timeout_ms);
+    return res > 0 && (pfd.revents & POLLIN) != 0;
+  }
+
  private:
   int fd;
+  bool flow_control;
 };
@@ -0,0 +1,61 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <stdexcept>
+
+/*
+ * File mapped in memory, as persistent storage for an outbox (see utils/outbox.h):
+ *
+ *   MappedFile file("outbox.bin", 64 * 1024);
+ *   owl_outbox_init(&outbox, file.data(), file.size(), 256, owl_outbox_retention::DropOldest, MappedFile::sync);
+ */
+class MappedFile {
+ public:
+  MappedFile(const char *path, size_t size) : size_(size) {
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("Cannot open file");
+    }
+
+    // A new file reads as zeroes, which is an empty outbox
+    if (ftruncate(fd, size) != 0) {
+      close(fd);
+      throw std::runtime_error("Cannot resize file");
+    }
+
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Cannot map file");
+    }
+    data_ = (uint8_t *)addr;
+  }
+
+  virtual ~MappedFile() {
+    msync(data_, size_, MS_SYNC);
+    munmap(data_, size_);
+    close(fd);
+  }
+
+  uint8_t *data() {
+    return data_;
+  }
+
+  size_t size() {
+    return size_;
+  }
+
+  /* Write a changed range back to the file, usable as an owl_outbox_sync_f */
+  static void sync(const void *addr, uint32_t len, void *priv) {
+    uintptr_t page  = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr & ~(page - 1);
+    msync((void *)start, (uintptr_t)addr + len - start, MS_SYNC);
+  }
+
+ private:
+  int fd;
+  uint8_t *data_;
+  size_t size_;
+};
@@ -7,9 +7,14 @@
 #include <future>
 #include <modem/OwlModemBG96.h>
 #include "CharDeviceSerial.h"
+#include "MappedFile.h"
 
 #define OVERWRITE_TLS_CREDS false
 
+#define OUTBOX_FILE "mqtt-outbox.bin"
+#define OUTBOX_SIZE (64 * 1024)
+#define OUTBOX_RECORD_SIZE 256
+
 static void print_message(str topic, str data) {
   fprintf(stderr, "MQTT message: %.*s - %.*s\n", topic.len, topic.s, data.len, data.s);
 }
@@ -42,6 +47,7 @@ bool spin_thread(OwlModemBG96& modem, std::atomic_bool& cancel) {
   while (!cancel) {
     usleep(200);
     modem.AT.spin();
+    modem.mqtt.handlePublishTimeouts();
   }
   return true;
 }
@@ -94,6 +100,16 @@ int main(int argc, const char** argv) {
   CharDeviceSerial serial(device_path, 9600);
   OwlModemBG96 bg96(&serial);
 
+  // Messages published with "spub" wait here until delivered, across restarts of the sample
+  MappedFile outbox_file(OUTBOX_FILE, OUTBOX_SIZE);
+  owl_outbox outbox;
+  if (!owl_outbox_init(&outbox, outbox_file.data(), outbox_file.size(), OUTBOX_RECORD_SIZE,
+                       owl_outbox_retention::DropOldest, MappedFile::sync)) {
+    fprintf(stderr, "Failed to open the outbox\n");
+    return 1;
+  }
+  bg96.mqtt.setOutbox(&outbox);
+
   if (!bg96.powerOn()) {
     fprintf(stderr, "Failed to power on the modem\n");
     return 1;
@@ -242,6 +258,19 @@ int main(int argc, const char** argv) {
       if (!bg96.mqtt.publish(tok_argv[1], to_publish)) {
         fprintf(stderr, "Failed to publish to MQTT broker\n");
       }
+    } else if (strcmp(tok_argv[0], "spub") == 0) {
+      if (tok_argc != 3) {
+        fprintf(stderr, "Usage: spub <topic> <message>\n");
+        continue;
+      }
+
+      str to_publish = STRDECL(tok_argv[2]);
+
+      if (!bg96.mqtt.publishStored(tok_argv[1], to_publish)) {
+        fprintf(stderr, "Failed to store the message\n");
+      } else {
+        fprintf(stderr, "%u message(s) in the outbox\n", owl_outbox_count(&outbox));
+      }
     } else if (strcmp(tok_argv[0], "sub") == 0) {
       if (tok_argc != 2) {
         fprintf(stderr, "Usage: sub <topic>\n");
@@ -273,6 +302,7 @@ int main(int argc, const char** argv) {
               "    open <broker_addr> <broker_port>\n"
               "    login <client_id> [<login> <password>]\n"
               "    pub <topic> <message>\n"
+              "    spub <topic> <message>\n"
               "    sub <topic>\n"
               "    exit\n");
     }
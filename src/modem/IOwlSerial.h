@@ -3,6 +3,16 @@
 
 #include <stdint.h>
 
+#include "../platform/time.h"
+
+#define OWL_SERIAL_POLL_INTERVAL 5
+
+/* One buffer of a gathering write, see IOwlSerial::writev */
+struct OwlSerialSegment {
+  const uint8_t *buf;
+  uint32_t len;
+};
+
 class IOwlSerial {
  public:
   virtual ~IOwlSerial() {
@@ -29,5 +39,57 @@ class IOwlSerial {
    * @return - number of bytes actually written. Can be negative in case of an error
    */
   virtual int32_t write(const uint8_t *buf, uint32_t count) = 0;
+
+  /**
+   * Non-blocking write of several buffers in one go. The default implementation writes them one by one, override it
+   * if the platform has a vectored write.
+   * @param segments - buffers to write, in order
+   * @param count - number of buffers
+   * @return - number of bytes actually written. Can be negative in case of an error
+   */
+  virtual int32_t writev(const OwlSerialSegment *segments, int count) {
+    int32_t total = 0;
+
+    for (int i = 0; i < count; i++) {
+      int32_t cnt = write(segments[i].buf, segments[i].len);
+      if (cnt < 0) {
+        return (total > 0) ? total : cnt;
+      }
+      total += cnt;
+      if ((uint32_t)cnt < segments[i].len) {
+        break;
+      }
+    }
+
+    return total;
+  }
+
+  /**
+   * Whether hardware (RTS/CTS) flow control is active on the interface. If it is, write() only accepts what the
+   * modem is ready to take and data can be sent as fast as the interface accepts it, without fixed pacing.
+   * @return - true if the interface is flow-controlled
+   */
+  virtual bool flowControlEnabled() {
+    return false;
+  }
+
+  /**
+   * Block until there is data available on the interface or until the timeout expires. The default implementation
+   * polls available(), override it if the platform can wait on the device more efficiently.
+   * @param timeout_ms - maximum time to wait in milliseconds, 0 only checks the current state
+   * @return - true if data is available, false on timeout or error
+   */
+  virtual bool waitReadable(uint32_t timeout_ms) {
+    owl_time_t timeout_time = owl_time() + timeout_ms;
+
+    while (available() <= 0) {
+      if (owl_time() >= timeout_time) {
+        return false;
+      }
+      owl_delay(OWL_SERIAL_POLL_INTERVAL);
+    }
+
+    return true;
+  }
 };
 #endif  // __I_OWL_SERIAL_H__
@@ -2,20 +2,51 @@
 #include <stdarg.h>
 #include <stdio.h>
 
-#define AT_DATA_SEND_INTERVAL 100
-#define AT_DATA_CHUNK_SIZE 100
-#define AT_DO_COMMAND_SPIN_INTERVAL 200
+#define AT_DO_COMMAND_MAX_WAIT 1000
+#define AT_DATA_FLOW_MIN_CHUNK 16
+#define AT_DATA_FLOW_MAX_CHUNK 1024
+#define AT_DATA_FLOW_RETRY_INTERVAL 5
+#define AT_WRITE_STALL_TIMEOUT 1000
+#define AT_HEX_SCRATCH_SIZE 256
 
 #ifdef BUILD_FOR_TEST
 void spinProcessLineTestpoint(str line);
 #endif
 
-void OwlModemAT::spinProcessLine() {
+OwlModemATBase::OwlModemATBase(IOwlSerial *serial, const Storage &storage)
+    : serial_(serial),
+      command_queue_(storage.command_queue),
+      queued_commands_(storage.queued_commands),
+      max_queued_commands_(storage.max_queued_commands),
+      queued_command_size_(storage.queued_command_size),
+      command_buffer_({.s = storage.command_buffer, .len = 0}),
+      command_buffer_size_(storage.command_buffer_size),
+      rx_buffer_({.s = storage.rx_buffer, .len = 0}),
+      rx_buffer_size_(storage.max_line_size + storage.input_chunk_size),
+      max_line_size_(storage.max_line_size),
+      input_chunk_size_(storage.input_chunk_size),
+      payload_lines_(storage.payload_lines),
+      max_payload_lines_(storage.max_payload_lines),
+      response_buffer_({.s = storage.response_buffer, .len = 0}),
+      response_buffer_size_(storage.response_buffer_size),
+      urc_names_(storage.urc_names),
+      urc_names_size_(storage.urc_names_size),
+      max_urc_names_(storage.max_urc_names),
+      urc_handlers_(storage.urc_handlers),
+      max_urc_handlers_(storage.max_urc_handlers),
+      special_prefixes_(storage.special_prefixes),
+      max_prefixes_(storage.max_prefixes) {
+}
+
+void OwlModemATBase::spinProcessLine() {
 #ifdef BUILD_FOR_TEST
-  spinProcessLineTestpoint(line_buffer_);
+  spinProcessLineTestpoint(line_);
 #endif
 
   switch (state_) {
+    case modem_state_t::data_mode:
+      break;
+
     case modem_state_t::idle:
     case modem_state_t::send_data:
     case modem_state_t::response_ready:
@@ -40,25 +71,125 @@ void OwlModemAT::spinProcessLine() {
       if (state_ == modem_state_t::wait_prompt && code == at_result_code::CONNECT) {
         processInputPrompt();
       } else {
-        last_response_code_ = code;
-
-        if (response_handler_ != nullptr &&
-            response_handler_(last_response_code_, response_buffer_, response_handler_param_)) {
-          state_ = modem_state_t::idle;
-        } else {
-          state_ = modem_state_t::response_ready;
-        }
+        completeCommand(code);
       }
       break;
   }
 }
 
-void OwlModemAT::spin() {
-  spinProcessInput();
+void OwlModemATBase::completeCommand(at_result_code code) {
+  last_response_code_ = code;
+
+  if (data_mode_pending_ && code == at_result_code::CONNECT) {
+    // Whatever follows is raw data, see spinProcessInputChunk
+    data_mode_pending_  = false;
+    data_mode_write_ts_ = owl_time();
+    state_              = modem_state_t::data_mode;
+    return;
+  }
+
+  if (queued_command_active_) {
+    // Queued commands report to their own callback and never stop in response_ready
+    CommandCallback callback = command_callback_;
+    void *priv               = command_callback_priv_;
+
+    queued_command_active_ = false;
+    command_callback_      = nullptr;
+    command_callback_priv_ = nullptr;
+    state_                 = modem_state_t::idle;
+
+    if (callback != nullptr) {
+      callback(code, response_buffer_, priv);
+    }
+  } else if (response_handler_ != nullptr && response_handler_(code, response_buffer_, response_handler_param_)) {
+    state_ = modem_state_t::idle;
+  } else {
+    state_ = modem_state_t::response_ready;
+  }
+
+  // Pipelining: send the next queued command right away, without waiting for the next spin
+  startQueuedCommand();
+}
+
+int OwlModemATBase::spin() {
+  int processed = spinProcessInput();
   spinProcessTime();
+  startQueuedCommand();
+
+  return processed;
 }
 
-void OwlModemAT::spinProcessTime() {
+void OwlModemATBase::setSpinBudget(unsigned int max_bytes, owl_time_t max_time_ms) {
+  spin_byte_budget_ = max_bytes;
+  spin_time_budget_ = max_time_ms;
+}
+
+void OwlModemATBase::setDataPacing(data_pacing_t pacing, unsigned int chunk_size, owl_time_t interval_ms) {
+  data_pacing_        = pacing;
+  data_chunk_size_    = (chunk_size > 0) ? chunk_size : AT_DATA_CHUNK_SIZE;
+  data_send_interval_ = interval_ms;
+}
+
+bool OwlModemATBase::dataFlowControlled() {
+  switch (data_pacing_) {
+    case data_pacing_t::flow_control:
+      return true;
+
+    case data_pacing_t::automatic:
+      return serial_ != nullptr && serial_->flowControlEnabled();
+
+    case data_pacing_t::fixed:
+    default:
+      return false;
+  }
+}
+
+owl_time_t OwlModemATBase::dataSendInterval() {
+  // with flow control the interval is only a retry delay for when the port stopped accepting data
+  return dataFlowControlled() ? AT_DATA_FLOW_RETRY_INTERVAL : data_send_interval_;
+}
+
+owl_time_t OwlModemATBase::nextTimerEvent(owl_time_t max_wait) {
+  owl_time_t now = owl_time();
+  owl_time_t event_time;
+
+  switch (state_) {
+    case modem_state_t::wait_result:
+    case modem_state_t::wait_prompt:
+      if (command_timeout_ == 0) {
+        return max_wait;
+      }
+      event_time = command_started_ + command_timeout_ + 1;
+      break;
+
+    case modem_state_t::send_data:
+      if (send_data_ts_ == 0) {
+        return 0;
+      }
+      event_time = send_data_ts_ + dataSendInterval() + 1;
+      break;
+
+    case modem_state_t::idle:
+    case modem_state_t::response_ready:
+    default:
+      return max_wait;
+  }
+
+  if (event_time <= now) {
+    return 0;
+  }
+
+  return (event_time - now < max_wait) ? event_time - now : max_wait;
+}
+
+int OwlModemATBase::spinBlocking(owl_time_t timeout_ms) {
+  if (serial_ != nullptr) {
+    serial_->waitReadable(nextTimerEvent(timeout_ms));
+  }
+  return spin();
+}
+
+void OwlModemATBase::spinProcessTime() {
   switch (state_) {
     case modem_state_t::idle:
     case modem_state_t::response_ready:
@@ -71,35 +202,39 @@ void OwlModemAT::spinProcessTime() {
       }
 
       if (owl_time() > command_started_ + command_timeout_) {
-        if (response_handler_ != nullptr &&
-            response_handler_(at_result_code::timeout, response_buffer_, response_handler_param_)) {
-          state_ = modem_state_t::idle;
-        } else {
-          last_response_code_ = at_result_code::timeout;
-          state_              = modem_state_t::response_ready;
-        }
+        completeCommand(at_result_code::timeout);
       }
       return;
 
     case modem_state_t::send_data:
-      if (send_data_ts_ == 0 || owl_time() > send_data_ts_ + AT_DATA_SEND_INTERVAL) {
-        unsigned int to_send = (command_data_.len > AT_DATA_CHUNK_SIZE) ? AT_DATA_CHUNK_SIZE : command_data_.len;
-        str chunk            = {.s = command_data_.s, .len = to_send};
-        sendData(chunk);
-        send_data_ts_ = owl_time();
-        command_data_.len -= to_send;
-        command_data_.s += to_send;
-
-        if (command_data_.len == 0) {
-          if (command_data_term_ != 0xFFFF) {
-            char term_byte = (char)(command_data_term_ & 0xFF);
-            str term       = {.s = &term_byte, .len = 1};
-            sendData(term);
+      if (send_data_ts_ != 0 && owl_time() <= send_data_ts_ + dataSendInterval()) {
+        return;
+      }
+
+      if (!dataFlowControlled()) {
+        sendDataChunk();
+      } else if (!sendDataFlowControlled()) {
+        return;  // write error, command completed with a failure
+      }
+      send_data_ts_ = owl_time();
+
+      if (command_data_.len == 0) {
+        if (command_data_term_ != 0xFFFF) {
+          uint8_t term_byte = (uint8_t)(command_data_term_ & 0xFF);
+          int32_t cnt       = serial_->write(&term_byte, 1);
+          if (cnt == 0 && dataFlowControlled() &&
+              (command_timeout_ == 0 || owl_time() <= command_started_ + command_timeout_)) {
+            return;  // port held by the modem, retried on a later spin
+          }
+          if (cnt != 1) {
+            LOG(L_ERR, "Error writing the data terminator to the modem\r\n");
+            completeCommand(at_result_code::failure);
+            return;
           }
-          command_started_     = owl_time();
-          response_buffer_.len = 0;
-          state_               = modem_state_t::wait_result;
         }
+        command_started_     = owl_time();
+        response_buffer_.len = 0;
+        state_               = modem_state_t::wait_result;
       }
       return;
 
@@ -108,115 +243,396 @@ void OwlModemAT::spinProcessTime() {
   }
 }
 
-void OwlModemAT::spinProcessInput() {
-  // "tokenizer" looks for strings of type "\r\n.*\r\n"
-  //   then gives the string too the main string processor spinProcessLine
+void OwlModemATBase::sendDataChunk() {
+  unsigned int to_send = (command_data_.len > data_chunk_size_) ? data_chunk_size_ : command_data_.len;
+  str chunk            = {.s = command_data_.s, .len = to_send};
+  sendData(chunk);
+  command_data_.len -= to_send;
+  command_data_.s += to_send;
+}
+
+bool OwlModemATBase::sendDataFlowControlled() {
+  // Grow the chunk while the port takes it whole and shrink it to what the port took on a short write. Stop when
+  // the port takes nothing, the rest goes out on a later spin, when the modem raised CTS again.
+  while (command_data_.len > 0) {
+    unsigned int to_send = (command_data_.len > flow_chunk_size_) ? flow_chunk_size_ : command_data_.len;
+    int32_t cnt          = serial_->write((const uint8_t *)command_data_.s, to_send);
+
+    if (cnt < 0) {
+      LOG(L_ERR, "Error writing data to the modem\r\n");
+      completeCommand(at_result_code::failure);
+      return false;
+    }
+
+    if (cnt == 0) {
+      break;
+    }
+
+    command_data_.s += cnt;
+    command_data_.len -= cnt;
+
+    if ((unsigned int)cnt < to_send) {
+      flow_chunk_size_ = ((unsigned int)cnt > AT_DATA_FLOW_MIN_CHUNK) ? (unsigned int)cnt : AT_DATA_FLOW_MIN_CHUNK;
+    } else if (flow_chunk_size_ < AT_DATA_FLOW_MAX_CHUNK) {
+      flow_chunk_size_ *= 2;
+    }
+  }
+  return true;
+}
+
+int OwlModemATBase::spinProcessInput() {
+  if (spin_byte_budget_ == 0) {
+    return spinProcessInputChunk(input_chunk_size_);
+  }
+
+  // Drain the interface until it is empty or the budget is exhausted, so that bursts (e.g. large
+  //   socket reads or NMEA output) are consumed in one pass
+  owl_time_t started = owl_time();
+  unsigned int total = 0;
+
+  while (total < spin_byte_budget_) {
+    unsigned int left = spin_byte_budget_ - total;
+    int processed     = spinProcessInputChunk(left);
+    if (processed <= 0) {
+      break;
+    }
+
+    total += processed;
+
+    if (spin_time_budget_ != 0 && owl_time() - started >= spin_time_budget_) {
+      break;
+    }
+  }
+
+  return total;
+}
+
+int OwlModemATBase::spinProcessInputChunk(int max_len) {
+  // "tokenizer" looks for strings of type "\r\n.*\r\n" in the receive buffer
+  //   and gives them to the main string processor spinProcessLine as slices of the buffer.
+  //   Only the incomplete tail of the input is kept between the reads, moved to the beginning of the buffer
+  if (state_ == modem_state_t::data_mode) {
+    return 0;  // the input belongs to the byte pipe
+  }
+
   int available = serial_->available();
 
-  if (available == 0) {
-    return;
+  if (available <= 0) {
+    return 0;
+  }
+
+  int space = rx_buffer_size_ - rx_buffer_.len;
+  if (max_len > space) {
+    max_len = space;
+  }
+
+  char *chunk  = rx_buffer_.s + rx_buffer_.len;
+  int read_len = serial_->read(reinterpret_cast<uint8_t *>(chunk), (available > max_len) ? max_len : available);
+  if (read_len <= 0) {
+    return 0;
   }
 
-  input_buffer_.len = serial_->read(reinterpret_cast<uint8_t *>(input_buffer_.s),
-                                    (available > AT_INPUT_BUFFER_SIZE) ? AT_INPUT_BUFFER_SIZE : available);
   LOG(L_DBG, "Input from the modem\r\n");
-  LOGSTR(L_DBG, input_buffer_);
+  LOGSTR(L_DBG, ((str){.s = chunk, .len = (unsigned int)read_len}));
 
-  str input_buffer_slice = input_buffer_;
-  do {
-    // Special case: current command is expecting input prompt, and we get '>' symbol in the
+  unsigned int scan_pos = rx_buffer_.len;  // everything before has been already scanned for line ends
+  rx_buffer_.len += read_len;
+
+  if (rx_discard_) {
+    // The line is too long, drop the input up to the line end
+    const char *lf_pos = (char *)memchr(chunk, '\n', read_len);
+    if (lf_pos == nullptr) {
+      rx_buffer_.len = scan_pos;
+      return read_len;
+    }
+
+    unsigned int tail_len = rx_buffer_.len - (lf_pos - rx_buffer_.s);
+    memmove(chunk, lf_pos, tail_len);
+    rx_buffer_.len = scan_pos + tail_len;
+    rx_discard_    = false;
+  }
+
+  unsigned int line_start = 0;
+  for (;;) {
+    // Special case: current command is expecting input prompt, and we get '>' (or '@' for binary data) symbol in the
     //   beginning of the line. In this case no line end delimiter ("\r\n") is expected
-    if (line_buffer_.len == 0 && state_ == modem_state_t::wait_prompt && input_buffer_slice.s[0] == '>') {
+    if (line_start < rx_buffer_.len && state_ == modem_state_t::wait_prompt &&
+        (rx_buffer_.s[line_start] == '>' || rx_buffer_.s[line_start] == '@')) {
       processInputPrompt();
-      input_buffer_slice.s++;
-      input_buffer_slice.len--;
+      line_start++;
+      if (scan_pos < line_start) {
+        scan_pos = line_start;
+      }
+      continue;
+    }
+
+    // Lines with long payloads are streamed to their handlers as the data arrives
+    if (payload_line_ >= 0 || startPayloadLine(&line_start)) {
+      if (!processPayloadLine(&line_start)) {
+        break;
+      }
+      scan_pos = line_start;
       continue;
     }
 
-    // General case: normal input string delimited by "\r\n" from both ends
+    const char *lf_pos = (char *)memchr(rx_buffer_.s + scan_pos, '\n', rx_buffer_.len - scan_pos);
+    if (lf_pos == nullptr) {
+      break;
+    }
 
-    const char *lf_pos = (char *)memchr(input_buffer_slice.s, '\n', input_buffer_slice.len);
+    unsigned int line_end = lf_pos - rx_buffer_.s;
+    unsigned int next     = line_end + 1;
 
-    int chunk_len;
+    // try to be liberal and allow both "\r\n" and plain "\n" line endings
+    if (line_end > line_start && rx_buffer_.s[line_end - 1] == '\r') {
+      line_end--;
+    }
 
-    if (lf_pos == nullptr) {
-      if (input_buffer_slice.s[input_buffer_slice.len - 1] == '\r') {
-        // Annoying corner case: '\r' has arrived while '\n' is to be read next. '\r' doesn't belong to the string
-        --input_buffer_slice.len;
+    // empty line means we're run into "\r\n\r\n" sequence. Probably means that we treated end marker
+    //   as begin marker, just skip it
+    if (line_end != line_start) {
+      line_.s   = rx_buffer_.s + line_start;
+      line_.len = line_end - line_start;
+      spinProcessLine();
+    }
+
+    line_start = next;
+    scan_pos   = next;
+
+    if (state_ == modem_state_t::data_mode) {
+      break;  // the rest of the input is pipe data, kept in rx_buffer_ for dataRead
+    }
+  }
+
+  // Keep the incomplete line for the next read
+  line_.len = 0;
+  if (line_start != 0) {
+    rx_buffer_.len -= line_start;
+    memmove(rx_buffer_.s, rx_buffer_.s + line_start, rx_buffer_.len);
+  }
+
+  if (state_ != modem_state_t::data_mode && rx_buffer_.len > max_line_size_) {
+    LOG(L_ERR, "AT input string is too long, truncating\r\n");
+    rx_buffer_.len = max_line_size_;
+    rx_discard_    = true;
+  }
+
+  return read_len;
+}
+
+/* Payload length in a header field, false if the field is not a bare integer */
+static bool payload_length(str header, int field, unsigned int *out_length) {
+  unsigned int pos = 0;
+  bool quoted      = false;
+  for (; field > 0 && pos < header.len; pos++) {
+    if (header.s[pos] == '"') {
+      quoted = !quoted;
+    } else if (header.s[pos] == ',' && !quoted) {
+      field--;
+    }
+  }
+
+  uint32_t length = 0;
+  if (field > 0 || !str_parse_uint32({.s = header.s + pos, .len = header.len - pos}, 10, &length)) {
+    return false;
+  }
+  *out_length = length;
+  return true;
+}
+
+bool OwlModemATBase::startPayloadLine(unsigned int *line_start) {
+  str line = {.s = rx_buffer_.s + *line_start, .len = rx_buffer_.len - *line_start};
+
+  for (int i = 0; i < num_payload_lines_; i++) {
+    PayloadLine *entry = &payload_lines_[i];
+    if (!str_equal_prefix(line, entry->prefix)) {
+      continue;
+    }
+
+    // Look for the comma terminating the last header field. If the line ends before, it is a normal line. Commas
+    // within quoted fields (e.g. MQTT topics) don't count
+    int fields  = 0;
+    bool quoted = false;
+    for (unsigned int pos = entry->prefix.len; pos < line.len; pos++) {
+      if (line.s[pos] == '\n') {
+        return false;
       }
-      chunk_len = input_buffer_slice.len;
-    } else {
-      // try to be liberal and allow both "\r\n" and plain "\n" line endings
-      if ((lf_pos != input_buffer_slice.s) && (*(lf_pos - 1) == '\r')) {
-        chunk_len = (int)(lf_pos - 1 - input_buffer_slice.s);
-      } else {
-        chunk_len = (int)(lf_pos - input_buffer_slice.s);
+      if (line.s[pos] == '"') {
+        quoted = !quoted;
+      }
+      if (line.s[pos] != ',' || quoted || ++fields < entry->header_fields) {
+        continue;
       }
+
+      unsigned int header_len = pos - entry->prefix.len;
+      if (header_len > AT_PAYLOAD_HEADER_SIZE) {
+        LOG(L_ERR, "Payload line header is too long, processing as a normal line\r\n");
+        return false;
+      }
+
+      // Without a length where one is expected, the commas counted may as well be in the payload (e.g. +QMTRECV
+      // without the length, where the payload is quoted but may hold quotes itself)
+      str header             = {.s = line.s + entry->prefix.len, .len = header_len};
+      unsigned int remaining = 0;
+      if (entry->length_field >= 0 && !payload_length(header, entry->length_field, &remaining)) {
+        return false;
+      }
+
+      memcpy(payload_header_.s, header.s, header_len);
+      payload_header_.len = header_len;
+      payload_line_       = i;
+      payload_start_      = true;
+      payload_quoted_     = false;
+      payload_trailer_    = false;
+      payload_remaining_  = remaining;
+      *line_start += pos + 1;
+      return true;
     }
 
-    if (line_buffer_.len + chunk_len > AT_LINE_BUFFER_SIZE) {
-      LOG(L_ERR, "AT input string is too long, truncating\r\n");
-      chunk_len = AT_LINE_BUFFER_SIZE - line_buffer_.len;
+    return false;
+  }
+
+  return false;
+}
+
+bool OwlModemATBase::processPayloadLine(unsigned int *line_start) {
+  PayloadLine *entry = &payload_lines_[payload_line_];
+  char *data         = rx_buffer_.s + *line_start;
+  unsigned int len   = rx_buffer_.len - *line_start;
+
+  if (payload_start_) {
+    if (len == 0) {
+      return false;
+    }
+    payload_start_ = false;
+    if (data[0] == '"') {
+      payload_quoted_ = true;
+      data++;
+      len--;
+      (*line_start)++;
     }
+  }
 
-    if (chunk_len != 0) {
-      memcpy(line_buffer_.s + line_buffer_.len, input_buffer_slice.s, chunk_len);
-      line_buffer_.len += chunk_len;
-      input_buffer_slice.s += chunk_len;
-      input_buffer_slice.len -= chunk_len;
+  if (entry->length_field >= 0) {
+    return processPayloadBytes(entry, line_start);
+  }
+
+  const char *lf_pos = (char *)memchr(data, '\n', len);
+  bool last          = (lf_pos != nullptr);
+  unsigned int chunk_len;
+  unsigned int consumed;
+
+  if (last) {
+    chunk_len = lf_pos - data;
+    consumed  = chunk_len + 1;
+    if (chunk_len > 0 && data[chunk_len - 1] == '\r') {
+      chunk_len--;
+    }
+    if (payload_quoted_ && chunk_len > 0 && data[chunk_len - 1] == '"') {
+      chunk_len--;
     }
+  } else {
+    // Hold back what might turn out to be the line end, and an unpaired hex digit
+    chunk_len = len;
+    if (chunk_len > 0 && data[chunk_len - 1] == '\r') {
+      chunk_len--;
+    }
+    if (payload_quoted_ && chunk_len > 0 && data[chunk_len - 1] == '"') {
+      chunk_len--;
+    }
+    if (entry->hex_decode) {
+      chunk_len &= ~1u;
+    }
+    consumed = chunk_len;
+  }
 
-    if (lf_pos != nullptr) {
-      // end of line found, process the line
-      if (line_buffer_.len == 0) {
-        // empty line means we're run into "\r\n\r\n" sequence. Probably
-        //   means that we treated end marker as begin marker, so run again
-        //   using "end" as "begin"
-        // still need to eat delimiters
-        while (input_buffer_slice.len != 0) {
-          if (input_buffer_slice.s[0] == '\r' || input_buffer_slice.s[0] == '\n') {
-            input_buffer_slice.s++;
-            input_buffer_slice.len--;
-          } else {
-            break;
-          }
-        }
-      } else {
-        // normal line, process
-        spinProcessLine();
-        line_buffer_.len = 0;
-        input_buffer_slice.s++;  // skip line delimiter
-        input_buffer_slice.len--;
-      }
+  str chunk = {.s = data, .len = chunk_len};
+  if (entry->hex_decode && chunk_len != 0) {
+    // Decoding in place, the output is never longer than the input
+    chunk.len = hex_to_str(data, chunk_len, chunk);
+    if (chunk.len == 0) {
+      LOG(L_ERR, "Bad hex payload in [%.*s] line\r\n", entry->prefix.len, entry->prefix.s);
+    }
+  }
+
+  if (chunk.len != 0 || last) {
+    entry->handler(payload_header_, chunk, last, entry->priv);
+  }
+
+  *line_start += consumed;
+
+  if (last) {
+    payload_line_ = -1;
+  }
+
+  return last;
+}
+
+bool OwlModemATBase::processPayloadBytes(PayloadLine *entry, unsigned int *line_start) {
+  char *data       = rx_buffer_.s + *line_start;
+  unsigned int len = rx_buffer_.len - *line_start;
+
+  if (!payload_trailer_) {
+    // Exactly the announced number of bytes, whatever they are
+    unsigned int chunk_len = (len < payload_remaining_) ? len : payload_remaining_;
+    payload_remaining_ -= chunk_len;
+
+    bool last = (payload_remaining_ == 0);
+    if (chunk_len != 0 || last) {
+      entry->handler(payload_header_, {.s = data, .len = chunk_len}, last, entry->priv);
     }
-  } while (input_buffer_slice.len != 0);
+
+    *line_start += chunk_len;
+    data += chunk_len;
+    len -= chunk_len;
+    if (!last) {
+      return false;
+    }
+    payload_trailer_ = true;
+  }
+
+  // Skip the closing quote and the line end
+  const char *lf_pos = (char *)memchr(data, '\n', len);
+  if (lf_pos == nullptr) {
+    *line_start += len;
+    return false;
+  }
+
+  *line_start += lf_pos - data + 1;
+  payload_line_ = -1;
+  return true;
 }
 
-bool OwlModemAT::processURC() {
-  if (line_buffer_.len < 1 || line_buffer_.s[0] != '+') {
+bool OwlModemATBase::processURC() {
+  if (line_.len < 1 || line_.s[0] != '+') {
     return false;
   }
 
-  const char *colon_pos = (char *)memchr(line_buffer_.s, ':', line_buffer_.len);
+  const char *colon_pos = (char *)memchr(line_.s, ':', line_.len);
   if (colon_pos == nullptr) {
     return false;
   }
 
-  unsigned int urc_len = (int)(colon_pos - line_buffer_.s);
+  unsigned int urc_len = (int)(colon_pos - line_.s);
 
   // Response format: "+<COMMAND>: <data>" (space after colon is required)
-  if (urc_len > line_buffer_.len - 2 || line_buffer_.s[urc_len + 1] != ' ') {
+  if (urc_len > line_.len - 2 || line_.s[urc_len + 1] != ' ') {
     return false;
   }
 
-  str urc  = {.s = line_buffer_.s, .len = urc_len};
-  str data = {.s = line_buffer_.s + urc_len + 2, .len = line_buffer_.len - urc_len - 2};
+  str urc  = {.s = line_.s, .len = urc_len};
+  str data = {.s = line_.s + urc_len + 2, .len = line_.len - urc_len - 2};
 
   LOG(L_DBG, "URC [%.*s] Data [%.*s]\r\n", urc.len, urc.s, data.len, data.s);
 
+  UrcNameEntry *entry = findUrcName(urc);
+  if (entry != nullptr && entry->handler(urc, data, entry->priv)) {
+    return true;
+  }
+
   /* ordered based on expected incoming count of events */
   for (int i = 0; i < num_urc_handlers_; i++) {
-    if (urc_handlers_[i](urc, data, urc_handler_params_[i])) {
+    if (urc_handlers_[i].handler(urc, data, urc_handlers_[i].priv)) {
       return true;
     }
   }
@@ -224,40 +640,40 @@ bool OwlModemAT::processURC() {
   return false;
 }
 
-void OwlModemAT::processPrefix() {
+void OwlModemATBase::processPrefix() {
   if (prefix_handler_ == nullptr) {
     return;
   }
 
   for (int i = 0; i < num_special_prefixes_; ++i) {
-    if (str_equal_prefix(line_buffer_, special_prefixes_[i])) {
-      prefix_handler_(line_buffer_, prefix_handler_param_);
+    if (str_equal_prefix(line_, special_prefixes_[i])) {
+      prefix_handler_(line_, prefix_handler_param_);
       return;
     }
   }
 }
 
-void OwlModemAT::appendLineToResponse() {
+void OwlModemATBase::appendLineToResponse() {
   int to_append;
 
-  if (line_buffer_.len + response_buffer_.len < AT_RESPONSE_BUFFER_SIZE) {
-    to_append = line_buffer_.len;
+  if (line_.len + response_buffer_.len < response_buffer_size_) {
+    to_append = line_.len;
   } else {
     LOG(L_ERR, "Line doesn't fit into response buffer, truncating");
-    to_append = AT_RESPONSE_BUFFER_SIZE - response_buffer_.len;
+    to_append = response_buffer_size_ - response_buffer_.len;
   }
 
   if (to_append != 0) {
-    memcpy(response_buffer_.s + response_buffer_.len, line_buffer_.s, to_append);
+    memcpy(response_buffer_.s + response_buffer_.len, line_.s, to_append);
     response_buffer_.len += to_append;
 
-    if (response_buffer_.len < AT_RESPONSE_BUFFER_SIZE) {
+    if (response_buffer_.len < response_buffer_size_) {
       response_buffer_.s[response_buffer_.len++] = '\n';
     }
   }
 }
 
-at_result_code OwlModemAT::tryParseCode() {
+at_result_code OwlModemATBase::tryParseCode() {
   using at_code_entry = struct {
     str value;
     at_result_code code;
@@ -271,34 +687,126 @@ at_result_code OwlModemAT::tryParseCode() {
       {.value = {.s = "ERROR", .len = 5}, .code = at_result_code::ERROR},
       {.value = {.s = "NO DIALTONE", .len = 11}, .code = at_result_code::NO_DIALTONE},
       {.value = {.s = "BUSY", .len = 4}, .code = at_result_code::BUSY},
-      {.value = {.s = "NO ANSWER", .len = 9}, .code = at_result_code::NO_ANSWER}};
+      {.value = {.s = "NO ANSWER", .len = 9}, .code = at_result_code::NO_ANSWER},
+      {.value = {.s = "DISCONNECT", .len = 10}, .code = at_result_code::DISCONNECT}};
 
   for (unsigned int i = 0; i < sizeof(at_result_codes) / sizeof(at_code_entry); ++i) {
-    if (str_equal(line_buffer_, at_result_codes[i].value)) {
+    if (str_equal(line_, at_result_codes[i].value)) {
       return at_result_codes[i].code;
     }
   }
 
   // CONNECT code also comes in a vendor-customized flavour with a postfix
-  if (str_equal_prefix_char(line_buffer_, "CONNECT ")) {
+  if (str_equal_prefix_char(line_, "CONNECT ")) {
     return at_result_code::CONNECT;
   }
 
-  if (str_equal_prefix_char(line_buffer_, "+CME ERROR")) {
+  if (str_equal_prefix_char(line_, "+CME ERROR")) {
     return at_result_code::cme_error;
   }
 
   return at_result_code::unknown;
 }
 
-void OwlModemAT::processInputPrompt() {
+void OwlModemATBase::processInputPrompt() {
   state_               = modem_state_t::send_data;
   send_data_ts_        = 0;
+  flow_chunk_size_     = data_chunk_size_;
   response_buffer_.len = 0;
   last_response_code_  = at_result_code::unknown;
 }
 
-bool OwlModemAT::startATCommand(owl_time_t timeout_ms, str data, uint16_t data_term) {
+bool OwlModemATBase::waitWritable(owl_time_t timeout_time) {
+  // A flow-controlled port takes nothing while the modem holds it, on any other port a zero write is an error
+  if (!serial_->flowControlEnabled() || owl_time() > timeout_time) {
+    return false;
+  }
+
+  owl_delay(AT_DATA_FLOW_RETRY_INTERVAL);
+  return true;
+}
+
+bool OwlModemATBase::sendSegments(OwlSerialSegment *segments, int count, owl_time_t timeout_time) {
+  while (count > 0) {
+    int32_t cnt = serial_->writev(segments, count);
+    if (cnt == 0 && waitWritable(timeout_time)) {
+      continue;
+    }
+    if (cnt <= 0) {
+      LOG(L_ERR, "Writing to the modem failed with %d segments left\r\n", count);
+      return false;
+    }
+
+    // skip over what was written, the first partially written segment is resumed from where the write stopped
+    while (count > 0 && (uint32_t)cnt >= segments->len) {
+      cnt -= segments->len;
+      ++segments;
+      --count;
+    }
+    if (count > 0) {
+      segments->buf += cnt;
+      segments->len -= cnt;
+    }
+  }
+  return true;
+}
+
+bool OwlModemATBase::writeCommand(const CommandSegment *segments, int num_segments, owl_time_t timeout_ms) {
+  OwlSerialSegment out[AT_COMMAND_MAX_SEGMENTS + 1];
+  char hex[AT_HEX_SCRATCH_SIZE];
+  int count               = 0;
+  owl_time_t timeout_time = owl_time() + ((timeout_ms != 0) ? timeout_ms : AT_WRITE_STALL_TIMEOUT);
+
+  LOG(L_DBG, "Output to the modem \r\n");
+  for (int i = 0; i < num_segments; i++) {
+    str data = segments[i].data;
+
+    if (!segments[i].hex) {
+      LOGSTR(L_DBG, data);
+      out[count++] = {.buf = (const uint8_t *)data.s, .len = data.len};
+      continue;
+    }
+
+    LOG(L_DBG, "<%u bytes as HEX>\r\n", data.len);
+    // HEX is produced through the scratch buffer, so everything gathered so far is written out each time it fills up
+    while (data.len > 0) {
+      str chunk = {.s = data.s, .len = (data.len > AT_HEX_SCRATCH_SIZE / 2) ? AT_HEX_SCRATCH_SIZE / 2 : data.len};
+
+      out[count++] = {.buf = (const uint8_t *)hex, .len = str_to_hex(hex, AT_HEX_SCRATCH_SIZE, chunk)};
+      if (!sendSegments(out, count, timeout_time)) {
+        return false;
+      }
+      count = 0;
+      data.s += chunk.len;
+      data.len -= chunk.len;
+    }
+  }
+
+  out[count++] = {.buf = (const uint8_t *)"\r\n", .len = 2};
+  return sendSegments(out, count, timeout_time);
+}
+
+bool OwlModemATBase::sendCommand(const CommandSegment *segments, int num_segments, owl_time_t timeout_ms, str data,
+                                 uint16_t data_term) {
+  response_buffer_.len = 0;
+
+  if (!writeCommand(segments, num_segments, timeout_ms)) {
+    LOG(L_ERR, "sendCommand [%.*s] failed: writing to serial device failed\r\n", segments[0].data.len,
+        segments[0].data.s);
+    return false;
+  }
+
+  command_data_      = data;
+  command_data_term_ = data_term;
+  command_started_   = owl_time();
+  command_timeout_   = timeout_ms;
+
+  state_ = (command_data_.s == nullptr) ? modem_state_t::wait_result : modem_state_t::wait_prompt;
+
+  return true;
+}
+
+bool OwlModemATBase::startATCommand(owl_time_t timeout_ms, str data, uint16_t data_term) {
   if (serial_ == nullptr) {
     LOG(L_ERR, "startATCommand [%.*s] failed: serial device unavailable\r\n", command_buffer_.len, command_buffer_.s);
     return false;
@@ -316,43 +824,180 @@ bool OwlModemAT::startATCommand(owl_time_t timeout_ms, str data, uint16_t data_t
     return false;
   }
 
-  response_buffer_.len = 0;
+  commandCloseText();
+  if (!sendCommand(command_segments_, num_command_segments_, timeout_ms, data, data_term)) {
+    return false;
+  }
 
-  LOG(L_DBG, "Output to the modem \r\n");
-  LOGSTR(L_DBG, command_buffer_);
-  if (!sendData(command_buffer_)) {
-    LOG(L_ERR, "sendCommand [%.*s] failed: writing to serial device failed\r\n", command_buffer_.len,
-        command_buffer_.s);
+  command_valid_ = false;  // Command sent, invalidating the buffer
+
+  return true;
+}
+
+bool OwlModemATBase::queueCommand(str command, owl_time_t timeout_ms, CommandCallback callback, void *priv, str data,
+                                  uint16_t data_term) {
+  if (command.len > queued_command_size_) {
+    LOG(L_ERR, "queueCommand [%.*s] failed: command does not fit in the queue slot\r\n", command.len, command.s);
     return false;
   }
 
-  if (!sendData("\r\n")) {
-    LOG(L_ERR, "sendCommand [%.*s] failed: writing to serial device failed\r\n", command_buffer_.len,
+  if (command_queue_len_ >= max_queued_commands_) {
+    LOG(L_ERR, "queueCommand [%.*s] failed: command queue is full\r\n", command.len, command.s);
+    return false;
+  }
+
+  int index            = (command_queue_head_ + command_queue_len_) % max_queued_commands_;
+  QueuedCommand *entry = &command_queue_[index];
+
+  memcpy(queued_commands_ + index * queued_command_size_, command.s, command.len);
+  entry->command_len = command.len;
+  entry->timeout_ms  = timeout_ms;
+  entry->data        = data;
+  entry->data_term   = data_term;
+  entry->callback    = callback;
+  entry->priv        = priv;
+  entry->seq         = next_command_seq_++;
+
+  ++command_queue_len_;
+
+  startQueuedCommand();
+  return true;
+}
+
+bool OwlModemATBase::enqueueATCommand(const char *command, owl_time_t timeout_ms, CommandCallback callback, void *priv,
+                                      str data, uint16_t data_term) {
+  str command_str = {.s = command, .len = static_cast<unsigned int>(strlen(command))};
+  return queueCommand(command_str, timeout_ms, callback, priv, data, data_term);
+}
+
+bool OwlModemATBase::enqueueATCommand(owl_time_t timeout_ms, CommandCallback callback, void *priv, str data,
+                                      uint16_t data_term) {
+  if (!command_valid_) {
+    LOG(L_ERR, "enqueueATCommand [%.*s] failed: command in the buffer is invalid\r\n", command_buffer_.len,
         command_buffer_.s);
     return false;
   }
 
-  command_valid_ = false;  // Command sent, invalidating the buffer
+  if (command_has_refs_) {
+    LOG(L_ERR, "enqueueATCommand [%.*s] failed: command with referenced data can't be queued\r\n",
+        command_buffer_.len, command_buffer_.s);
+    return false;
+  }
 
-  command_data_      = data;
-  command_data_term_ = data_term;
-  command_started_   = owl_time();
-  command_timeout_   = timeout_ms;
+  if (!queueCommand(command_buffer_, timeout_ms, callback, priv, data, data_term)) {
+    return false;
+  }
 
-  state_ = (command_data_.s == nullptr) ? modem_state_t::wait_result : modem_state_t::wait_prompt;
+  command_valid_ = false;  // Command copied to the queue, invalidating the buffer
+  return true;
+}
+
+void OwlModemATBase::startQueuedCommand() {
+  while (state_ == modem_state_t::idle && command_queue_len_ > 0 && serial_ != nullptr) {
+    QueuedCommand *entry = &command_queue_[command_queue_head_];
+    char *command_text   = queued_commands_ + command_queue_head_ * queued_command_size_;
+    str command          = {.s = command_text, .len = entry->command_len};
+    if (queue_held_ && (int32_t)(entry->seq - queue_hold_seq_) >= 0) {
+      return;  // queued after a blocking command waiting for its turn
+    }
+
+    command_queue_head_ = (command_queue_head_ + 1) % max_queued_commands_;
+    --command_queue_len_;
+
+    CommandSegment segment = {.data = command, .hex = false};
+
+    if (sendCommand(&segment, 1, entry->timeout_ms, entry->data, entry->data_term)) {
+      queued_command_active_ = true;
+      command_callback_      = entry->callback;
+      command_callback_priv_ = entry->priv;
+      return;
+    }
+
+    // Could not even send it - report the failure and try the next one
+    if (entry->callback != nullptr) {
+      str empty = {nullptr, 0};
+      entry->callback(at_result_code::failure, empty, entry->priv);
+    }
+  }
+}
+
+bool OwlModemATBase::waitCommandQueueBlocking(owl_time_t timeout_ms) {
+  owl_time_t timeout_time = owl_time() + timeout_ms;
+
+  while (getQueuedCommandsCount() > 0) {
+    if (serial_ == nullptr || (timeout_ms != 0 && owl_time() > timeout_time)) {
+      return false;
+    }
+
+    spinBlocking(AT_DO_COMMAND_MAX_WAIT);
+  }
+
+  return true;
+}
+
+bool OwlModemATBase::waitEarlierCommandsBlocking(owl_time_t timeout_ms) {
+  owl_time_t timeout_time = owl_time() + timeout_ms;
+
+  // Completions may keep queueing commands (e.g. a send stream), only the ones already there are waited for
+  queue_held_     = true;
+  queue_hold_seq_ = next_command_seq_;
+
+  while (queued_command_active_ ||
+         (command_queue_len_ > 0 && (int32_t)(command_queue_[command_queue_head_].seq - queue_hold_seq_) < 0)) {
+    if (serial_ == nullptr || (timeout_ms != 0 && owl_time() > timeout_time)) {
+      queue_held_ = false;
+      return false;
+    }
+
+    spinBlocking(AT_DO_COMMAND_MAX_WAIT);
+  }
 
   return true;
 }
 
-at_result_code OwlModemAT::doCommandBlocking(owl_time_t timeout_millis, str *out_response, str command_data,
-                                             uint16_t data_term) {
-  if (!startATCommand(timeout_millis, command_data, data_term)) {
+int OwlModemATBase::cancelQueuedCommands(CommandCallback callback, void *priv) {
+  int kept = 0;
+
+  // Compact the queue in place, keeping the order of the remaining commands
+  for (int i = 0; i < command_queue_len_; i++) {
+    int from             = (command_queue_head_ + i) % max_queued_commands_;
+    QueuedCommand *entry = &command_queue_[from];
+    if (entry->callback == callback && entry->priv == priv) {
+      continue;
+    }
+
+    int to = (command_queue_head_ + kept) % max_queued_commands_;
+    if (to != from) {
+      command_queue_[to] = *entry;
+      memcpy(queued_commands_ + to * queued_command_size_, queued_commands_ + from * queued_command_size_,
+             entry->command_len);
+    }
+    kept++;
+  }
+
+  int cancelled      = command_queue_len_ - kept;
+  command_queue_len_ = kept;
+  return cancelled;
+}
+
+at_result_code OwlModemATBase::doCommandBlocking(owl_time_t timeout_millis, str *out_response, str command_data,
+                                                 uint16_t data_term) {
+  // Let the queued commands go first, they were issued earlier
+  if (!waitEarlierCommandsBlocking(timeout_millis)) {
+    LOG(L_ERR, "Queued commands did not complete in time for [%.*s]\r\n", command_buffer_.len, command_buffer_.s);
+    return at_result_code::timeout;
+  }
+
+  // The later queued commands are started once this one completes
+  bool started = startATCommand(timeout_millis, command_data, data_term);
+  queue_held_  = false;
+  if (!started) {
     return at_result_code::ERROR;
   }
 
   for (;;) {
-    owl_delay(AT_DO_COMMAND_SPIN_INTERVAL);
-    spin();
+    // Wakes up on the first byte of the response or on the command deadline, whatever comes first
+    spinBlocking(AT_DO_COMMAND_MAX_WAIT);
 
     switch (state_) {
       case modem_state_t::send_data:
@@ -368,13 +1013,102 @@ at_result_code OwlModemAT::doCommandBlocking(owl_time_t timeout_millis, str *out
   }
 }
 
-void OwlModemAT::filterResponse(str prefix, str response, str *filtered) {
+bool OwlModemATBase::enterDataMode(owl_time_t timeout_ms, str *out_response) {
+  data_mode_pending_  = true;
+  at_result_code code = doCommandBlocking(timeout_ms, out_response);
+  data_mode_pending_  = false;
+
+  if (state_ != modem_state_t::data_mode) {
+    LOG(L_ERR, "Modem did not enter data mode - result %d %s\r\n", (int)code, at_enum_stringify(code));
+    return false;
+  }
+  return true;
+}
+
+bool OwlModemATBase::exitDataMode(owl_time_t guard_ms) {
+  if (state_ != modem_state_t::data_mode) {
+    LOG(L_ERR, "exitDataMode called while not in data mode\r\n");
+    return false;
+  }
+
+  owl_time_t silent = owl_time() - data_mode_write_ts_;
+  if (silent < guard_ms) {
+    owl_delay(guard_ms - silent);
+  }
+  if (!sendData("+++")) {
+    return false;
+  }
+
+  // Back to parsing lines, the modem confirms after the trailing guard time. What dataRead() didn't take yet is lost
+  if (rx_buffer_.len > 0) {
+    LOG(L_WARN, "Dropping %u bytes not read in data mode\r\n", rx_buffer_.len);
+  }
+  rx_buffer_.len       = 0;
+  response_buffer_.len = 0;
+  command_started_     = owl_time();
+  command_timeout_     = guard_ms + AT_DATA_MODE_EXIT_TIMEOUT;
+  state_               = modem_state_t::wait_result;
+
+  while (state_ == modem_state_t::wait_result) {
+    spinBlocking(AT_DO_COMMAND_MAX_WAIT);
+  }
+
+  at_result_code code = getLastCommandResponse(nullptr);
+  // SARA-R4 ends a direct link with DISCONNECT
+  if (code != at_result_code::OK && code != at_result_code::NO_CARRIER && code != at_result_code::DISCONNECT) {
+    LOG(L_ERR, "Modem did not leave data mode - result %d %s\r\n", (int)code, at_enum_stringify(code));
+    data_mode_write_ts_ = owl_time();
+    state_              = modem_state_t::data_mode;
+    return false;
+  }
+  return true;
+}
+
+int32_t OwlModemATBase::dataRead(uint8_t *buf, uint32_t count) {
+  if (state_ != modem_state_t::data_mode) {
+    return -1;
+  }
+
+  // First the data which came in along with the CONNECT
+  if (rx_buffer_.len > 0) {
+    uint32_t len = (count < rx_buffer_.len) ? count : rx_buffer_.len;
+    memcpy(buf, rx_buffer_.s, len);
+    rx_buffer_.len -= len;
+    memmove(rx_buffer_.s, rx_buffer_.s + len, rx_buffer_.len);
+    return len;
+  }
+
+  return serial_->read(buf, count);
+}
+
+int32_t OwlModemATBase::dataWrite(const uint8_t *buf, uint32_t count) {
+  if (state_ != modem_state_t::data_mode) {
+    return -1;
+  }
+
+  int32_t cnt = serial_->write(buf, count);
+  if (cnt > 0) {
+    data_mode_write_ts_ = owl_time();
+  }
+  return cnt;
+}
+
+bool OwlModemATBase::dataWaitReadable(owl_time_t timeout_ms) {
+  if (state_ != modem_state_t::data_mode) {
+    return false;
+  }
+  return rx_buffer_.len > 0 || serial_->waitReadable(timeout_ms);
+}
+
+static constexpr str_sepset s_newline = str_sepset_make("\n");
+
+void OwlModemATBase::filterResponse(str prefix, str response, str *filtered) {
   if (!filtered) {
     return;
   }
 
   str line = {0};
-  while (str_tok(response, "\n", &line)) {
+  while (str_tok_set(response, &s_newline, &line)) {
     if (str_equal_prefix(line, prefix)) {
       line.s += prefix.len;
       line.len -= prefix.len;
@@ -390,12 +1124,16 @@ void OwlModemAT::filterResponse(str prefix, str response, str *filtered) {
   *filtered = {nullptr, 0};
 }
 
-bool OwlModemAT::sendData(str data) {
-  uint32_t written = 0;
+bool OwlModemATBase::sendData(str data) {
+  uint32_t written        = 0;
+  owl_time_t timeout_time = owl_time() + AT_WRITE_STALL_TIMEOUT;
   int32_t cnt;
 
   do {
     cnt = serial_->write((const uint8_t *)data.s + written, data.len - written);
+    if (cnt == 0 && waitWritable(timeout_time)) {
+      continue;
+    }
     if (cnt <= 0) {
       LOG(L_ERR, "Had %d bytes to send on modem_port, but wrote only %d.\r\n", data.len, written);
       return false;
@@ -405,7 +1143,7 @@ bool OwlModemAT::sendData(str data) {
   return true;
 }
 
-at_result_code OwlModemAT::getLastCommandResponse(str *out_response) {
+at_result_code OwlModemATBase::getLastCommandResponse(str *out_response) {
   if (state_ != modem_state_t::response_ready) {
     return at_result_code::unknown;
   } else {
@@ -417,64 +1155,163 @@ at_result_code OwlModemAT::getLastCommandResponse(str *out_response) {
   }
 }
 
-bool OwlModemAT::initTerminal() {
-  if (doCommandBlocking("ATV1", 1000, nullptr) != at_result_code::OK) {
-    LOG(L_WARN, "Potential error setting commands to always return response codes\r\n");
+static void initTerminalCallback(at_result_code code, str response, void *priv) {
+  *reinterpret_cast<at_result_code *>(priv) = code;
+}
+
+bool OwlModemATBase::initTerminal() {
+  struct init_command {
+    const char *command;
+    bool mandatory;
+    const char *error;
+  };
+
+  static const init_command init_commands[] = {
+      {"ATV1", false, "Potential error setting commands to always return response codes"},
+      {"ATQ0", true, "Error setting commands to return text response codes"},
+      {"ATE0", true, "Error setting echo off"},
+      {"AT+CMEE=2", true, "Error setting Modem Errors output to verbose (not numeric) values"},
+      {"ATS3=13", false, "Error setting command terminating character"},
+      {"ATS4=10", false, "Error setting response separator character"}};
+  static constexpr int num_init_commands = sizeof(init_commands) / sizeof(init_command);
+
+  at_result_code results[num_init_commands];
+
+  // Queue all of them at once, so that they are pipelined without waiting in between
+  for (int i = 0; i < num_init_commands; i++) {
+    results[i] = at_result_code::unknown;
+
+    // Smaller queues can't take all of them, wait for a slot to free up
+    owl_time_t timeout_time = owl_time() + 1000;
+    while (command_queue_len_ >= max_queued_commands_ && serial_ != nullptr && owl_time() <= timeout_time) {
+      spinBlocking(AT_DO_COMMAND_MAX_WAIT);
+    }
+
+    if (!enqueueATCommand(init_commands[i].command, 1000, initTerminalCallback, &results[i])) {
+      results[i] = at_result_code::failure;
+    }
   }
 
-  if (doCommandBlocking("ATQ0", 1000, nullptr) != at_result_code::OK) {
-    LOG(L_ERR, "Error setting commands to return text response codes\r\n");
-    return false;
+  waitCommandQueueBlocking(num_init_commands * 1000);
+
+  bool success = true;
+  for (int i = 0; i < num_init_commands; i++) {
+    if (results[i] != at_result_code::OK) {
+      LOG(init_commands[i].mandatory ? L_ERR : L_WARN, "%s\r\n", init_commands[i].error);
+      success = success && !init_commands[i].mandatory;
+    }
   }
 
-  if (doCommandBlocking("ATE0", 1000, nullptr) != at_result_code::OK) {
-    LOG(L_ERR, "Error setting echo off\r\n");
-    return false;
+  return success;
+}
+
+bool OwlModemATBase::registerUrcHandler(const char *unique_id, UrcHandler handler, void *priv) {
+  // First look if the handler with this id is already registered, if so replace
+  for (int i = 0; i < num_urc_handlers_; i++) {
+    if (strcmp(urc_handlers_[i].id, unique_id) == 0) {
+      urc_handlers_[i].handler = handler;
+      urc_handlers_[i].priv    = priv;
+      return true;
+    }
   }
 
-  if (doCommandBlocking("AT+CMEE=2", 1000, nullptr) != at_result_code::OK) {
-    LOG(L_ERR, "Error setting Modem Errors output to verbose (not numeric) values\r\n");
+  // Then append the handler to the array
+  if (num_urc_handlers_ >= max_urc_handlers_) {
     return false;
   }
 
-  if (doCommandBlocking("ATS3=13", 1000, nullptr) != at_result_code::OK) {
-    LOG(L_WARN, "Error setting command terminating character\r\n");
+  urc_handlers_[num_urc_handlers_].handler = handler;
+  urc_handlers_[num_urc_handlers_].priv    = priv;
+  urc_handlers_[num_urc_handlers_].id      = unique_id;
+
+  ++num_urc_handlers_;
+  return true;
+}
+
+static uint32_t urc_name_hash(str name) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (unsigned int i = 0; i < name.len; i++) {
+    hash ^= (uint8_t)name.s[i];
+    hash *= 16777619u;
   }
+  return hash;
+}
+
+OwlModemATBase::UrcNameEntry *OwlModemATBase::findUrcName(str urc) {
+  unsigned int index = urc_name_hash(urc) & (urc_names_size_ - 1);
 
-  if (doCommandBlocking("ATS4=10", 1000, nullptr) != at_result_code::OK) {
-    LOG(L_WARN, "Error setting response separator character\r\n");
+  for (int probe = 0; probe < urc_names_size_; probe++) {
+    UrcNameEntry *entry = &urc_names_[index];
+    if (entry->name.s == nullptr) {
+      return nullptr;
+    }
+    if (str_equal(entry->name, urc)) {
+      return entry;
+    }
+    index = (index + 1) & (urc_names_size_ - 1);
   }
 
-  return true;
+  return nullptr;
 }
 
-bool OwlModemAT::registerUrcHandler(const char *unique_id, UrcHandler handler, void *priv) {
-  // First look if the handler with this id is already registered, if so replace
-  for (int i = 0; i < num_urc_handlers_; i++) {
-    if (strcmp(urc_handler_ids_[i], unique_id) == 0) {
-      urc_handlers_[i]       = handler;
-      urc_handler_params_[i] = priv;
+bool OwlModemATBase::registerUrcNameHandler(const char *urc, UrcHandler handler, void *priv) {
+  str name           = {.s = urc, .len = static_cast<unsigned int>(strlen(urc))};
+  unsigned int index = urc_name_hash(name) & (urc_names_size_ - 1);
+
+  for (int probe = 0; probe < urc_names_size_; probe++) {
+    UrcNameEntry *entry = &urc_names_[index];
+    if (entry->name.s == nullptr) {
+      if (num_urc_names_ >= max_urc_names_) {
+        LOG(L_ERR, "Can't register URC [%s]: too many URCs registered\r\n", urc);
+        return false;
+      }
+      entry->name = name;
+      ++num_urc_names_;
+    }
+
+    if (str_equal(entry->name, name)) {
+      entry->handler = handler;
+      entry->priv    = priv;
       return true;
     }
+    index = (index + 1) & (urc_names_size_ - 1);
   }
 
-  // Then append the handler to the array
-  if (num_urc_handlers_ >= MaxUrcHandlers) {
+  return false;
+}
+
+bool OwlModemATBase::registerPayloadLine(const char *prefix, int header_fields, bool hex_decode, PayloadHandler handler,
+                                         void *priv, int length_field) {
+  str prefix_str = {.s = prefix, .len = static_cast<unsigned int>(strlen(prefix))};
+
+  // Replace the handler if the prefix is already registered
+  int index = 0;
+  while (index < num_payload_lines_ && !str_equal(payload_lines_[index].prefix, prefix_str)) {
+    index++;
+  }
+
+  if (index >= max_payload_lines_) {
     return false;
   }
 
-  urc_handlers_[num_urc_handlers_]       = handler;
-  urc_handler_params_[num_urc_handlers_] = priv;
-  urc_handler_ids_[num_urc_handlers_]    = unique_id;
+  payload_lines_[index].prefix        = prefix_str;
+  payload_lines_[index].header_fields = header_fields;
+  payload_lines_[index].hex_decode    = hex_decode;
+  payload_lines_[index].handler       = handler;
+  payload_lines_[index].priv          = priv;
+  payload_lines_[index].length_field  = length_field;
 
-  ++num_urc_handlers_;
+  if (index == num_payload_lines_) {
+    ++num_payload_lines_;
+  }
   return true;
 }
 
-void OwlModemAT::registerPrefixHandler(PrefixHandler handler, void *priv, const str *prefixes, int num_prefixes) {
-  num_special_prefixes_ = num_prefixes;
+void OwlModemATBase::registerPrefixHandler(PrefixHandler handler, void *priv, const str *prefixes, int num_prefixes) {
+  num_special_prefixes_ = (num_prefixes < max_prefixes_) ? num_prefixes : max_prefixes_;
 
-  for (int i = 0; i < num_prefixes && i < MaxPrefixes; ++i) {
+  for (int i = 0; i < num_special_prefixes_; ++i) {
     special_prefixes_[i] = prefixes[i];
   }
 
@@ -482,22 +1319,24 @@ void OwlModemAT::registerPrefixHandler(PrefixHandler handler, void *priv, const
   prefix_handler_param_ = priv;
 }
 
-void OwlModemAT::deregisterPrefixHandler() {
+void OwlModemATBase::deregisterPrefixHandler() {
   num_special_prefixes_ = 0;
   prefix_handler_       = nullptr;
 }
 
-bool OwlModemAT::commandSprintf(const char *format, ...) {
+bool OwlModemATBase::commandSprintf(const char *format, ...) {
+  commandResetSegments();
+
   va_list args;
   va_start(args, format);
 
-  int res = vsnprintf(command_buffer_.s, AT_COMMAND_BUFFER_SIZE, format, args);
+  int res = vsnprintf(command_buffer_.s, command_buffer_size_, format, args);
 
   va_end(args);
 
   // vsnprintf returns the number of bytes that _would_ have been written if the
   //   buffer was unlimited
-  if (res <= 0 || res > AT_COMMAND_BUFFER_SIZE) {
+  if (res <= 0 || (unsigned int)res > command_buffer_size_) {
     LOG(L_ERR, "Command does not fit in the buffer, invalidating\r\n");
     command_valid_ = false;
     return false;
@@ -509,9 +1348,11 @@ bool OwlModemAT::commandSprintf(const char *format, ...) {
   return true;
 }
 
-bool OwlModemAT::commandStrcpy(const char *command) {
+bool OwlModemATBase::commandStrcpy(const char *command) {
+  commandResetSegments();
+
   int res = strlen(command);
-  if (res > AT_COMMAND_BUFFER_SIZE) {
+  if ((unsigned int)res > command_buffer_size_) {
     LOG(L_ERR, "Command does not fit in the buffer, invalidating\r\n");
     command_valid_ = false;
     return false;
@@ -522,14 +1363,14 @@ bool OwlModemAT::commandStrcpy(const char *command) {
   return true;
 }
 
-bool OwlModemAT::commandStrcat(const char *data) {
+bool OwlModemATBase::commandStrcat(const char *data) {
   if (!command_valid_) {
     return false;
   }
 
   int data_len = strlen(data);
 
-  if (command_buffer_.len + data_len > AT_COMMAND_BUFFER_SIZE) {
+  if (command_buffer_.len + data_len > command_buffer_size_) {
     LOG(L_ERR, "Command does not fit in the buffer, invalidating\r\n");
     command_valid_ = false;
     return false;
@@ -543,20 +1384,55 @@ bool OwlModemAT::commandStrcat(const char *data) {
   return true;
 }
 
-bool OwlModemAT::commandAppendHex(str data) {
+bool OwlModemATBase::commandAppendHex(str data) {
   if (!command_valid_) {
     return false;
   }
 
-  if (command_buffer_.len + 2 * data.len > AT_COMMAND_BUFFER_SIZE) {
+  if (command_buffer_.len + 2 * data.len > command_buffer_size_) {
     LOG(L_ERR, "Command does not fit in the buffer, invalidating\r\n");
     command_valid_ = false;
     return false;
   }
 
   command_buffer_.len +=
-      str_to_hex(command_buffer_.s + command_buffer_.len, AT_COMMAND_BUFFER_SIZE - command_buffer_.len, data);
+      str_to_hex(command_buffer_.s + command_buffer_.len, command_buffer_size_ - command_buffer_.len, data);
 
   command_valid_ = true;
   return true;
 }
+
+bool OwlModemATBase::commandAppendRef(str data, bool hex) {
+  if (!command_valid_) {
+    return false;
+  }
+
+  // room for the text before the reference, the reference itself and the text after it
+  if (num_command_segments_ + 3 > AT_COMMAND_MAX_SEGMENTS) {
+    LOG(L_ERR, "Command has too many segments, invalidating\r\n");
+    command_valid_ = false;
+    return false;
+  }
+
+  commandCloseText();
+  if (data.len > 0) {
+    command_segments_[num_command_segments_++] = {.data = data, .hex = hex};
+    command_has_refs_                          = true;
+  }
+  return true;
+}
+
+void OwlModemATBase::commandResetSegments() {
+  num_command_segments_ = 0;
+  command_text_start_   = 0;
+  command_has_refs_     = false;
+}
+
+void OwlModemATBase::commandCloseText() {
+  if (command_buffer_.len > command_text_start_) {
+    str text = {.s = command_buffer_.s + command_text_start_, .len = command_buffer_.len - command_text_start_};
+
+    command_segments_[num_command_segments_++] = {.data = text, .hex = false};
+    command_text_start_                        = command_buffer_.len;
+  }
+}
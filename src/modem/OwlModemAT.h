@@ -15,7 +15,7 @@
  *   s - strings of data
  *     su - URC string (+XXXXX)
  *     sr - result string (OK, ERROR, +CME ERROR)
- *     si - invitation for an input (CONNNECT, >)
+ *     si - invitation for an input (CONNNECT, >, @)
  *     so - other strings
  *   r - command requests
  *   t - timeouts
@@ -45,10 +45,29 @@
  *
  */
 
+/* Default buffer sizes, see OwlModemATDefaultTraits */
 #define AT_INPUT_BUFFER_SIZE 64
-#define AT_LINE_BUFFER_SIZE 256
+#define AT_MAX_LINE_SIZE 256
+/* Former name of AT_MAX_LINE_SIZE */
+#define AT_LINE_BUFFER_SIZE AT_MAX_LINE_SIZE
 #define AT_RESPONSE_BUFFER_SIZE 1024
 #define AT_COMMAND_BUFFER_SIZE 1200
+#define AT_QUEUED_COMMAND_SIZE 128
+
+/* Header fields of a payload line, up to the payload (e.g. the MQTT topic of +QMTRECV) */
+#define AT_PAYLOAD_HEADER_SIZE 128
+
+#define AT_COMMAND_MAX_SEGMENTS 8
+#define AT_SPIN_BYTE_BUDGET 2048
+#define AT_SPIN_TIME_BUDGET 100
+
+/* Fixed data pacing, for modems without hardware flow control */
+#define AT_DATA_SEND_INTERVAL 100
+#define AT_DATA_CHUNK_SIZE 100
+
+/* Data mode escape: silence before and after "+++", and how long to wait for the modem to confirm */
+#define AT_DATA_MODE_GUARD_TIME 1000
+#define AT_DATA_MODE_EXIT_TIMEOUT 2000
 
 /*
  * Core class the OwlModem group. Every OwlModem* class is using it.
@@ -57,7 +76,11 @@
  *   - either by polling the state with `getModemState` and when the state is
  *       `response_ready` getting it with `getLastCommandResponse`
  *   - or by registering a callback with `registerResponseHandler`.
- * Unsolicited Response Codes (URC) can be subscribed to with `registerURCHandler`
+ * Several commands can also be queued with `enqueueATCommand`. Queued commands are
+ *   sent one after another as soon as the result of the previous one arrives, and
+ *   each of them reports its result to its own completion callback.
+ * Unsolicited Response Codes (URC) can be subscribed to with `registerURCHandler`,
+ *   or individually by name with `registerUrcNameHandler`
  * Modem state should be advanced regularly by calling `spin`. Energy consuption
  *   can be optimized by only calling `spin` where there is data available on
  *   the input port or when the modem has something to do on timer (i.e. in
@@ -65,8 +88,10 @@
  *   state delaying for a grace period before sending a new chunk of data).
  * This class is not thread-safe, and all calls to its methods should be protected
  * by a mutex when used in multithreaded environment.
+ * The buffers and handler tables are provided by the derived OwlModemATT template, which takes
+ *   their sizes as compile-time parameters. OwlModemAT is the default-sized variant.
  */
-class OwlModemAT {
+class OwlModemATBase {
  public:
   /*
    *  Response handler
@@ -77,8 +102,21 @@ class OwlModemAT {
   using ResponseHandler = bool (*)(at_result_code, str, void *);
   using UrcHandler      = bool (*)(str, str, void *);  // code, data, private (pointer to the instance normally)
   using PrefixHandler   = void (*)(str, void *);       // input string, private (pointer to the instance normally)
-  static constexpr int MaxUrcHandlers = 8;
-  static constexpr int MaxPrefixes    = 8;
+  /*
+   *  Completion callback of a queued command
+   *  @param at_result_code - result code
+   *  @param str - result data. Only valid for the duration of the call
+   *  @param void* - private data passed to enqueueATCommand
+   */
+  using CommandCallback = void (*)(at_result_code, str, void *);
+  /*
+   *  Payload line handler, receives the payload of a line registered with `registerPayloadLine` in chunks
+   *  @param str - header: the fields between the prefix and the payload, without the trailing comma
+   *  @param str - next chunk of the payload, hex-decoded if requested. Only valid for the duration of the call
+   *  @param bool - whether this is the last chunk of the line
+   *  @param void* - private data passed to registerPayloadLine
+   */
+  using PayloadHandler = void (*)(str, str, bool, void *);
 
   enum class modem_state_t {
     idle,
@@ -86,14 +124,21 @@ class OwlModemAT {
     wait_result,
     wait_prompt,
     response_ready,
+    data_mode,
+  };
+
+  /* How data following a prompt is paced out to the modem */
+  enum class data_pacing_t {
+    automatic,     // flow_control if the serial interface has flow control enabled, fixed otherwise
+    fixed,         // one chunk of fixed size per interval
+    flow_control,  // as fast as the serial interface accepts it, chunk size adapted to what write() takes
   };
 
-  OwlModemAT(IOwlSerial *serial) : serial_(serial) {
-  }
   bool initTerminal();
 
   /**
-   * Send arbitrary data to the modem.
+   * Send arbitrary data to the modem. On a flow-controlled port the writes the modem holds back are retried for up to
+   * a second.
    * @param data - data to send
    * @return success status
    */
@@ -104,8 +149,35 @@ class OwlModemAT {
 
   /**
    * Call this function periodically, to handle incoming message from the modem.
+   * Input is drained until the serial interface is empty or the spin budget (see `setSpinBudget`) is used up.
+   * @return - number of bytes read from the modem
+   */
+  int spin();
+
+  /**
+   * Limit the amount of input processed by a single `spin`.
+   * @param max_bytes - stop reading after this many bytes, 0 to read at most one input chunk per spin
+   * @param max_time_ms - stop reading after this much time, 0 for no time limit
+   */
+  void setSpinBudget(unsigned int max_bytes, owl_time_t max_time_ms);
+
+  /**
+   * Select how data after a prompt (see `startATCommand`) is sent.
+   * @param pacing - pacing policy, `automatic` by default
+   * @param chunk_size - size of a chunk for `fixed` pacing
+   * @param interval_ms - time between the chunks for `fixed` pacing
+   */
+  void setDataPacing(data_pacing_t pacing, unsigned int chunk_size = AT_DATA_CHUNK_SIZE,
+                     owl_time_t interval_ms = AT_DATA_SEND_INTERVAL);
+
+  /**
+   * Sleep until there is input from the modem, the modem has something to do on timer (e.g. a command timeout or
+   * the next data chunk to send) or the timeout expires, whatever comes first, then spin. Use it in blocking loops
+   * instead of a fixed delay.
+   * @param timeout_ms - maximum time to sleep
+   * @return - number of bytes read from the modem
    */
-  void spin();
+  int spinBlocking(owl_time_t timeout_ms);
 
   /* Move modem to WaitResult (if data.s is nullptr) or WaitPrompt (otherwise) state and send the command.
    * @param command - AT command to send (without "\r\n" postfix)
@@ -123,6 +195,96 @@ class OwlModemAT {
     return startATCommand(timeout_ms, data, data_term);
   }
 
+  /* Append a command to the command queue. The queued commands are sent one by one from `spin`, each of them as soon
+   * as the previous one has completed.
+   * @param command - AT command to send (without "\r\n" postfix). The command is copied to the queue
+   * @param timeout_ms - timeout on the command or 0 to wait indefinitely
+   * @param callback - optional callback to be called with the result of the command. Should not block or issue
+   *   blocking commands, but can queue new ones
+   * @param priv - private data for the callback
+   * @param data - optional data to send after prompt. Only pointer and length are copied over, so it shouldn't
+   *   be deallocated until the command is completed
+   * @param data_term - optional terminating symbol appended to the sent data
+   * @return false if the queue is full or the command does not fit into a queue slot
+   */
+  bool enqueueATCommand(const char *command, owl_time_t timeout_ms, CommandCallback callback = nullptr,
+                        void *priv = nullptr, str data = {nullptr, 0}, uint16_t data_term = 0xFFFF);
+  /* Same as above, but queues the command previously prepared with commandStrcpy/commandSprintf */
+  bool enqueueATCommand(owl_time_t timeout_ms, CommandCallback callback = nullptr, void *priv = nullptr,
+                        str data = {nullptr, 0}, uint16_t data_term = 0xFFFF);
+
+  /*
+   * Number of commands waiting in the queue or being currently executed from it
+   */
+  int getQueuedCommandsCount() {
+    return command_queue_len_ + (queued_command_active_ ? 1 : 0);
+  }
+
+  /*
+   * Whether the command being executed comes from the queue, e.g. to tell the payload lines of a queued command from
+   * those of a blocking one
+   */
+  bool isQueuedCommandActive() {
+    return queued_command_active_;
+  }
+
+  /**
+   * Blockingly spin until all the queued commands are completed, including the ones queued meanwhile.
+   * @param timeout_ms - maximum time to wait or 0 to wait until the queue is empty
+   * @return true if the queue was emptied, false on timeout or if there is no serial to send the commands to
+   */
+  bool waitCommandQueueBlocking(owl_time_t timeout_ms = 0);
+
+  /**
+   * Drop the queued commands with the given callback and private data which haven't been sent yet. Their callbacks
+   * are not called. Can be used from a completion callback to stop the commands queued after the completed one.
+   * @param callback - completion callback of the commands to drop
+   * @param priv - private data of the commands to drop
+   * @return number of commands dropped
+   */
+  int cancelQueuedCommands(CommandCallback callback, void *priv);
+
+  /**
+   * Send the command prepared in the command buffer and switch to data mode if the modem answers with CONNECT (e.g.
+   * a socket direct link or transparent access). In data mode the serial stream is a raw byte pipe, moved with
+   * `dataRead`/`dataWrite`: spin() leaves the input alone and no commands can be sent until `exitDataMode`.
+   * @param timeout_ms - timeout on the CONNECT
+   * @param out_response - optional output response, when the modem didn't answer with CONNECT
+   * @return true if the modem is now in data mode
+   */
+  bool enterDataMode(owl_time_t timeout_ms, str *out_response = nullptr);
+
+  /**
+   * Leave data mode with the "+++" escape sequence. Waits for the guard time before and after it, so this blocks
+   * for at least 2 * guard_ms. Drain the pipe with `dataRead` first: the data not read yet is dropped, and what the
+   * modem sends after the escape sequence is parsed as AT lines.
+   * @param guard_ms - silence required around the escape sequence, as configured on the modem
+   * @return true if the modem confirmed it is back in command mode. Otherwise it is considered still in data mode
+   */
+  bool exitDataMode(owl_time_t guard_ms = AT_DATA_MODE_GUARD_TIME);
+
+  bool inDataMode() {
+    return state_ == modem_state_t::data_mode;
+  }
+
+  /**
+   * Non-blocking read from the byte pipe, in data mode
+   * @return number of bytes read, can be zero, negative on error or when not in data mode
+   */
+  int32_t dataRead(uint8_t *buf, uint32_t count);
+
+  /**
+   * Non-blocking write to the byte pipe, in data mode
+   * @return number of bytes written, can be less than count, negative on error or when not in data mode
+   */
+  int32_t dataWrite(const uint8_t *buf, uint32_t count);
+
+  /**
+   * Block until there is data to read from the byte pipe or the timeout expires
+   * @return true if data is available
+   */
+  bool dataWaitReadable(owl_time_t timeout_ms);
+
   /*
    * Get the current state of the modem
    */
@@ -139,6 +301,50 @@ class OwlModemAT {
   at_result_code getLastCommandResponse(str *out_response);
 
   bool registerUrcHandler(const char *unique_id, UrcHandler handler, void *priv);
+
+  /**
+   * Register a handler for a single URC, e.g. "+UUSORD". Handlers registered this way are found with one hash table
+   *   lookup, before the generic handlers registered with `registerUrcHandler` are tried. Registering a handler for the
+   *   same URC again replaces the previous one.
+   * @param urc - URC name including the '+'. Not copied, should be a static string
+   * @param handler - URC handler
+   * @param priv - private data for the handler
+   * @return false if there are too many URCs registered
+   */
+  bool registerUrcNameHandler(const char *urc, UrcHandler handler, void *priv);
+
+  /*
+   * Adapters to register a member function of a module as a URC handler, e.g.
+   *   registerUrcNameHandler("+CPIN", OwlModemAT::urcMethod<OwlModemSIM, &OwlModemSIM::handleCPIN>, this)
+   */
+  template <typename T, bool (T::*method)(str, str)>
+  static bool urcMethod(str urc, str data, void *instance) {
+    return (static_cast<T *>(instance)->*method)(urc, data);
+  }
+  template <typename T, void (T::*method)(str)>
+  static bool urcMethod(str urc, str data, void *instance) {
+    (static_cast<T *>(instance)->*method)(data);
+    return true;
+  }
+
+  /**
+   * Register a line carrying a long payload, e.g. "+USORD: 0,512,\"<1024 hex chars>\"". Such lines are not limited by
+   *   the maximum line size: once the prefix and all the header fields have been received, the rest of the line is
+   *   streamed to the handler in chunks instead of being processed as a URC or added to the command response.
+   *   Lines with the prefix but with fewer header fields are processed as usual.
+   * @param prefix - line prefix, e.g. "+USORD: ". Not copied, should be a static string
+   * @param header_fields - number of comma-separated fields preceding the payload
+   * @param hex_decode - whether the payload is hex-encoded and should be decoded before passing it to the handler.
+   *   Quotes around the payload are stripped in any case
+   * @param handler - payload handler
+   * @param priv - private data for the handler
+   * @param length_field - index of the header field holding the payload length in bytes, or -1 if the payload ends
+   *   with the line. Binary payloads, which may contain line ends and quotes, need the length. hex_decode is ignored
+   *   for them. Lines where this field is not a bare integer are processed as usual
+   * @return false if there are too many payload lines registered
+   */
+  bool registerPayloadLine(const char *prefix, int header_fields, bool hex_decode, PayloadHandler handler, void *priv,
+                           int length_field = -1);
   void registerPrefixHandler(PrefixHandler handler, void *priv, const str *prefixes, int num_prefixes);
   void deregisterPrefixHandler();
   void registerResponseHandler(ResponseHandler handler, void *priv);
@@ -153,6 +359,9 @@ class OwlModemAT {
    * @param command_data - additional data to a command requiring it (e.g. UDWNFILE in U-Blox Sara R4/N4).
    * @return the AT result code, or AT_Result_Code__failure on failure to send the data, or AT_Result_Code__timeout in
    * case of timeout while waiting for one of the standard AT result codes.
+   *
+   * The commands queued before the call are executed first, within the same timeout. The ones queued afterwards, even
+   * by the completions of the earlier ones, wait for this command.
    */
   at_result_code doCommandBlocking(owl_time_t timeout_millis, str *out_response, str command_data = {nullptr, 0},
                                    uint16_t data_term = 0xFFFF);
@@ -191,6 +400,17 @@ class OwlModemAT {
    */
   bool commandAppendHex(str data);
 
+  /*
+   * Append data to the command by reference, without copying it into the command buffer. The command is then written
+   * to the modem piece by piece, so it can be longer than the command buffer. The data must stay valid until the
+   * command is sent. Commands with referenced data can't be queued with enqueueATCommand.
+   * @param data - data to append
+   * @param hex - convert the data to HEX representation while writing it
+   * @return if the resulting command is valid. Can be processed right away, or, if ignored, startATCommand or
+   * doCommandBlocking will return an error when called
+   */
+  bool commandAppendRef(str data, bool hex = false);
+
   /**
    * Utility function to filter out of the response for a command, lines which do not start with a certain prefix.
    * The prefix is also eliminated, so that you have just your actual data left.
@@ -202,6 +422,78 @@ class OwlModemAT {
 
 
 
+
+ protected:
+  struct QueuedCommand {
+    unsigned int command_len;
+    owl_time_t timeout_ms;
+    str data;
+    uint16_t data_term;
+    CommandCallback callback;
+    void *priv;
+    uint32_t seq;  // order of queueing
+  };
+
+  struct CommandSegment {
+    str data;
+    bool hex;
+  };
+
+  struct UrcHandlerEntry {
+    const char *id;
+    UrcHandler handler;
+    void *priv;
+  };
+
+  struct UrcNameEntry {
+    str name;
+    UrcHandler handler;
+    void *priv;
+  };
+
+  struct PayloadLine {
+    str prefix;
+    int header_fields;
+    bool hex_decode;
+    PayloadHandler handler;
+    void *priv;
+    int length_field;
+  };
+
+  /* Buffers and tables provided by the derived class */
+  struct Storage {
+    char *rx_buffer;
+    unsigned int max_line_size;
+    unsigned int input_chunk_size;
+    char *response_buffer;
+    unsigned int response_buffer_size;
+    char *command_buffer;
+    unsigned int command_buffer_size;
+    QueuedCommand *command_queue;
+    char *queued_commands;  // max_queued_commands slots of queued_command_size bytes
+    int max_queued_commands;
+    unsigned int queued_command_size;
+    UrcHandlerEntry *urc_handlers;
+    int max_urc_handlers;
+    UrcNameEntry *urc_names;  // urc_names_size entries, zero-initialized. The size is a power of 2
+    int urc_names_size;
+    int max_urc_names;
+    str *special_prefixes;
+    int max_prefixes;
+    PayloadLine *payload_lines;
+    int max_payload_lines;
+  };
+
+  OwlModemATBase(IOwlSerial *serial, const Storage &storage);
+
+  static constexpr int urcNameTableSize(int max_urc_names) {
+    int size = 1;
+    while (size < 2 * max_urc_names) {
+      size <<= 1;
+    }
+    return size;
+  }
+
  private:
   IOwlSerial *serial_{nullptr};
 
@@ -214,44 +506,213 @@ class OwlModemAT {
   owl_time_t send_data_ts_{0};
   bool ignore_first_line_{false};
 
-  at_result_code last_response_code_{at_result_code::unknown};
-
-  char command_buffer_c_[AT_COMMAND_BUFFER_SIZE];
-  str_mut command_buffer_ = {.s = command_buffer_c_, .len = 0};
-  bool command_valid_{false};
+  bool data_mode_pending_{false};      // CONNECT to the command being executed switches to data mode
+  owl_time_t data_mode_write_ts_{0};  // last write to the byte pipe, for the escape guard time
 
-  char input_buffer_c_[AT_INPUT_BUFFER_SIZE];
-  str_mut input_buffer_ = {.s = input_buffer_c_, .len = 0};
+  data_pacing_t data_pacing_{data_pacing_t::automatic};
+  unsigned int data_chunk_size_{AT_DATA_CHUNK_SIZE};
+  owl_time_t data_send_interval_{AT_DATA_SEND_INTERVAL};
+  unsigned int flow_chunk_size_{AT_DATA_CHUNK_SIZE};
 
-  char line_buffer_c_[AT_LINE_BUFFER_SIZE];
-  str_mut line_buffer_ = {.s = line_buffer_c_, .len = 0};
+  unsigned int spin_byte_budget_{AT_SPIN_BYTE_BUDGET};
+  owl_time_t spin_time_budget_{AT_SPIN_TIME_BUDGET};
 
-  char response_buffer_c_[AT_RESPONSE_BUFFER_SIZE];
-  str_mut response_buffer_ = {.s = response_buffer_c_, .len = 0};
+  at_result_code last_response_code_{at_result_code::unknown};
 
-  UrcHandler urc_handlers_[MaxUrcHandlers];
-  const char *urc_handler_ids_[MaxUrcHandlers];
-  void *urc_handler_params_[MaxUrcHandlers];
+  QueuedCommand *command_queue_;
+  char *queued_commands_;
+  int max_queued_commands_;
+  unsigned int queued_command_size_;
+  int command_queue_head_{0};
+  int command_queue_len_{0};
+  bool queued_command_active_{false};
+  uint32_t next_command_seq_{0};
+  bool queue_held_{false};     // by a blocking command, the queued commands from queue_hold_seq_ on wait for it
+  uint32_t queue_hold_seq_{0};
+  CommandCallback command_callback_{nullptr};
+  void *command_callback_priv_{nullptr};
+
+  str_mut command_buffer_;
+  unsigned int command_buffer_size_;
+  bool command_valid_{false};
+  CommandSegment command_segments_[AT_COMMAND_MAX_SEGMENTS];
+  int num_command_segments_{0};
+  unsigned int command_text_start_{0};
+  bool command_has_refs_{false};
+
+  // Receive buffer: lines are processed in place, only the incomplete tail of the input is kept between reads
+  str_mut rx_buffer_;
+  unsigned int rx_buffer_size_;
+  unsigned int max_line_size_;
+  unsigned int input_chunk_size_;
+  bool rx_discard_{false};
+
+  // Line being processed, a slice of rx_buffer_
+  str line_ = {.s = nullptr, .len = 0};
+
+  PayloadLine *payload_lines_;
+  int max_payload_lines_;
+  int num_payload_lines_{0};
+
+  // Payload line being streamed, -1 if none
+  int payload_line_{-1};
+  bool payload_start_{false};
+  bool payload_quoted_{false};
+  unsigned int payload_remaining_{0};  // bytes left of a payload with a length field
+  bool payload_trailer_{false};        // all the bytes are in, skipping the rest of the line
+  char payload_header_c_[AT_PAYLOAD_HEADER_SIZE];
+  str_mut payload_header_ = {.s = payload_header_c_, .len = 0};
+
+  str_mut response_buffer_;
+  unsigned int response_buffer_size_;
+
+  // Open addressing hash table of the URC name handlers, empty entries have name.s == nullptr
+  UrcNameEntry *urc_names_;
+  int urc_names_size_;
+  int max_urc_names_;
+  int num_urc_names_{0};
+
+  UrcHandlerEntry *urc_handlers_;
+  int max_urc_handlers_;
   int num_urc_handlers_{0};
 
   ResponseHandler response_handler_{nullptr};
   void *response_handler_param_{nullptr};
 
 
-  str special_prefixes_[MaxPrefixes];
+  str *special_prefixes_;
+  int max_prefixes_;
   PrefixHandler prefix_handler_{nullptr};
   void *prefix_handler_param_{nullptr};
   int num_special_prefixes_{0};
 
   void spinProcessTime();
-  void spinProcessInput();
+  owl_time_t nextTimerEvent(owl_time_t max_wait);
+  bool dataFlowControlled();
+  owl_time_t dataSendInterval();
+  void sendDataChunk();
+  bool sendDataFlowControlled();
+  int spinProcessInput();
+  int spinProcessInputChunk(int max_len);
+  bool startPayloadLine(unsigned int *line_start);
+  bool processPayloadLine(unsigned int *line_start);
+  bool processPayloadBytes(PayloadLine *entry, unsigned int *line_start);
   void spinProcessLine();
   void appendLineToResponse();
   bool processURC();
+  UrcNameEntry *findUrcName(str urc);
   void processPrefix();
   void processInputPrompt();
+  void completeCommand(at_result_code code);
+  void commandResetSegments();
+  void commandCloseText();
+  bool waitWritable(owl_time_t timeout_time);
+  bool sendSegments(OwlSerialSegment *segments, int count, owl_time_t timeout_time);
+  bool writeCommand(const CommandSegment *segments, int num_segments, owl_time_t timeout_ms);
+  bool sendCommand(const CommandSegment *segments, int num_segments, owl_time_t timeout_ms, str data,
+                   uint16_t data_term);
+  bool queueCommand(str command, owl_time_t timeout_ms, CommandCallback callback, void *priv, str data,
+                    uint16_t data_term);
+  void startQueuedCommand();
+  bool waitEarlierCommandsBlocking(owl_time_t timeout_ms);
 
   at_result_code tryParseCode();
 };
 
+/*
+ * Buffer sizes and handler table capacities of OwlModemATT
+ */
+struct OwlModemATDefaultTraits {
+  static constexpr unsigned int InputChunkSize     = AT_INPUT_BUFFER_SIZE;     // bytes read from the serial at once
+  static constexpr unsigned int MaxLineSize        = AT_MAX_LINE_SIZE;         // longer lines are truncated
+  static constexpr unsigned int ResponseBufferSize = AT_RESPONSE_BUFFER_SIZE;  // all lines of a command response
+  static constexpr unsigned int CommandBufferSize  = AT_COMMAND_BUFFER_SIZE;   // command prepared with commandSprintf
+  static constexpr unsigned int QueuedCommandSize  = AT_QUEUED_COMMAND_SIZE;   // command in a queue slot
+  static constexpr int MaxQueuedCommands           = 8;
+  static constexpr int MaxUrcHandlers              = 8;
+  static constexpr int MaxUrcNames                 = 32;
+  static constexpr int MaxPrefixes                 = 8;
+  static constexpr int MaxPayloadLines             = 4;
+};
+
+/* Smallest hosts: short commands and responses, small UDP packets only */
+struct OwlModemATLeanTraits : OwlModemATDefaultTraits {
+  static constexpr unsigned int InputChunkSize     = 32;
+  static constexpr unsigned int MaxLineSize        = 128;
+  static constexpr unsigned int ResponseBufferSize = 256;
+  static constexpr unsigned int CommandBufferSize  = 300;
+  static constexpr unsigned int QueuedCommandSize  = 64;
+  static constexpr int MaxQueuedCommands           = 4;
+  static constexpr int MaxUrcHandlers              = 2;
+  static constexpr int MaxUrcNames                 = 24;
+  static constexpr int MaxPrefixes                 = 4;
+  static constexpr int MaxPayloadLines             = 2;
+};
+
+/* Gateways: large socket payloads and long responses */
+struct OwlModemATLargeTraits : OwlModemATDefaultTraits {
+  static constexpr unsigned int InputChunkSize     = 256;
+  static constexpr unsigned int MaxLineSize        = 1024;
+  static constexpr unsigned int ResponseBufferSize = 4096;
+  static constexpr unsigned int CommandBufferSize  = 2200;
+  static constexpr unsigned int QueuedCommandSize  = 256;
+  static constexpr int MaxQueuedCommands           = 16;
+};
+
+/*
+ * OwlModemAT with the buffers and handler tables sized at compile time by Traits (see OwlModemATDefaultTraits)
+ */
+template <typename Traits>
+class OwlModemATT : public OwlModemATBase {
+ public:
+  static constexpr int MaxQueuedCommands = Traits::MaxQueuedCommands;
+  static constexpr int MaxUrcHandlers    = Traits::MaxUrcHandlers;
+  static constexpr int MaxUrcNames       = Traits::MaxUrcNames;
+  static constexpr int MaxPrefixes       = Traits::MaxPrefixes;
+  static constexpr int MaxPayloadLines   = Traits::MaxPayloadLines;
+
+  OwlModemATT(IOwlSerial *serial)
+      : OwlModemATBase(serial, {.rx_buffer            = rx_buffer_c_,
+                                .max_line_size        = Traits::MaxLineSize,
+                                .input_chunk_size     = Traits::InputChunkSize,
+                                .response_buffer      = response_buffer_c_,
+                                .response_buffer_size = Traits::ResponseBufferSize,
+                                .command_buffer       = command_buffer_c_,
+                                .command_buffer_size  = Traits::CommandBufferSize,
+                                .command_queue        = command_queue_c_,
+                                .queued_commands      = &queued_commands_c_[0][0],
+                                .max_queued_commands  = Traits::MaxQueuedCommands,
+                                .queued_command_size  = Traits::QueuedCommandSize,
+                                .urc_handlers         = urc_handlers_c_,
+                                .max_urc_handlers     = Traits::MaxUrcHandlers,
+                                .urc_names            = urc_names_c_,
+                                .urc_names_size       = UrcNameTableSize,
+                                .max_urc_names        = Traits::MaxUrcNames,
+                                .special_prefixes     = special_prefixes_c_,
+                                .max_prefixes         = Traits::MaxPrefixes,
+                                .payload_lines        = payload_lines_c_,
+                                .max_payload_lines    = Traits::MaxPayloadLines}) {
+  }
+
+ private:
+  static constexpr int UrcNameTableSize = urcNameTableSize(Traits::MaxUrcNames);
+
+  char rx_buffer_c_[Traits::MaxLineSize + Traits::InputChunkSize];
+  char response_buffer_c_[Traits::ResponseBufferSize];
+  char command_buffer_c_[Traits::CommandBufferSize];
+  QueuedCommand command_queue_c_[Traits::MaxQueuedCommands];
+  char queued_commands_c_[Traits::MaxQueuedCommands][Traits::QueuedCommandSize];
+  UrcHandlerEntry urc_handlers_c_[Traits::MaxUrcHandlers];
+  UrcNameEntry urc_names_c_[UrcNameTableSize] = {};
+  str special_prefixes_c_[Traits::MaxPrefixes];
+  PayloadLine payload_lines_c_[Traits::MaxPayloadLines];
+};
+
+/* Default buffer sizes profile. Define OWL_MODEM_AT_TRAITS to build e.g. with OwlModemATLeanTraits instead */
+#ifndef OWL_MODEM_AT_TRAITS
+#define OWL_MODEM_AT_TRAITS OwlModemATDefaultTraits
+#endif
+
+using OwlModemAT = OwlModemATT<OWL_MODEM_AT_TRAITS>;
+
 #endif  // __OWL_MODEM_AT_H__
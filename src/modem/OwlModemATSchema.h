@@ -0,0 +1,186 @@
+/*
+ * OwlModemATSchema.h
+ * Twilio Breakout SDK
+ *
+ * Copyright (c) 2018 Twilio, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file OwlModemATSchema.h - declarative parsers for the parameters of AT responses and URCs
+ */
+
+#ifndef __OWL_MODEM_AT_SCHEMA_H__
+#define __OWL_MODEM_AT_SCHEMA_H__
+
+#include "../utils/str.h"
+
+/*
+ * A schema is a struct to fill and the list of its comma separated parameters, in order:
+ *
+ *   struct cereg_t { cereg_n n; cereg_stat stat; uint16_t lac; uint32_t ci; };
+ *   using CeregSchema = OwlATSchema<cereg_t, AT_INT(&cereg_t::n), AT_INT(&cereg_t::stat), AT_HEX(&cereg_t::lac),
+ *                                   AT_HEX(&cereg_t::ci)>;
+ *
+ *   cereg_t status = {cereg_n::URC_Disabled, cereg_stat::Not_Registered, 0, 0xFFFFFFFFu};
+ *   CeregSchema::parse(data, &status);                           // URC data, or
+ *   CeregSchema::parseResponse(response, s_cereg_full, &status);  // the line with the prefix in a command response
+ *
+ * The parser is put together at compile time and scans the input once. Commas inside double quotes don't split.
+ * Parameters that are missing, empty, don't parse or are out of range for their member leave it untouched, so set the
+ * defaults beforehand.
+ */
+
+/* Integer parameter in the given base, quoted or not, stored into an integer or enum member */
+#define AT_INT(member) OwlATNumber<decltype(member), member, 10>
+#define AT_HEX(member) OwlATNumber<decltype(member), member, 16>
+#define AT_BIN(member) OwlATNumber<decltype(member), member, 2>
+/* String parameter stored into a str member without the quotes, pointing into the parsed data */
+#define AT_STR(member) OwlATString<decltype(member), member>
+/* Parameter that is not needed */
+#define AT_SKIP OwlATSkip
+
+template <typename Member, Member member, int base>
+struct OwlATNumber;
+
+template <typename S, typename T, T S::*member, int base>
+struct OwlATNumber<T S::*, member, base> {
+  static void parse(str token, S *out) {
+    uint32_t value;
+    long int signed_value;
+
+    if (str_parse_uint32(token, base, &value)) {
+      store(out, value);
+    } else if (str_parse_long(token, base, &signed_value)) {
+      store(out, signed_value);
+    }
+  }
+
+  /* Values the member can't hold (e.g. 300 for a uint8_t, -1 for an unsigned) are rejected rather than wrapped */
+  static void store(S *out, int64_t value) {
+    T narrowed = (T)value;
+    if ((int64_t)narrowed == value) {
+      out->*member = narrowed;
+    }
+  }
+};
+
+template <typename Member, Member member>
+struct OwlATString;
+
+template <typename S, str S::*member>
+struct OwlATString<str S::*, member> {
+  static void parse(str token, S *out) {
+    if (token.len >= 2 && token.s[0] == '"' && token.s[token.len - 1] == '"') {
+      token.s++;
+      token.len -= 2;
+    }
+    out->*member = token;
+  }
+};
+
+struct OwlATSkip {
+  template <typename S>
+  static void parse(str token, S *out) {
+  }
+};
+
+/* End of the parameter starting at pos: the next comma outside quotes, or the end of the line */
+static inline unsigned int owl_at_field_end(str data, unsigned int pos) {
+  bool quoted = false;
+
+  for (; pos < data.len; pos++) {
+    char c = data.s[pos];
+    if (c == '"') {
+      quoted = !quoted;
+    } else if (!quoted && (c == ',' || c == '\r' || c == '\n')) {
+      break;
+    }
+  }
+  return pos;
+}
+
+template <typename S, typename... Fields>
+struct OwlATFieldList;
+
+template <typename S>
+struct OwlATFieldList<S> {
+  static int parse(str data, unsigned int pos, S *out) {
+    return 0;
+  }
+};
+
+template <typename S, typename Field, typename... Rest>
+struct OwlATFieldList<S, Field, Rest...> {
+  static int parse(str data, unsigned int pos, S *out) {
+    if (pos > data.len) {
+      return 0;
+    }
+
+    unsigned int end = owl_at_field_end(data, pos);
+    Field::parse({.s = data.s + pos, .len = end - pos}, out);
+
+    if (end < data.len && data.s[end] != ',') {
+      data.len = end;  // end of the line, no more parameters
+    }
+    return 1 + OwlATFieldList<S, Rest...>::parse(data, end + 1, out);
+  }
+};
+
+template <typename S, typename... Fields>
+struct OwlATSchema {
+  /**
+   * Parse the parameters of a single line, e.g. the data of a URC.
+   * @param data - parameters, without the "+XXX: " prefix
+   * @param out - struct to fill
+   * @return - number of parameters found in the line, up to the number of fields in the schema
+   */
+  static int parse(str data, S *out) {
+    if (data.len == 0) {
+      return 0;
+    }
+    return OwlATFieldList<S, Fields...>::parse(data, 0, out);
+  }
+
+  /**
+   * Parse the parameters of the first line starting with prefix in a (multi-line) command response.
+   * @param response - command response
+   * @param prefix - line prefix, e.g. "+CEREG: "
+   * @param out - struct to fill
+   * @return - number of parameters found in the line, -1 if there is no such line
+   */
+  static int parseResponse(str response, str prefix, S *out) {
+    unsigned int pos = 0;
+
+    while (pos < response.len) {
+      while (pos < response.len && (response.s[pos] == '\r' || response.s[pos] == '\n')) {
+        pos++;
+      }
+
+      str line = {.s = response.s + pos, .len = response.len - pos};
+      if (str_equal_prefix(line, prefix)) {
+        line.s += prefix.len;
+        line.len -= prefix.len;
+        return parse(line, out);
+      }
+
+      while (pos < response.len && response.s[pos] != '\n') {
+        pos++;
+      }
+    }
+    return -1;
+  }
+};
+
+#endif  // __OWL_MODEM_AT_SCHEMA_H__
@@ -31,7 +31,8 @@ OwlModemBG96::OwlModemBG96(IOwlSerial* modem_port_in)
       network(&AT),
       pdn(&AT),
       ssl(&AT),
-      mqtt(&AT) {
+      mqtt(&AT),
+      socket(&AT) {
   if (!modem_port_in) {
     LOG(L_ERR, "OwlModemBG96 initialized without modem port. That is not going to work\r\n");
   }
@@ -28,6 +28,7 @@
 #include "OwlModemPDN.h"
 #include "OwlModemSIM.h"
 #include "OwlModemMQTTBG96.h"
+#include "OwlModemSocketBG96.h"
 #include "OwlModemSSLBG96.h"
 
 #include <stdio.h>
@@ -105,6 +106,9 @@ class OwlModemBG96 {
   /** MQTT client */
   OwlModemMQTTBG96 mqtt;
 
+  /** TCP/UDP sockets in transparent access mode */
+  OwlModemSocketBG96 socket;
+
  private:
   bool has_modem_port{false};
 
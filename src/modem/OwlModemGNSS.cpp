@@ -31,12 +31,15 @@ OwlModemGNSS::OwlModemGNSS(OwlModemRN4 *owlModem) : owlModem(owlModem) {
 }
 
 
-static str s_rmc = STRDECL("RMC,");
+static str s_rmc                       = STRDECL("RMC,");
+static constexpr str_sepset s_comma    = str_sepset_make(",");
+static constexpr str_sepset s_line_end = str_sepset_make("\r\n");
 
 int OwlModemGNSS::getGNSSData(gnss_data_t *out_data) {
   owl_time_t timeout = owl_time() + 5 * 1000;
   str line           = {0};
-  str token          = {0};
+  str fields[12];
+  int num_fields;
 
   if (!out_data) {
     LOG(L_ERR, "Null parameter\r\n");
@@ -48,7 +51,7 @@ int OwlModemGNSS::getGNSSData(gnss_data_t *out_data) {
     //    LOG(L_DBG, "Draining GNSS-Rx\r\n");
     owlModem->drainGNSSRx(&GNSS_response, MODEM_GNSS_RESPONSE_BUFFER_SIZE);
     bzero(&line, sizeof(str));
-    while (str_tok(GNSS_response, "\r\n", &line)) {
+    while (str_tok_set(GNSS_response, &s_line_end, &line)) {
       // Looking for $--RMC,hhmmss.sss,x,llll.lll,a,yyyyy.yyy,a,x.x,u.u,xxxxxx,,,v*hh<CR><LF>
       // If this is incomplete, skip it
       if (line.s + line.len >= GNSS_response.s + GNSS_response.len) break;
@@ -57,12 +60,13 @@ int OwlModemGNSS::getGNSSData(gnss_data_t *out_data) {
       line.s += 3;
       line.len -= 3;
       if (!str_equalcase_prefix(line, s_rmc)) continue;
-      line.s += s_rmc.len - 1;
-      line.len -= s_rmc.len - 1;
+      line.s += s_rmc.len;
+      line.len -= s_rmc.len;
       // hhmmss.sss,x,llll.lll,a,yyyyy.yyy,a,x.x,u.u,xxxxxx,,,v*hh
-      bzero(&token, sizeof(str));
+      num_fields = str_split(line, &s_comma, STR_SPLIT_EMPTY_TOKENS, fields, 12);
       bzero(out_data, sizeof(gnss_data_t));
-      for (int cnt = 0; str_tok_with_empty_tokens(line, ",", &token); cnt++) {
+      for (int cnt = 0; cnt < num_fields; cnt++) {
+        str token = fields[cnt];
         LOG(L_DB, "  Token[%d] = [%.*s]\r\n", cnt, token.len, token.s);
         switch (cnt) {
           case 0:
@@ -140,14 +144,6 @@ int OwlModemGNSS::getGNSSData(gnss_data_t *out_data) {
             break;
         }
       }
-
-      for (int cnt = 0; str_tok_with_empty_tokens(line, ",", &token); cnt++) {
-        int k = str_find_char(line, ",");
-        if (k < 0) {
-          token.s   = line.s;
-          token.len = line.len;
-        }
-      }
       return 1;
     }
   next_line:
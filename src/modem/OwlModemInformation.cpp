@@ -23,7 +23,7 @@
 
 #include "OwlModemInformation.h"
 
-OwlModemInformation::OwlModemInformation(OwlModemAT *atModem) : atModem_(atModem) {
+OwlModemInformation::OwlModemInformation(OwlModemATBase *atModem) : atModem_(atModem) {
 }
 
 int OwlModemInformation::getManufacturer(str *out_response) {
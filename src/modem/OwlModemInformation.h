@@ -32,7 +32,7 @@
  */
 class OwlModemInformation {
  public:
-  OwlModemInformation(OwlModemAT *atModem);
+  OwlModemInformation(OwlModemATBase *atModem);
 
   /*
    * Methods to get information from the modem or SIM card
@@ -68,7 +68,7 @@ class OwlModemInformation {
   int getIMEI(str *out_response);
 
  private:
-  OwlModemAT *atModem_ = 0;
+  OwlModemATBase *atModem_ = 0;
 };
 
 #endif
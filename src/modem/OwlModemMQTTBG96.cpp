@@ -1,18 +1,88 @@
 #include "OwlModemMQTTBG96.h"
+#include "OwlModemATSchema.h"
 #include <stdio.h>
+#include <string.h>
 
-static char URC_ID[] = "MQTTBG96";
-OwlModemMQTTBG96::OwlModemMQTTBG96(OwlModemAT* atModem) : atModem_(atModem) {
-  if (atModem_ != nullptr) {
-    atModem_->registerUrcHandler(URC_ID, OwlModemMQTTBG96::processURC, this);
+OwlModemMQTTClientBG96::OwlModemMQTTClientBG96(OwlModemATBase* atModem) : atModem_(atModem) {
+  init();
+}
+
+OwlModemMQTTClientBG96::OwlModemMQTTClientBG96(OwlModemMQTTBG96* primary, uint8_t connect_id)
+    : atModem_(primary->atModem_), connect_id_(connect_id) {
+  if (connect_id == 0 || connect_id >= MQTT_MAX_CLIENTS || primary->clients_[connect_id] != nullptr) {
+    LOG(L_ERR, "MQTT client %u is not available\r\n", (unsigned int)connect_id);
+    valid_ = false;
+  } else {
+    primary->clients_[connect_id] = this;
+    primary_                      = primary;
   }
 
+  init();
+}
+
+OwlModemMQTTClientBG96::~OwlModemMQTTClientBG96() {
+  if (primary_ != nullptr) {
+    primary_->clients_[connect_id_] = nullptr;
+  }
+}
+
+void OwlModemMQTTClientBG96::init() {
   for (int i = 0; i < _num_mqtt_commands; ++i) {
     wait_for_command_[i] = false;
   }
+
+  for (int i = 0; i < MQTT_MAX_PUBLISH_IN_FLIGHT; ++i) {
+    publish_slots_[i]       = {};
+    publish_slots_[i].owner = this;
+  }
+
+  owl_topic_trie_init(&topic_trie_, topic_nodes_, MQTT_MAX_TOPIC_NODES, topic_pool_, MQTT_TOPIC_POOL_SIZE);
+}
+
+bool OwlModemMQTTClientBG96::checkValid() {
+  if (!valid_) {
+    LOG(L_ERR, "MQTT client %u is not available\r\n", (unsigned int)connect_id_);
+  }
+  return valid_;
 }
 
-bool OwlModemMQTTBG96::waitResultBlocking(mqtt_command command, int32_t timeout) {
+OwlModemMQTTBG96::OwlModemMQTTBG96(OwlModemATBase* atModem) : OwlModemMQTTClientBG96(atModem) {
+  if (atModem_ != nullptr) {
+    // Messages with their length, the payload is taken by length and may hold any byte. Without the length or
+    // with only the buffered message announcement, the line goes to the URC handler
+    atModem_->registerPayloadLine("+QMTRECV: ", 4, false, OwlModemMQTTBG96::processPayloadRecv, this, 3);
+    atModem_->registerUrcNameHandler("+QMTRECV", routeURC<&OwlModemMQTTClientBG96::processURCQmtrecv>, this);
+    atModem_->registerUrcNameHandler("+QMTPUB", routeURC<&OwlModemMQTTClientBG96::processURCQmtpub>, this);
+    atModem_->registerUrcNameHandler("+QMTOPEN", routeURC<&OwlModemMQTTClientBG96::processURCQmtopen>, this);
+    atModem_->registerUrcNameHandler("+QMTCLOSE", routeURC<&OwlModemMQTTClientBG96::processURCQmtclose>, this);
+    atModem_->registerUrcNameHandler("+QMTCONN", routeURC<&OwlModemMQTTClientBG96::processURCQmtconn>, this);
+    atModem_->registerUrcNameHandler("+QMTDISC", routeURC<&OwlModemMQTTClientBG96::processURCQmtdisc>, this);
+    atModem_->registerUrcNameHandler("+QMTSUB", routeURC<&OwlModemMQTTClientBG96::processURCQmtsub>, this);
+    atModem_->registerUrcNameHandler("+QMTUNS", routeURC<&OwlModemMQTTClientBG96::processURCQmtuns>, this);
+    atModem_->registerUrcNameHandler("+QMTSTAT", routeURC<&OwlModemMQTTClientBG96::processURCQmtstat>, this);
+  }
+
+  for (int i = 0; i < MQTT_MAX_CLIENTS; ++i) {
+    clients_[i] = nullptr;
+  }
+  clients_[0] = this;
+}
+
+OwlModemMQTTClientBG96* OwlModemMQTTBG96::clientFor(str data) {
+  // All the QMT URCs start with the tcpconnectID
+  const char* comma = (const char*)memchr(data.s, ',', data.len);
+  str field         = {.s = data.s, .len = (comma != nullptr) ? (unsigned int)(comma - data.s) : data.len};
+  uint32_t connect_id;
+
+  if (!str_parse_uint32(field, 10, &connect_id) || connect_id >= MQTT_MAX_CLIENTS ||
+      clients_[connect_id] == nullptr) {
+    LOG(L_WARN, "No MQTT client for [%.*s]\r\n", data.len, data.s);
+    return nullptr;
+  }
+  return clients_[connect_id];
+}
+
+bool OwlModemMQTTClientBG96::waitResultBlocking(mqtt_command command, int32_t timeout) {
   owl_time_t timeout_time = owl_time() + timeout;
 
   do {
@@ -20,341 +90,282 @@ bool OwlModemMQTTBG96::waitResultBlocking(mqtt_command command, int32_t timeout)
       return command_success_[command];
     }
 
-    atModem_->spin();
-
     if (owl_time() >= timeout_time) {
       return false;
     }
 
-    owl_delay(50);
+    atModem_->spinBlocking(timeout_time - owl_time());
   } while (1);
 }
 
-static str s_qmtopen_urc  = STRDECL("+QMTOPEN");
-static str s_qmtclose_urc = STRDECL("+QMTCLOSE");
-static str s_qmtconn_urc  = STRDECL("+QMTCONN");
-static str s_qmtdisc_urc  = STRDECL("+QMTDISC");
-static str s_qmtpub_urc   = STRDECL("+QMTPUB");
-static str s_qmtsub_urc   = STRDECL("+QMTSUB");
-static str s_qmtuns_urc   = STRDECL("+QMTUNS");
-static str s_qmtrecv_urc  = STRDECL("+QMTRECV");
-
-bool OwlModemMQTTBG96::processURC(str urc, str data, void* instance) {
-  OwlModemMQTTBG96* inst = reinterpret_cast<OwlModemMQTTBG96*>(instance);
-
-  if (str_equal(urc, s_qmtopen_urc)) {
-    inst->processURCQmtopen(data);
-    return true;
-  } else if (str_equal(urc, s_qmtclose_urc)) {
-    inst->processURCQmtclose(data);
-    return true;
-  } else if (str_equal(urc, s_qmtconn_urc)) {
-    inst->processURCQmtconn(data);
-    return true;
-  } else if (str_equal(urc, s_qmtdisc_urc)) {
-    inst->processURCQmtdisc(data);
-    return true;
-  } else if (str_equal(urc, s_qmtpub_urc)) {
-    inst->processURCQmtpub(data);
-    return true;
-  } else if (str_equal(urc, s_qmtsub_urc)) {
-    inst->processURCQmtsub(data);
-    return true;
-  } else if (str_equal(urc, s_qmtuns_urc)) {
-    inst->processURCQmtuns(data);
-    return true;
-  } else if (str_equal(urc, s_qmtrecv_urc)) {
-    inst->processURCQmtrecv(data);
-    return true;
-  }
-  return false;
-}
-
-void OwlModemMQTTBG96::processURCQmtopen(str data) {
-  str token = {0};
-
-  if (!wait_for_command_[qmtopen]) {
-    return;
-  }
-
-  wait_for_command_[qmtopen] = false;
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtopen] = false;
-    return;
-  }
-
-  // ignore tcpconnectID
-
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtopen] = false;
-    return;
-  }
-
-  command_success_[qmtopen] = (str_to_long_int(token, 10) == 0);
+/* tcpconnectID,result[,ret_code] */
+struct qmt_result_t {
+  int connect_id;
+  int result;
+  int ret_code;
+};
+using ResultSchema =
+    OwlATSchema<qmt_result_t, AT_INT(&qmt_result_t::connect_id), AT_INT(&qmt_result_t::result),
+                AT_INT(&qmt_result_t::ret_code)>;
+
+/* tcpconnectID,msgID,result[,value] */
+struct qmt_ack_t {
+  int connect_id;
+  int msg_id;
+  int result;
+};
+using AckSchema = OwlATSchema<qmt_ack_t, AT_INT(&qmt_ack_t::connect_id), AT_INT(&qmt_ack_t::msg_id),
+                              AT_INT(&qmt_ack_t::result)>;
+
+/* tcpconnectID,msgID,"topic","payload" - the payload may contain commas */
+struct qmt_recv_t {
+  int connect_id;
+  int msg_id;
+  str topic;
+  str payload;
+};
+using RecvSchema = OwlATSchema<qmt_recv_t, AT_INT(&qmt_recv_t::connect_id), AT_INT(&qmt_recv_t::msg_id),
+                               AT_STR(&qmt_recv_t::topic), AT_STR(&qmt_recv_t::payload)>;
+
+/* tcpconnectID,msgID,"topic",payload_len - header of a message with its length */
+struct qmt_recv_header_t {
+  int connect_id;
+  int msg_id;
+  str topic;
+  int length;
+};
+using RecvHeaderSchema =
+    OwlATSchema<qmt_recv_header_t, AT_INT(&qmt_recv_header_t::connect_id), AT_INT(&qmt_recv_header_t::msg_id),
+                AT_STR(&qmt_recv_header_t::topic), AT_INT(&qmt_recv_header_t::length)>;
+
+void OwlModemMQTTClientBG96::processResultURC(mqtt_command command, str data) {
+  qmt_result_t params = {0};
+
+  if (!wait_for_command_[command]) {
+    return;
+  }
+
+  wait_for_command_[command] = false;
+  if (ResultSchema::parse(data, &params) < 2) {
+    command_success_[command] = false;
+    return;
+  }
+
+  command_success_[command] = (params.result == 0);
 }
 
-void OwlModemMQTTBG96::processURCQmtclose(str data) {
-  str token = {0};
-
-  if (!wait_for_command_[qmtclose]) {
-    return;
-  }
-
-  wait_for_command_[qmtclose] = false;
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtclose] = false;
-    return;
-  }
-
-  // ignore tcpconnectID
-
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtclose] = false;
-    return;
-  }
+void OwlModemMQTTClientBG96::processURCQmtopen(str data) {
+  processResultURC(qmtopen, data);
+}
 
-  command_success_[qmtclose] = (str_to_long_int(token, 10) == 0);
+void OwlModemMQTTClientBG96::processURCQmtclose(str data) {
+  connected_ = false;
+  failPublishes();
+  processResultURC(qmtclose, data);
 }
 
-void OwlModemMQTTBG96::processURCQmtconn(str data) {
-  str token = {0};
+void OwlModemMQTTClientBG96::processURCQmtconn(str data) {
+  qmt_result_t params = {0};
 
   if (!wait_for_command_[qmtconn]) {
     return;
   }
 
   wait_for_command_[qmtconn] = false;
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtconn] = false;
-    return;
-  }
-
-  // ignore tcpconnectID
-
-  if (!str_tok(data, ",", &token)) {
+  int num_fields             = ResultSchema::parse(data, &params);
+  if (num_fields < 2) {
     command_success_[qmtconn] = false;
     return;
   }
 
-  int ack_result = str_to_long_int(token, 10);
-  if (ack_result == 2) {  // Failed to send
+  if (params.result == 2) {  // Failed to send
     command_success_[qmtconn] = false;
     return;
-  } else if (ack_result == 1) {         // Retransmission
+  } else if (params.result == 1) {      // Retransmission
     wait_for_command_[qmtconn] = true;  // wait for next URC
     return;
   }  // else ack succeeded
 
-  if (!str_tok(data, ",", &token)) {
+  if (num_fields < 3) {
     command_success_[qmtconn] = false;
     return;
   }
-  command_success_[qmtconn] = (str_to_long_int(token, 10) == 0);
-}
-
-void OwlModemMQTTBG96::processURCQmtdisc(str data) {
-  str token = {0};
+  command_success_[qmtconn] = (params.ret_code == 0);
 
-  if (!wait_for_command_[qmtdisc]) {
-    return;
+  if (command_success_[qmtconn]) {
+    connected_     = true;
+    outbox_paused_ = false;
+    drainOutbox();
   }
-
-  wait_for_command_[qmtdisc] = false;
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtdisc] = false;
-    return;
-  }
-
-  // ignore tcpconnectID
-
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtdisc] = false;
-    return;
-  }
-
-  command_success_[qmtdisc] = (str_to_long_int(token, 10) == 0);
 }
 
-void OwlModemMQTTBG96::processURCQmtsub(str data) {
-  str token = {0};
+void OwlModemMQTTClientBG96::processURCQmtstat(str data) {
+  // The link to the broker is gone, whatever the reason
+  LOG(L_WARN, "MQTT connection state changed: %.*s\r\n", data.len, data.s);
+  connected_ = false;
+  failPublishes();
+}
 
-  if (!wait_for_command_[qmtsub]) {
-    return;
-  }
+void OwlModemMQTTClientBG96::processURCQmtdisc(str data) {
+  connected_ = false;
+  failPublishes();
+  processResultURC(qmtdisc, data);
+}
 
-  wait_for_command_[qmtsub] = false;
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtsub] = false;
-    return;
+void OwlModemMQTTClientBG96::failPublishes() {
+  // Their acknowledgements won't come anymore, the outbox records are sent again after the next login
+  for (int i = 0; i < MQTT_MAX_PUBLISH_IN_FLIGHT; ++i) {
+    if (publish_slots_[i].in_use) {
+      finishPublish(&publish_slots_[i], false);
+    }
   }
+}
 
-  // ignore tcpconnectID
+void OwlModemMQTTClientBG96::processAckURC(mqtt_command command, str data) {
+  qmt_ack_t params = {0};
 
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtsub] = false;
+  if (!wait_for_command_[command]) {
     return;
   }
 
-  // ignore msgID
-
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtsub] = false;
+  wait_for_command_[command] = false;
+  if (AckSchema::parse(data, &params) < 3) {
+    command_success_[command] = false;
     return;
   }
 
-  int ack_result = str_to_long_int(token, 10);
-  if (ack_result == 2) {  // Failed to send
-    command_success_[qmtsub] = false;
-    return;
-  } else if (ack_result == 1) {        // Retransmission
-    wait_for_command_[qmtsub] = true;  // wait for next URC
-    return;
+  if (params.result == 2) {  // Failed to send
+    command_success_[command] = false;
+  } else if (params.result == 1) {      // Retransmission
+    wait_for_command_[command] = true;  // wait for next URC
   } else {
-    command_success_[qmtsub] = true;
-    return;
+    command_success_[command] = true;
   }
 }
 
-void OwlModemMQTTBG96::processURCQmtuns(str data) {
-  str token = {0};
-
-  if (!wait_for_command_[qmtuns]) {
-    return;
-  }
-
-  wait_for_command_[qmtuns] = false;
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtuns] = false;
-    return;
-  }
-
-  // ignore tcpconnectID
+void OwlModemMQTTClientBG96::processURCQmtsub(str data) {
+  processAckURC(qmtsub, data);
+}
 
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtuns] = false;
-    return;
-  }
+void OwlModemMQTTClientBG96::processURCQmtuns(str data) {
+  processAckURC(qmtuns, data);
+}
 
-  // ignore msgID
+void OwlModemMQTTClientBG96::processURCQmtpub(str data) {
+  qmt_ack_t params = {0};
 
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtuns] = false;
-    return;
+  if (AckSchema::parse(data, &params) >= 3) {
+    PublishSlot* slot = findPublish(params.msg_id);
+    if (slot != nullptr) {
+      if (params.result != 1) {  // else retransmission, wait for the next URC
+        finishPublish(slot, params.result == 0);
+      }
+      return;
+    }
   }
 
-  int ack_result = str_to_long_int(token, 10);
-  if (ack_result == 2) {  // Failed to send
-    command_success_[qmtuns] = false;
-    return;
-  } else if (ack_result == 1) {        // Retransmission
-    wait_for_command_[qmtuns] = true;  // wait for next URC
-    return;
-  } else {
-    command_success_[qmtuns] = true;
-    return;
-  }
+  processAckURC(qmtpub, data);
 }
 
-void OwlModemMQTTBG96::processURCQmtpub(str data) {
-  str token = {0};
+void OwlModemMQTTClientBG96::processURCQmtrecv(str data) {
+  qmt_recv_t params = {0};
 
-  if (!wait_for_command_[qmtpub]) {
+  int num_fields = RecvSchema::parse(data, &params);
+  if (num_fields == 2) {
+    // Buffered receive mode: tcpconnectID,recv_id announces a message kept by the modem, fetch it
+    char command[32];
+    snprintf(command, sizeof(command), "AT+QMTRECV=%d,%d", params.connect_id, params.msg_id);
+    if (!atModem_->enqueueATCommand(command, 1000, processRecvReadCommand, this)) {
+      LOG(L_WARN, "Could not queue the read of buffered message %d\r\n", params.msg_id);
+    }
     return;
   }
 
-  wait_for_command_[qmtpub] = false;
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtpub] = false;
+  if (num_fields < 4) {
     return;
   }
 
-  // ignore tcpconnectID
-
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtpub] = false;
-    return;
+  // The payload field goes up to the end of the line: quotes in the payload may leave commas unquoted
+  str payload = {.s = params.payload.s, .len = (unsigned int)(data.s + data.len - params.payload.s)};
+  if (payload.s > data.s && payload.s[-1] == '"') {
+    payload.s--;
+    payload.len++;
+  }
+  if (payload.len >= 2 && payload.s[0] == '"' && payload.s[payload.len - 1] == '"') {
+    payload.s++;
+    payload.len -= 2;
   }
 
-  // ignore msgID
+  deliverMessage(params.topic, payload);
+}
 
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtpub] = false;
-    return;
+void OwlModemMQTTClientBG96::deliverMessage(str topic, str payload) {
+  if (owl_topic_trie_match(&topic_trie_, topic, payload) == 0 && message_callback_ != nullptr) {
+    message_callback_(topic, payload);
   }
+}
 
-  int ack_result = str_to_long_int(token, 10);
-  if (ack_result == 2) {  // Failed to send
-    command_success_[qmtpub] = false;
-    return;
-  } else if (ack_result == 1) {        // Retransmission
-    wait_for_command_[qmtpub] = true;  // wait for next URC
-    return;
-  } else {
-    command_success_[qmtpub] = true;
-    return;
+void OwlModemMQTTClientBG96::processRecvReadCommand(at_result_code code, str response, void* priv) {
+  if (code != at_result_code::OK) {
+    LOG(L_ERR, "Reading a buffered message failed: %d %s\r\n", (int)code, at_enum_stringify(code));
   }
+  // else the message came in the +QMTRECV payload line
 }
 
-void OwlModemMQTTBG96::processURCQmtrecv(str data) {
-  str token = {0};
+void OwlModemMQTTBG96::processPayloadRecv(str header, str chunk, bool last, void* priv) {
+  // Received in the buffer of the primary client, then routed
+  OwlModemMQTTBG96* instance = (OwlModemMQTTBG96*)priv;
 
-  if (message_callback_ == nullptr) {
-    return;
+  unsigned int room = MQTT_RECV_BUFFER_SIZE - instance->recv_len_;
+  if (chunk.len > room) {
+    instance->recv_truncated_ = true;
+    chunk.len                 = room;
   }
+  memcpy(instance->recv_buffer_ + instance->recv_len_, chunk.s, chunk.len);
+  instance->recv_len_ += chunk.len;
 
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtuns] = false;
+  if (!last) {
     return;
   }
 
-  // ignore tcpconnectID
-
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtuns] = false;
-    return;
+  qmt_recv_header_t params = {0};
+  if (RecvHeaderSchema::parse(header, &params) < 4) {
+    LOG(L_ERR, "Bad +QMTRECV header [%.*s]\r\n", header.len, header.s);
+  } else {
+    if (instance->recv_truncated_) {
+      LOG(L_WARN, "Message of %d bytes on %.*s truncated to %d bytes\r\n", params.length, params.topic.len,
+          params.topic.s, MQTT_RECV_BUFFER_SIZE);
+    }
+    OwlModemMQTTClientBG96* client = instance->clientFor(header);
+    if (client != nullptr) {
+      client->deliverMessage(params.topic, {.s = instance->recv_buffer_, .len = instance->recv_len_});
+    }
   }
 
-  // ignore msgID
+  instance->recv_len_       = 0;
+  instance->recv_truncated_ = false;
+}
 
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtuns] = false;
-    return;
+bool OwlModemMQTTClientBG96::setReceiveMode(bool buffered) {
+  if (!checkValid()) {
+    return false;
   }
 
-  str topic = token;
-  if (topic.len >= 2) {
-    // strip quotes
-    topic.s++;
-    topic.len -= 2;
-  }
+  atModem_->commandSprintf("AT+QMTCFG=\"recv/mode\",%d,%d,1", connect_id_, buffered ? 1 : 0);
+  return atModem_->doCommandBlocking(1 * 1000, nullptr) == at_result_code::OK;
+}
 
-  if (!str_tok(data, ",", &token)) {
-    command_success_[qmtuns] = false;
-    return;
-  }
-  str message = token;
-  if (message.len >= 2) {
-    // strip quotes
-    message.s++;
-    message.len -= 2;
+bool OwlModemMQTTClientBG96::openConnection(const char* host_addr, uint16_t port) {
+  if (!checkValid()) {
+    return false;
   }
 
-
-  message_callback_(topic, message);
-}
-
-bool OwlModemMQTTBG96::openConnection(const char* host_addr, uint16_t port) {
-  if (use_tls_) {
-    if (atModem_->doCommandBlocking("AT+QMTCFG=\"ssl\",0,1,0", 1 * 1000, nullptr) != at_result_code::OK) {
-      return false;
-    }
-  } else {
-    if (atModem_->doCommandBlocking("AT+QMTCFG=\"ssl\",0,0,0", 1 * 1000, nullptr) != at_result_code::OK) {
-      return false;
-    }
+  atModem_->commandSprintf("AT+QMTCFG=\"ssl\",%d,%d,0", connect_id_, use_tls_ ? 1 : 0);
+  if (atModem_->doCommandBlocking(1 * 1000, nullptr) != at_result_code::OK) {
+    return false;
   }
 
-  atModem_->commandSprintf("AT+QMTOPEN=0,\"%s\",%d", host_addr, (int)port);
+  atModem_->commandSprintf("AT+QMTOPEN=%d,\"%s\",%d", connect_id_, host_addr, (int)port);
 
   wait_for_command_[qmtopen] = true;
 
@@ -370,10 +381,16 @@ bool OwlModemMQTTBG96::openConnection(const char* host_addr, uint16_t port) {
   return true;
 }
 
-bool OwlModemMQTTBG96::closeConnection() {
+bool OwlModemMQTTClientBG96::closeConnection() {
+  if (!checkValid()) {
+    return false;
+  }
+
+  atModem_->commandSprintf("AT+QMTCLOSE=%d", connect_id_);
+
   wait_for_command_[qmtclose] = true;
 
-  if (atModem_->doCommandBlocking("AT+QMTCLOSE=0", 1 * 1000, nullptr) != at_result_code::OK) {
+  if (atModem_->doCommandBlocking(1 * 1000, nullptr) != at_result_code::OK) {
     wait_for_command_[qmtclose] = false;
     return false;
   }
@@ -381,11 +398,15 @@ bool OwlModemMQTTBG96::closeConnection() {
   return waitResultBlocking(qmtclose, 60 * 1000);
 }
 
-bool OwlModemMQTTBG96::login(const char* client_id, const char* uname, const char* password) {
+bool OwlModemMQTTClientBG96::login(const char* client_id, const char* uname, const char* password) {
+  if (!checkValid()) {
+    return false;
+  }
+
   if (uname == nullptr || password == nullptr) {
-    atModem_->commandSprintf("AT+QMTCONN=0,\"%s\"", client_id);
+    atModem_->commandSprintf("AT+QMTCONN=%d,\"%s\"", connect_id_, client_id);
   } else {
-    atModem_->commandSprintf("AT+QMTCONN=0,\"%s\",\"%s\",\"%s\"", client_id, uname, password);
+    atModem_->commandSprintf("AT+QMTCONN=%d,\"%s\",\"%s\",\"%s\"", connect_id_, client_id, uname, password);
   }
 
   wait_for_command_[qmtconn] = true;
@@ -398,10 +419,16 @@ bool OwlModemMQTTBG96::login(const char* client_id, const char* uname, const cha
   return waitResultBlocking(qmtconn, 60 * 1000);
 }
 
-bool OwlModemMQTTBG96::logout() {
+bool OwlModemMQTTClientBG96::logout() {
+  if (!checkValid()) {
+    return false;
+  }
+
+  atModem_->commandSprintf("AT+QMTDISC=%d", connect_id_);
+
   wait_for_command_[qmtdisc] = true;
 
-  if (atModem_->doCommandBlocking("AT+QMTDISC=0", 1 * 1000, nullptr) != at_result_code::OK) {
+  if (atModem_->doCommandBlocking(1 * 1000, nullptr) != at_result_code::OK) {
     wait_for_command_[qmtdisc] = false;
     return false;
   }
@@ -409,16 +436,35 @@ bool OwlModemMQTTBG96::logout() {
   return waitResultBlocking(qmtdisc, 60 * 1000);
 }
 
-bool OwlModemMQTTBG96::publish(const char* topic, str data, bool retain, qos_t qos, uint16_t msg_id) {
+/* Format of the publish command, taking connect_id, msg_id, qos, retain, topic and data length (used by
+ * AT+QMTPUBEX only). Returns the terminator to send after the data */
+uint16_t OwlModemMQTTClientBG96::publishFormat(const char** out_format) {
+  if (use_length_publish_) {
+    // The data length is given, nothing follows the data after the '>' prompt
+    *out_format = "AT+QMTPUBEX=%d,%d,%d,%d,\"%s\",%u";
+    return 0xFFFF;
+  }
+
+  *out_format = "AT+QMTPUB=%d,%d,%d,%d,\"%s\"";
+  return 0x1A;
+}
+
+bool OwlModemMQTTClientBG96::publish(const char* topic, str data, bool retain, qos_t qos, uint16_t msg_id) {
+  if (!checkValid()) {
+    return false;
+  }
+
   if (qos == qos_t::atMostOnce) {
     msg_id = 0;
   }
 
-  atModem_->commandSprintf("AT+QMTPUB=0,%d,%d,%d,\"%s\"", (int)msg_id, qos, retain, topic);
+  const char* format;
+  uint16_t data_term = publishFormat(&format);
+  atModem_->commandSprintf(format, connect_id_, (int)msg_id, qos, retain, topic, (unsigned int)data.len);
 
   wait_for_command_[qmtpub] = true;
 
-  if (atModem_->doCommandBlocking(1 * 1000, nullptr, data, 0x1A) != at_result_code::OK) {
+  if (atModem_->doCommandBlocking(1 * 1000, nullptr, data, data_term) != at_result_code::OK) {
     wait_for_command_[qmtpub] = false;
     return false;
   }
@@ -426,8 +472,215 @@ bool OwlModemMQTTBG96::publish(const char* topic, str data, bool retain, qos_t q
   return waitResultBlocking(qmtpub, 60 * 1000);
 }
 
-bool OwlModemMQTTBG96::subscribe(const char* topic_filter, uint16_t msg_id, qos_t qos) {
-  atModem_->commandSprintf("AT+QMTSUB=0,%d,\"%s\",%d", (int)msg_id, topic_filter, qos);
+uint16_t OwlModemMQTTClientBG96::allocateMsgId() {
+  // 0 is reserved for QoS 0, skip the ids still waiting for their acknowledgement
+  for (;;) {
+    uint16_t msg_id = next_msg_id_++;
+    if (next_msg_id_ == 0) {
+      next_msg_id_ = 1;
+    }
+    if (findPublish(msg_id) == nullptr) {
+      return msg_id;
+    }
+  }
+}
+
+OwlModemMQTTClientBG96::PublishSlot* OwlModemMQTTClientBG96::findPublish(uint16_t msg_id) {
+  PublishSlot* found = nullptr;
+
+  // Oldest first, several QoS 0 publishes share msg_id 0
+  for (int i = 0; i < MQTT_MAX_PUBLISH_IN_FLIGHT; ++i) {
+    PublishSlot* slot = &publish_slots_[i];
+    if (slot->in_use && slot->msg_id == msg_id && (found == nullptr || (int32_t)(slot->seq - found->seq) < 0)) {
+      found = slot;
+    }
+  }
+  return found;
+}
+
+void OwlModemMQTTClientBG96::finishPublish(PublishSlot* slot, bool success) {
+  mqtt_publish_callback_t callback = slot->callback;
+  void* priv                       = slot->priv;
+  uint16_t msg_id                  = slot->msg_id;
+
+  // A publish failed before its command was sent must not go out later, its data may be gone by then
+  if (atModem_->cancelQueuedCommands(processPublishCommand, slot) > 0) {
+    slot->command_pending = false;
+  }
+  // One already running still sends the data, the callback and the outbox record wait for it to complete
+  if (!success && slot->command_pending) {
+    slot->finish_deferred = true;
+    return;
+  }
+  slot->in_use = false;
+  if (callback != nullptr) {
+    callback(msg_id, success, priv);
+  }
+
+  if (slot->outbox_index >= 0 && outbox_ != nullptr) {
+    if (success) {
+      owl_outbox_remove(outbox_, slot->outbox_index);
+    } else {
+      owl_outbox_set_sending(outbox_, slot->outbox_index, false);  // to be sent again
+      // Not after a connection loss, the login resumes the draining anyway
+      if (connected_) {
+        outbox_paused_ = true;
+      }
+    }
+  }
+  if (success && !outbox_paused_) {
+    drainOutbox();
+  }
+}
+
+void OwlModemMQTTClientBG96::processPublishCommand(at_result_code code, str response, void* priv) {
+  PublishSlot* slot = (PublishSlot*)priv;
+
+  slot->command_pending = false;
+  if (slot->finish_deferred) {
+    slot->finish_deferred = false;
+    slot->owner->finishPublish(slot, false);
+    return;
+  }
+  if (code != at_result_code::OK && slot->in_use) {
+    LOG(L_ERR, "Publish of message %u failed: %d %s\r\n", (unsigned int)slot->msg_id, (int)code,
+        at_enum_stringify(code));
+    slot->owner->finishPublish(slot, false);
+  }
+  // else wait for +QMTPUB
+}
+
+bool OwlModemMQTTClientBG96::publishAsync(const char* topic, str data, bool retain, qos_t qos,
+                                          mqtt_publish_callback_t callback, void* priv) {
+  return startPublish(topic, data, retain, qos, -1, callback, priv);
+}
+
+bool OwlModemMQTTClientBG96::startPublish(const char* topic, str data, bool retain, qos_t qos, int outbox_index,
+                                          mqtt_publish_callback_t callback, void* priv) {
+  if (!checkValid()) {
+    return false;
+  }
+
+  PublishSlot* slot = nullptr;
+  for (int i = 0; i < MQTT_MAX_PUBLISH_IN_FLIGHT && slot == nullptr; ++i) {
+    if (!publish_slots_[i].in_use && !publish_slots_[i].command_pending) {
+      slot = &publish_slots_[i];
+    }
+  }
+  if (slot == nullptr) {
+    LOG(L_WARN, "Too many publishes in flight\r\n");
+    return false;
+  }
+
+  uint16_t msg_id = (qos == qos_t::atMostOnce) ? 0 : allocateMsgId();
+
+  // Taken before queueing, the command may already complete from within enqueueATCommand
+  slot->in_use          = true;
+  slot->command_pending = true;
+  slot->finish_deferred = false;
+  slot->msg_id          = msg_id;
+  slot->seq             = next_seq_++;
+  slot->started         = owl_time();
+  slot->outbox_index    = outbox_index;
+  slot->callback        = callback;
+  slot->priv            = priv;
+
+  // Also started from the URCs, where the command buffer may hold the command of a blocking call
+  char command[AT_QUEUED_COMMAND_SIZE];
+  const char* format;
+  uint16_t data_term = publishFormat(&format);
+  int command_len    = snprintf(command, sizeof(command), format, connect_id_, (int)msg_id, qos, retain, topic,
+                                (unsigned int)data.len);
+  if (command_len < 0 || command_len >= (int)sizeof(command)) {
+    LOG(L_ERR, "Publish command for %s is too long\r\n", topic);
+    slot->in_use          = false;
+    slot->command_pending = false;
+    return false;
+  }
+  if (!atModem_->enqueueATCommand(command, 1 * 1000, processPublishCommand, slot, data, data_term)) {
+    LOG(L_WARN, "Could not queue the publish of message %u\r\n", (unsigned int)msg_id);
+    slot->in_use          = false;
+    slot->command_pending = false;
+    return false;
+  }
+  return true;
+}
+
+int OwlModemMQTTClientBG96::getPublishInFlight() {
+  int count = 0;
+  for (int i = 0; i < MQTT_MAX_PUBLISH_IN_FLIGHT; ++i) {
+    if (publish_slots_[i].in_use) {
+      count++;
+    }
+  }
+  return count;
+}
+
+void OwlModemMQTTClientBG96::handlePublishTimeouts() {
+  owl_time_t now = owl_time();
+  for (int i = 0; i < MQTT_MAX_PUBLISH_IN_FLIGHT; ++i) {
+    PublishSlot* slot = &publish_slots_[i];
+    if (slot->in_use && !slot->finish_deferred && now - slot->started > MQTT_PUBLISH_TIMEOUT) {
+      LOG(L_WARN, "Publish of message %u timed out\r\n", (unsigned int)slot->msg_id);
+      finishPublish(slot, false);
+    }
+  }
+}
+
+bool OwlModemMQTTClientBG96::publishStored(const char* topic, str data, bool retain, qos_t qos, uint8_t priority) {
+  if (!checkValid()) {
+    return false;
+  }
+
+  if (outbox_ == nullptr) {
+    LOG(L_ERR, "No outbox set\r\n");
+    return false;
+  }
+
+  str topic_str = STRDECL(topic);
+  if (!owl_outbox_push(outbox_, topic_str, data, (uint8_t)qos, retain, priority)) {
+    LOG(L_WARN, "Could not store the message for %s\r\n", topic);
+    return false;
+  }
+
+  if (!outbox_paused_) {
+    drainOutbox();
+  }
+  return true;
+}
+
+int OwlModemMQTTClientBG96::drainOutbox() {
+  if (outbox_ == nullptr || !connected_) {
+    return 0;
+  }
+
+  outbox_paused_ = false;
+  int started    = 0;
+  int index;
+  while (!outbox_paused_ && getPublishInFlight() < MQTT_MAX_PUBLISH_IN_FLIGHT &&
+         (index = owl_outbox_next(outbox_)) >= 0) {
+    str topic, data;
+    uint8_t qos;
+    bool retain;
+    owl_outbox_get(outbox_, index, &topic, &data, &qos, &retain);
+
+    // The record stays in place while in flight: the topic is 0-terminated there and the data is sent from it
+    owl_outbox_set_sending(outbox_, index, true);
+    if (!startPublish(topic.s, data, retain, (qos_t)qos, index, nullptr, nullptr)) {
+      owl_outbox_set_sending(outbox_, index, false);
+      break;  // command queue full, continued as the publishes complete
+    }
+    started++;
+  }
+  return started;
+}
+
+bool OwlModemMQTTClientBG96::subscribe(const char* topic_filter, uint16_t msg_id, qos_t qos) {
+  if (!checkValid()) {
+    return false;
+  }
+
+  atModem_->commandSprintf("AT+QMTSUB=%d,%d,\"%s\",%d", connect_id_, (int)msg_id, topic_filter, qos);
 
   wait_for_command_[qmtsub] = true;
 
@@ -438,3 +691,50 @@ bool OwlModemMQTTBG96::subscribe(const char* topic_filter, uint16_t msg_id, qos_
 
   return waitResultBlocking(qmtsub, 60 * 1000);
 }
+
+bool OwlModemMQTTClientBG96::subscribe(const char* topic_filter, uint16_t msg_id, qos_t qos,
+                                       mqtt_topic_handler_t handler, void* priv) {
+  if (!checkValid()) {
+    return false;
+  }
+
+  // Routed before subscribing, retained messages come right after the acknowledgement
+  str filter                        = STRDECL(topic_filter);
+  mqtt_topic_handler_t prev_handler = nullptr;
+  void* prev_priv                   = nullptr;
+  bool existed                      = owl_topic_trie_find(&topic_trie_, filter, &prev_handler, &prev_priv);
+  if (!owl_topic_trie_add(&topic_trie_, filter, handler, priv)) {
+    LOG(L_ERR, "Could not add a handler for %s\r\n", topic_filter);
+    return false;
+  }
+
+  if (!subscribe(topic_filter, msg_id, qos)) {
+    // The modem keeps an earlier subscription to the filter, so does its handler
+    if (existed) {
+      owl_topic_trie_add(&topic_trie_, filter, prev_handler, prev_priv);
+    } else {
+      owl_topic_trie_remove(&topic_trie_, filter);
+    }
+    return false;
+  }
+  return true;
+}
+
+bool OwlModemMQTTClientBG96::unsubscribe(const char* topic_filter, uint16_t msg_id) {
+  if (!checkValid()) {
+    return false;
+  }
+
+  owl_topic_trie_remove(&topic_trie_, STRDECL(topic_filter));
+
+  atModem_->commandSprintf("AT+QMTUNS=%d,%d,\"%s\"", connect_id_, (int)msg_id, topic_filter);
+
+  wait_for_command_[qmtuns] = true;
+
+  if (atModem_->doCommandBlocking(1 * 1000, nullptr) != at_result_code::OK) {
+    wait_for_command_[qmtuns] = false;
+    return false;
+  }
+
+  return waitResultBlocking(qmtuns, 60 * 1000);
+}
@@ -27,8 +27,41 @@
 #include "enums.h"
 
 #include "OwlModemAT.h"
+#include "../utils/outbox.h"
+#include "../utils/topic_trie.h"
 
-class OwlModemMQTTBG96 {
+/* MQTT clients of the modem, each with its own broker connection. The BG96 has 6 */
+#define MQTT_MAX_CLIENTS 6
+
+/* Number of publishes started with publishAsync that can wait for their acknowledgement at the same time */
+#ifndef MQTT_MAX_PUBLISH_IN_FLIGHT
+#define MQTT_MAX_PUBLISH_IN_FLIGHT 8
+#endif
+
+/* Time after which an unacknowledged publish is reported as failed */
+#ifndef MQTT_PUBLISH_TIMEOUT
+#define MQTT_PUBLISH_TIMEOUT (60 * 1000)
+#endif
+
+/* Capacity of the subscription routing: distinct topic levels of all the filters, and their total length */
+#ifndef MQTT_MAX_TOPIC_NODES
+#define MQTT_MAX_TOPIC_NODES 32
+#endif
+#ifndef MQTT_TOPIC_POOL_SIZE
+#define MQTT_TOPIC_POOL_SIZE 256
+#endif
+
+/* Largest received message payload passed to the message callback, longer ones are truncated */
+#ifndef MQTT_RECV_BUFFER_SIZE
+#define MQTT_RECV_BUFFER_SIZE 1024
+#endif
+
+class OwlModemMQTTBG96;
+
+/**
+ * One MQTT client of the modem, with its own broker connection, subscriptions and publishes in flight
+ */
+class OwlModemMQTTClientBG96 {
  public:
   enum class qos_t {
     atMostOnce  = 0,
@@ -38,13 +71,60 @@ class OwlModemMQTTBG96 {
 
 
   using mqtt_message_callback_t = void (*)(str, str);
+  /*
+   *  Completion callback of a publishAsync
+   *  @param uint16_t - message id assigned by publishAsync, 0 for QoS 0
+   *  @param bool - whether the message was delivered (acknowledged by the broker for QoS 1 and 2)
+   *  @param void* - private data passed to publishAsync
+   */
+  using mqtt_publish_callback_t = void (*)(uint16_t, bool, void*);
+  /*
+   *  Handler of the messages matching a subscription
+   *  @param str - topic of the message
+   *  @param str - payload
+   *  @param void* - private data passed to subscribe
+   */
+  using mqtt_topic_handler_t = owl_topic_handler_f;
 
-  OwlModemMQTTBG96(OwlModemAT* atModem);
+  /**
+   * A client other than 0. The clients are used independently and share the AT command queue, so they can publish
+   * concurrently.
+   * @param primary - client 0, must outlive this client
+   * @param connect_id - client id, 1 to MQTT_MAX_CLIENTS - 1, one object per id. Check isValid()
+   */
+  OwlModemMQTTClientBG96(OwlModemMQTTBG96* primary, uint8_t connect_id);
+  ~OwlModemMQTTClientBG96();
+
+  uint8_t getConnectId() {
+    return connect_id_;
+  }
+
+  /**
+   * Whether the client got its id. If not (out of range or taken by another object), all the calls fail
+   */
+  bool isValid() {
+    return valid_;
+  }
 
   bool openConnection(const char* host_addr, uint16_t port);
   void useTLS(bool use) {
     use_tls_ = use;
   }
+  /**
+   * Publish with AT+QMTPUBEX and an explicit data length instead of AT+QMTPUB terminated by Ctrl-Z, so that the data
+   * can hold any byte, 0x1A included. Needs a modem firmware supporting AT+QMTPUBEX.
+   */
+  void useLengthPublish(bool use) {
+    use_length_publish_ = use;
+  }
+  /**
+   * Configure how received messages are delivered. Call before openConnection. The payload length is always
+   * reported, so that binary payloads are received whole whatever bytes they contain.
+   * @param buffered - false to get the messages right away in the +QMTRECV URC, true to have the modem keep them
+   * and fetch each one with AT+QMTRECV as it is announced, so that bursts don't flood the serial line
+   * @return success status
+   */
+  bool setReceiveMode(bool buffered);
   bool closeConnection();
   bool login(const char* client_id, const char* uname, const char* password);
   bool logout();
@@ -58,6 +138,63 @@ class OwlModemMQTTBG96 {
    */
   bool publish(const char* topic, str data, bool retain = false, qos_t qos = qos_t::atMostOnce, uint16_t msg_id = 1);
 
+  /**
+   * Publish to a topic without waiting for the broker. The publishes are pipelined through the AT command queue and
+   * up to MQTT_MAX_PUBLISH_IN_FLIGHT of them wait for their acknowledgement at the same time, matched by message id.
+   * Don't mix with publish() calls using the same message ids.
+   * @param topic - topic to publish to, copied
+   * @param data - published data. Must stay valid until the callback is called
+   * @param retain - whether the data should be retained on the server
+   * @param qos - MQTT Quality of Service
+   * @param callback - optional completion callback
+   * @param priv - private data for the callback
+   * @return true if the publish was started, false if too many are in flight or the command queue is full
+   */
+  bool publishAsync(const char* topic, str data, bool retain = false, qos_t qos = qos_t::atMostOnce,
+                    mqtt_publish_callback_t callback = nullptr, void* priv = nullptr);
+
+  /**
+   * Number of publishes started with publishAsync and not completed yet
+   */
+  int getPublishInFlight();
+
+  /**
+   * Fail the publishes not acknowledged within MQTT_PUBLISH_TIMEOUT. Call this function from the main loop, every
+   * once in a while, when using publishAsync.
+   */
+  void handlePublishTimeouts();
+
+  /**
+   * Use an outbox for publishStored. The messages already in it are sent on the next drain.
+   * @param outbox - outbox, opened with owl_outbox_init. nullptr to stop using it
+   */
+  void setOutbox(owl_outbox* outbox) {
+    outbox_ = outbox;
+  }
+
+  /**
+   * Publish through the outbox: the message is stored first and sent in the background while logged in, with
+   * publishAsync. It stays in the outbox until acknowledged, so it survives coverage loss (and resets, with
+   * persistent outbox storage). The outbox is drained in order at full speed after each successful login.
+   * @param topic - topic to publish to
+   * @param data - published data, copied into the outbox
+   * @param retain - whether the data should be retained on the server
+   * @param qos - MQTT Quality of Service
+   * @param priority - higher priority messages are sent first and dropped last when the outbox is full
+   * @return false if there is no outbox or the message could not be stored
+   */
+  bool publishStored(const char* topic, str data, bool retain = false, qos_t qos = qos_t::atLeastOnce,
+                     uint8_t priority = 0);
+
+  /**
+   * Start sending the messages waiting in the outbox, as many as can be in flight. Called automatically after a
+   * successful login and as the messages are acknowledged. A publish failing while connected pauses the automatic
+   * draining until the next login or call to this function. The ones in flight when the connection is lost are sent
+   * again after the next login.
+   * @return number of publishes started
+   */
+  int drainOutbox();
+
   /**
    * Subscribe to a topic filter
    * @param topic_filter - topic filter used for subscription
@@ -66,12 +203,34 @@ class OwlModemMQTTBG96 {
    */
   bool subscribe(const char* topic_filter, uint16_t msg_id, qos_t qos = qos_t::atMostOnce);
 
+  /**
+   * Subscribe to a topic filter and route the matching messages to a handler. The filters are kept in a trie, so a
+   * message is dispatched with a single walk over its topic levels. A message matching several filters is passed to
+   * each of their handlers, one matching none goes to the message callback.
+   * @param topic_filter - topic filter used for subscription, '+' and '#' wildcards allowed
+   * @param handler - handler of the matching messages, replaces the one of an earlier subscription to the same filter
+   * @param priv - private data for the handler
+   * @return success status, false if the filter is invalid or there is no room left for it
+   */
+  bool subscribe(const char* topic_filter, uint16_t msg_id, qos_t qos, mqtt_topic_handler_t handler, void* priv);
+
+  /**
+   * Unsubscribe from a topic filter, dropping its handler if any
+   * @return success status
+   */
+  bool unsubscribe(const char* topic_filter, uint16_t msg_id);
+
+  /* Messages not routed to a subscription handler */
   void setMessageCallback(mqtt_message_callback_t callback) {
     message_callback_ = callback;
   }
 
+ protected:
+  OwlModemMQTTClientBG96(OwlModemATBase* atModem);
+
  private:
-  static bool processURC(str urc, str data, void* instance);
+  friend class OwlModemMQTTBG96;
+
   void processURCQmtopen(str data);
   void processURCQmtclose(str data);
   void processURCQmtconn(str data);
@@ -80,16 +239,91 @@ class OwlModemMQTTBG96 {
   void processURCQmtsub(str data);
   void processURCQmtuns(str data);
   void processURCQmtrecv(str data);
+  void processURCQmtstat(str data);
+  void deliverMessage(str topic, str payload);
+  static void processRecvReadCommand(at_result_code code, str response, void* priv);
+
+  OwlModemATBase* atModem_;
+  uint8_t connect_id_{0};
+  bool valid_{true};
+  OwlModemMQTTBG96* primary_{nullptr};  // set for the clients other than 0
 
-  OwlModemAT* atModem_;
+  void init();
+  bool checkValid();
   mqtt_message_callback_t message_callback_{nullptr};
   bool use_tls_{false};
+  bool use_length_publish_{false};
+
+  owl_topic_trie topic_trie_;
+  owl_topic_node topic_nodes_[MQTT_MAX_TOPIC_NODES];
+  char topic_pool_[MQTT_TOPIC_POOL_SIZE];
 
   enum mqtt_command { qmtopen, qmtclose, qmtconn, qmtdisc, qmtpub, qmtsub, qmtuns, _num_mqtt_commands };
 
   bool wait_for_command_[_num_mqtt_commands];
   bool command_success_[_num_mqtt_commands];
   bool waitResultBlocking(mqtt_command command, int32_t timeout);
+
+  /** Publish started with publishAsync */
+  struct PublishSlot {
+    OwlModemMQTTClientBG96* owner;
+    bool in_use;
+    bool command_pending;  // its AT+QMTPUB is queued or running, the slot can't be reused before it completes
+    bool finish_deferred;  // failed while its AT+QMTPUB was running, reported once the command completes
+    uint16_t msg_id;
+    uint32_t seq;  // order of the publishes, QoS 0 ones are all acknowledged with msg_id 0
+    owl_time_t started;
+    int outbox_index;  // record of the message if it comes from the outbox, -1 otherwise
+    mqtt_publish_callback_t callback;
+    void* priv;
+  };
+  PublishSlot publish_slots_[MQTT_MAX_PUBLISH_IN_FLIGHT];
+  uint16_t next_msg_id_{1};
+  uint32_t next_seq_{0};
+
+  owl_outbox* outbox_{nullptr};
+  bool connected_{false};
+  bool outbox_paused_{false};
+
+  bool startPublish(const char* topic, str data, bool retain, qos_t qos, int outbox_index,
+                    mqtt_publish_callback_t callback, void* priv);
+  uint16_t publishFormat(const char** out_format);
+  uint16_t allocateMsgId();
+  PublishSlot* findPublish(uint16_t msg_id);
+  void finishPublish(PublishSlot* slot, bool success);
+  void failPublishes();
+  static void processPublishCommand(at_result_code code, str response, void* priv);
+  void processResultURC(mqtt_command command, str data);
+  void processAckURC(mqtt_command command, str data);
+};
+
+/**
+ * MQTT client 0 of the modem. It also receives the URCs of all the clients and passes them on by client id.
+ */
+class OwlModemMQTTBG96 : public OwlModemMQTTClientBG96 {
+ public:
+  OwlModemMQTTBG96(OwlModemATBase* atModem);
+
+ private:
+  friend class OwlModemMQTTClientBG96;
+
+  OwlModemMQTTClientBG96* clients_[MQTT_MAX_CLIENTS];
+
+  OwlModemMQTTClientBG96* clientFor(str data);
+  template <void (OwlModemMQTTClientBG96::*method)(str)>
+  static bool routeURC(str urc, str data, void* priv) {
+    OwlModemMQTTClientBG96* client = static_cast<OwlModemMQTTBG96*>(priv)->clientFor(data);
+    if (client != nullptr) {
+      (client->*method)(data);
+    }
+    return true;
+  }
+  static void processPayloadRecv(str header, str chunk, bool last, void* priv);
+
+  /* Message being received through the +QMTRECV payload line, for any client */
+  char recv_buffer_[MQTT_RECV_BUFFER_SIZE];
+  unsigned int recv_len_{0};
+  bool recv_truncated_{false};
 };
 
 #endif  // __OWL_MODEM_MQTT_H__
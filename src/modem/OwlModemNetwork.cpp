@@ -22,76 +22,62 @@
  */
 
 #include "OwlModemNetwork.h"
+#include "OwlModemATSchema.h"
 
 #include <stdio.h>
 
 
-static char URC_ID[] = "Network";
-
-OwlModemNetwork::OwlModemNetwork(OwlModemAT *atModem) : atModem_(atModem) {
+OwlModemNetwork::OwlModemNetwork(OwlModemATBase *atModem) : atModem_(atModem) {
   if (atModem_ != nullptr) {
-    atModem_->registerUrcHandler(URC_ID, OwlModemNetwork::processURC, this);
+    atModem_->registerUrcNameHandler(
+        "+CREG", OwlModemAT::urcMethod<OwlModemNetwork, &OwlModemNetwork::processURCNetworkRegistration>, this);
+    atModem_->registerUrcNameHandler(
+        "+CGREG", OwlModemAT::urcMethod<OwlModemNetwork, &OwlModemNetwork::processURCGPRSRegistration>, this);
+    atModem_->registerUrcNameHandler(
+        "+CEREG", OwlModemAT::urcMethod<OwlModemNetwork, &OwlModemNetwork::processURCEPSRegistration>, this);
+    atModem_->registerUrcNameHandler(
+        "+CEDRXP", OwlModemAT::urcMethod<OwlModemNetwork, &OwlModemNetwork::processURCEDRXResult>, this);
   }
 }
 
-static str s_creg      = STRDECL("+CREG");
 static str s_creg_full = STRDECL("+CREG: ");
 
-void OwlModemNetwork::parseNetworkRegistrationStatus(str response, creg_n *out_n, creg_stat *out_stat,
-                                                     uint16_t *out_lac, uint32_t *out_ci, creg_act *out_act) {
-  int cnt   = 0;
-  str token = {0};
-  if (out_n) *out_n = creg_n::URC_Disabled;
-  if (out_stat) *out_stat = creg_stat::Not_Registered;
-  if (out_lac) *out_lac = 0;
-  if (out_ci) *out_ci = 0xFFFFFFFFu;
-  if (out_act) *out_act = creg_act::invalid;
+/*
+ * The +CREG/+CGREG/+CEREG read responses start with <n>, the URCs don't. Tell them apart by the second parameter,
+ * which is the quoted <lac> in the URC.
+ */
+static bool registration_status_has_n(str data) {
+  const char *comma = (const char *)memchr(data.s, ',', data.len);
+  return !(comma && comma + 1 < data.s + data.len && comma[1] == '"');
+}
+
+void OwlModemNetwork::parseNetworkRegistrationStatus(str data, owl_network_status_t *out) {
+  using Schema = OwlATSchema<owl_network_status_t, AT_INT(&owl_network_status_t::n),
+                             AT_INT(&owl_network_status_t::stat), AT_HEX(&owl_network_status_t::lac),
+                             AT_HEX(&owl_network_status_t::ci), AT_HEX(&owl_network_status_t::act)>;
+
+  using SchemaURC = OwlATSchema<owl_network_status_t, AT_INT(&owl_network_status_t::stat),
+                                AT_HEX(&owl_network_status_t::lac), AT_HEX(&owl_network_status_t::ci),
+                                AT_HEX(&owl_network_status_t::act)>;
+
+  *out = {
+      .n    = creg_n::URC_Disabled,
+      .stat = creg_stat::Not_Registered,
+      .lac  = 0,
+      .ci   = 0xFFFFFFFFu,
+      .act  = creg_act::invalid,
+  };
 
-  str data = response;
   str_skipover_prefix(&data, s_creg_full);
-  int has_n = 1;
-  while (str_tok(data, ",", &token)) {
-    if (cnt == 1) {
-      if (token.len && token.s[0] == '\"') has_n = 0;
-      break;
-    }
-    cnt++;
-  }
-  token = {0};
-  if (has_n)
-    cnt = 0;
-  else
-    cnt = 1;
-  while (str_tok(data, ",", &token)) {
-    switch (cnt) {
-      case 0:
-        if (out_n) *out_n = (creg_n)str_to_long_int(token, 10);
-        break;
-      case 1:
-        if (out_stat) *out_stat = (creg_stat)str_to_long_int(token, 10);
-        break;
-      case 2:
-        if (out_lac) *out_lac = (uint16_t)str_to_long_int(token, 16);
-        break;
-      case 3:
-        if (out_ci) *out_ci = (uint32_t)str_to_uint32_t(token, 16);
-        break;
-      case 4:
-        if (out_act) *out_act = (creg_act)str_to_long_int(token, 16);
-        break;
-      default:
-        LOG(L_ERR, "Not handled %d(-th) token [%.*s] data was [%.*s]\r\n", cnt, token.len, token.s, data.len, data.s);
-    }
-    cnt++;
+  if (registration_status_has_n(data)) {
+    Schema::parse(data, out);
+  } else {
+    SchemaURC::parse(data, out);
   }
 }
 
 bool OwlModemNetwork::processURCNetworkRegistration(str urc, str data) {
-  if (!str_equal(urc, s_creg)) {
-    return false;
-  }
-  this->parseNetworkRegistrationStatus(data, &last_network_status.n, &last_network_status.stat,
-                                       &last_network_status.lac, &last_network_status.ci, &last_network_status.act);
+  this->parseNetworkRegistrationStatus(data, &last_network_status);
 
   if (!this->handler_creg) {
     LOG(L_INFO,
@@ -107,68 +93,37 @@ bool OwlModemNetwork::processURCNetworkRegistration(str urc, str data) {
 
 
 
-static str s_cgreg      = STRDECL("+CGREG");
 static str s_cgreg_full = STRDECL("+CGREG: ");
 
-void OwlModemNetwork::parseGPRSRegistrationStatus(str response, cgreg_n *out_n, cgreg_stat *out_stat, uint16_t *out_lac,
-                                                  uint32_t *out_ci, cgreg_act *out_act, uint8_t *out_rac) {
-  int cnt   = 0;
-  str token = {0};
-  if (out_n) *out_n = cgreg_n::URC_Disabled;
-  if (out_stat) *out_stat = cgreg_stat::Not_Registered;
-  if (out_lac) *out_lac = 0;
-  if (out_ci) *out_ci = 0xFFFFFFFFu;
-  if (out_act) *out_act = cgreg_act::invalid;
-  if (out_rac) *out_rac = 0;
+void OwlModemNetwork::parseGPRSRegistrationStatus(str data, owl_last_gprs_status_t *out) {
+  using Schema = OwlATSchema<owl_last_gprs_status_t, AT_INT(&owl_last_gprs_status_t::n),
+                             AT_INT(&owl_last_gprs_status_t::stat), AT_HEX(&owl_last_gprs_status_t::lac),
+                             AT_HEX(&owl_last_gprs_status_t::ci), AT_INT(&owl_last_gprs_status_t::act),
+                             AT_HEX(&owl_last_gprs_status_t::rac)>;
+
+  using SchemaURC = OwlATSchema<owl_last_gprs_status_t, AT_INT(&owl_last_gprs_status_t::stat),
+                                AT_HEX(&owl_last_gprs_status_t::lac), AT_HEX(&owl_last_gprs_status_t::ci),
+                                AT_INT(&owl_last_gprs_status_t::act), AT_HEX(&owl_last_gprs_status_t::rac)>;
+
+  *out = {
+      .n    = cgreg_n::URC_Disabled,
+      .stat = cgreg_stat::Not_Registered,
+      .lac  = 0,
+      .ci   = 0xFFFFFFFFu,
+      .act  = cgreg_act::invalid,
+      .rac  = 0,
+  };
 
-  str data = response;
   str_skipover_prefix(&data, s_cgreg_full);
-  int has_n = 1;
-  while (str_tok(data, ",", &token)) {
-    if (cnt == 1) {
-      if (token.len && token.s[0] == '\"') has_n = 0;
-      break;
-    }
-    cnt++;
-  }
-  token = {0};
-  if (has_n)
-    cnt = 0;
-  else
-    cnt = 1;
-  while (str_tok(data, ",", &token)) {
-    switch (cnt) {
-      case 0:
-        if (out_n) *out_n = (cgreg_n)str_to_long_int(token, 10);
-        break;
-      case 1:
-        if (out_stat) *out_stat = (cgreg_stat)str_to_long_int(token, 10);
-        break;
-      case 2:
-        if (out_lac) *out_lac = (uint16_t)str_to_long_int(token, 16);
-        break;
-      case 3:
-        if (out_ci) *out_ci = (uint32_t)str_to_uint32_t(token, 16);
-        break;
-      case 4:
-        if (out_act) *out_act = (cgreg_act)str_to_long_int(token, 10);
-        break;
-      case 5:
-        if (out_rac) *out_rac = (uint8_t)str_to_long_int(token, 16);
-        break;
-      default:
-        LOG(L_ERR, "Not handled %d(-th) token [%.*s] data was [%.*s]\r\n", cnt, token.len, token.s, data.len, data.s);
-    }
-    cnt++;
+  if (registration_status_has_n(data)) {
+    Schema::parse(data, out);
+  } else {
+    SchemaURC::parse(data, out);
   }
 }
 
 bool OwlModemNetwork::processURCGPRSRegistration(str urc, str data) {
-  if (!str_equal(urc, s_cgreg)) {
-    return false;
-  }
-  this->parseGPRSRegistrationStatus(data, &last_gprs_status.n, &last_gprs_status.stat, &last_gprs_status.lac,
-                                    &last_gprs_status.ci, &last_gprs_status.act, &last_gprs_status.rac);
+  this->parseGPRSRegistrationStatus(data, &last_gprs_status);
   if (!this->handler_cgreg) {
     LOG(L_INFO,
         "Received URC for CGREG [%.*s]. Set a handler with setHandlerGPRSRegistrationURC() if you wish to "
@@ -183,75 +138,39 @@ bool OwlModemNetwork::processURCGPRSRegistration(str urc, str data) {
 
 
 
-static str s_cereg      = STRDECL("+CEREG");
 static str s_cereg_full = STRDECL("+CEREG: ");
 
-void OwlModemNetwork::parseEPSRegistrationStatus(str response, cereg_n *out_n, cereg_stat *out_stat, uint16_t *out_lac,
-                                                 uint32_t *out_ci, cereg_act *out_act, cereg_cause_type *out_cause_type,
-                                                 uint32_t *out_reject_cause) {
-  int cnt   = 0;
-  str token = {0};
-  if (out_n) *out_n = cereg_n::URC_Disabled;
-  if (out_stat) *out_stat = cereg_stat::Not_Registered;
-  if (out_lac) *out_lac = 0;
-  if (out_ci) *out_ci = 0xFFFFFFFFu;
-  if (out_act) *out_act = cereg_act::invalid;
-  if (out_cause_type) *out_cause_type = cereg_cause_type::EMM_Cause;
-  if (out_reject_cause) *out_reject_cause = 0;
+void OwlModemNetwork::parseEPSRegistrationStatus(str data, owl_last_eps_status_t *out) {
+  using Schema = OwlATSchema<owl_last_eps_status_t, AT_INT(&owl_last_eps_status_t::n),
+                             AT_INT(&owl_last_eps_status_t::stat), AT_HEX(&owl_last_eps_status_t::lac),
+                             AT_HEX(&owl_last_eps_status_t::ci), AT_INT(&owl_last_eps_status_t::act),
+                             AT_INT(&owl_last_eps_status_t::cause_type), AT_INT(&owl_last_eps_status_t::reject_cause)>;
+
+  using SchemaURC = OwlATSchema<owl_last_eps_status_t, AT_INT(&owl_last_eps_status_t::stat),
+                                AT_HEX(&owl_last_eps_status_t::lac), AT_HEX(&owl_last_eps_status_t::ci),
+                                AT_INT(&owl_last_eps_status_t::act), AT_INT(&owl_last_eps_status_t::cause_type),
+                                AT_INT(&owl_last_eps_status_t::reject_cause)>;
+
+  *out = {
+      .n            = cereg_n::URC_Disabled,
+      .stat         = cereg_stat::Not_Registered,
+      .lac          = 0,
+      .ci           = 0xFFFFFFFFu,
+      .act          = cereg_act::invalid,
+      .cause_type   = cereg_cause_type::EMM_Cause,
+      .reject_cause = 0,
+  };
 
-  str data = response;
   str_skipover_prefix(&data, s_cereg_full);
-  int has_n = 1;
-  while (str_tok(data, ",", &token)) {
-    if (cnt == 1) {
-      if (token.len && token.s[0] == '\"') has_n = 0;
-      break;
-    }
-    cnt++;
-  }
-  token = {0};
-  if (has_n)
-    cnt = 0;
-  else
-    cnt = 1;
-  while (str_tok(data, ",", &token)) {
-    switch (cnt) {
-      case 0:
-        if (out_n) *out_n = (cereg_n)str_to_long_int(token, 10);
-        break;
-      case 1:
-        if (out_stat) *out_stat = (cereg_stat)str_to_long_int(token, 10);
-        break;
-      case 2:
-        if (out_lac) *out_lac = (uint16_t)str_to_long_int(token, 16);
-        break;
-      case 3:
-        if (out_ci) *out_ci = (uint32_t)str_to_uint32_t(token, 16);
-        break;
-      case 4:
-        if (out_act) *out_act = (cereg_act)str_to_long_int(token, 10);
-        break;
-      case 5:
-        if (out_cause_type) *out_cause_type = (cereg_cause_type)str_to_long_int(token, 10);
-        break;
-      case 6:
-        if (out_reject_cause) *out_reject_cause = (uint32_t)str_to_uint32_t(token, 10);
-        break;
-      default:
-        LOG(L_ERR, "Not handled %d(-th) token [%.*s] data was [%.*s]\r\n", cnt, token.len, token.s, data.len, data.s);
-    }
-    cnt++;
+  if (registration_status_has_n(data)) {
+    Schema::parse(data, out);
+  } else {
+    SchemaURC::parse(data, out);
   }
 }
 
 bool OwlModemNetwork::processURCEPSRegistration(str urc, str data) {
-  if (!str_equal(urc, s_cereg)) {
-    return false;
-  }
-
-  this->parseEPSRegistrationStatus(data, &last_eps_status.n, &last_eps_status.stat, &last_eps_status.lac,
-                                   &last_eps_status.ci, &last_eps_status.act, &last_eps_status.cause_type,
-                                   &last_eps_status.reject_cause);
+  this->parseEPSRegistrationStatus(data, &last_eps_status);
   if (!this->handler_cereg) {
     LOG(L_INFO,
         "Received URC for CEREG [%.*s]. Set a handler with setHandlerEPSRegistrationURC() if you wish to "
@@ -266,49 +185,26 @@ bool OwlModemNetwork::processURCEPSRegistration(str urc, str data) {
 
 
 
-static str s_edrx      = STRDECL("+CEDRXP");
 static str s_edrx_full = STRDECL("+CEDRXP: ");
 
-void OwlModemNetwork::parseEDRXStatus(str response, edrx_act *out_network, edrx_cycle_length *out_requested_value,
-                                      edrx_cycle_length *out_provided_value,
-                                      edrx_paging_time_window *out_paging_time_window) {
-  int cnt   = 0;
-  str token = {0};
-  if (out_network) *out_network = edrx_act::Unspecified;
-  if (out_requested_value) *out_requested_value = edrx_cycle_length::Unspecified;
-  if (out_provided_value) *out_provided_value = edrx_cycle_length::Unspecified;
-  if (out_paging_time_window) *out_paging_time_window = edrx_paging_time_window::Unspecified;
-
-  str data = response;
+void OwlModemNetwork::parseEDRXStatus(str data, owl_edrx_status_t *out) {
+  using Schema = OwlATSchema<owl_edrx_status_t, AT_INT(&owl_edrx_status_t::network),
+                             AT_BIN(&owl_edrx_status_t::requested_value), AT_BIN(&owl_edrx_status_t::provided_value),
+                             AT_BIN(&owl_edrx_status_t::paging_time_window)>;
+
+  *out = {
+      .network            = edrx_act::Unspecified,
+      .requested_value    = edrx_cycle_length::Unspecified,
+      .provided_value     = edrx_cycle_length::Unspecified,
+      .paging_time_window = edrx_paging_time_window::Unspecified,
+  };
+
   str_skipover_prefix(&data, s_edrx_full);
-  while (str_tok(data, ",", &token)) {
-    switch (cnt) {
-      case 0:
-        if (out_network) *out_network = (edrx_act)str_to_long_int(token, 10);
-        break;
-      case 1:
-        if (out_requested_value) *out_requested_value = (edrx_cycle_length)str_to_uint32_t(token, 2);
-        break;
-      case 2:
-        if (out_provided_value) *out_provided_value = (edrx_cycle_length)str_to_uint32_t(token, 2);
-        break;
-      case 3:
-        if (out_paging_time_window) *out_paging_time_window = (edrx_paging_time_window)str_to_uint32_t(token, 2);
-        break;
-      default:
-        LOG(L_ERR, "Not handled %d(-th) token [%.*s] data was [%.*s]\r\n", cnt, token.len, token.s, data.len, data.s);
-    }
-    cnt++;
-  }
+  Schema::parse(data, out);
 }
 
 bool OwlModemNetwork::processURCEDRXResult(str urc, str data) {
-  if (!str_equal(urc, s_edrx)) {
-    return false;
-  }
-
-  this->parseEDRXStatus(data, &last_edrx_status.network, &last_edrx_status.requested_value,
-                        &last_edrx_status.provided_value, &last_edrx_status.paging_time_window);
+  this->parseEDRXStatus(data, &last_edrx_status);
 
   if (!this->handler_edrx) {
     LOG(L_INFO,
@@ -325,36 +221,20 @@ bool OwlModemNetwork::processURCEDRXResult(str urc, str data) {
 
 
 
-bool OwlModemNetwork::processURC(str urc, str data, void *instance) {
-  OwlModemNetwork *inst = reinterpret_cast<OwlModemNetwork *>(instance);
-
-  return inst->processURCNetworkRegistration(urc, data) || inst->processURCGPRSRegistration(urc, data) ||
-         inst->processURCEPSRegistration(urc, data) || inst->processURCEDRXResult(urc, data);
-}
-
-
-
 static str s_cfun = STRDECL("+CFUN: ");
 
 int OwlModemNetwork::getModemFunctionality(cfun_power_mode *out_power_mode) {
-  if (out_power_mode) *out_power_mode = cfun_power_mode::Minimum_Functionality;
+  struct cfun_t {
+    cfun_power_mode power_mode;
+  };
+  using Schema = OwlATSchema<cfun_t, AT_INT(&cfun_t::power_mode)>;
+
+  cfun_t cfun = {.power_mode = cfun_power_mode::Minimum_Functionality};
+  if (out_power_mode) *out_power_mode = cfun.power_mode;
   int result = atModem_->doCommandBlocking("AT+CFUN?", 15 * 1000, &network_response) == at_result_code::OK;
   if (!result) return 0;
-  OwlModemAT::filterResponse(s_cfun, network_response, &network_response);
-  str token = {0};
-  int cnt   = 0;
-  while (str_tok(network_response, ",\r\n", &token)) {
-    switch (cnt) {
-      case 0:
-        if (out_power_mode) *out_power_mode = (cfun_power_mode)str_to_long_int(token, 10);
-        break;
-      case 1:
-        break;
-      default:
-        LOG(L_ERR, "Not handled %d(-th) token [%.*s]\r\n", cnt, token.len, token.s);
-    }
-    cnt++;
-  }
+  Schema::parseResponse(network_response, s_cfun, &cfun);
+  if (out_power_mode) *out_power_mode = cfun.power_mode;
   return 1;
 }
 
@@ -370,37 +250,35 @@ static str s_cops = STRDECL("+COPS: ");
 
 int OwlModemNetwork::getOperatorSelection(cops_mode *out_mode, cops_format *out_format, str_mut *out_oper,
                                           unsigned int max_oper_len, cops_act *out_act) {
-  int cnt   = 0;
-  str token = {0};
-  if (out_mode) *out_mode = cops_mode::Automatic_Selection;
-  if (out_format) *out_format = cops_format::Long_Alphanumeric;
+  struct cops_t {
+    cops_mode mode;
+    cops_format format;
+    str oper;
+    cops_act act;
+  };
+  using Schema = OwlATSchema<cops_t, AT_INT(&cops_t::mode), AT_INT(&cops_t::format), AT_STR(&cops_t::oper),
+                             AT_INT(&cops_t::act)>;
+
+  cops_t cops = {
+      .mode   = cops_mode::Automatic_Selection,
+      .format = cops_format::Long_Alphanumeric,
+      .oper   = {0},
+      .act    = (cops_act)0,
+  };
+  if (out_mode) *out_mode = cops.mode;
+  if (out_format) *out_format = cops.format;
   if (out_oper) out_oper->len = 0;
-  if (out_act) *out_act = (cops_act)0;
+  if (out_act) *out_act = cops.act;
   int result = atModem_->doCommandBlocking("AT+COPS?", 3 * 60 * 1000, &network_response) == at_result_code::OK;
   if (!result) return 0;
-  OwlModemAT::filterResponse(s_cops, network_response, &network_response);
-  while (str_tok(network_response, ",\r\n", &token)) {
-    switch (cnt) {
-      case 0:
-        if (out_mode) *out_mode = (cops_mode)str_to_long_int(token, 10);
-        break;
-      case 1:
-        if (out_format) *out_format = (cops_format)str_to_long_int(token, 10);
-        break;
-      case 2:
-        if (out_oper) {
-          memcpy(out_oper->s, token.s, token.len > max_oper_len ? max_oper_len : token.len);
-          out_oper->len = token.len;
-        }
-        break;
-      case 3:
-        if (out_act) *out_act = (cops_act)str_to_long_int(token, 10);
-        break;
-      default:
-        LOG(L_ERR, "Not handled %d(-th) token [%.*s]\r\n", cnt, token.len, token.s);
-    }
-    cnt++;
+  Schema::parseResponse(network_response, s_cops, &cops);
+  if (out_mode) *out_mode = cops.mode;
+  if (out_format) *out_format = cops.format;
+  if (out_oper) {
+    out_oper->len = cops.oper.len > max_oper_len ? max_oper_len : cops.oper.len;
+    memcpy(out_oper->s, cops.oper.s, out_oper->len);
   }
+  if (out_act) *out_act = cops.act;
   return 1;
 }
 
@@ -527,26 +405,20 @@ void OwlModemNetwork::setHandlerEPSRegistrationURC(OwlModem_EPSRegistrationStatu
 static str s_csq = STRDECL("+CSQ: ");
 
 int OwlModemNetwork::getSignalQuality(csq_rssi *out_rssi, csq_qual *out_qual) {
-  int cnt   = 0;
-  str token = {0};
-  if (out_rssi) *out_rssi = csq_rssi::Not_Known_or_Detectable_99;
-  if (out_qual) *out_qual = csq_qual::Not_Known_or_Not_Detectable;
+  struct csq_t {
+    csq_rssi rssi;
+    csq_qual qual;
+  };
+  using Schema = OwlATSchema<csq_t, AT_INT(&csq_t::rssi), AT_INT(&csq_t::qual)>;
+
+  csq_t csq = {.rssi = csq_rssi::Not_Known_or_Detectable_99, .qual = csq_qual::Not_Known_or_Not_Detectable};
+  if (out_rssi) *out_rssi = csq.rssi;
+  if (out_qual) *out_qual = csq.qual;
   int result = atModem_->doCommandBlocking("AT+CSQ", 1000, &network_response) == at_result_code::OK;
   if (!result) return 0;
-  OwlModemAT::filterResponse(s_csq, network_response, &network_response);
-  while (str_tok(network_response, ",", &token)) {
-    switch (cnt) {
-      case 0:
-        if (out_rssi) *out_rssi = (csq_rssi)str_to_long_int(token, 10);
-        break;
-      case 1:
-        if (out_qual) *out_qual = (csq_qual)str_to_long_int(token, 10);
-        break;
-      default:
-        LOG(L_ERR, "Not handled %d(-th) token [%.*s]\r\n", cnt, token.len, token.s);
-    }
-    cnt++;
-  }
+  Schema::parseResponse(network_response, s_csq, &csq);
+  if (out_rssi) *out_rssi = csq.rssi;
+  if (out_qual) *out_qual = csq.qual;
   return 1;
 }
 
@@ -79,15 +79,7 @@ typedef void (*OwlModem_EDRXStatusChangeHandler_f)(edrx_act network, edrx_cycle_
  */
 class OwlModemNetwork {
  public:
-  OwlModemNetwork(OwlModemAT *atModem);
-
-  /**
-   * Handler for Unsolicited Response Codes from the modem - called from OwlModem on timer, when URC is received
-   * @param urc - event id
-   * @param data - data of the event
-   * @return if the line was handled
-   */
-  static bool processURC(str urc, str data, void *instance);
+  OwlModemNetwork(OwlModemATBase *atModem);
 
 
 
@@ -109,8 +101,8 @@ class OwlModemNetwork {
    * Retrieve the current Operator Selection Mode and selected Operator, Radio Access Technology
    * @param out_mode - output current mode
    * @param out_format - output format of the following operator string
-   * @param out_oper - output operator string
-   * @param max_oper_len - buffer length provided in the operator string
+   * @param out_oper - output operator string, without the surrounding quotes. Empty if no operator is selected
+   * @param max_oper_len - buffer length provided in the operator string, longer names are truncated to it
    * @param out_act - output radio access technology type
    * @return 1 on success, 0 on failure
    */
@@ -291,7 +283,7 @@ class OwlModemNetwork {
 
 
  private:
-  OwlModemAT *atModem_ = 0;
+  OwlModemATBase *atModem_ = 0;
 
   str network_response = {.s = nullptr, .len = 0};
 
@@ -305,17 +297,6 @@ class OwlModemNetwork {
   bool processURCEPSRegistration(str urc, str data);
   bool processURCEDRXResult(str urc, str data);
 
-
-  void parseNetworkRegistrationStatus(str response, creg_n *out_n, creg_stat *out_stat, uint16_t *out_lac,
-                                      uint32_t *out_ci, creg_act *out_act);
-  void parseGPRSRegistrationStatus(str response, cgreg_n *out_n, cgreg_stat *out_stat, uint16_t *out_lac,
-                                   uint32_t *out_ci, cgreg_act *out_act, uint8_t *out_rac);
-  void parseEPSRegistrationStatus(str response, cereg_n *out_n, cereg_stat *out_stat, uint16_t *out_lac,
-                                  uint32_t *out_ci, cereg_act *out_act, cereg_cause_type *out_cause_type,
-                                  uint32_t *out_reject_cause);
-  void parseEDRXStatus(str response, edrx_act *out_network, edrx_cycle_length *out_requested_value,
-                       edrx_cycle_length *out_provided_value, edrx_paging_time_window *out_paging_time_window);
-
   typedef struct {
     creg_n n;
     creg_stat stat;
@@ -383,6 +364,11 @@ class OwlModemNetwork {
       .provided_value     = edrx_cycle_length::Unspecified,
       .paging_time_window = edrx_paging_time_window::Unspecified,
   };
+
+  void parseNetworkRegistrationStatus(str data, owl_network_status_t *out);
+  void parseGPRSRegistrationStatus(str data, owl_last_gprs_status_t *out);
+  void parseEPSRegistrationStatus(str data, owl_last_eps_status_t *out);
+  void parseEDRXStatus(str data, owl_edrx_status_t *out);
 };
 
 #endif
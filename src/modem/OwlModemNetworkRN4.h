@@ -33,7 +33,7 @@
  */
 class OwlModemNetworkRN4 {
  public:
-  OwlModemNetworkRN4(OwlModemAT *atModem);
+  OwlModemNetworkRN4(OwlModemATBase *atModem);
 
   /**
    * Retrieve the current modem MNO profile selection.
@@ -50,7 +50,7 @@ class OwlModemNetworkRN4 {
   int setModemMNOProfile(umnoprof_mno_profile profile);
 
  private:
-  OwlModemAT *atModem_ = 0;
+  OwlModemATBase *atModem_ = 0;
 
   str network_response = {.s = nullptr, .len = 0};
 };
@@ -26,12 +26,14 @@
 #include <stdio.h>
 
 
-OwlModemPDN::OwlModemPDN(OwlModemAT *atModem) : atModem_(atModem) {
+OwlModemPDN::OwlModemPDN(OwlModemATBase *atModem) : atModem_(atModem) {
 }
 
 
 
-static str s_cgpaddr = STRDECL("+CGPADDR: ");
+static str s_cgpaddr                         = STRDECL("+CGPADDR: ");
+static constexpr str_sepset s_cgpaddr_fields = str_sepset_make(",\r\n");
+static constexpr str_sepset s_address_quotes = str_sepset_make(" \"");
 
 int OwlModemPDN::getAPNIPAddress(uint8_t cid, uint8_t ipv4[4], uint8_t ipv6[16]) {
   int cnt   = 0;
@@ -42,7 +44,7 @@ int OwlModemPDN::getAPNIPAddress(uint8_t cid, uint8_t ipv4[4], uint8_t ipv6[16])
   int result = atModem_->doCommandBlocking(3000, &pdn_response) == at_result_code::OK;
   if (!result) return 0;
   OwlModemAT::filterResponse(s_cgpaddr, pdn_response, &pdn_response);
-  while (str_tok(pdn_response, ",\r\n", &token)) {
+  while (str_tok_set(pdn_response, &s_cgpaddr_fields, &token)) {
     str token_ip = {0};
     switch (cnt) {
       case 0:
@@ -50,7 +52,7 @@ int OwlModemPDN::getAPNIPAddress(uint8_t cid, uint8_t ipv4[4], uint8_t ipv6[16])
         break;
       case 1:
       case 2:
-        while (str_tok(token, " \"", &token_ip)) {
+        while (str_tok_set(token, &s_address_quotes, &token_ip)) {
           if (token_ip.len <= 15) {
             /* IPv4 */
             int digit        = 0;
@@ -32,7 +32,7 @@
  */
 class OwlModemPDN {
  public:
-  OwlModemPDN(OwlModemAT *atModem);
+  OwlModemPDN(OwlModemATBase *atModem);
 
 
   // TODO
@@ -62,7 +62,7 @@ class OwlModemPDN {
 
 
  private:
-  OwlModemAT *atModem_ = 0;
+  OwlModemATBase *atModem_ = 0;
 
   str pdn_response = {.s = nullptr, .len = 0};
 };
@@ -220,8 +220,8 @@ int OwlModemRN4::initModem(int testing_variant, const char *apn, const char *cop
   }
   SIM.setHandlerPIN(saved_handler);
 
-  if (AT.doCommandBlocking("AT+UDCONF=1,1", 1000, nullptr) != at_result_code::OK) {
-    LOG(L_WARN, "Potential error setting ublox HEX mode for socket ops send/receive\r\n");
+  if (!socket.setDataMode(socket.getDataMode())) {
+    LOG(L_WARN, "Potential error setting ublox data mode for socket ops send/receive\r\n");
   }
 
   LOG(L_DBG, "Modem correctly initialized\r\n");
@@ -25,17 +25,13 @@
 
 #include <stdio.h>
 
-static char URC_ID[] = "SIM";
-OwlModemSIM::OwlModemSIM(OwlModemAT *atModem) : atModem_(atModem) {
+OwlModemSIM::OwlModemSIM(OwlModemATBase *atModem) : atModem_(atModem) {
   if (atModem_ != nullptr) {
-    atModem_->registerUrcHandler(URC_ID, OwlModemSIM::processURC, this);
+    atModem_->registerUrcNameHandler("+CPIN", OwlModemAT::urcMethod<OwlModemSIM, &OwlModemSIM::handleCPIN>, this);
   }
 }
 
-static str s_cpin = {.s = "+CPIN", .len = 5};
-
-int OwlModemSIM::handleCPIN(str urc, str data) {
-  if (!str_equal(urc, s_cpin)) return 0;
+bool OwlModemSIM::handleCPIN(str urc, str data) {
   if (!this->handler_cpin) {
     LOG(L_NOTICE,
         "Received URC for PIN [%.*s]. Set a handler with setHandlerPIN() if you wish to receive this event "
@@ -44,16 +40,9 @@ int OwlModemSIM::handleCPIN(str urc, str data) {
   } else {
     (this->handler_cpin)(data);
   }
-  return 1;
+  return true;
 }
 
-bool OwlModemSIM::processURC(str urc, str data, void *instance) {
-  OwlModemSIM *inst = reinterpret_cast<OwlModemSIM *>(instance);
-  if (inst->handleCPIN(urc, data)) return true;
-  return false;
-}
-
-
 static str s_ccid = STRDECL("+CCID: ");
 
 int OwlModemSIM::getICCID(str *out_response) {
@@ -40,15 +40,7 @@ typedef void (*OwlModem_PINHandler_f)(str message);
  */
 class OwlModemSIM {
  public:
-  OwlModemSIM(OwlModemAT *atModem);
-
-  /**
-   * Handler for Unsolicited Response Codes from the modem - called from OwlModem on timer, when URC is received
-   * @param urc - event id
-   * @param data - data of the event
-   * @return true if the line was handled, false if no match here
-   */
-  static bool processURC(str urc, str data, void *instance);
+  OwlModemSIM(OwlModemATBase *atModem);
 
 
 
@@ -87,9 +79,9 @@ class OwlModemSIM {
   OwlModem_PINHandler_f handler_cpin = 0;
 
  private:
-  OwlModemAT *atModem_ = 0;
+  OwlModemATBase *atModem_ = 0;
 
-  int handleCPIN(str urc, str data);
+  bool handleCPIN(str urc, str data);
 };
 
 #endif
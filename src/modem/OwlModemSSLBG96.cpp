@@ -1,7 +1,7 @@
 #include "OwlModemSSLBG96.h"
 #include <stdio.h>
 
-OwlModemSSLBG96::OwlModemSSLBG96(OwlModemAT* atModem) : atModem_(atModem) {
+OwlModemSSLBG96::OwlModemSSLBG96(OwlModemATBase* atModem) : atModem_(atModem) {
 }
 
 bool OwlModemSSLBG96::initContext() {
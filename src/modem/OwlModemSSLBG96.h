@@ -30,7 +30,7 @@
 
 class OwlModemSSLBG96 {
  public:
-  OwlModemSSLBG96(OwlModemAT* atModem);
+  OwlModemSSLBG96(OwlModemATBase* atModem);
 
   bool setDeviceCert(str cert, bool force = false);
   bool setDevicePkey(str pkey, bool force = false);
@@ -39,7 +39,7 @@ class OwlModemSSLBG96 {
   bool initContext();
 
  private:
-  OwlModemAT* atModem_;
+  OwlModemATBase* atModem_;
   str ssl_response = {.s = nullptr, .len = 0};
 };
 
@@ -4,7 +4,7 @@
 #include "../utils/md5.h"
 #include "../utils/base64.h"
 
-OwlModemSSLRN4::OwlModemSSLRN4(OwlModemAT *atModem) : atModem_(atModem) {
+OwlModemSSLRN4::OwlModemSSLRN4(OwlModemATBase *atModem) : atModem_(atModem) {
 }
 
 static str s_ca_name   = STRDECL("CA");
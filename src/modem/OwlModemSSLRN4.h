@@ -31,7 +31,7 @@
 
 class OwlModemSSLRN4 {
  public:
-  OwlModemSSLRN4(OwlModemAT* atModem);
+  OwlModemSSLRN4(OwlModemATBase* atModem);
 
   /**
    * Populate a device certificate to the TLS system on a SARA-R410/SARA-N410 modem.
@@ -111,7 +111,7 @@ class OwlModemSSLRN4 {
                    usecprf_cipher_suite_e cipher_suite = USECPREF_CIPHER_SUITE_TLS_RSA_WITH_AES_256_CBC_SHA256);
 
  private:
-  OwlModemAT* atModem_;
+  OwlModemATBase* atModem_;
   str ssl_response   = {.s = nullptr, .len = 0};
   bool hasDeviceCert = false;
   bool hasDevicePkey = false;
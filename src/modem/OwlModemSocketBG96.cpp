@@ -0,0 +1,67 @@
+/*
+ * OwlModemSocketBG96.cpp
+ * Twilio Breakout SDK
+ *
+ * Copyright (c) 2018 Twilio, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file OwlModemSocketBG96.cpp - API for TCP/UDP sockets in transparent access mode on Quectel BG96 modems
+ */
+
+#include "OwlModemSocketBG96.h"
+
+OwlModemSocketBG96::OwlModemSocketBG96(OwlModemATBase* atModem) : atModem_(atModem) {
+}
+
+bool OwlModemSocketBG96::openTransparent(uint8_t connect_id, uso_protocol protocol, str remote_host,
+                                         uint16_t remote_port, uint16_t local_port, uint8_t context_id) {
+  if (connect_id >= BG96_MAX_SOCKETS) {
+    LOG(L_ERR, "Bad socket %d >= %d\r\n", connect_id, BG96_MAX_SOCKETS);
+    return false;
+  }
+
+  const char* service;
+  switch (protocol) {
+    case uso_protocol::TCP:
+      service = "TCP";
+      break;
+    case uso_protocol::UDP:
+      service = "UDP";
+      break;
+    default:
+      LOG(L_ERR, "Unsupported protocol %d\r\n", (int)protocol);
+      return false;
+  }
+
+  // The connection result comes as CONNECT or ERROR in transparent access mode, not as +QIOPEN
+  atModem_->commandSprintf("AT+QIOPEN=%u,%u,\"%s\",\"%.*s\",%u,%u,2", context_id, connect_id, service,
+                           remote_host.len, remote_host.s, remote_port, local_port);
+  return atModem_->enterDataMode(150 * 1000, &socket_response_);
+}
+
+bool OwlModemSocketBG96::suspend(owl_time_t guard_ms) {
+  return atModem_->exitDataMode(guard_ms);
+}
+
+bool OwlModemSocketBG96::resume() {
+  atModem_->commandStrcpy("ATO");
+  return atModem_->enterDataMode(5 * 1000, &socket_response_);
+}
+
+bool OwlModemSocketBG96::close(uint8_t connect_id) {
+  atModem_->commandSprintf("AT+QICLOSE=%u", connect_id);
+  return atModem_->doCommandBlocking(10 * 1000, &socket_response_) == at_result_code::OK;
+}
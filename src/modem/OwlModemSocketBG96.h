@@ -0,0 +1,79 @@
+/*
+ * OwlModemSocketBG96.h
+ * Twilio Breakout SDK
+ *
+ * Copyright (c) 2018 Twilio, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file OwlModemSocketBG96.h - API for TCP/UDP sockets in transparent access mode on Quectel BG96 modems
+ */
+
+#ifndef __OWL_MODEM_SOCKET_BG96_H__
+#define __OWL_MODEM_SOCKET_BG96_H__
+
+#include "enums.h"
+
+#include "OwlModemAT.h"
+
+#define BG96_MAX_SOCKETS 12
+
+/*
+ * Sockets in transparent access mode: while open, the serial line is a byte pipe to the socket, moved with
+ * OwlModemATBase::dataRead() and dataWrite(). No commands or URCs go through until the pipe is suspended.
+ */
+class OwlModemSocketBG96 {
+ public:
+  OwlModemSocketBG96(OwlModemATBase* atModem);
+
+  /**
+   * Open a socket in transparent access mode (AT+QIOPEN with access mode 2) and switch to the byte pipe
+   * @param connect_id - socket id, 0 to BG96_MAX_SOCKETS - 1
+   * @param protocol - TCP or UDP
+   * @param remote_host - remote IP or domain name
+   * @param remote_port - remote port
+   * @param local_port - local port to bind to, 0 to pick one automatically
+   * @param context_id - PDP context to use
+   * @return true if the socket is connected and the modem is in data mode
+   */
+  bool openTransparent(uint8_t connect_id, uso_protocol protocol, str remote_host, uint16_t remote_port,
+                       uint16_t local_port = 0, uint8_t context_id = 1);
+
+  /**
+   * Suspend the byte pipe with the "+++" escape sequence. The connection stays open, resume() goes back to it.
+   * @param guard_ms - silence required around the escape sequence
+   * @return true if the modem is back in command mode
+   */
+  bool suspend(owl_time_t guard_ms = AT_DATA_MODE_GUARD_TIME);
+
+  /**
+   * Go back to the byte pipe of the socket left with suspend() (ATO)
+   * @return true if the modem is in data mode again
+   */
+  bool resume();
+
+  /**
+   * Close a socket (AT+QICLOSE). Call suspend() first if the byte pipe is active.
+   * @param connect_id - socket id
+   * @return success status
+   */
+  bool close(uint8_t connect_id);
+
+ private:
+  OwlModemATBase* atModem_;
+  str socket_response_ = {.s = nullptr, .len = 0};
+};
+
+#endif  // __OWL_MODEM_SOCKET_BG96_H__
@@ -22,9 +22,43 @@
  */
 
 #include "OwlModemSocketRN4.h"
+#include "OwlModemATSchema.h"
 
 #include <stdio.h>
 
+/* <socket>,<value> - the +UUSOCO, +UUSORD and +UUSORF URCs and the +USOWR, +USOST, +USORD and +USORF responses */
+struct uso_socket_value_t {
+  uint8_t socket;
+  int value;
+};
+using SocketValueSchema =
+    OwlATSchema<uso_socket_value_t, AT_INT(&uso_socket_value_t::socket), AT_INT(&uso_socket_value_t::value)>;
+
+/* <socket>,<remote_ip>,<remote_port>,<listening_socket>,<local_ip>,<local_port> - the +UUSOLI URC */
+struct uso_accept_t {
+  uint8_t new_socket;
+  str remote_ip;
+  uint16_t remote_port;
+  uint8_t listening_socket;
+  str local_ip;
+  uint16_t local_port;
+};
+using AcceptSchema =
+    OwlATSchema<uso_accept_t, AT_INT(&uso_accept_t::new_socket), AT_STR(&uso_accept_t::remote_ip),
+                AT_INT(&uso_accept_t::remote_port), AT_INT(&uso_accept_t::listening_socket),
+                AT_STR(&uso_accept_t::local_ip), AT_INT(&uso_accept_t::local_port)>;
+
+/* <socket>,<remote_ip>,<remote_port>,<length> - the +USORF payload header */
+struct uso_receive_from_t {
+  uint8_t socket;
+  str remote_ip;
+  uint16_t remote_port;
+  int len;
+};
+using ReceiveFromSchema =
+    OwlATSchema<uso_receive_from_t, AT_INT(&uso_receive_from_t::socket), AT_STR(&uso_receive_from_t::remote_ip),
+                AT_INT(&uso_receive_from_t::remote_port), AT_INT(&uso_receive_from_t::len)>;
+
 void OwlModemSocketRN4Status::setOpened(uso_protocol proto) {
   is_opened    = 1;
   is_connected = 0;
@@ -34,6 +68,10 @@ void OwlModemSocketRN4Status::setOpened(uso_protocol proto) {
 
   protocol = proto;
 
+  owl_ring_init(&rx_ring, nullptr, 0);
+  rx_read_queued     = false;
+  rx_read_retry_time = 0;
+
   handler_UDPData      = nullptr;
   handler_TCPData      = nullptr;
   handler_TCPAccept    = nullptr;
@@ -56,39 +94,68 @@ void OwlModemSocketRN4Status::setClosed() {
   handler_SocketClosed = nullptr;
 }
 
-static char URC_ID[] = "Socket";
-OwlModemSocketRN4::OwlModemSocketRN4(OwlModemAT *atModem) : atModem_(atModem) {
-  for (uint8_t socket = 0; socket < MODEM_MAX_SOCKETS; socket++)
+OwlModemSocketRN4::OwlModemSocketRN4(OwlModemATBase *atModem) : atModem_(atModem) {
+  for (uint8_t socket = 0; socket < MODEM_MAX_SOCKETS; socket++) {
     status[socket].setClosed();
+    streams_[socket] = {.owner          = this,
+                        .socket         = socket,
+                        .buffers        = nullptr,
+                        .count          = 0,
+                        .written_index  = 0,
+                        .written_offset = 0,
+                        .queued_index   = 0,
+                        .queued_offset  = 0,
+                        .in_flight      = 0,
+                        .bytes_sent     = 0,
+                        .handler        = nullptr,
+                        .handler_priv   = nullptr};
+    receive_refs_[socket] = {.owner = this, .socket = socket};
+  }
 
   if (atModem_ != nullptr) {
-    atModem_->registerUrcHandler(URC_ID, OwlModemSocketRN4::processURC, this);
+    atModem_->registerUrcNameHandler(
+        "+UUSORF", OwlModemAT::urcMethod<OwlModemSocketRN4, &OwlModemSocketRN4::processURCReceiveFrom>, this);
+    atModem_->registerUrcNameHandler(
+        "+UUSORD", OwlModemAT::urcMethod<OwlModemSocketRN4, &OwlModemSocketRN4::processURCReceive>, this);
+    atModem_->registerUrcNameHandler(
+        "+UUSOLI", OwlModemAT::urcMethod<OwlModemSocketRN4, &OwlModemSocketRN4::processURCTCPAccept>, this);
+    atModem_->registerUrcNameHandler(
+        "+UUSOCO", OwlModemAT::urcMethod<OwlModemSocketRN4, &OwlModemSocketRN4::processURCConnected>, this);
+    atModem_->registerUrcNameHandler(
+        "+UUSOCL", OwlModemAT::urcMethod<OwlModemSocketRN4, &OwlModemSocketRN4::processURCClosed>, this);
+    registerPayloadLines();
+  }
+}
+
+void OwlModemSocketRN4::registerPayloadLines() {
+  if (data_mode_ == uso_data_mode::Binary) {
+    // Raw bytes may contain line ends, they are delimited by the length field instead
+    atModem_->registerPayloadLine("+USORD: ", 2, false, OwlModemSocketRN4::processPayloadReceive, this, 1);
+    atModem_->registerPayloadLine("+USORF: ", 4, false, OwlModemSocketRN4::processPayloadReceiveFrom, this, 3);
+  } else {
+    atModem_->registerPayloadLine("+USORD: ", 2, true, OwlModemSocketRN4::processPayloadReceive, this);
+    atModem_->registerPayloadLine("+USORF: ", 4, true, OwlModemSocketRN4::processPayloadReceiveFrom, this);
   }
 }
 
+int OwlModemSocketRN4::setDataMode(uso_data_mode mode) {
+  atModem_->commandSprintf("AT+UDCONF=1,%d", mode);
+  if (atModem_->doCommandBlocking(1000, nullptr) != at_result_code::OK) {
+    return 0;
+  }
+
+  data_mode_ = mode;
+  registerPayloadLines();
+  return 1;
+}
 
 
-static str s_uusoco = STRDECL("+UUSOCO");
 
 bool OwlModemSocketRN4::processURCConnected(str urc, str data) {
-  if (!str_equal(urc, s_uusoco)) {
-    return false;
-  }
-  str token        = {0};
-  uint8_t socket   = 0;
-  int socket_error = 0;
-  for (int i = 0; str_tok(data, ",", &token); i++) {
-    switch (i) {
-      case 0:
-        socket = str_to_uint32_t(token, 10);
-        break;
-      case 1:
-        socket_error = str_to_long_int(token, 10);
-        break;
-      default:
-        break;
-    }
-  }
+  uso_socket_value_t params = {.socket = 0, .value = 0};
+  SocketValueSchema::parse(data, &params);
+  uint8_t socket   = params.socket;
+  int socket_error = params.value;
   if (socket >= MODEM_MAX_SOCKETS) {
     LOG(L_ERR, "Bad socket %d >= %d\r\n", socket, MODEM_MAX_SOCKETS);
   } else {
@@ -104,23 +171,10 @@ bool OwlModemSocketRN4::processURCConnected(str urc, str data) {
 }
 
 
-static str s_uusocl = STRDECL("+UUSOCL");
-
 bool OwlModemSocketRN4::processURCClosed(str urc, str data) {
-  if (!str_equal(urc, s_uusocl)) {
-    return false;
-  }
-  str token      = {0};
-  uint8_t socket = 0;
-  for (int i = 0; str_tok(data, ",", &token); i++) {
-    switch (i) {
-      case 0:
-        socket = str_to_uint32_t(token, 10);
-        break;
-      default:
-        break;
-    }
-  }
+  uso_socket_value_t params = {.socket = 0, .value = 0};
+  SocketValueSchema::parse(data, &params);
+  uint8_t socket = params.socket;
   if (socket >= MODEM_MAX_SOCKETS) {
     LOG(L_ERR, "handleClosed()  Bad socket %d >= %d\r\n", socket, MODEM_MAX_SOCKETS);
   } else {
@@ -137,52 +191,15 @@ bool OwlModemSocketRN4::processURCClosed(str urc, str data) {
 }
 
 
-static str s_uusoli = STRDECL("+UUSOLI");
-
 bool OwlModemSocketRN4::processURCTCPAccept(str urc, str data) {
-  if (!str_equal(urc, s_uusoli)) {
-    return false;
-  }
-
-  str token                = {0};
-  uint8_t new_socket       = 0;
-  str remote_ip            = {0};
-  uint16_t remote_port     = 0;
-  uint8_t listening_socket = 0;
-  str local_ip             = {0};
-  uint16_t local_port      = 0;
-  for (int i = 0; str_tok(data, ",", &token); i++) {
-    switch (i) {
-      case 0:
-        new_socket = str_to_uint32_t(token, 10);
-        break;
-      case 1:
-        remote_ip = token;
-        if (remote_ip.len >= 2 && remote_ip.s[0] == '\"' && remote_ip.s[remote_ip.len - 1] == '\"') {
-          remote_ip.s += 1;
-          remote_ip.len -= 2;
-        }
-        break;
-      case 2:
-        remote_port = (uint16_t)str_to_uint32_t(token, 10);
-        break;
-      case 3:
-        listening_socket = str_to_uint32_t(token, 10);
-        break;
-      case 4:
-        local_ip = token;
-        if (local_ip.len >= 2 && local_ip.s[0] == '\"' && local_ip.s[local_ip.len - 1] == '\"') {
-          local_ip.s += 1;
-          local_ip.len -= 2;
-        }
-        break;
-      case 5:
-        local_port = (uint16_t)str_to_uint32_t(token, 10);
-        break;
-      default:
-        break;
-    }
-  }
+  uso_accept_t params = {0};
+  AcceptSchema::parse(data, &params);
+  uint8_t new_socket       = params.new_socket;
+  str remote_ip            = params.remote_ip;
+  uint16_t remote_port     = params.remote_port;
+  uint8_t listening_socket = params.listening_socket;
+  str local_ip             = params.local_ip;
+  uint16_t local_port      = params.local_port;
   if (new_socket >= MODEM_MAX_SOCKETS) {
     LOG(L_ERR, "Bad new_socket %d >= %d\r\n", new_socket, MODEM_MAX_SOCKETS);
   } else if (listening_socket >= MODEM_MAX_SOCKETS) {
@@ -210,28 +227,11 @@ bool OwlModemSocketRN4::processURCTCPAccept(str urc, str data) {
 }
 
 
-static str s_uusord = STRDECL("+UUSORD");
-
 bool OwlModemSocketRN4::processURCReceive(str urc, str data) {
-  if (!str_equal(urc, s_uusord)) {
-    return false;
-  }
-
-  str token      = {0};
-  uint8_t socket = 0;
-  uint16_t len   = 0;
-  for (int i = 0; str_tok(data, ",", &token); i++) {
-    switch (i) {
-      case 0:
-        socket = str_to_uint32_t(token, 10);
-        break;
-      case 1:
-        len = str_to_uint32_t(token, 10);
-        break;
-      default:
-        break;
-    }
-  }
+  uso_socket_value_t params = {.socket = 0, .value = 0};
+  SocketValueSchema::parse(data, &params);
+  uint8_t socket = params.socket;
+  uint16_t len   = params.value;
   if (socket >= MODEM_MAX_SOCKETS) {
     LOG(L_ERR, "Bad socket %d >= %d\r\n", socket, MODEM_MAX_SOCKETS);
   } else {
@@ -240,33 +240,17 @@ bool OwlModemSocketRN4::processURCReceive(str urc, str data) {
     }
     this->status[socket].len_outstanding_receive_data = len;
     LOG(L_INFO, "Receive URC for queued received data on socket %d of %d bytes\r\n", socket, len);
+    scheduleBufferedRead(socket);
   }
   return true;
 }
 
 
-static str s_uusorf = STRDECL("+UUSORF");
-
 bool OwlModemSocketRN4::processURCReceiveFrom(str urc, str data) {
-  if (!str_equal(urc, s_uusorf)) {
-    return false;
-  }
-
-  str token      = {0};
-  uint8_t socket = 0;
-  uint16_t len   = 0;
-  for (int i = 0; str_tok(data, ",", &token); i++) {
-    switch (i) {
-      case 0:
-        socket = str_to_uint32_t(token, 10);
-        break;
-      case 1:
-        len = str_to_uint32_t(token, 10);
-        break;
-      default:
-        break;
-    }
-  }
+  uso_socket_value_t params = {.socket = 0, .value = 0};
+  SocketValueSchema::parse(data, &params);
+  uint8_t socket = params.socket;
+  uint16_t len   = params.value;
   if (socket >= MODEM_MAX_SOCKETS) {
     LOG(L_ERR, "Bad socket %d >= %d\r\n", socket, MODEM_MAX_SOCKETS);
   } else {
@@ -277,17 +261,6 @@ bool OwlModemSocketRN4::processURCReceiveFrom(str urc, str data) {
 }
 
 
-bool OwlModemSocketRN4::processURC(str urc, str data, void *instance) {
-  OwlModemSocketRN4 *inst = reinterpret_cast<OwlModemSocketRN4 *>(instance);
-
-  /* ordered based on the expected frequency of arrival */
-  return inst->processURCReceiveFrom(urc, data) || inst->processURCReceive(urc, data) ||
-         inst->processURCTCPAccept(urc, data) || inst->processURCConnected(urc, data) ||
-         inst->processURCClosed(urc, data);
-}
-
-
-
 void OwlModemSocketRN4::handleWaitingData() {
   LOG(L_MEM, "Starting handleWaitingData\r\n");
 
@@ -297,6 +270,11 @@ void OwlModemSocketRN4::handleWaitingData() {
   int data_len         = 0;
 
   for (uint8_t socket = 0; socket < MODEM_MAX_SOCKETS; socket++) {
+    /* Send stream stalled on a full command queue */
+    if (streams_[socket].buffers != nullptr && streams_[socket].in_flight == 0) {
+      pumpStream(&streams_[socket]);
+    }
+
     /* Receive-From - UDP */
     if (status[socket].len_outstanding_receivefrom_data) {
       remote_ip.len = 0;
@@ -324,8 +302,11 @@ void OwlModemSocketRN4::handleWaitingData() {
       }
     }
 
-    /* Receive - UDP or TCP */
-    if (status[socket].len_outstanding_receive_data) {
+    /* Receive ring read that could not be queued or failed earlier */
+    scheduleBufferedRead(socket);
+
+    /* Receive - UDP or TCP, unless the data goes to the receive ring */
+    if (status[socket].len_outstanding_receive_data && status[socket].rx_ring.size == 0) {
       remote_ip.len = 0;
       remote_port   = 0;
       switch (status[socket].protocol) {
@@ -415,6 +396,10 @@ int OwlModemSocketRN4::close(uint8_t socket) {
   int result = (atModem_->doCommandBlocking(120 * 1000, nullptr) == at_result_code::OK);
   if (!result) return 0;
 
+  // The queued writes of a send stream went out before the close, anything left can't be sent anymore
+  if (streams_[socket].buffers != nullptr) {
+    finishStream(&streams_[socket], false);
+  }
   this->status[socket].setClosed();
 
   return result;
@@ -488,28 +473,42 @@ int OwlModemSocketRN4::connect(uint8_t socket, str remote_ip, uint16_t remote_po
   return result;
 }
 
+int OwlModemSocketRN4::openDirectLink(uint8_t socket) {
+  if (socket >= MODEM_MAX_SOCKETS) {
+    LOG(L_ERR, "Bad socket %d >= %d\r\n", socket, MODEM_MAX_SOCKETS);
+    return 0;
+  }
+  if (!this->status[socket].is_connected) {
+    LOG(L_ERR, "Socket %d is not connected\r\n", socket);
+    return 0;
+  }
+  atModem_->commandSprintf("AT+USODL=%u", socket);
+  return atModem_->enterDataMode(10 * 1000, &socket_response);
+}
+
+int OwlModemSocketRN4::closeDirectLink(owl_time_t guard_ms) {
+  return atModem_->exitDataMode(guard_ms);
+}
+
 static str s_usowr = STRDECL("+USOWR: ");
 
 int OwlModemSocketRN4::send(uint8_t socket, str data) {
   int bytes_sent = 0;
-  atModem_->commandSprintf("AT+USOWR=%u,%d,\"", socket, data.len);
-  atModem_->commandAppendHex(data);
-  atModem_->commandStrcat("\"");
-  int result = atModem_->doCommandBlocking(120 * 1000, &socket_response) == at_result_code::OK;
+  int result;
+  if (data_mode_ == uso_data_mode::Binary) {
+    // The raw data follows the '@' prompt
+    atModem_->commandSprintf("AT+USOWR=%u,%d", socket, data.len);
+    result = atModem_->doCommandBlocking(120 * 1000, &socket_response, data) == at_result_code::OK;
+  } else {
+    atModem_->commandSprintf("AT+USOWR=%u,%d,\"", socket, data.len);
+    atModem_->commandAppendRef(data, true);
+    atModem_->commandStrcat("\"");
+    result = atModem_->doCommandBlocking(120 * 1000, &socket_response) == at_result_code::OK;
+  }
   if (!result) return -1;
-  OwlModemAT::filterResponse(s_usowr, socket_response, &socket_response);
-  str token = {0};
-  for (int i = 0; str_tok(socket_response, ",\r\n", &token); i++)
-    switch (i) {
-      case 0:
-        // socket
-        break;
-      case 1:
-        bytes_sent = str_to_long_int(token, 10);
-        break;
-      default:
-        break;
-    }
+  uso_socket_value_t params = {.socket = socket, .value = 0};
+  SocketValueSchema::parseResponse(socket_response, s_usowr, &params);
+  bytes_sent = params.value;
   return bytes_sent;
 }
 
@@ -518,8 +517,8 @@ int OwlModemSocketRN4::sendUDP(uint8_t socket, str data, int *out_bytes_sent) {
     LOG(L_ERR, "Bad socket %d >= %d\r\n", socket, MODEM_MAX_SOCKETS);
     return 0;
   }
-  if (data.len > 512) {
-    LOG(L_ERR, "Too much data %d > max 512 bytes\r\n", data.len);
+  if (data.len > maxDataLen()) {
+    LOG(L_ERR, "Too much data %d > max %u bytes\r\n", data.len, maxDataLen());
     return 0;
   }
   if (!this->status[socket].is_opened) {
@@ -545,8 +544,8 @@ int OwlModemSocketRN4::sendTCP(uint8_t socket, str data, int *out_bytes_sent) {
     LOG(L_ERR, "Bad socket %d >= %d\r\n", socket, MODEM_MAX_SOCKETS);
     return 0;
   }
-  if (data.len > 512) {
-    LOG(L_ERR, "Too much data %d > max 512 bytes\r\n", data.len);
+  if (data.len > maxDataLen()) {
+    LOG(L_ERR, "Too much data %d > max %u bytes\r\n", data.len, maxDataLen());
     return 0;
   }
   if (!this->status[socket].is_opened) {
@@ -575,8 +574,8 @@ int OwlModemSocketRN4::sendToUDP(uint8_t socket, str remote_ip, uint16_t remote_
     LOG(L_ERR, "Bad socket %d >= %d\r\n", socket, MODEM_MAX_SOCKETS);
     return 0;
   }
-  if (data.len > 512) {
-    LOG(L_ERR, "Too much data %d > max 512 bytes\r\n", data.len);
+  if (data.len > maxDataLen()) {
+    LOG(L_ERR, "Too much data %d > max %u bytes\r\n", data.len, maxDataLen());
     return 0;
   }
   if (!this->status[socket].is_opened) {
@@ -587,28 +586,205 @@ int OwlModemSocketRN4::sendToUDP(uint8_t socket, str remote_ip, uint16_t remote_
     LOG(L_ERR, "Socket %d is not an UDP socket\r\n", socket);
     return 0;
   }
-  atModem_->commandSprintf("AT+USOST=%u,\"%.*s\",%u,%d,\"", socket, remote_ip.len, remote_ip.s, remote_port, data.len);
-  atModem_->commandAppendHex(data);
-  atModem_->commandStrcat("\"");
-  int result = atModem_->doCommandBlocking(10 * 1000, &socket_response) == at_result_code::OK;
+  int result;
+  if (data_mode_ == uso_data_mode::Binary) {
+    // The raw data follows the '@' prompt
+    atModem_->commandSprintf("AT+USOST=%u,\"%.*s\",%u,%d", socket, remote_ip.len, remote_ip.s, remote_port, data.len);
+    result = atModem_->doCommandBlocking(10 * 1000, &socket_response, data) == at_result_code::OK;
+  } else {
+    atModem_->commandSprintf("AT+USOST=%u,\"%.*s\",%u,%d,\"", socket, remote_ip.len, remote_ip.s, remote_port,
+                             data.len);
+    atModem_->commandAppendRef(data, true);
+    atModem_->commandStrcat("\"");
+    result = atModem_->doCommandBlocking(10 * 1000, &socket_response) == at_result_code::OK;
+  }
   if (!result) return 0;
-  OwlModemAT::filterResponse(s_usost, socket_response, &socket_response);
-  str token = {0};
-  for (int i = 0; str_tok(socket_response, ",\r\n", &token); i++)
-    switch (i) {
-      case 0:
-        // socket
-        break;
-      case 1:
-        bytes_sent = str_to_long_int(token, 10);
-        break;
-      default:
-        break;
-    }
+  uso_socket_value_t params = {.socket = socket, .value = 0};
+  SocketValueSchema::parseResponse(socket_response, s_usost, &params);
+  bytes_sent = params.value;
   LOG(L_INFO, "Sent data over UDP on socket %u %d bytes\r\n", socket, bytes_sent);
   return (bytes_sent >= 0) && (static_cast<unsigned int>(bytes_sent) == data.len);
 }
 
+int OwlModemSocketRN4::sendStream(uint8_t socket, const str *buffers, int count,
+                                  OwlModem_SocketStreamSentHandler_f handler, void *handler_priv) {
+  if (socket >= MODEM_MAX_SOCKETS) {
+    LOG(L_ERR, "Bad socket %d >= %d\r\n", socket, MODEM_MAX_SOCKETS);
+    return 0;
+  }
+  if (!this->status[socket].is_opened) {
+    LOG(L_ERR, "Socket %d is not opened\r\n", socket);
+    return 0;
+  }
+  if (!this->status[socket].is_connected) {
+    LOG(L_ERR, "Socket %d is not connected\r\n", socket);
+    return 0;
+  }
+
+  SendStream *stream = &streams_[socket];
+  if (stream->buffers != nullptr || stream->in_flight > 0) {
+    LOG(L_ERR, "A send stream is already active on socket %d\r\n", socket);
+    return 0;
+  }
+
+  stream->buffers        = buffers;
+  stream->count          = count;
+  stream->written_index  = 0;
+  stream->written_offset = 0;
+  stream->bytes_sent     = 0;
+  stream->handler        = handler;
+  stream->handler_priv   = handler_priv;
+  advanceStream(stream, &stream->written_index, &stream->written_offset, 0);  // skip empty buffers
+  stream->queued_index  = stream->written_index;
+  stream->queued_offset = stream->written_offset;
+
+  if (stream->written_index >= stream->count) {
+    finishStream(stream, true);
+    return 1;
+  }
+
+  pumpStream(stream);
+  return 1;
+}
+
+uint32_t OwlModemSocketRN4::getStreamPending(uint8_t socket) {
+  if (socket >= MODEM_MAX_SOCKETS || streams_[socket].buffers == nullptr) {
+    return 0;
+  }
+
+  SendStream *stream = &streams_[socket];
+  uint32_t pending   = 0;
+  for (int i = stream->written_index; i < stream->count; i++) {
+    pending += stream->buffers[i].len;
+  }
+  return pending - stream->written_offset;
+}
+
+void OwlModemSocketRN4::advanceStream(SendStream *stream, int *index, unsigned int *offset, unsigned int len) {
+  *offset += len;
+  while (*index < stream->count && *offset >= stream->buffers[*index].len) {
+    *offset -= stream->buffers[*index].len;
+    (*index)++;
+  }
+}
+
+unsigned int OwlModemSocketRN4::streamSegmentLen(SendStream *stream, int index, unsigned int offset) {
+  if (index >= stream->count) {
+    return 0;
+  }
+
+  // Writes never span buffers, so the segments are the same whenever they are cut from the same position
+  unsigned int len = stream->buffers[index].len - offset;
+  return (len > MODEM_MAX_SOCKET_DATA_BINARY) ? MODEM_MAX_SOCKET_DATA_BINARY : len;
+}
+
+void OwlModemSocketRN4::pumpStream(SendStream *stream) {
+  char command[32];
+
+  while (stream->buffers != nullptr && stream->in_flight < MODEM_STREAM_MAX_IN_FLIGHT &&
+         stream->queued_index < stream->count) {
+    int index           = stream->queued_index;
+    unsigned int offset = stream->queued_offset;
+    unsigned int len    = streamSegmentLen(stream, index, offset);
+    str data            = {.s = stream->buffers[index].s + offset, .len = len};
+
+    // Binary syntax whatever the data mode: the raw data follows the '@' prompt, up to 1024 bytes
+    snprintf(command, sizeof(command), "AT+USOWR=%u,%u", stream->socket, len);
+
+    advanceStream(stream, &stream->queued_index, &stream->queued_offset, len);
+    stream->in_flight++;
+    if (!atModem_->enqueueATCommand(command, 120 * 1000, processStreamWrite, stream, data)) {
+      // The command queue is full, the rest is queued from the completions or from handleWaitingData()
+      stream->in_flight--;
+      stream->queued_index  = index;
+      stream->queued_offset = offset;
+      break;
+    }
+  }
+}
+
+void OwlModemSocketRN4::finishStream(SendStream *stream, bool success) {
+  OwlModem_SocketStreamSentHandler_f handler = stream->handler;
+
+  stream->in_flight -= atModem_->cancelQueuedCommands(processStreamWrite, stream);
+  stream->buffers = nullptr;
+  stream->handler = nullptr;
+
+  LOG(L_INFO, "Send stream on socket %u %s after %u bytes\r\n", stream->socket, success ? "completed" : "failed",
+      stream->bytes_sent);
+  if (handler != nullptr) {
+    handler(stream->socket, stream->bytes_sent, success, stream->handler_priv);
+  }
+}
+
+void OwlModemSocketRN4::processStreamWrite(at_result_code code, str response, void *priv) {
+  SendStream *stream      = reinterpret_cast<SendStream *>(priv);
+  OwlModemSocketRN4 *inst = stream->owner;
+
+  stream->in_flight--;
+  if (stream->buffers == nullptr) {
+    return;  // the stream has been finished while the write was executing
+  }
+
+  uso_socket_value_t params = {.socket = stream->socket, .value = 0};
+  if (code == at_result_code::OK) {
+    SocketValueSchema::parseResponse(response, s_usowr, &params);
+  }
+  if (params.value <= 0) {
+    LOG(L_ERR, "Send stream write on socket %u failed with %d\r\n", stream->socket, code);
+    inst->finishStream(stream, false);
+    return;
+  }
+
+  unsigned int expected = inst->streamSegmentLen(stream, stream->written_index, stream->written_offset);
+  unsigned int written  = ((unsigned int)params.value < expected) ? params.value : expected;
+  stream->bytes_sent += written;
+  inst->advanceStream(stream, &stream->written_index, &stream->written_offset, written);
+
+  if (written < expected) {
+    // The writes queued after this one would leave a gap, so drop them and resume where the modem stopped
+    LOG(L_INFO, "Partial write on socket %u, %u of %u bytes\r\n", stream->socket, written, expected);
+    stream->in_flight -= inst->atModem_->cancelQueuedCommands(processStreamWrite, stream);
+    stream->queued_index  = stream->written_index;
+    stream->queued_offset = stream->written_offset;
+  }
+
+  if (stream->written_index >= stream->count) {
+    inst->finishStream(stream, true);
+    return;
+  }
+
+  inst->pumpStream(stream);
+}
+
+int OwlModemSocketRN4::receiveQueuedUDP(uint8_t socket, str_mut *out_remote_ip, uint16_t *out_remote_port,
+                                        str_mut *out_data, int max_data_len) {
+  if (out_remote_ip) out_remote_ip->len = 0;
+  if (out_remote_port) *out_remote_port = 0;
+  if (out_data) out_data->len = 0;
+  if (socket >= MODEM_MAX_SOCKETS) {
+    LOG(L_ERR, "Bad socket %d >= %d\r\n", socket, MODEM_MAX_SOCKETS);
+    return 0;
+  }
+  if (status[socket].protocol != uso_protocol::UDP) {
+    LOG(L_ERR, "Socket %d is not a UDP socket\r\n", socket);
+    return 0;
+  }
+
+  /* receive might include an event for the next data, so reset the current value now */
+  int data_len = status[socket].len_outstanding_receivefrom_data;
+  if (data_len) {
+    status[socket].len_outstanding_receivefrom_data = 0;
+    return receiveFromUDP(socket, data_len, out_remote_ip, out_remote_port, out_data, max_data_len);
+  }
+  data_len = status[socket].len_outstanding_receive_data;
+  if (data_len) {
+    status[socket].len_outstanding_receive_data = 0;
+    return receiveUDP(socket, data_len, out_data, max_data_len);
+  }
+  return 1;
+}
+
 int OwlModemSocketRN4::getQueuedForReceive(uint8_t socket, int *out_receive_tcp, int *out_receive_udp,
                                            int *out_receivefrom_udp) {
   if (out_receive_tcp) *out_receive_tcp = 0;
@@ -638,52 +814,110 @@ int OwlModemSocketRN4::receive(uint8_t socket, uint16_t len, str_mut *out_data,
   if (out_data) out_data->len = 0;
 
   atModem_->commandSprintf("AT+USORD=%u,%u", socket, len);
+  startPayload(socket, out_data, max_data_len, nullptr, nullptr);
   int result = (atModem_->doCommandBlocking(1000, &socket_response) == at_result_code::OK);
   if (!result) {
+    startPayload(-1, nullptr, 0, nullptr, nullptr);
     return 0;
   }
-  OwlModemAT::filterResponse(s_usord, socket_response, &socket_response);
-  str token             = {0};
-  str sub               = {0};
-  uint16_t received_len = 0;
-  for (int i = 0; str_tok(socket_response, "\r\n,", &token); i++)
-    switch (i) {
-      case 0:
-        // socket
-        break;
-      case 1:
-        if (len == 0) {
-          // This was a call to figure out how much data is there - re-send command with new length
-          int available_data = str_to_long_int(token, 10);
-          if (available_data > 0)
-            return receive(socket, available_data, out_data, max_data_len);
-          else
-            return 1;
-        }
-        received_len = str_to_uint32_t(token, 10);
-        break;
-      case 2:
-        sub = token;
-        if (sub.len >= 2 && sub.s[0] == '"' && sub.s[sub.len - 1] == '"') {
-          sub.s += 1;
-          sub.len -= 2;
-        }
-        if (sub.len != received_len * 2) {
-          LOG(L_ERR, "Indicator said payload has %d bytes follow, but %d hex characters found\r\n", received_len,
-              sub.len);
-        }
-        if (sub.len) {
-          out_data->len = hex_to_str(out_data->s, max_data_len, sub);
-          if (!out_data->len) goto error;
-        }
-        break;
-      default:
-        break;
-    }
+  if (payload_received_) {
+    // The payload has been streamed directly to out_data
+    return finishPayload();
+  }
+
+  // No payload in the response, this was a call to figure out how much data is there
+  uso_socket_value_t params = {.socket = socket, .value = 0};
+  SocketValueSchema::parseResponse(socket_response, s_usord, &params);
+  if (len == 0 && params.value > 0) {
+    // re-send command with new length
+    return receive(socket, params.value, out_data, max_data_len);
+  }
   return 1;
-error:
-  LOG(L_ERR, "Bad payload\r\n");
-  return 0;
+}
+
+void OwlModemSocketRN4::startPayload(int socket, str_mut *out_data, int max_data_len, str_mut *out_remote_ip,
+                                     uint16_t *out_remote_port) {
+  payload_socket_          = socket;
+  payload_out_data_        = out_data;
+  payload_max_data_len_    = max_data_len;
+  payload_out_remote_ip_   = out_remote_ip;
+  payload_out_remote_port_ = out_remote_port;
+  payload_received_len_    = 0;
+  payload_received_        = false;
+  payload_error_           = false;
+}
+
+int OwlModemSocketRN4::finishPayload() {
+  int result = !payload_error_;
+
+  if (payload_out_data_ && payload_out_data_->len != payload_received_len_) {
+    LOG(L_ERR, "Indicator said payload has %d bytes follow, but %d bytes received\r\n", payload_received_len_,
+        payload_out_data_->len);
+  }
+  if (payload_error_) {
+    LOG(L_ERR, "Bad payload\r\n");
+  }
+
+  startPayload(-1, nullptr, 0, nullptr, nullptr);
+  return result;
+}
+
+void OwlModemSocketRN4::appendPayload(str chunk) {
+  if (payload_out_data_ == nullptr) {
+    LOG(L_WARN, "Socket payload of %u bytes received while not reading - ignored\r\n", chunk.len);
+    return;
+  }
+
+  unsigned int to_copy = chunk.len;
+  if (payload_out_data_->len + to_copy > (unsigned int)payload_max_data_len_) {
+    LOG(L_ERR, "Socket payload doesn't fit in the output buffer, truncating\r\n");
+    to_copy        = payload_max_data_len_ - payload_out_data_->len;
+    payload_error_ = true;
+  }
+
+  memcpy(payload_out_data_->s + payload_out_data_->len, chunk.s, to_copy);
+  payload_out_data_->len += to_copy;
+}
+
+void OwlModemSocketRN4::processPayloadReceive(str header, str chunk, bool last, void *instance) {
+  OwlModemSocketRN4 *inst = reinterpret_cast<OwlModemSocketRN4 *>(instance);
+
+  // Header: socket,length
+  uso_socket_value_t params = {.socket = MODEM_MAX_SOCKETS, .value = 0};
+  SocketValueSchema::parse(header, &params);
+  if (inst->payload_out_data_ == nullptr || inst->atModem_->isQueuedCommandActive() ||
+      params.socket != inst->payload_socket_) {
+    // Not for the receive() call, so a read queued for a receive ring
+    inst->appendBufferedPayload(header, chunk, last);
+    return;
+  }
+
+  inst->appendPayload(chunk);
+  if (!last) {
+    return;
+  }
+
+  inst->payload_received_len_ = params.value;
+  inst->payload_received_     = true;
+}
+
+void OwlModemSocketRN4::processPayloadReceiveFrom(str header, str chunk, bool last, void *instance) {
+  OwlModemSocketRN4 *inst = reinterpret_cast<OwlModemSocketRN4 *>(instance);
+
+  inst->appendPayload(chunk);
+  if (!last) {
+    return;
+  }
+
+  uso_receive_from_t params = {0};
+  int cnt                   = ReceiveFromSchema::parse(header, &params);
+  if (cnt >= 2 && inst->payload_out_remote_ip_) {
+    memcpy(inst->payload_out_remote_ip_->s, params.remote_ip.s, params.remote_ip.len);
+    inst->payload_out_remote_ip_->len = params.remote_ip.len;
+  }
+  if (cnt >= 3 && inst->payload_out_remote_port_) *inst->payload_out_remote_port_ = params.remote_port;
+  inst->payload_received_len_ = params.len;
+  inst->payload_received_     = true;
 }
 
 int OwlModemSocketRN4::receiveUDP(uint8_t socket, uint16_t len, str_mut *out_data, int max_data_len) {
@@ -692,10 +926,8 @@ int OwlModemSocketRN4::receiveUDP(uint8_t socket, uint16_t len, str_mut *out_dat
     LOG(L_ERR, "Bad socket %d >= %d\r\n", socket);
     return 0;
   }
-  if (len > 512) {
-    LOG(L_ERR,
-        "Unfortunately, only supporting up to 512 binary bytes. 1024 would be possible, but in ASCII mode only\r\n",
-        len);
+  if (len > maxDataLen()) {
+    LOG(L_ERR, "Only up to %u bytes can be received at once in the current data mode\r\n", maxDataLen());
     return 0;
   }
   if (!this->status[socket].is_opened) {
@@ -719,10 +951,8 @@ int OwlModemSocketRN4::receiveTCP(uint8_t socket, uint16_t len, str_mut *out_dat
     LOG(L_ERR, "Bad socket %d >= %d\r\n", socket);
     return 0;
   }
-  if (len > 512) {
-    LOG(L_ERR,
-        "Unfortunately, only supporting up to 512 binary bytes. 1024 would be possible, but in ASCII mode only\r\n",
-        len);
+  if (len > maxDataLen()) {
+    LOG(L_ERR, "Only up to %u bytes can be received at once in the current data mode\r\n", maxDataLen());
     return 0;
   }
   if (!this->status[socket].is_opened) {
@@ -751,10 +981,8 @@ int OwlModemSocketRN4::receiveFromUDP(uint8_t socket, uint16_t len, str_mut *out
     LOG(L_ERR, "Bad socket %d >= %d\r\n", socket);
     return 0;
   }
-  if (len > 512) {
-    LOG(L_ERR,
-        "Unfortunately, only supporting up to 512 binary bytes. 1024 would be possible, but in ASCII mode only\r\n",
-        len);
+  if (len > maxDataLen()) {
+    LOG(L_ERR, "Only up to %u bytes can be received at once in the current data mode\r\n", maxDataLen());
     return 0;
   }
   if (!this->status[socket].is_opened) {
@@ -766,63 +994,156 @@ int OwlModemSocketRN4::receiveFromUDP(uint8_t socket, uint16_t len, str_mut *out
     return 0;
   }
   atModem_->commandSprintf("AT+USORF=%u,%u", socket, len);
+  startPayload(socket, out_data, max_data_len, out_remote_ip, out_remote_port);
   int result = (atModem_->doCommandBlocking(1000, &socket_response) == at_result_code::OK);
-  if (!result) return 0;
-  OwlModemAT::filterResponse(s_usorf, socket_response, &socket_response);
-  str token             = {0};
-  str sub               = {0};
-  uint16_t received_len = 0;
-  for (int i = 0; str_tok(socket_response, ",\r\n", &token); i++)
-    switch (i) {
-      case 0:
-        // socket
-        break;
-      case 1:
-        if (len == 0) {
-          // This was a call to figure out how much data is there - re-send command with new length
-          int available_data = str_to_long_int(token, 10);
-          if (available_data > 0)
-            return receiveFromUDP(socket, available_data, out_remote_ip, out_remote_port, out_data, max_data_len);
-        }
-        if (out_remote_ip) {
-          sub = token;
-          if (sub.len >= 2 && sub.s[0] == '"' && sub.s[sub.len - 1] == '"') {
-            sub.s += 1;
-            sub.len -= 2;
-          }
-          memcpy(out_remote_ip->s, sub.s, sub.len);
-          out_remote_ip->len = sub.len;
-        }
-        break;
-      case 2:
-        if (out_remote_port) *out_remote_port = (uint16_t)str_to_uint32_t(token, 10);
-        break;
-      case 3:
-        received_len = str_to_uint32_t(token, 10);
-        break;
-      case 4:
-        sub = token;
-        if (sub.len >= 2 && sub.s[0] == '"' && sub.s[sub.len - 1] == '"') {
-          sub.s += 1;
-          sub.len -= 2;
-        }
-        if (sub.len != received_len * 2) {
-          LOG(L_ERR, "Indicator said payload has %d bytes follow, but %d hex characters found\r\n", received_len,
-              sub.len);
-        }
-        if (sub.len) {
-          out_data->len = hex_to_str(out_data->s, max_data_len, sub);
-          if (!out_data->len) goto error;
-        }
-        break;
-      default:
-        break;
-    }
+  if (!result) {
+    startPayload(-1, nullptr, 0, nullptr, nullptr);
+    return 0;
+  }
+  if (payload_received_) {
+    // The payload has been streamed directly to out_data
+    return finishPayload();
+  }
+
+  // No payload in the response, this was a call to figure out how much data is there
+  uso_socket_value_t params = {.socket = socket, .value = 0};
+  SocketValueSchema::parseResponse(socket_response, s_usorf, &params);
+  if (len == 0 && params.value > 0) {
+    // re-send command with new length
+    return receiveFromUDP(socket, params.value, out_remote_ip, out_remote_port, out_data, max_data_len);
+  }
 
   return 1;
-error:
-  LOG(L_ERR, "Bad payload\r\n");
-  return 0;
+}
+
+int OwlModemSocketRN4::setReceiveBuffer(uint8_t socket, uint8_t *buf, uint32_t size) {
+  if (socket >= MODEM_MAX_SOCKETS) {
+    LOG(L_ERR, "Bad socket %d >= %d\r\n", socket, MODEM_MAX_SOCKETS);
+    return 0;
+  }
+  if (!this->status[socket].is_opened) {
+    LOG(L_ERR, "Socket %d is not opened\r\n", socket);
+    return 0;
+  }
+
+  owl_ring_init(&this->status[socket].rx_ring, buf, size);
+  scheduleBufferedRead(socket);  // data might have been announced already
+  return 1;
+}
+
+uint32_t OwlModemSocketRN4::getReceiveBuffered(uint8_t socket) {
+  if (socket >= MODEM_MAX_SOCKETS) {
+    return 0;
+  }
+  return owl_ring_used(&this->status[socket].rx_ring);
+}
+
+uint32_t OwlModemSocketRN4::readBuffered(uint8_t socket, uint8_t *out, uint32_t max_len) {
+  if (socket >= MODEM_MAX_SOCKETS) {
+    return 0;
+  }
+
+  uint32_t len = owl_ring_read(&this->status[socket].rx_ring, out, max_len);
+  scheduleBufferedRead(socket);  // there is space for more now, or an earlier read could not be queued
+  return len;
+}
+
+bool OwlModemSocketRN4::waitReceiveBuffered(uint8_t socket, uint32_t len, owl_time_t timeout_ms) {
+  if (socket >= MODEM_MAX_SOCKETS) {
+    return false;
+  }
+
+  OwlModemSocketRN4Status *s = &this->status[socket];
+  owl_time_t timeout_time    = owl_time() + timeout_ms;
+  if (len > s->rx_ring.size) {
+    len = s->rx_ring.size;
+  }
+
+  while (owl_ring_used(&s->rx_ring) < len) {
+    // The modem announces the data only once, a read that could not be queued or failed is retried from here
+    scheduleBufferedRead(socket);
+    if (!s->is_connected && !s->rx_read_queued && s->len_outstanding_receive_data <= 0) {
+      return false;  // nothing more is coming
+    }
+
+    owl_time_t now = owl_time();
+    if (now >= timeout_time) {
+      return false;
+    }
+    owl_time_t wait = timeout_time - now;
+    if (!s->rx_read_queued && wait > MODEM_RX_READ_RETRY_DELAY) {
+      wait = MODEM_RX_READ_RETRY_DELAY;
+    }
+    atModem_->spinBlocking(wait);
+  }
+
+  return true;
+}
+
+void OwlModemSocketRN4::scheduleBufferedRead(uint8_t socket) {
+  OwlModemSocketRN4Status *s = &this->status[socket];
+
+  if (s->rx_ring.size == 0 || s->rx_read_queued || s->len_outstanding_receive_data <= 0 ||
+      (s->rx_read_retry_time != 0 && owl_time() < s->rx_read_retry_time)) {
+    return;
+  }
+
+  uint32_t len = s->len_outstanding_receive_data;
+  if (len > owl_ring_free(&s->rx_ring)) {
+    len = owl_ring_free(&s->rx_ring);
+  }
+  if (len > maxDataLen()) {
+    len = maxDataLen();
+  }
+  if (len == 0) {
+    return;  // the ring is full, readBuffered() schedules the read once there is space
+  }
+
+  char command[32];
+  snprintf(command, sizeof(command), "AT+USORD=%u,%u", socket, (unsigned int)len);
+  if (!atModem_->enqueueATCommand(command, 1000, processBufferedRead, &receive_refs_[socket])) {
+    return;  // the command queue is full, retried by readBuffered(), waitReceiveBuffered() or handleWaitingData()
+  }
+  s->rx_read_queued     = true;
+  s->rx_read_retry_time = 0;
+}
+
+void OwlModemSocketRN4::appendBufferedPayload(str header, str chunk, bool last) {
+  // Header: socket,length
+  uso_socket_value_t params = {.socket = MODEM_MAX_SOCKETS, .value = 0};
+  SocketValueSchema::parse(header, &params);
+  if (params.socket >= MODEM_MAX_SOCKETS || this->status[params.socket].rx_ring.size == 0) {
+    LOG(L_WARN, "Socket payload of %u bytes received while not reading - ignored\r\n", chunk.len);
+    return;
+  }
+
+  OwlModemSocketRN4Status *s = &this->status[params.socket];
+  if (owl_ring_write(&s->rx_ring, reinterpret_cast<const uint8_t *>(chunk.s), chunk.len) < chunk.len) {
+    LOG(L_ERR, "Receive ring of socket %u is full, data dropped\r\n", params.socket);
+  }
+  if (last) {
+    s->len_outstanding_receive_data -= params.value;
+    if (s->len_outstanding_receive_data < 0) {
+      s->len_outstanding_receive_data = 0;
+    }
+  }
+}
+
+void OwlModemSocketRN4::processBufferedRead(at_result_code code, str response, void *priv) {
+  ReceiveRef *ref = reinterpret_cast<ReceiveRef *>(priv);
+
+  OwlModemSocketRN4Status *s = &ref->owner->status[ref->socket];
+
+  s->rx_read_queued = false;
+  if (code != at_result_code::OK) {
+    // Not retrying right away, that could loop. Retried after a delay by readBuffered(), waitReceiveBuffered() or
+    // handleWaitingData()
+    LOG(L_ERR, "Read for the receive ring of socket %u failed with %d\r\n", ref->socket, code);
+    s->rx_read_retry_time = owl_time() + MODEM_RX_READ_RETRY_DELAY;
+    return;
+  }
+
+  ref->owner->scheduleBufferedRead(ref->socket);
 }
 
 int OwlModemSocketRN4::listenUDP(uint8_t socket, uint16_t local_port, OwlModem_UDPDataHandler_f cb, void *cb_priv) {
@@ -26,6 +26,7 @@
 
 #include "enums.h"
 #include "OwlModemAT.h"
+#include "../utils/ring.h"
 
 
 
@@ -33,6 +34,16 @@
 #define MODEM_UDP_BUFFER_SIZE 512
 #define MODEM_MAX_SOCKETS 7
 
+/* Maximum socket data per send or receive command */
+#define MODEM_MAX_SOCKET_DATA_HEX 512
+#define MODEM_MAX_SOCKET_DATA_BINARY 1024
+
+/* Writes of a send stream queued to the modem at the same time, see OwlModemSocketRN4::sendStream */
+#define MODEM_STREAM_MAX_IN_FLIGHT 3
+
+/* Delay before retrying a failed read for a receive ring */
+#define MODEM_RX_READ_RETRY_DELAY 500
+
 /**
  * Handler for UDP data
  * @param socket - socket the data was received on
@@ -71,6 +82,16 @@ typedef void (*OwlModem_TCPAcceptHandler_f)(uint8_t new_socket, str remote_ip, u
  */
 typedef void (*OwlModem_SocketClosedHandler_f)(uint8_t socket, void* priv);
 
+/**
+ * Handler for the end of a send stream, called once per stream: when all the data has been written, when a write
+ * failed or when the socket was closed with data still pending. Partial writes are resent and don't call it.
+ * @param socket - the socket the stream was sent on
+ * @param bytes_sent - bytes accepted by the modem, all the data on success, the prefix written so far otherwise
+ * @param success - true if all the data has been written
+ * @param priv - private data
+ */
+typedef void (*OwlModem_SocketStreamSentHandler_f)(uint8_t socket, uint32_t bytes_sent, bool success, void* priv);
+
 
 
 class OwlModemSocketRN4Status {
@@ -83,6 +104,11 @@ class OwlModemSocketRN4Status {
 
   uso_protocol protocol = uso_protocol::none;
 
+  /** Receive ring, see OwlModemSocketRN4::setReceiveBuffer. No storage if not used */
+  owl_ring rx_ring              = {.buf = nullptr, .size = 0, .head = 0, .len = 0};
+  bool rx_read_queued           = false;
+  owl_time_t rx_read_retry_time = 0;  // after a failed read, no new one before this
+
   // TODO: consider using just one piece of private data for all handlers
   OwlModem_UDPDataHandler_f handler_UDPData           = nullptr;
   void* handler_UDPData_priv                          = nullptr;
@@ -104,16 +130,7 @@ class OwlModemSocketRN4Status {
  */
 class OwlModemSocketRN4 {
  public:
-  OwlModemSocketRN4(OwlModemAT* atModem);
-
-  /**
-   * Handler for Unsolicited Response Codes from the modem - called from OwlModem on timer, when URC is received
-   * @param urc - event id
-   * @param data - data of the event
-   * @param instance - pointer to OwlModemSocketRN4 instance
-   * @return if the line was handled
-   */
-  static bool processURC(str urc, str data, void* instance);
+  OwlModemSocketRN4(OwlModemATBase* atModem);
 
   /**
    * Handler for incoming data - triggers receive and handler calling for UDP/TCP queued packets.
@@ -122,6 +139,21 @@ class OwlModemSocketRN4 {
    */
   void handleWaitingData();
 
+  /**
+   * Select how socket data is exchanged with the modem (AT+UDCONF=1). HEX mode doubles the bytes on the serial line,
+   * binary mode writes and reads the raw bytes and allows up to twice as much data per command. HEX is the default.
+   * @param mode - data mode
+   * @return 1 on success, 0 on failure
+   */
+  int setDataMode(uso_data_mode mode);
+
+  /**
+   * Currently selected data mode
+   */
+  uso_data_mode getDataMode() {
+    return data_mode_;
+  }
+
 
 
   /**
@@ -177,10 +209,28 @@ class OwlModemSocketRN4 {
   int connect(uint8_t socket, str remote_ip, uint16_t remote_port, OwlModem_SocketClosedHandler_f cb,
               void* cb_priv = nullptr);
 
+  /**
+   * Switch a connected socket to direct link mode (AT+USODL). The serial line then becomes a transparent byte pipe to
+   * the socket, without AT framing or hex encoding: move the data with OwlModemATBase::dataRead() and dataWrite().
+   * No commands or URCs go through until closeDirectLink(), so the other sockets are on hold. Use a serial line with
+   * hardware flow control for bulk transfers.
+   * @param socket - socket id, connected before calling this function
+   * @return 1 on success, 0 on failure
+   */
+  int openDirectLink(uint8_t socket);
+
+  /**
+   * Leave direct link mode and return to AT commands, with the "+++" escape sequence. Read all the data first, what
+   * is left in the pipe is dropped
+   * @param guard_ms - silence required around the escape sequence (the modem's DL guard time)
+   * @return 1 on success, 0 on failure
+   */
+  int closeDirectLink(owl_time_t guard_ms = AT_DATA_MODE_GUARD_TIME);
+
   /**
    * Send data over UDP
    * @param socket
-   * @param data - max 512 bytes in binary format
+   * @param data - max 512 bytes in HEX data mode, 1024 in binary data mode
    * @param out_bytes_sent - output number of bytes actually sent
    * @return 1 on success, 0 on failure or not all bytes sent
    */
@@ -189,7 +239,7 @@ class OwlModemSocketRN4 {
   /**
    * Send data over TCP
    * @param socket
-   * @param data - max 512 bytes in binary format
+   * @param data - max 512 bytes in HEX data mode, 1024 in binary data mode
    * @param out_bytes_sent - output number of bytes actually sent
    * @return 1 on success or partial success (not all bytes written), 0 on failure
    */
@@ -200,11 +250,70 @@ class OwlModemSocketRN4 {
    * @param socket - socket id, obtained from openUDPSocket()
    * @param remote_ip - destination IP
    * @param remote_port - destination port
-   * @param data - max 512 bytes in binary format
+   * @param data - max 512 bytes in HEX data mode, 1024 in binary data mode
    * @return 1 on success, 0 on failure
    */
   int sendToUDP(uint8_t socket, str remote_ip, uint16_t remote_port, str data);
 
+  /**
+   * Start sending data of any size over a connected TCP or UDP socket, without blocking. The data is split into
+   * modem-sized writes, which are pipelined through the AT command queue, several of them at a time. Partial writes
+   * reported by the modem are resent. On UDP sockets every write is a separate datagram.
+   * Only one stream can be active on a socket at a time: start the next one from the handler or once
+   * getStreamPending() is back to 0. If the AT command queue is full, the remaining writes are queued from
+   * handleWaitingData().
+   * @param socket - socket id
+   * @param buffers - data to send, in order. The array and the data must stay valid until the handler is called
+   * @param count - number of buffers
+   * @param handler - called once all the data has been written, or when sending failed
+   * @param handler_priv - private data for the handler
+   * @return 1 if the stream was started, 0 on failure or if a stream is already active on the socket
+   */
+  int sendStream(uint8_t socket, const str* buffers, int count, OwlModem_SocketStreamSentHandler_f handler,
+                 void* handler_priv = nullptr);
+
+  /**
+   * Number of bytes of the active send stream on the socket not yet written to the modem, 0 if there is none
+   */
+  uint32_t getStreamPending(uint8_t socket);
+
+  /**
+   * Give a socket a receive ring. From then on, the data announced with +UUSORD is read as soon as the URC arrives,
+   * through the AT command queue, and stored in the ring. Reads are scheduled as long as there is space in the ring.
+   * The application takes the data with readBuffered(), without issuing AT commands, and handleWaitingData() leaves
+   * the socket alone. Data announced with +UUSORF (unconnected UDP) is not buffered, as it comes with an address.
+   * The ring is dropped when the socket is opened again.
+   * @param socket - socket id. Should be open before calling this function
+   * @param buf - storage for the ring, must stay valid as long as the socket is used
+   * @param size - size of the storage
+   * @return 1 on success, 0 on failure
+   */
+  int setReceiveBuffer(uint8_t socket, uint8_t* buf, uint32_t size);
+
+  /**
+   * Number of received bytes waiting in the receive ring of a socket
+   */
+  uint32_t getReceiveBuffered(uint8_t socket);
+
+  /**
+   * Take received data out of the receive ring of a socket
+   * @param socket - socket id
+   * @param out - output buffer
+   * @param max_len - maximum bytes to take
+   * @return number of bytes taken
+   */
+  uint32_t readBuffered(uint8_t socket, uint8_t* out, uint32_t max_len);
+
+  /**
+   * Spin the modem until the receive ring of a socket holds at least len bytes. Sleeps in between, waking up on the
+   * input from the modem, so the data is there as soon as the modem delivers it.
+   * @param socket - socket id
+   * @param len - number of bytes to wait for, capped at the size of the ring
+   * @param timeout_ms - maximum time to wait
+   * @return true if the data is there, false on timeout or if the socket got disconnected first
+   */
+  bool waitReceiveBuffered(uint8_t socket, uint32_t len, owl_time_t timeout_ms);
+
   /**
    * Retrieve lengths of currently queued data for receive. Use this function as an alternative to calling
    * handleWaitingData(). If data is available, you can retrieve it with receiveTCP(), receiveUDP(), respectively
@@ -220,6 +329,19 @@ class OwlModemSocketRN4 {
    */
   int getQueuedForReceive(uint8_t socket, int* out_receive_tcp, int* out_receive_udp, int* out_receivefrom_udp);
 
+  /**
+   * Receive the next datagram announced on a UDP socket by +UUSORF or +UUSORD, if any. Use this function as an
+   * alternative to calling handleWaitingData(), when polling the sockets yourself.
+   * @param socket - socket id to read from
+   * @param out_remote_ip - output remote IP (empty for a connected socket) - buffer must be at least 40 bytes long
+   * @param out_remote_port - output remote port (0 for a connected socket)
+   * @param out_data - output buffer for the data - binary data here. Its len is 0 if nothing was queued.
+   * @param max_data_len - maximum bytes to write in out_data
+   * @return 1 on success, 0 on failure
+   */
+  int receiveQueuedUDP(uint8_t socket, str_mut* out_remote_ip, uint16_t* out_remote_port, str_mut* out_data,
+                       int max_data_len);
+
   /**
    * Do Receive on UDP when the socket was connected to a remote IP:port - typically called on +UUSORD events.
    * @param socket - socket id to read from
@@ -365,20 +487,75 @@ class OwlModemSocketRN4 {
 
 
  private:
-  OwlModemAT* atModem_ = 0;
+  OwlModemATBase* atModem_ = 0;
 
 
   OwlModemSocketRN4Status status[MODEM_MAX_SOCKETS];
 
   str socket_response = {.s = nullptr, .len = 0};
 
+  uso_data_mode data_mode_ = uso_data_mode::Hex;
+
+  /** Send stream of a socket. Positions are a buffer index and an offset in it */
+  struct SendStream {
+    OwlModemSocketRN4* owner;
+    uint8_t socket;
+    const str* buffers;
+    int count;
+    int written_index;  // up to here the data has been accepted by the modem
+    unsigned int written_offset;
+    int queued_index;  // up to here the writes have been queued
+    unsigned int queued_offset;
+    int in_flight;
+    uint32_t bytes_sent;
+    OwlModem_SocketStreamSentHandler_f handler;
+    void* handler_priv;
+  };
+  SendStream streams_[MODEM_MAX_SOCKETS];
+
+  /** Private data of the reads queued for the receive rings */
+  struct ReceiveRef {
+    OwlModemSocketRN4* owner;
+    uint8_t socket;
+  };
+  ReceiveRef receive_refs_[MODEM_MAX_SOCKETS];
+
 
   /** UDP buffer, to be used internally when receiving data */
   char udp_buffer[MODEM_UDP_BUFFER_SIZE];
   str_mut udp_data = {.s = udp_buffer, .len = 0};
 
+  /** Destination of the payload streamed by the +USORD/+USORF response of the receive command being executed */
+  int payload_socket_                = -1;
+  str_mut* payload_out_data_         = nullptr;
+  int payload_max_data_len_          = 0;
+  str_mut* payload_out_remote_ip_    = nullptr;
+  uint16_t* payload_out_remote_port_ = nullptr;
+  uint16_t payload_received_len_     = 0;
+  bool payload_received_             = false;
+  bool payload_error_                = false;
+
+  unsigned int maxDataLen() {
+    return data_mode_ == uso_data_mode::Binary ? MODEM_MAX_SOCKET_DATA_BINARY : MODEM_MAX_SOCKET_DATA_HEX;
+  }
+  void registerPayloadLines();
+  void advanceStream(SendStream* stream, int* index, unsigned int* offset, unsigned int len);
+  unsigned int streamSegmentLen(SendStream* stream, int index, unsigned int offset);
+  void pumpStream(SendStream* stream);
+  void finishStream(SendStream* stream, bool success);
+  static void processStreamWrite(at_result_code code, str response, void* priv);
+  void scheduleBufferedRead(uint8_t socket);
+  void appendBufferedPayload(str header, str chunk, bool last);
+  static void processBufferedRead(at_result_code code, str response, void* priv);
   int send(uint8_t socket, str data);
   int receive(uint8_t socket, uint16_t len, str_mut* out_data, int max_data_len);
+  void startPayload(int socket, str_mut* out_data, int max_data_len, str_mut* out_remote_ip,
+                    uint16_t* out_remote_port);
+  int finishPayload();
+  void appendPayload(str chunk);
+
+  static void processPayloadReceive(str header, str chunk, bool last, void* instance);
+  static void processPayloadReceiveFrom(str header, str chunk, bool last, void* instance);
 
   bool processURCConnected(str urc, str data);
   bool processURCClosed(str urc, str data);
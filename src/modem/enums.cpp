@@ -45,6 +45,7 @@ const at_enum_text_match result_code_text_match[] = {{static_cast<int>(at_result
                                                      {static_cast<int>(at_result_code::NO_DIALTONE), "NO DIALTONE"},
                                                      {static_cast<int>(at_result_code::BUSY), "BUSY"},
                                                      {static_cast<int>(at_result_code::NO_ANSWER), "NO ANSWER"},
+                                                     {static_cast<int>(at_result_code::DISCONNECT), "DISCONNECT"},
                                                      {0, nullptr}};
 
 const at_enum_text_match cfun_fun_text_match[] = {
@@ -50,6 +50,7 @@ enum class at_result_code : int {
   NO_DIALTONE  = 6,
   BUSY         = 7,
   NO_ANSWER    = 8,
+  DISCONNECT   = 9, /**< u-blox, direct link closed */
 };
 extern const at_enum_text_match result_code_text_match[];
 static inline const char *at_enum_stringify(at_result_code code) {
@@ -314,6 +315,11 @@ static inline const char *at_enum_stringify(uso_protocol code) {
   return at_enum_stringify(static_cast<int>(code), uso_protocol_text_match);
 }
 
+enum class uso_data_mode : int {
+  Binary = 0, /**< Socket data sent and received as raw bytes, up to 1024 bytes per command */
+  Hex    = 1, /**< Socket data sent and received HEX-encoded, up to 512 bytes per command */
+};
+
 enum class uso_error : int {
   Success                  = 0,   /**< No Error */
   U_EPERM                  = 1,   /**< Operation not permitted (internal error) */
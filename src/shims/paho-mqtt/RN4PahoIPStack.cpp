@@ -1,5 +1,7 @@
 #include "RN4PahoIPStack.h"
 
+#include <string.h>
+
 #define RN4_PAHO_LOCAL_PORT 8883
 
 bool RN4PahoIPStack::connect(const char* hostname, int port, bool use_tls, int tls_id) {
@@ -8,6 +10,9 @@ bool RN4PahoIPStack::connect(const char* hostname, int port, bool use_tls, int t
     return false;
   }
 
+  // Incoming data is read ahead into rx_buffer_ as soon as the modem announces it
+  modem_->setReceiveBuffer(socket_id_, rx_buffer_, sizeof(rx_buffer_));
+
   if (use_tls) {
     if (!modem_->enableTLS(socket_id_, tls_id)) {
       LOG(L_ERR, "failed to enable tls\r\n");
@@ -41,7 +46,9 @@ bool RN4PahoIPStack::connect(const char* hostname, int port, bool use_tls, int t
 }
 
 int RN4PahoIPStack::disconnect() {
-  open_ = false;
+  tx_len_          = 0;
+  tx_packet_start_ = 0;
+  open_            = false;
   modem_->close(socket_id_);
   socket_id_ = 0;
   return 0;
@@ -53,29 +60,120 @@ void RN4PahoIPStack::socketCloseHandler(uint8_t socket, void* priv) {
 }
 
 int RN4PahoIPStack::read(unsigned char* buffer, int len, int timeout_ms) {
-  // TODO: support timeout
-  if (!open_) {
+  checkCoalesceTimer();
+
+  if (!open_ && modem_->getReceiveBuffered(socket_id_) == 0) {
     return -1;
   }
 
-  str_mut out_data;
-  out_data.s   = (char*)buffer;
-  out_data.len = 0;
-  if (!modem_->receiveTCP(socket_id_, len, &out_data, len)) {
-    return -1;
+  owl_time_t timeout_time = owl_time() + timeout_ms;
+  int total               = 0;
+  while (total < len) {
+    // Wait for all of it when it fits in the buffer, so that a read timing out doesn't consume a partial packet
+    owl_time_t now = owl_time();
+    if (!modem_->waitReceiveBuffered(socket_id_, len - total, (timeout_time > now) ? timeout_time - now : 0)) {
+      break;
+    }
+    total += modem_->readBuffered(socket_id_, buffer + total, len - total);
+  }
+
+  return total;
+}
+
+/* End of the MQTT packet starting at pos, or -1 if its fixed header is not complete yet */
+static int mqtt_packet_end(const uint8_t* buf, int len, int pos) {
+  int remaining  = 0;
+  int multiplier = 1;
+
+  for (int i = pos + 1; i < len && i <= pos + 4; i++) {
+    remaining += (buf[i] & 0x7F) * multiplier;
+    if ((buf[i] & 0x80) == 0) {
+      return i + 1 + remaining;
+    }
+    multiplier *= 128;
+  }
+  return -1;
+}
+
+void RN4PahoIPStack::setWriteCoalescing(bool enabled) {
+  if (!enabled) {
+    flush();
+  }
+  coalesce_ = enabled;
+}
+
+bool RN4PahoIPStack::sendAll(str data) {
+  while (data.len > 0) {
+    int bytes_sent;
+    if (!modem_->sendTCP(socket_id_, data, &bytes_sent) || bytes_sent <= 0) {
+      return false;
+    }
+    data.s += bytes_sent;
+    data.len -= bytes_sent;
+  }
+  return true;
+}
+
+bool RN4PahoIPStack::flush() {
+  if (tx_len_ == 0) {
+    return true;
+  }
+
+  str data         = {.s = (char*)tx_buffer_, .len = (unsigned int)tx_len_};
+  bool result      = open_ && sendAll(data);
+  tx_len_          = 0;
+  tx_packet_start_ = 0;
+  if (!result) {
+    LOG(L_ERR, "failed to send coalesced data on socket [%d]\r\n", socket_id_);
   }
+  return result;
+}
 
-  return out_data.len;
+void RN4PahoIPStack::checkCoalesceTimer() {
+  if (tx_len_ > 0 && owl_time() - tx_first_time_ >= RN4_PAHO_TX_COALESCE_MS) {
+    flush();
+  }
 }
 
 int RN4PahoIPStack::write(unsigned char* buffer, int len, int timeout_ms) {
+  if (!open_) {
+    return -1;
+  }
+
+  if (coalesce_) {
+    checkCoalesceTimer();
+
+    if (tx_len_ + len > RN4_PAHO_TX_BUFFER_SIZE) {
+      // Doesn't fit, send what is there and this one as it comes
+      if (!flush()) {
+        return -1;
+      }
+    }
+
+    if (len <= RN4_PAHO_TX_BUFFER_SIZE) {
+      if (tx_len_ == 0) {
+        tx_first_time_ = owl_time();
+      }
+      memcpy(tx_buffer_ + tx_len_, buffer, len);
+      tx_len_ += len;
+
+      // Flush once the data ends on a packet boundary
+      int end;
+      while (tx_packet_start_ < tx_len_ &&
+             (end = mqtt_packet_end(tx_buffer_, tx_len_, tx_packet_start_)) >= 0 && end <= tx_len_) {
+        tx_packet_start_ = end;
+      }
+      if (tx_packet_start_ == tx_len_ && !flush()) {
+        return -1;
+      }
+      return len;
+    }
+  }
+
   str data;
   data.s   = (char*)buffer;
   data.len = len;
   int bytes_sent;
-  if (!open_) {
-    return -1;
-  }
 
   if (!modem_->sendTCP(socket_id_, data, &bytes_sent)) {
     return -1;
@@ -3,6 +3,21 @@
 
 #include "../../modem/OwlModemSocketRN4.h"
 
+/* Read-ahead buffer, should hold the largest MQTT packet expected */
+#ifndef RN4_PAHO_RX_BUFFER_SIZE
+#define RN4_PAHO_RX_BUFFER_SIZE 1024
+#endif
+
+/* Coalescing buffer for writes, packets larger than this are sent as they come */
+#ifndef RN4_PAHO_TX_BUFFER_SIZE
+#define RN4_PAHO_TX_BUFFER_SIZE 512
+#endif
+
+/* Longest time coalesced data waits for the rest of its packet */
+#ifndef RN4_PAHO_TX_COALESCE_MS
+#define RN4_PAHO_TX_COALESCE_MS 20
+#endif
+
 class RN4PahoIPStack {
  public:
   RN4PahoIPStack(OwlModemSocketRN4* modem) : modem_{modem} {
@@ -18,12 +33,35 @@ class RN4PahoIPStack {
     return open_;
   }
 
+  /**
+   * Batch up the writes and send each MQTT packet with a single socket write, once all of it was written or when
+   * RN4_PAHO_TX_COALESCE_MS passed since its first byte. Off by default.
+   * @param enabled - true to coalesce, false to send on each write (pending data is flushed)
+   */
+  void setWriteCoalescing(bool enabled);
+
+  /**
+   * Send the coalesced data right away
+   * @return true on success, false if the socket write failed (the data is dropped)
+   */
+  bool flush();
+
   static void socketCloseHandler(uint8_t socket, void* priv);
 
  private:
+  bool sendAll(str data);
+  void checkCoalesceTimer();
+
   OwlModemSocketRN4* modem_;
   uint8_t socket_id_;
   bool open_{false};
+  uint8_t rx_buffer_[RN4_PAHO_RX_BUFFER_SIZE];
+
+  bool coalesce_{false};
+  uint8_t tx_buffer_[RN4_PAHO_TX_BUFFER_SIZE];
+  int tx_len_{0};
+  int tx_packet_start_{0};  // start of the first packet in tx_buffer_ not written completely yet
+  owl_time_t tx_first_time_{0};
 };
 
 #endif  // __RN4_PAHO_IP_STACK_H__
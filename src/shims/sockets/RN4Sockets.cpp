@@ -0,0 +1,297 @@
+#include "RN4Sockets.h"
+
+#include <string.h>
+
+RN4Sockets::Socket* RN4Sockets::get(int fd) {
+  if (fd < 0 || fd >= MODEM_MAX_SOCKETS || !sockets_[fd].in_use) {
+    LOG(L_ERR, "Bad socket descriptor %d\r\n", fd);
+    return nullptr;
+  }
+  return &sockets_[fd];
+}
+
+void RN4Sockets::setUp(uint8_t fd, uso_protocol protocol) {
+  sockets_[fd]          = {};
+  sockets_[fd].in_use   = true;
+  sockets_[fd].protocol = protocol;
+  if (protocol == uso_protocol::TCP) {
+    socket_->setReceiveBuffer(fd, rx_buffer_[fd], RN4_SOCKETS_RX_BUFFER_SIZE);
+  }
+}
+
+int RN4Sockets::socket(uso_protocol protocol, uint16_t local_port) {
+  uint8_t fd;
+  if (!socket_->open(protocol, local_port, &fd)) {
+    LOG(L_ERR, "failed to open socket\r\n");
+    return RN4_SOCKET_ERROR;
+  }
+  setUp(fd, protocol);
+  return fd;
+}
+
+int RN4Sockets::connect(int fd, str remote_ip, uint16_t remote_port) {
+  Socket* s = get(fd);
+  if (!s) {
+    return RN4_SOCKET_ERROR;
+  }
+  if (!socket_->connect(fd, remote_ip, remote_port, socketClosedHandler, this)) {
+    LOG(L_ERR, "failed to connect socket [%d]\r\n", fd);
+    return RN4_SOCKET_ERROR;
+  }
+  s->connected = true;
+  s->hup       = false;
+  return 0;
+}
+
+int RN4Sockets::listen(int fd, uint16_t local_port) {
+  Socket* s = get(fd);
+  if (!s) {
+    return RN4_SOCKET_ERROR;
+  }
+  if (s->protocol != uso_protocol::TCP) {
+    LOG(L_ERR, "listen on socket [%d] which is not TCP\r\n", fd);
+    return RN4_SOCKET_ERROR;
+  }
+  if (!socket_->acceptTCP(fd, local_port, tcpAcceptHandler, socketClosedHandler, nullptr, this, this)) {
+    LOG(L_ERR, "failed to listen on socket [%d]\r\n", fd);
+    return RN4_SOCKET_ERROR;
+  }
+  s->listening = true;
+  return 0;
+}
+
+int RN4Sockets::accept(int fd, str_mut* out_remote_ip, uint16_t* out_remote_port) {
+  closeRefused();
+
+  Socket* s = get(fd);
+  if (!s || !s->listening) {
+    return RN4_SOCKET_ERROR;
+  }
+  if (s->backlog_len == 0) {
+    return RN4_SOCKET_WOULD_BLOCK;
+  }
+
+  PendingAccept* pending = &s->backlog[0];
+  if (out_remote_ip) {
+    memcpy(out_remote_ip->s, pending->remote_ip, pending->remote_ip_len);
+    out_remote_ip->len = pending->remote_ip_len;
+  }
+  if (out_remote_port) {
+    *out_remote_port = pending->remote_port;
+  }
+  int new_fd = pending->fd;
+
+  s->backlog_len--;
+  memmove(&s->backlog[0], &s->backlog[1], s->backlog_len * sizeof(PendingAccept));
+  return new_fd;
+}
+
+int RN4Sockets::send(int fd, const uint8_t* data, int len) {
+  Socket* s = get(fd);
+  if (!s) {
+    return RN4_SOCKET_ERROR;
+  }
+  if (s->error || s->hup || !s->connected) {
+    return RN4_SOCKET_ERROR;
+  }
+
+  if (s->protocol == uso_protocol::UDP) {
+    int bytes_sent = 0;
+    str datagram   = {.s = (char*)data, .len = (unsigned int)len};
+    if (!socket_->sendUDP(fd, datagram, &bytes_sent)) {
+      return RN4_SOCKET_ERROR;
+    }
+    return bytes_sent;
+  }
+
+  if (socket_->getStreamPending(fd) > 0) {
+    return RN4_SOCKET_WOULD_BLOCK;
+  }
+  if (len > RN4_SOCKETS_TX_BUFFER_SIZE) {
+    len = RN4_SOCKETS_TX_BUFFER_SIZE;
+  }
+  memcpy(tx_buffer_[fd], data, len);
+  s->tx_data = {.s = (char*)tx_buffer_[fd], .len = (unsigned int)len};
+  if (!socket_->sendStream(fd, &s->tx_data, 1, streamSentHandler, this)) {
+    return RN4_SOCKET_ERROR;
+  }
+  return len;
+}
+
+int RN4Sockets::sendto(int fd, const uint8_t* data, int len, str remote_ip, uint16_t remote_port) {
+  Socket* s = get(fd);
+  if (!s || s->protocol != uso_protocol::UDP) {
+    return RN4_SOCKET_ERROR;
+  }
+  str datagram = {.s = (char*)data, .len = (unsigned int)len};
+  if (!socket_->sendToUDP(fd, remote_ip, remote_port, datagram)) {
+    return RN4_SOCKET_ERROR;
+  }
+  return len;
+}
+
+int RN4Sockets::recv(int fd, uint8_t* buf, int len) {
+  Socket* s = get(fd);
+  if (!s) {
+    return RN4_SOCKET_ERROR;
+  }
+  if (s->protocol == uso_protocol::UDP) {
+    return recvfrom(fd, buf, len, nullptr, nullptr);
+  }
+
+  int received = socket_->readBuffered(fd, buf, len);
+  if (received > 0) {
+    return received;
+  }
+
+  int outstanding = 0;
+  socket_->getQueuedForReceive(fd, &outstanding, nullptr, nullptr);
+  if (s->hup && outstanding == 0) {
+    return 0;
+  }
+  return RN4_SOCKET_WOULD_BLOCK;
+}
+
+int RN4Sockets::recvfrom(int fd, uint8_t* buf, int len, str_mut* out_remote_ip, uint16_t* out_remote_port) {
+  Socket* s = get(fd);
+  if (!s || s->protocol != uso_protocol::UDP) {
+    return RN4_SOCKET_ERROR;
+  }
+
+  char ip_buf[40];
+  str_mut remote_ip = {.s = ip_buf, .len = 0};
+  str_mut out_data  = {.s = (char*)buf, .len = 0};
+  if (!socket_->receiveQueuedUDP(fd, out_remote_ip ? out_remote_ip : &remote_ip, out_remote_port, &out_data,
+                                       len)) {
+    return RN4_SOCKET_ERROR;
+  }
+  if (out_data.len == 0) {
+    return RN4_SOCKET_WOULD_BLOCK;
+  }
+  return out_data.len;
+}
+
+int RN4Sockets::close(int fd) {
+  Socket* s = get(fd);
+  if (!s) {
+    return RN4_SOCKET_ERROR;
+  }
+
+  // Not yet accepted connections go along with the listening socket
+  for (int i = 0; i < s->backlog_len; i++) {
+    socket_->close(s->backlog[i].fd);
+    sockets_[s->backlog[i].fd].in_use = false;
+  }
+  s->in_use = false;
+
+  if (!socket_->close(fd)) {
+    LOG(L_ERR, "failed to close socket [%d]\r\n", fd);
+    return RN4_SOCKET_ERROR;
+  }
+  return 0;
+}
+
+short RN4Sockets::readiness(int fd) {
+  if (fd < 0 || fd >= MODEM_MAX_SOCKETS || !sockets_[fd].in_use) {
+    return RN4_POLLERR;
+  }
+
+  Socket* s    = &sockets_[fd];
+  short events = 0;
+  if (s->listening) {
+    if (s->backlog_len > 0) {
+      events |= RN4_POLLIN;
+    }
+  } else if (s->protocol == uso_protocol::UDP) {
+    int outstanding = 0, outstanding_from = 0;
+    socket_->getQueuedForReceive(fd, nullptr, &outstanding, &outstanding_from);
+    if (outstanding > 0 || outstanding_from > 0) {
+      events |= RN4_POLLIN;
+    }
+    events |= RN4_POLLOUT;
+  } else {
+    // A closed connection is readable too, recv() returns 0 once the data is drained
+    if (socket_->getReceiveBuffered(fd) > 0 || s->hup) {
+      events |= RN4_POLLIN;
+    }
+    if (s->connected && !s->hup && socket_->getStreamPending(fd) == 0) {
+      events |= RN4_POLLOUT;
+    }
+    if (s->hup) {
+      events |= RN4_POLLHUP;
+    }
+  }
+  if (s->error) {
+    events |= RN4_POLLERR;
+  }
+  return events;
+}
+
+int RN4Sockets::poll(rn4_pollfd* fds, int nfds, owl_time_t timeout_ms) {
+  owl_time_t timeout_time = owl_time() + timeout_ms;
+
+  while (true) {
+    closeRefused();
+
+    int ready = 0;
+    for (int i = 0; i < nfds; i++) {
+      fds[i].revents = readiness(fds[i].fd) & (fds[i].events | RN4_POLLERR | RN4_POLLHUP);
+      if (fds[i].revents) {
+        ready++;
+      }
+    }
+    if (ready > 0 || owl_time() >= timeout_time) {
+      return ready;
+    }
+
+    // Sleep until the modem has something, the URCs update the readiness
+    at_->spinBlocking(timeout_time - owl_time());
+  }
+}
+
+void RN4Sockets::closeRefused() {
+  for (int fd = 0; fd < MODEM_MAX_SOCKETS; fd++) {
+    if (close_pending_[fd]) {
+      close_pending_[fd] = false;
+      if (!socket_->close(fd)) {
+        LOG(L_ERR, "failed to close refused socket [%d]\r\n", fd);
+      }
+    }
+  }
+}
+
+void RN4Sockets::socketClosedHandler(uint8_t socket, void* priv) {
+  RN4Sockets* instance = (RN4Sockets*)priv;
+  if (socket < MODEM_MAX_SOCKETS && instance->sockets_[socket].in_use) {
+    instance->sockets_[socket].hup = true;
+  }
+}
+
+void RN4Sockets::tcpAcceptHandler(uint8_t new_socket, str remote_ip, uint16_t remote_port, uint8_t listening_socket,
+                                  str local_ip, uint16_t local_port, void* priv) {
+  RN4Sockets* instance = (RN4Sockets*)priv;
+  Socket* listener     = &instance->sockets_[listening_socket];
+  if (listener->backlog_len >= RN4_SOCKETS_ACCEPT_BACKLOG) {
+    // Can't close it from within the URC, that takes an AT command
+    LOG(L_WARN, "Accept backlog of socket [%d] is full - closing new socket [%d]\r\n", listening_socket, new_socket);
+    instance->close_pending_[new_socket] = true;
+    return;
+  }
+
+  instance->setUp(new_socket, uso_protocol::TCP);
+  instance->sockets_[new_socket].connected = true;
+
+  PendingAccept* pending = &listener->backlog[listener->backlog_len++];
+  pending->fd            = new_socket;
+  pending->remote_port   = remote_port;
+  pending->remote_ip_len = remote_ip.len < sizeof(pending->remote_ip) ? remote_ip.len : sizeof(pending->remote_ip);
+  memcpy(pending->remote_ip, remote_ip.s, pending->remote_ip_len);
+}
+
+void RN4Sockets::streamSentHandler(uint8_t socket, uint32_t bytes_sent, bool success, void* priv) {
+  RN4Sockets* instance = (RN4Sockets*)priv;
+  if (!success && socket < MODEM_MAX_SOCKETS) {
+    LOG(L_ERR, "send on socket [%d] failed after %u bytes\r\n", socket, (unsigned int)bytes_sent);
+    instance->sockets_[socket].error = true;
+  }
+}
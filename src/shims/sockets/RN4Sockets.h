@@ -0,0 +1,167 @@
+#ifndef __RN4_SOCKETS_H__
+#define __RN4_SOCKETS_H__
+
+#include "../../modem/OwlModemRN4.h"
+
+/* Per-socket receive ring for TCP */
+#ifndef RN4_SOCKETS_RX_BUFFER_SIZE
+#define RN4_SOCKETS_RX_BUFFER_SIZE 512
+#endif
+
+/* Per-socket send buffer, a send() takes at most this much at a time */
+#ifndef RN4_SOCKETS_TX_BUFFER_SIZE
+#define RN4_SOCKETS_TX_BUFFER_SIZE 512
+#endif
+
+/* Connections waiting for accept() on a listening socket */
+#ifndef RN4_SOCKETS_ACCEPT_BACKLOG
+#define RN4_SOCKETS_ACCEPT_BACKLOG 2
+#endif
+
+/* Return values, besides the byte counts */
+#define RN4_SOCKET_ERROR -1
+#define RN4_SOCKET_WOULD_BLOCK -2
+
+/* poll() events, same values as in POSIX */
+#define RN4_POLLIN 0x0001
+#define RN4_POLLOUT 0x0004
+#define RN4_POLLERR 0x0008
+#define RN4_POLLHUP 0x0010
+
+struct rn4_pollfd {
+  int fd;
+  short events;
+  short revents;
+};
+
+/**
+ * BSD-style, non-blocking sockets over OwlModemSocketRN4. The file descriptors are the modem socket ids.
+ *
+ * TCP transfers never wait for the network: data is read ahead into a receive ring as +UUSORD comes in and sent
+ * through a send stream, so send()/recv() return RN4_SOCKET_WOULD_BLOCK instead of waiting. poll() sleeps on the
+ * modem input and uses the URCs as readiness events, so one loop can serve all the sockets.
+ *
+ * Only readiness is non-blocking for UDP: recv()/recvfrom() return RN4_SOCKET_WOULD_BLOCK until +UUSORD/+UUSORF
+ * announced a datagram, then fetch it with one blocking AT command. send()/sendto() on UDP also block for the
+ * duration of their AT command. socket(), connect(), listen() and close() always do.
+ *
+ * Don't call OwlModemSocketRN4::handleWaitingData() for sockets managed here, it would take their UDP data away.
+ */
+class RN4Sockets {
+ public:
+  RN4Sockets(OwlModemRN4* modem) : RN4Sockets(&modem->socket, &modem->AT) {
+  }
+  RN4Sockets(OwlModemSocketRN4* socket, OwlModemATBase* at) : socket_{socket}, at_{at} {
+  }
+
+  /**
+   * Open a socket
+   * @param protocol - TCP or UDP
+   * @param local_port - local port to bind to, 0 if you don't care what it should be
+   * @return file descriptor, or RN4_SOCKET_ERROR
+   */
+  int socket(uso_protocol protocol, uint16_t local_port = 0);
+
+  /**
+   * Connect a socket. For UDP, this sets the destination of send()
+   * @return 0 on success, RN4_SOCKET_ERROR on failure
+   */
+  int connect(int fd, str remote_ip, uint16_t remote_port);
+
+  /**
+   * Listen for incoming TCP connections, to pick up with accept()
+   * @return 0 on success, RN4_SOCKET_ERROR on failure
+   */
+  int listen(int fd, uint16_t local_port);
+
+  /**
+   * Take the next incoming connection of a listening socket
+   * @param out_remote_ip - output remote IP, can be nullptr. Buffer must be at least 40 bytes long
+   * @param out_remote_port - output remote port, can be nullptr
+   * @return file descriptor of the connection, RN4_SOCKET_WOULD_BLOCK or RN4_SOCKET_ERROR
+   */
+  int accept(int fd, str_mut* out_remote_ip, uint16_t* out_remote_port);
+
+  /**
+   * Send on a connected socket. On TCP the data is copied and sent in the background, a send only takes what fits in
+   * the send buffer. On UDP the datagram is sent right away, blocking for the AT command.
+   * @return number of bytes taken, RN4_SOCKET_WOULD_BLOCK or RN4_SOCKET_ERROR
+   */
+  int send(int fd, const uint8_t* data, int len);
+
+  /**
+   * Send a datagram on a UDP socket, blocking for the AT command
+   * @return len, or RN4_SOCKET_ERROR
+   */
+  int sendto(int fd, const uint8_t* data, int len, str remote_ip, uint16_t remote_port);
+
+  /**
+   * Receive on a socket. On UDP this is one datagram, truncated to len, fetched with a blocking AT command once
+   * announced.
+   * @return number of bytes received, 0 if a TCP connection was closed by the peer, RN4_SOCKET_WOULD_BLOCK or
+   * RN4_SOCKET_ERROR
+   */
+  int recv(int fd, uint8_t* buf, int len);
+
+  /**
+   * Receive a datagram on a UDP socket, along with its source. Blocks for the AT command once one was announced
+   * @param out_remote_ip - output remote IP, can be nullptr. Buffer must be at least 40 bytes long
+   * @param out_remote_port - output remote port, can be nullptr
+   * @return number of bytes received, RN4_SOCKET_WOULD_BLOCK or RN4_SOCKET_ERROR
+   */
+  int recvfrom(int fd, uint8_t* buf, int len, str_mut* out_remote_ip, uint16_t* out_remote_port);
+
+  /**
+   * Close a socket, dropping the data not sent or received yet
+   * @return 0 on success, RN4_SOCKET_ERROR on failure
+   */
+  int close(int fd);
+
+  /**
+   * Wait until some of the sockets are ready. RN4_POLLERR and RN4_POLLHUP are always reported.
+   * @param fds - sockets and the events to wait for, revents is set on return
+   * @param nfds - number of entries in fds
+   * @param timeout_ms - maximum time to wait, 0 to just check
+   * @return number of entries with revents set, 0 on timeout
+   */
+  int poll(rn4_pollfd* fds, int nfds, owl_time_t timeout_ms);
+
+ private:
+  struct PendingAccept {
+    uint8_t fd;
+    uint16_t remote_port;
+    char remote_ip[40];
+    unsigned int remote_ip_len;
+  };
+
+  struct Socket {
+    bool in_use;
+    uso_protocol protocol;
+    bool connected;
+    bool listening;
+    bool hup;    // connection closed by the peer
+    bool error;  // a background send failed
+    PendingAccept backlog[RN4_SOCKETS_ACCEPT_BACKLOG];
+    int backlog_len;
+    str tx_data;
+  };
+
+  OwlModemSocketRN4* socket_;
+  OwlModemATBase* at_;
+  Socket sockets_[MODEM_MAX_SOCKETS] = {};
+  bool close_pending_[MODEM_MAX_SOCKETS] = {};  // connections refused on a full backlog, closed outside the URC
+  uint8_t rx_buffer_[MODEM_MAX_SOCKETS][RN4_SOCKETS_RX_BUFFER_SIZE];
+  uint8_t tx_buffer_[MODEM_MAX_SOCKETS][RN4_SOCKETS_TX_BUFFER_SIZE];
+
+  Socket* get(int fd);
+  void setUp(uint8_t fd, uso_protocol protocol);
+  short readiness(int fd);
+  void closeRefused();
+
+  static void socketClosedHandler(uint8_t socket, void* priv);
+  static void tcpAcceptHandler(uint8_t new_socket, str remote_ip, uint16_t remote_port, uint8_t listening_socket,
+                               str local_ip, uint16_t local_port, void* priv);
+  static void streamSentHandler(uint8_t socket, uint32_t bytes_sent, bool success, void* priv);
+};
+
+#endif  // __RN4_SOCKETS_H__
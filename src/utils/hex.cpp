@@ -0,0 +1,285 @@
+/*
+ * hex.cpp
+ * Twilio Breakout SDK
+ *
+ * Copyright (c) 2018 Twilio, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file hex.cpp - HEX encoding and decoding of binary data
+ *
+ * Scalar code is table-driven. On hosts with SSE2, AVX2 or AArch64 NEON (as enabled by the compiler flags) whole
+ * blocks are converted with vector instructions and the tables only handle the tail. Define OWL_HEX_SCALAR to build
+ * the scalar code only.
+ */
+
+#include "str.h"
+
+#if !defined(OWL_HEX_SCALAR) && defined(__AVX2__)
+#include <immintrin.h>
+#define OWL_HEX_AVX2
+#elif !defined(OWL_HEX_SCALAR) && defined(__SSE2__)
+#include <emmintrin.h>
+#define OWL_HEX_SSE2
+#elif !defined(OWL_HEX_SCALAR) && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define OWL_HEX_NEON
+#endif
+
+/* Value of a HEX digit, -1 for other characters */
+static const int8_t hex_value[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+/* HEX representation of every byte value */
+static const char hex_pairs[] =
+    "0001020304050607"
+    "08090a0b0c0d0e0f"
+    "1011121314151617"
+    "18191a1b1c1d1e1f"
+    "2021222324252627"
+    "28292a2b2c2d2e2f"
+    "3031323334353637"
+    "38393a3b3c3d3e3f"
+    "4041424344454647"
+    "48494a4b4c4d4e4f"
+    "5051525354555657"
+    "58595a5b5c5d5e5f"
+    "6061626364656667"
+    "68696a6b6c6d6e6f"
+    "7071727374757677"
+    "78797a7b7c7d7e7f"
+    "8081828384858687"
+    "88898a8b8c8d8e8f"
+    "9091929394959697"
+    "98999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7"
+    "a8a9aaabacadaeaf"
+    "b0b1b2b3b4b5b6b7"
+    "b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7"
+    "c8c9cacbcccdcecf"
+    "d0d1d2d3d4d5d6d7"
+    "d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7"
+    "e8e9eaebecedeeef"
+    "f0f1f2f3f4f5f6f7"
+    "f8f9fafbfcfdfeff";
+
+int hex_to_int(char c) {
+  return hex_value[(uint8_t)c];
+}
+
+#if defined(OWL_HEX_AVX2)
+
+/* 32 bytes in, 64 characters out per block */
+static unsigned int hex_encode_blocks(char *dst, const uint8_t *src, unsigned int len) {
+  const __m256i lut  = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+                                        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+  const __m256i mask = _mm256_set1_epi8(0x0F);
+  unsigned int i;
+
+  for (i = 0; i + 32 <= len; i += 32) {
+    __m256i v  = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+    __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, mask));
+    // unpack interleaves within 128-bit lanes, put the lanes back in order
+    __m256i a = _mm256_unpacklo_epi8(hi, lo);
+    __m256i b = _mm256_unpackhi_epi8(hi, lo);
+    _mm256_storeu_si256((__m256i *)(dst + 2 * i), _mm256_permute2x128_si256(a, b, 0x20));
+    _mm256_storeu_si256((__m256i *)(dst + 2 * i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+  }
+  return i;
+}
+
+/* 64 characters in, 32 bytes out per block. Stops before the first block with a non-HEX character */
+static unsigned int hex_decode_blocks(uint8_t *dst, const char *src, unsigned int len) {
+  const __m256i zero    = _mm256_setzero_si256();
+  const __m256i weights = _mm256_set1_epi16(0x0110);  // high nibble * 16 + low nibble * 1
+  unsigned int i;
+
+  for (i = 0; i + 32 <= len; i += 32) {
+    __m256i res[2];
+
+    for (int k = 0; k < 2; k++) {
+      __m256i c      = _mm256_loadu_si256((const __m256i *)(src + 2 * i + 32 * k));
+      __m256i d      = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+      __m256i l      = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+      __m256i digit  = _mm256_andnot_si256(_mm256_cmpgt_epi8(zero, d), _mm256_cmpgt_epi8(_mm256_set1_epi8(10), d));
+      __m256i letter = _mm256_andnot_si256(_mm256_cmpgt_epi8(zero, l), _mm256_cmpgt_epi8(_mm256_set1_epi8(6), l));
+
+      if (_mm256_movemask_epi8(_mm256_or_si256(digit, letter)) != -1) {
+        return i;
+      }
+      __m256i v = _mm256_or_si256(_mm256_and_si256(digit, d),
+                                  _mm256_and_si256(letter, _mm256_add_epi8(l, _mm256_set1_epi8(10))));
+      res[k] = _mm256_maddubs_epi16(v, weights);
+    }
+    // pack works within 128-bit lanes, put the quadwords back in order
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(res[0], res[1]), 0xD8);
+    _mm256_storeu_si256((__m256i *)(dst + i), packed);
+  }
+  return i;
+}
+
+#elif defined(OWL_HEX_SSE2)
+
+static inline __m128i hex_nibble_chars(__m128i n) {
+  // '0' + n, plus the distance to 'a' for n > 9
+  __m128i over9 = _mm_cmpgt_epi8(n, _mm_set1_epi8(9));
+  return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), _mm_and_si128(over9, _mm_set1_epi8('a' - '0' - 10)));
+}
+
+/* 16 bytes in, 32 characters out per block */
+static unsigned int hex_encode_blocks(char *dst, const uint8_t *src, unsigned int len) {
+  const __m128i mask = _mm_set1_epi8(0x0F);
+  unsigned int i;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    __m128i v  = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i hi = hex_nibble_chars(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+    __m128i lo = hex_nibble_chars(_mm_and_si128(v, mask));
+    _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i *)(dst + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+  return i;
+}
+
+/* 32 characters in, 16 bytes out per block. Stops before the first block with a non-HEX character */
+static unsigned int hex_decode_blocks(uint8_t *dst, const char *src, unsigned int len) {
+  const __m128i zero       = _mm_setzero_si128();
+  const __m128i low_byte   = _mm_set1_epi16(0x00FF);
+  unsigned int i;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    __m128i res[2];
+
+    for (int k = 0; k < 2; k++) {
+      __m128i c      = _mm_loadu_si128((const __m128i *)(src + 2 * i + 16 * k));
+      __m128i d      = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+      __m128i l      = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+      __m128i digit  = _mm_andnot_si128(_mm_cmplt_epi8(d, zero), _mm_cmplt_epi8(d, _mm_set1_epi8(10)));
+      __m128i letter = _mm_andnot_si128(_mm_cmplt_epi8(l, zero), _mm_cmplt_epi8(l, _mm_set1_epi8(6)));
+
+      if (_mm_movemask_epi8(_mm_or_si128(digit, letter)) != 0xFFFF) {
+        return i;
+      }
+      __m128i v = _mm_or_si128(_mm_and_si128(digit, d), _mm_and_si128(letter, _mm_add_epi8(l, _mm_set1_epi8(10))));
+      // little endian words hold [high nibble, low nibble] pairs
+      res[k] = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, low_byte), 4), _mm_srli_epi16(v, 8));
+    }
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(res[0], res[1]));
+  }
+  return i;
+}
+
+#elif defined(OWL_HEX_NEON)
+
+/* 16 bytes in, 32 characters out per block */
+static unsigned int hex_encode_blocks(char *dst, const uint8_t *src, unsigned int len) {
+  static const uint8_t digits[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
+  const uint8x16_t lut            = vld1q_u8(digits);
+  unsigned int i;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    uint8x16_t v = vld1q_u8(src + i);
+    uint8x16x2_t out;
+    out.val[0] = vqtbl1q_u8(lut, vshrq_n_u8(v, 4));
+    out.val[1] = vqtbl1q_u8(lut, vandq_u8(v, vdupq_n_u8(0x0F)));
+    vst2q_u8((uint8_t *)dst + 2 * i, out);
+  }
+  return i;
+}
+
+static inline uint8x16_t hex_nibble_values(uint8x16_t c, uint8x16_t *valid) {
+  uint8x16_t d      = vsubq_u8(c, vdupq_n_u8('0'));
+  uint8x16_t l      = vsubq_u8(vorrq_u8(c, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+  uint8x16_t digit  = vcltq_u8(d, vdupq_n_u8(10));
+  uint8x16_t letter = vcltq_u8(l, vdupq_n_u8(6));
+
+  *valid = vandq_u8(*valid, vorrq_u8(digit, letter));
+  return vbslq_u8(digit, d, vaddq_u8(l, vdupq_n_u8(10)));
+}
+
+/* 32 characters in, 16 bytes out per block. Stops before the first block with a non-HEX character */
+static unsigned int hex_decode_blocks(uint8_t *dst, const char *src, unsigned int len) {
+  unsigned int i;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    uint8x16x2_t c   = vld2q_u8((const uint8_t *)src + 2 * i);  // deinterleaves high and low nibble characters
+    uint8x16_t valid = vdupq_n_u8(0xFF);
+    uint8x16_t hi    = hex_nibble_values(c.val[0], &valid);
+    uint8x16_t lo    = hex_nibble_values(c.val[1], &valid);
+
+    if (vminvq_u8(valid) != 0xFF) {
+      return i;
+    }
+    vst1q_u8(dst + i, vorrq_u8(vshlq_n_u8(hi, 4), lo));
+  }
+  return i;
+}
+
+#else
+
+static unsigned int hex_encode_blocks(char *dst, const uint8_t *src, unsigned int len) {
+  return 0;
+}
+
+static unsigned int hex_decode_blocks(uint8_t *dst, const char *src, unsigned int len) {
+  return 0;
+}
+
+#endif
+
+unsigned int hex_to_str(char *dst, unsigned int max_dst_len, str src) {
+  if (src.len % 2 != 0) return 0;
+
+  unsigned int len = (src.len / 2 < max_dst_len) ? src.len / 2 : max_dst_len;
+  // blocks are written behind the characters they are read from, so decoding in place (dst == src.s) is fine
+  unsigned int i = hex_decode_blocks((uint8_t *)dst, src.s, len);
+
+  for (; i < len; i++) {
+    int hn = hex_value[(uint8_t)src.s[2 * i]];
+    int ln = hex_value[(uint8_t)src.s[2 * i + 1]];
+    if ((hn | ln) < 0) return 0;
+    *((uint8_t *)(dst + i)) = (hn << 4) | ln;
+  }
+  return len;
+}
+
+unsigned int str_to_hex(char *dst, unsigned int max_dst_len, str src) {
+  unsigned int len = (src.len < max_dst_len / 2) ? src.len : max_dst_len / 2;
+  unsigned int i   = hex_encode_blocks(dst, (const uint8_t *)src.s, len);
+
+  for (; i < len; i++) {
+    memcpy(dst + 2 * i, hex_pairs + 2 * *((uint8_t *)src.s + i), 2);
+  }
+  return 2 * len;
+}
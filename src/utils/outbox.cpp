@@ -0,0 +1,274 @@
+/*
+ * outbox.cpp
+ * Twilio Breakout SDK
+ *
+ * Copyright (c) 2018 Twilio, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file outbox.cpp - store-and-forward queue of messages in fixed-size records over caller-provided storage
+ */
+
+#include "outbox.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#define OUTBOX_MAGIC 0x58424F4Fu  // "OOBX"
+
+/* Record states. Zero-filled storage holds only free records */
+#define RECORD_FREE 0x00
+#define RECORD_PENDING 0x5A
+#define RECORD_SENDING 0xA5
+
+/* CRC-32 (IEEE 802.3), a nibble at a time to keep the table small */
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len) {
+  static const uint32_t table[16] = {0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+                                     0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+                                     0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+  crc = ~crc;
+  for (uint32_t i = 0; i < len; i++) {
+    crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+    crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+static uint32_t header_crc(const owl_outbox_header *header) {
+  return crc32_update(0, (const uint8_t *)header, offsetof(owl_outbox_header, crc));
+}
+
+static uint32_t record_crc(const owl_outbox_record *record) {
+  uint32_t crc = crc32_update(0, (const uint8_t *)&record->seq, sizeof(record->seq));
+  crc          = crc32_update(crc, &record->priority, offsetof(owl_outbox_record, crc) -
+                                                           offsetof(owl_outbox_record, priority));
+  return crc32_update(crc, (const uint8_t *)(record + 1), record->topic_len + 1 + record->data_len);
+}
+
+static owl_outbox_record *record_at(const owl_outbox *outbox, int index) {
+  return (owl_outbox_record *)(outbox->records + index * outbox->header->record_size);
+}
+
+static void sync_range(owl_outbox *outbox, const void *addr, uint32_t len) {
+  if (outbox->sync != nullptr) {
+    outbox->sync(addr, len, outbox->sync_priv);
+  }
+}
+
+static void set_state(owl_outbox *outbox, owl_outbox_record *record, uint8_t state) {
+  record->state = state;
+  sync_range(outbox, &record->state, sizeof(record->state));
+}
+
+/* Recompute the counters from the records, after opening or removing the oldest one */
+static void update_tail(owl_outbox *outbox) {
+  bool found = false;
+
+  outbox->tail = outbox->head;
+  for (uint32_t i = 0; i < outbox->header->record_count; i++) {
+    owl_outbox_record *record = record_at(outbox, i);
+    if (record->state != RECORD_FREE && (!found || (int32_t)(record->seq - outbox->tail) < 0)) {
+      outbox->tail = record->seq;
+      found        = true;
+    }
+  }
+}
+
+bool owl_outbox_init(owl_outbox *outbox, uint8_t *storage, uint32_t size, uint32_t record_size,
+                     owl_outbox_retention retention, owl_outbox_sync_f sync, void *sync_priv) {
+  if (size < sizeof(owl_outbox_header) + record_size || record_size <= sizeof(owl_outbox_record) + 1 ||
+      (record_size & 3) != 0) {
+    return false;
+  }
+
+  outbox->header    = (owl_outbox_header *)storage;
+  outbox->records   = storage + sizeof(owl_outbox_header);
+  outbox->retention = retention;
+  outbox->sync      = sync;
+  outbox->sync_priv = sync_priv;
+  outbox->head      = 0;
+  outbox->tail      = 0;
+  outbox->count     = 0;
+
+  owl_outbox_header *header = outbox->header;
+  uint32_t record_count     = (size - sizeof(owl_outbox_header)) / record_size;
+  if (header->magic != OUTBOX_MAGIC || header->record_size != record_size || header->record_count != record_count ||
+      header->crc != header_crc(header)) {
+    // New storage or a different geometry, start over
+    header->magic        = OUTBOX_MAGIC;
+    header->record_size  = record_size;
+    header->record_count = record_count;
+    header->crc          = header_crc(header);
+    for (uint32_t i = 0; i < record_count; i++) {
+      record_at(outbox, i)->state = RECORD_FREE;
+    }
+    sync_range(outbox, storage, sizeof(owl_outbox_header) + record_count * record_size);
+    return true;
+  }
+
+  // Keep the intact records, those being sent when the storage was left are sent again
+  bool found = false;
+  for (uint32_t i = 0; i < record_count; i++) {
+    owl_outbox_record *record = record_at(outbox, i);
+    if (record->state == RECORD_FREE) {
+      continue;
+    }
+    if ((record->state != RECORD_PENDING && record->state != RECORD_SENDING) ||
+        (uint32_t)record->topic_len + 1 + record->data_len > record_size - sizeof(owl_outbox_record) ||
+        record->crc != record_crc(record)) {
+      set_state(outbox, record, RECORD_FREE);
+      continue;
+    }
+    if (record->state == RECORD_SENDING) {
+      set_state(outbox, record, RECORD_PENDING);
+    }
+    if (!found || (int32_t)(record->seq - outbox->head) >= 0) {
+      outbox->head = record->seq + 1;
+      found        = true;
+    }
+    outbox->count++;
+  }
+  update_tail(outbox);
+
+  return true;
+}
+
+/* Free record, or the one to drop to make room for a message of the given priority, -1 if none */
+static int find_slot(owl_outbox *outbox, uint8_t priority) {
+  int victim = -1;
+
+  for (uint32_t i = 0; i < outbox->header->record_count; i++) {
+    owl_outbox_record *record = record_at(outbox, i);
+    if (record->state == RECORD_FREE) {
+      return i;
+    }
+    if (outbox->retention != owl_outbox_retention::DropOldest || record->state != RECORD_PENDING ||
+        record->priority > priority) {
+      continue;
+    }
+
+    // Lowest priority first, then the oldest
+    owl_outbox_record *current = (victim >= 0) ? record_at(outbox, victim) : nullptr;
+    if (current == nullptr || record->priority < current->priority ||
+        (record->priority == current->priority && (int32_t)(record->seq - current->seq) < 0)) {
+      victim = i;
+    }
+  }
+
+  if (victim >= 0) {
+    owl_outbox_remove(outbox, victim);
+  }
+  return victim;
+}
+
+bool owl_outbox_push(owl_outbox *outbox, str topic, str data, uint8_t qos, bool retain, uint8_t priority) {
+  if (topic.len + data.len > owl_outbox_max_message(outbox)) {
+    return false;
+  }
+
+  int index = find_slot(outbox, priority);
+  if (index < 0) {
+    return false;
+  }
+
+  // Content first, then the state: a record torn by a power loss stays free or fails its CRC
+  owl_outbox_record *record = record_at(outbox, index);
+  uint8_t *body             = (uint8_t *)(record + 1);
+  record->seq               = outbox->head;
+  record->priority          = priority;
+  record->qos               = qos;
+  record->retain            = retain ? 1 : 0;
+  record->topic_len         = topic.len;
+  record->data_len          = data.len;
+  memcpy(body, topic.s, topic.len);
+  body[topic.len] = 0;
+  memcpy(body + topic.len + 1, data.s, data.len);
+  record->crc = record_crc(record);
+  sync_range(outbox, record, sizeof(owl_outbox_record) + topic.len + 1 + data.len);
+
+  set_state(outbox, record, RECORD_PENDING);
+
+  if (outbox->count == 0) {
+    outbox->tail = outbox->head;
+  }
+  outbox->head++;
+  outbox->count++;
+  return true;
+}
+
+int owl_outbox_next(const owl_outbox *outbox) {
+  int next = -1;
+
+  for (uint32_t i = 0; i < outbox->header->record_count; i++) {
+    owl_outbox_record *record = record_at(outbox, i);
+    if (record->state != RECORD_PENDING) {
+      continue;
+    }
+
+    owl_outbox_record *current = (next >= 0) ? record_at(outbox, next) : nullptr;
+    if (current == nullptr || record->priority > current->priority ||
+        (record->priority == current->priority && (int32_t)(record->seq - current->seq) < 0)) {
+      next = i;
+    }
+  }
+  return next;
+}
+
+bool owl_outbox_get(const owl_outbox *outbox, int index, str *topic, str *data, uint8_t *qos, bool *retain) {
+  if (index < 0 || (uint32_t)index >= outbox->header->record_count) {
+    return false;
+  }
+
+  owl_outbox_record *record = record_at(outbox, index);
+  if (record->state == RECORD_FREE) {
+    return false;
+  }
+
+  const char *body = (const char *)(record + 1);
+  if (topic) *topic = {.s = body, .len = record->topic_len};
+  if (data) *data = {.s = body + record->topic_len + 1, .len = record->data_len};
+  if (qos) *qos = record->qos;
+  if (retain) *retain = (record->retain != 0);
+  return true;
+}
+
+void owl_outbox_set_sending(owl_outbox *outbox, int index, bool sending) {
+  if (index < 0 || (uint32_t)index >= outbox->header->record_count) {
+    return;
+  }
+
+  owl_outbox_record *record = record_at(outbox, index);
+  if (record->state != RECORD_FREE) {
+    set_state(outbox, record, sending ? RECORD_SENDING : RECORD_PENDING);
+  }
+}
+
+void owl_outbox_remove(owl_outbox *outbox, int index) {
+  if (index < 0 || (uint32_t)index >= outbox->header->record_count) {
+    return;
+  }
+
+  owl_outbox_record *record = record_at(outbox, index);
+  if (record->state == RECORD_FREE) {
+    return;
+  }
+
+  set_state(outbox, record, RECORD_FREE);
+  outbox->count--;
+  if (record->seq == outbox->tail) {
+    update_tail(outbox);
+  }
+}
@@ -0,0 +1,130 @@
+/*
+ * outbox.h
+ * Twilio Breakout SDK
+ *
+ * Copyright (c) 2018 Twilio, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file outbox.h - store-and-forward queue of messages in fixed-size records over caller-provided storage
+ */
+
+#ifndef __OWL_UTILS_OUTBOX_H__
+#define __OWL_UTILS_OUTBOX_H__
+
+#include <stdint.h>
+
+#include "str.h"
+
+/*
+ * The storage is meant to survive resets, e.g. a memory-mapped file or a battery-backed RAM region. It starts with a
+ * header describing its geometry, followed by the records. Each record has a CRC over its content, so that records
+ * torn by a power loss are dropped when the outbox is opened again.
+ *
+ * Messages are taken out by priority, then in the order they were pushed (head/tail are the newest and oldest
+ * sequence numbers stored). When the outbox is full, the retention policy decides whether the new message is
+ * rejected or replaces the oldest message of the lowest priority (never a higher priority one).
+ */
+
+enum class owl_outbox_retention {
+  RejectNew,
+  DropOldest,
+};
+
+typedef struct {
+  uint32_t magic;
+  uint32_t record_size;
+  uint32_t record_count;
+  uint32_t crc;  // of the fields above
+} owl_outbox_header;
+
+/* Record, followed by the topic, its terminating 0 and the data */
+typedef struct {
+  uint32_t seq;
+  uint8_t state;  // not covered by the CRC, changes in place
+  uint8_t priority;
+  uint8_t qos;
+  uint8_t retain;
+  uint16_t topic_len;
+  uint16_t data_len;
+  uint32_t crc;
+} owl_outbox_record;
+
+typedef void (*owl_outbox_sync_f)(const void *addr, uint32_t len, void *priv);
+
+typedef struct {
+  owl_outbox_header *header;
+  uint8_t *records;
+  owl_outbox_retention retention;
+  owl_outbox_sync_f sync;
+  void *sync_priv;
+  uint32_t head;   // next sequence number
+  uint32_t tail;   // oldest sequence number stored
+  uint32_t count;  // records stored
+} owl_outbox;
+
+/**
+ * Open the outbox on the given storage. Valid records left from before are kept, otherwise the storage is formatted.
+ * @param outbox - outbox to initialize
+ * @param storage - storage, must stay valid as long as the outbox is used. 4-byte aligned
+ * @param size - size of the storage
+ * @param record_size - size of a record, including its header. A multiple of 4
+ * @param retention - what to do when the outbox is full
+ * @param sync - optional, called after each change to make it persistent (e.g. msync), with the changed range
+ * @param sync_priv - private data for sync
+ * @return - false if the storage can't hold at least one record
+ */
+bool owl_outbox_init(owl_outbox *outbox, uint8_t *storage, uint32_t size, uint32_t record_size,
+                     owl_outbox_retention retention = owl_outbox_retention::DropOldest,
+                     owl_outbox_sync_f sync = nullptr, void *sync_priv = nullptr);
+
+/* Largest topic + data that fits in a record */
+static inline uint32_t owl_outbox_max_message(const owl_outbox *outbox) {
+  return outbox->header->record_size - sizeof(owl_outbox_record) - 1;
+}
+
+static inline uint32_t owl_outbox_count(const owl_outbox *outbox) {
+  return outbox->count;
+}
+
+/**
+ * Store a message
+ * @return - false if it doesn't fit in a record, or the outbox is full and the retention policy kept the old ones
+ */
+bool owl_outbox_push(owl_outbox *outbox, str topic, str data, uint8_t qos, bool retain, uint8_t priority = 0);
+
+/**
+ * Find the next message to send: highest priority first, oldest first. Messages being sent are skipped.
+ * @return - record index, -1 if there is nothing to send
+ */
+int owl_outbox_next(const owl_outbox *outbox);
+
+/**
+ * Get a stored message. The strings point into the storage, valid until the record is removed
+ * @param topic - output topic, 0-terminated
+ * @return - false if there is no message at this index
+ */
+bool owl_outbox_get(const owl_outbox *outbox, int index, str *topic, str *data, uint8_t *qos, bool *retain);
+
+/**
+ * Mark a message as being sent, or back as waiting if sending failed. Messages being sent are not dropped to make
+ * room, and go back to waiting when the outbox is opened again.
+ */
+void owl_outbox_set_sending(owl_outbox *outbox, int index, bool sending);
+
+/* Remove a message, once it was delivered */
+void owl_outbox_remove(owl_outbox *outbox, int index);
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * ring.cpp
+ * Twilio Breakout SDK
+ *
+ * Copyright (c) 2018 Twilio, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file ring.cpp - byte ring buffer over caller-provided storage
+ */
+
+#include "ring.h"
+
+#include <string.h>
+
+void owl_ring_init(owl_ring *ring, uint8_t *buf, uint32_t size) {
+  ring->buf  = buf;
+  ring->size = (buf != nullptr) ? size : 0;
+  ring->head = 0;
+  ring->len  = 0;
+}
+
+uint32_t owl_ring_write(owl_ring *ring, const uint8_t *data, uint32_t len) {
+  if (len > owl_ring_free(ring)) {
+    len = owl_ring_free(ring);
+  }
+  if (len == 0) {
+    return 0;
+  }
+
+  // At most two copies: up to the end of the storage, then from its start
+  uint32_t tail  = (ring->head + ring->len) % ring->size;
+  uint32_t first = ring->size - tail;
+  if (first > len) {
+    first = len;
+  }
+  memcpy(ring->buf + tail, data, first);
+  memcpy(ring->buf, data + first, len - first);
+
+  ring->len += len;
+  return len;
+}
+
+uint32_t owl_ring_read(owl_ring *ring, uint8_t *out, uint32_t max_len) {
+  uint32_t len = (max_len < ring->len) ? max_len : ring->len;
+  if (len == 0) {
+    return 0;
+  }
+
+  uint32_t first = ring->size - ring->head;
+  if (first > len) {
+    first = len;
+  }
+  if (out != nullptr) {
+    memcpy(out, ring->buf + ring->head, first);
+    memcpy(out + first, ring->buf, len - first);
+  }
+
+  ring->head = (ring->head + len) % ring->size;
+  ring->len -= len;
+  return len;
+}
@@ -0,0 +1,65 @@
+/*
+ * ring.h
+ * Twilio Breakout SDK
+ *
+ * Copyright (c) 2018 Twilio, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file ring.h - byte ring buffer over caller-provided storage
+ */
+
+#ifndef __OWL_UTILS_RING_H__
+#define __OWL_UTILS_RING_H__
+
+#include <stdint.h>
+
+typedef struct {
+  uint8_t *buf;
+  uint32_t size;
+  uint32_t head;  // position of the oldest byte
+  uint32_t len;   // number of bytes stored
+} owl_ring;
+
+/**
+ * Initialize an empty ring on the given storage
+ * @param ring - ring to initialize
+ * @param buf - storage, must stay valid as long as the ring is used. Can be nullptr for a ring without storage
+ * @param size - size of the storage
+ */
+void owl_ring_init(owl_ring *ring, uint8_t *buf, uint32_t size);
+
+static inline uint32_t owl_ring_used(const owl_ring *ring) {
+  return ring->len;
+}
+
+static inline uint32_t owl_ring_free(const owl_ring *ring) {
+  return ring->size - ring->len;
+}
+
+/**
+ * Append data to the ring
+ * @return - number of bytes stored, less than len if the ring got full
+ */
+uint32_t owl_ring_write(owl_ring *ring, const uint8_t *data, uint32_t len);
+
+/**
+ * Take the oldest data out of the ring
+ * @param out - output buffer, nullptr to drop the data
+ * @return - number of bytes taken, up to max_len
+ */
+uint32_t owl_ring_read(owl_ring *ring, uint8_t *out, uint32_t max_len);
+
+#endif
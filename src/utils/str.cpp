@@ -25,6 +25,7 @@
 
 #include <stdlib.h>
 #include <ctype.h>
+#include <limits.h>
 
 void str_skipover_prefix(str *x, str prefix) {
   if (!x) return;
@@ -34,93 +35,62 @@ void str_skipover_prefix(str *x, str prefix) {
   }
 }
 
-int str_tok(str src, const char *sep, str *dst) {
-  unsigned int i, j, is_sep, sep_len;
-  unsigned int start;
-  if (!src.len || !sep || !dst) return 0;
-  sep_len = strlen(sep);
-  if (!sep_len) return 0;
-  if (dst->s) {
-    if (dst->s < src.s || dst->s > src.s + src.len || dst->s + dst->len > src.s + src.len) {
-      //      LOG(L_ERR, "The token parameter must either be an empty string on first call, or the last token!");
-      return 0;
-    }
+/* Separator test of a single character, compared directly instead of through a set built on every call */
+struct sep_char {
+  char c;
+  bool has(char x) const {
+    return x == c;
   }
-  if (!dst->s)
-    start = 0;
-  else
-    start = dst->s + dst->len - src.s;
-  for (i = start; i < src.len; i++) {
-    is_sep = 0;
-    for (j = 0; j < sep_len; j++)
-      if (src.s[i] == sep[j]) {
-        is_sep = 1;
-        break;
-      }
-    if (!is_sep) {
-      dst->s = src.s + i;
-      for (i = i + 1; i < src.len; i++) {
-        is_sep = 0;
-        for (j = 0; j < sep_len; j++)
-          if (src.s[i] == sep[j]) {
-            is_sep = 1;
-            break;
-          }
-        if (is_sep) break;
-      }
-      dst->len = src.s + i - dst->s;
-      return 1;
-    }
+};
+
+struct sep_set {
+  const str_sepset *set;
+  bool has(char x) const {
+    return str_sepset_has(set, x);
   }
-  return 0;
-}
+};
 
-int str_tok_with_empty_tokens(str src, const char *sep, str *dst) {
-  unsigned int i, j, is_sep, sep_len;
-  unsigned int start;
-  if (!src.len || !sep || !dst) return 0;
-  sep_len = strlen(sep);
-  if (!sep_len) return 0;
-  if (dst->s) {
-    if (dst->s < src.s || dst->s > src.s + src.len || dst->s + dst->len > src.s + src.len) {
-      //      LOG(L_ERR, "The token parameter must either be an empty string on first call, or the last token!");
-      return 0;
-    }
+/* Start of the next token search, or -1 if dst is neither empty nor the last token of src */
+static int tok_start(str src, const str *dst) {
+  if (!dst->s) return 0;
+  if (dst->s < src.s || dst->s > src.s + src.len || dst->s + dst->len > src.s + src.len) {
+    //      LOG(L_ERR, "The token parameter must either be an empty string on first call, or the last token!");
+    return -1;
   }
-  if (!dst->s)
-    start = 0;
-  else
-    start = dst->s + dst->len - src.s;
+  return dst->s + dst->len - src.s;
+}
+
+template <typename Sep>
+static int tok(str src, Sep sep, str *dst) {
+  unsigned int i;
+  int start = tok_start(src, dst);
+  if (start < 0) return 0;
+  for (i = start; i < src.len && sep.has(src.s[i]); i++)
+    ;
+  if (i >= src.len) return 0;
+  dst->s = src.s + i;
+  for (i = i + 1; i < src.len && !sep.has(src.s[i]); i++)
+    ;
+  dst->len = src.s + i - dst->s;
+  return 1;
+}
+
+template <typename Sep>
+static int tok_with_empty_tokens(str src, Sep sep, str *dst) {
+  unsigned int i;
+  int start = tok_start(src, dst);
+  if (start < 0) return 0;
   for (i = start; i < src.len; i++) {
-    is_sep = 0;
-    for (j = 0; j < sep_len; j++)
-      if (src.s[i] == sep[j]) {
-        is_sep = 1;
-        break;
-      }
-    if (!is_sep) {
+    if (!sep.has(src.s[i])) {
       dst->s = src.s + i;
-      for (i = i + 1; i < src.len; i++) {
-        is_sep = 0;
-        for (j = 0; j < sep_len; j++)
-          if (src.s[i] == sep[j]) {
-            is_sep = 1;
-            break;
-          }
-        if (is_sep) break;
-      }
+      for (i = i + 1; i < src.len && !sep.has(src.s[i]); i++)
+        ;
       dst->len = src.s + i - dst->s;
       return 1;
     } else {
       // peek at the next token and if separator, return empty token
       if (i + 1 >= src.len) return 0;
-      is_sep = 0;
-      for (j = 0; j < sep_len; j++)
-        if (src.s[i + 1] == sep[j]) {
-          is_sep = 1;
-          break;
-        }
-      if (is_sep) {
+      if (sep.has(src.s[i + 1])) {
         dst->s   = src.s + i + 1;
         dst->len = 0;
         return 1;
@@ -130,132 +100,226 @@ int str_tok_with_empty_tokens(str src, const char *sep, str *dst) {
   return 0;
 }
 
-long int str_to_long_int(str x, int base) {
-  char buf[65];
-  if (x.len > 64) {
-    //    LOG(L_ERR, "The give string is too long to convert - %d > 64\r\n", x.len);
-    return 0;
-  }
-  if (x.len > 1 && x.s[0] == '"' && x.s[x.len - 1] == '"') {
-    memcpy(buf, x.s + 1, x.len - 2);
-    buf[x.len - 2] = 0;
-  } else {
-    memcpy(buf, x.s, x.len);
-    buf[x.len] = 0;
+int str_tok(str src, const char *sep, str *dst) {
+  if (!src.len || !sep || !*sep || !dst) return 0;
+  if (!sep[1]) return tok(src, sep_char{sep[0]}, dst);
+  str_sepset set = str_sepset_make(sep);
+  return tok(src, sep_set{&set}, dst);
+}
+
+int str_tok_set(str src, const str_sepset *sep, str *dst) {
+  if (!src.len || !sep || !dst) return 0;
+  return tok(src, sep_set{sep}, dst);
+}
+
+int str_tok_with_empty_tokens(str src, const char *sep, str *dst) {
+  if (!src.len || !sep || !*sep || !dst) return 0;
+  if (!sep[1]) return tok_with_empty_tokens(src, sep_char{sep[0]}, dst);
+  str_sepset set = str_sepset_make(sep);
+  return tok_with_empty_tokens(src, sep_set{&set}, dst);
+}
+
+int str_tok_with_empty_tokens_set(str src, const str_sepset *sep, str *dst) {
+  if (!src.len || !sep || !dst) return 0;
+  return tok_with_empty_tokens(src, sep_set{sep}, dst);
+}
+
+int str_split(str src, const str_sepset *sep, unsigned int flags, str *fields, int max_fields) {
+  int num_fields     = 0;
+  unsigned int start = 0;
+  bool quoted        = false;
+  str_sepset stops;
+  unsigned int i;
+  if (!src.len || !sep || !fields) return 0;
+  // quotes are stops too, so that ordinary characters are skipped with a single lookup
+  stops = *sep;
+  if (flags & STR_SPLIT_QUOTES) stops.bits['"' >> 5] |= 1u << ('"' & 31);
+  for (i = 0; i <= src.len && num_fields < max_fields; i++) {
+    if (i < src.len) {
+      if (!str_sepset_has(&stops, src.s[i])) continue;
+      if (src.s[i] == '"' && (flags & STR_SPLIT_QUOTES)) {
+        quoted = !quoted;
+        continue;
+      }
+      if (quoted) continue;
+    }
+    // end of a field, at a separator or at the end of the string
+    if (i > start || (flags & STR_SPLIT_EMPTY_TOKENS)) {
+      fields[num_fields].s   = src.s + start;
+      fields[num_fields].len = i - start;
+      num_fields++;
+    }
+    start = i + 1;
   }
-  return strtol(buf, 0, base);
+  return num_fields;
 }
 
-uint32_t str_to_uint32_t(str x, int base) {
-  char buf[33];
-  if (x.len > 32) {
-    //    LOG(L_ERR, "The give string is too long to convert - %d > 32\r\n", x.len);
-    return 0;
+/* Skip leading blanks and an opening quote, as found around AT response parameters */
+static unsigned int str_number_start(str x, bool *quoted) {
+  unsigned int i = 0;
+  while (i < x.len && (x.s[i] == ' ' || x.s[i] == '\t'))
+    i++;
+  *quoted = (i < x.len && x.s[i] == '"');
+  return *quoted ? i + 1 : i;
+}
+
+/* Consume the closing quote, if the number was quoted */
+static unsigned int str_number_end(str x, unsigned int i, bool quoted) {
+  return (quoted && i < x.len && x.s[i] == '"') ? i + 1 : i;
+}
+
+static inline int str_digit_value(char c, int base) {
+  int v;
+  if (c >= '0' && c <= '9')
+    v = c - '0';
+  else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'z')
+    v = (c | 0x20) - 'a' + 10;
+  else
+    return -1;
+  return v < base ? v : -1;
+}
+
+/* Digits of an unsigned number, with the strtol rules for the base prefix */
+static unsigned int str_parse_digits(str x, unsigned int i, int base, uint64_t limit, uint64_t *out) {
+  unsigned int start;
+  uint64_t value = 0;
+  int v;
+
+  if ((base == 0 || base == 16) && i + 2 < x.len && x.s[i] == '0' && (x.s[i + 1] | 0x20) == 'x' &&
+      str_digit_value(x.s[i + 2], 16) >= 0) {
+    i += 2;
+    base = 16;
+  } else if (base == 0) {
+    base = (i + 1 < x.len && x.s[i] == '0') ? 8 : 10;
   }
-  if (x.len > 1 && x.s[0] == '"' && x.s[x.len - 1] == '"') {
-    memcpy(buf, x.s + 1, x.len - 2);
-    buf[x.len - 2] = 0;
-  } else {
-    memcpy(buf, x.s, x.len);
-    buf[x.len] = 0;
+  if (base < 2 || base > 36) return 0;
+
+  for (start = i; i < x.len && (v = str_digit_value(x.s[i], base)) >= 0; i++) {
+    if (value > (limit - v) / base) return 0;  // overflow
+    value = value * base + v;
   }
-  return strtoul(buf, 0, base);
+  if (i == start) return 0;
+
+  *out = value;
+  return i;
 }
 
-double str_to_double(str x) {
-  char buf[65];
-  if (x.len > 64) {
-    //    LOG(L_ERR, "The give string is too long to convert - %d > 64\n", x.len);
-    return 0;
+unsigned int str_parse_long(str x, int base, long int *out) {
+  bool quoted, negative = false;
+  uint64_t value;
+  unsigned int i = str_number_start(x, &quoted);
+
+  if (i < x.len && (x.s[i] == '-' || x.s[i] == '+')) {
+    negative = (x.s[i] == '-');
+    i++;
   }
-  memcpy(buf, x.s, x.len);
-  buf[x.len] = 0;
-  return strtod(buf, 0);
+  i = str_parse_digits(x, i, base, negative ? (uint64_t)LONG_MAX + 1 : (uint64_t)LONG_MAX, &value);
+  if (!i) return 0;
+
+  if (out) *out = negative ? (long int)(0 - value) : (long int)value;
+  return str_number_end(x, i, quoted);
 }
 
-void uint8_t_to_binary_str(uint8_t x, str_mut *dst, uint8_t precision) {
-  int ndx = 0;
-  if (precision == 0 || precision > 8) precision = 8;
-  for (ndx = 0; ndx <= (precision - 1); ndx++) {
-    dst->s[(precision - 1) - ndx] = ((x >> ndx) & 1) ? '1' : '0';
-  }
-  dst->len = precision;
+unsigned int str_parse_uint32(str x, int base, uint32_t *out) {
+  bool quoted;
+  uint64_t value;
+  unsigned int i = str_number_start(x, &quoted);
+
+  if (i < x.len && x.s[i] == '+') i++;
+  i = str_parse_digits(x, i, base, UINT32_MAX, &value);
+  if (!i) return 0;
+
+  if (out) *out = (uint32_t)value;
+  return str_number_end(x, i, quoted);
 }
 
-int hex_to_int(char c) {
-  switch (c) {
-    case '0':
-      return 0;
-    case '1':
-      return 1;
-    case '2':
-      return 2;
-    case '3':
-      return 3;
-    case '4':
-      return 4;
-    case '5':
-      return 5;
-    case '6':
-      return 6;
-    case '7':
-      return 7;
-    case '8':
-      return 8;
-    case '9':
-      return 9;
-    case 'A':
-    case 'a':
-      return 10;
-    case 'B':
-    case 'b':
-      return 11;
-    case 'C':
-    case 'c':
-      return 12;
-    case 'D':
-    case 'd':
-      return 13;
-    case 'E':
-    case 'e':
-      return 14;
-    case 'F':
-    case 'f':
-      return 15;
-    default:
-      return -1;
+/* Powers of ten up to 1e22 are exact in a double, so fixed-point values are converted with a single rounding */
+static const double str_pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+unsigned int str_parse_double(str x, double *out) {
+  bool quoted, negative = false;
+  uint64_t mantissa = 0;
+  int digits = 0, exponent = 0;
+  unsigned int i = str_number_start(x, &quoted);
+  unsigned int start;
+  double value;
+
+  if (i < x.len && (x.s[i] == '-' || x.s[i] == '+')) {
+    negative = (x.s[i] == '-');
+    i++;
   }
-  return -1;
-}
 
-unsigned int hex_to_str(char *dst, unsigned int max_dst_len, str src) {
-  unsigned int len = 0;
-  int hn, ln;
-  unsigned int i;
-  if (src.len % 2 != 0) return 0;
-  for (i = 0; i < src.len && i < max_dst_len * 2; i += 2) {
-    hn = hex_to_int(src.s[i]) * 16;
-    if (hn < 0) goto error;
-    ln = hex_to_int(src.s[i + 1]);
-    if (ln < 0) goto error;
-    *((uint8_t *)(dst + len)) = hn + ln;
-    len++;
+  start = i;
+  for (; i < x.len && x.s[i] >= '0' && x.s[i] <= '9'; i++) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (x.s[i] - '0');
+      if (mantissa) digits++;
+    } else {
+      exponent++;  // beyond the precision of the mantissa
+    }
   }
-  return len;
-error:
-  return 0;
+  if (i < x.len && x.s[i] == '.') {
+    for (i++; i < x.len && x.s[i] >= '0' && x.s[i] <= '9'; i++) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (x.s[i] - '0');
+        if (mantissa) digits++;
+        exponent--;
+      }
+    }
+  }
+  if (i == start || (i == start + 1 && x.s[start] == '.')) return 0;
+
+  if (i + 1 < x.len && (x.s[i] | 0x20) == 'e') {
+    long int e;
+    unsigned int used = str_parse_long({.s = x.s + i + 1, .len = x.len - i - 1}, 10, &e);
+    // only plain digits with an optional sign, no blanks or quotes
+    if (used && x.s[i + 1] != ' ' && x.s[i + 1] != '\t' && x.s[i + 1] != '"' && e > -1000 && e < 1000) {
+      exponent += e;
+      i += 1 + used;
+    }
+  }
+
+  value = (double)mantissa;
+  while (exponent > 22) {
+    value *= 1e22;
+    exponent -= 22;
+  }
+  while (exponent < -22) {
+    value /= 1e22;
+    exponent += 22;
+  }
+  value = (exponent < 0) ? value / str_pow10[-exponent] : value * str_pow10[exponent];
+
+  if (out) *out = negative ? -value : value;
+  return str_number_end(x, i, quoted);
+}
+
+long int str_to_long_int(str x, int base) {
+  long int value = 0;
+  str_parse_long(x, base, &value);
+  return value;
 }
 
-static char hex_char[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
+uint32_t str_to_uint32_t(str x, int base) {
+  uint32_t value = 0;
+  str_parse_uint32(x, base, &value);
+  return value;
+}
 
-unsigned int str_to_hex(char *dst, unsigned int max_dst_len, str src) {
-  unsigned int len = 0;
-  unsigned int i;
-  for (i = 0; i < src.len && len < max_dst_len; i++) {
-    dst[len++] = hex_char[(*((uint8_t *)src.s + i) >> 4) & 0x0F];
-    dst[len++] = hex_char[(*((uint8_t *)src.s + i)) & 0x0F];
+double str_to_double(str x) {
+  double value = 0;
+  str_parse_double(x, &value);
+  return value;
+}
+
+void uint8_t_to_binary_str(uint8_t x, str_mut *dst, uint8_t precision) {
+  int ndx = 0;
+  if (precision == 0 || precision > 8) precision = 8;
+  for (ndx = 0; ndx <= (precision - 1); ndx++) {
+    dst->s[(precision - 1) - ndx] = ((x >> ndx) & 1) ? '1' : '0';
   }
-  return len;
+  dst->len = precision;
 }
 
 int str_find(str x, str y) {
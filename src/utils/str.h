@@ -63,9 +63,59 @@ typedef struct {
 #define str_equalcase_prefix(a, p) ((a).len >= (p).len && strncasecmp((a).s, (p).s, (p).len) == 0)
 #define str_equalcase_prefix_char(a, p) ((a).len >= strlen(p) && strncasecmp((a).s, (p), strlen(p)) == 0)
 
+/* Set of separator characters, a 256-bit map looked up in constant time. Build it once, with str_sepset_make. */
+typedef struct {
+  uint32_t bits[8];
+} str_sepset;
+
+static constexpr str_sepset str_sepset_make(const char *sep) {
+  str_sepset set = {};
+  for (; *sep; sep++) {
+    set.bits[(uint8_t)*sep >> 5] |= 1u << ((uint8_t)*sep & 31);
+  }
+  return set;
+}
+
+static inline bool str_sepset_has(const str_sepset *set, char c) {
+  return (set->bits[(uint8_t)c >> 5] >> ((uint8_t)c & 31)) & 1;
+}
+
 void str_skipover_prefix(str *x, str prefix);
+/* The _set variants take a separator set built once, e.g. a static one, the others build it on every call unless the
+ * separator is a single character */
 int str_tok(str src, const char *sep, str *dst);
+int str_tok_set(str src, const str_sepset *sep, str *dst);
 int str_tok_with_empty_tokens(str src, const char *sep, str *dst);
+int str_tok_with_empty_tokens_set(str src, const str_sepset *sep, str *dst);
+
+#define STR_SPLIT_EMPTY_TOKENS 1 /* every separator ends a field, so adjacent separators give empty fields */
+#define STR_SPLIT_QUOTES 2       /* separators between double quotes don't split, the quotes stay in the field */
+
+/**
+ * Split a string into fields in one pass, e.g. the parameters of an AT response.
+ * @param src - string to split
+ * @param sep - separators
+ * @param flags - STR_SPLIT_* flags
+ * @param fields - output array of fields, pointing into src
+ * @param max_fields - size of the fields array, splitting stops when it is full
+ * @return - number of fields stored
+ */
+int str_split(str src, const str_sepset *sep, unsigned int flags, str *fields, int max_fields);
+
+/**
+ * Parse a number at the start of x, in place. Leading blanks and double quotes around the number are skipped.
+ * Parsing is independent of the locale.
+ * @param x - input
+ * @param base - 2 to 36, or 0 to pick it from the prefix like strtol ("0x" for 16, "0" for 8)
+ * @param out - parsed value, not touched on error
+ * @return - number of characters consumed, including the quotes, or 0 if there is no number or it overflows
+ */
+unsigned int str_parse_long(str x, int base, long int *out);
+unsigned int str_parse_uint32(str x, int base, uint32_t *out);
+/* Same for decimal fractions with an optional exponent. Fixed-point values, as in NMEA, are rounded correctly. */
+unsigned int str_parse_double(str x, double *out);
+
+/* Shorthands for the above, returning 0 on error */
 long int str_to_long_int(str x, int base);
 uint32_t str_to_uint32_t(str x, int base);
 double str_to_double(str x);
@@ -79,9 +129,30 @@ double str_to_double(str x);
  */
 void uint8_t_to_binary_str(uint8_t x, str_mut *dst, uint8_t precision);
 
+/* HEX conversions, see hex.cpp */
+
+/**
+ * Value of a HEX digit
+ * @return - 0..15, or -1 if c is not a HEX digit
+ */
 int hex_to_int(char c);
 
+/**
+ * Decode HEX into binary. Decoding in place (dst == src.s) is supported.
+ * @param dst - output buffer
+ * @param max_dst_len - size of the output buffer, input beyond it is ignored
+ * @param src - HEX input, upper or lower case
+ * @return - number of bytes decoded, 0 if the input has odd length or contains a non-HEX character
+ */
 unsigned int hex_to_str(char *dst, unsigned int max_dst_len, str src);
+
+/**
+ * Encode binary into lower case HEX.
+ * @param dst - output buffer
+ * @param max_dst_len - size of the output buffer, input beyond it is ignored
+ * @param src - binary input
+ * @return - number of characters written
+ */
 unsigned int str_to_hex(char *dst, unsigned int max_dst_len, str src);
 
 int str_find(str x, str y);
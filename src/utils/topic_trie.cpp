@@ -0,0 +1,200 @@
+/*
+ * topic_trie.cpp
+ * Twilio Breakout SDK
+ *
+ * Copyright (c) 2018 Twilio, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file topic_trie.cpp - routing of MQTT topics to handlers by topic filter, over caller-provided storage
+ */
+
+#include "topic_trie.h"
+
+#include <string.h>
+
+static const str wildcard_one   = STRDECL("+");
+static const str wildcard_multi = STRDECL("#");
+
+/* Level starting at pos, up to the next '/' or the end */
+static str level_at(str topic, unsigned int pos) {
+  const char *slash = (const char *)memchr(topic.s + pos, '/', topic.len - pos);
+  unsigned int end  = (slash != nullptr) ? slash - topic.s : topic.len;
+  return {.s = topic.s + pos, .len = end - pos};
+}
+
+static str node_level(const owl_topic_trie *trie, const owl_topic_node *node) {
+  return {.s = trie->pool + node->level_offset, .len = node->level_len};
+}
+
+static int find_child(const owl_topic_trie *trie, int node, str level) {
+  for (int child = trie->nodes[node].first_child; child >= 0; child = trie->nodes[child].next_sibling) {
+    if (str_equal(node_level(trie, &trie->nodes[child]), level)) {
+      return child;
+    }
+  }
+  return -1;
+}
+
+void owl_topic_trie_init(owl_topic_trie *trie, owl_topic_node *nodes, uint16_t max_nodes, char *pool,
+                         uint32_t pool_size) {
+  trie->nodes     = nodes;
+  trie->max_nodes = max_nodes;
+  trie->num_nodes = 1;
+  trie->pool      = pool;
+  trie->pool_size = pool_size;
+  trie->pool_len  = 0;
+
+  nodes[0] = {.level_offset = 0, .level_len = 0, .first_child = -1, .next_sibling = -1, .handler = nullptr,
+              .priv = nullptr};
+}
+
+bool owl_topic_trie_add(owl_topic_trie *trie, str filter, owl_topic_handler_f handler, void *priv) {
+  if (filter.len == 0) {
+    return false;
+  }
+
+  int node         = 0;
+  unsigned int pos = 0;
+  while (true) {
+    str level = level_at(filter, pos);
+    pos += level.len;
+    bool last = (pos == filter.len);
+
+    // Wildcards take a whole level, '#' the last one
+    bool wildcard = memchr(level.s, '+', level.len) != nullptr || memchr(level.s, '#', level.len) != nullptr;
+    if ((wildcard && level.len != 1) || (str_equal(level, wildcard_multi) && !last)) {
+      return false;
+    }
+
+    int child = find_child(trie, node, level);
+    if (child < 0) {
+      if (trie->num_nodes >= trie->max_nodes || level.len > trie->pool_size - trie->pool_len) {
+        return false;
+      }
+      child                 = trie->num_nodes++;
+      owl_topic_node *added = &trie->nodes[child];
+      memcpy(trie->pool + trie->pool_len, level.s, level.len);
+      *added = {.level_offset = trie->pool_len,
+                .level_len    = (uint16_t)level.len,
+                .first_child  = -1,
+                .next_sibling = trie->nodes[node].first_child,
+                .handler      = nullptr,
+                .priv         = nullptr};
+      trie->pool_len += level.len;
+      trie->nodes[node].first_child = child;
+    }
+    node = child;
+
+    if (last) {
+      break;
+    }
+    pos++;  // skip the '/'
+  }
+
+  trie->nodes[node].handler = handler;
+  trie->nodes[node].priv    = priv;
+  return true;
+}
+
+/* Node of a filter with a handler, -1 if the filter is not there */
+static int find_filter(const owl_topic_trie *trie, str filter) {
+  if (filter.len == 0) {
+    return -1;
+  }
+
+  int node         = 0;
+  unsigned int pos = 0;
+  while (node >= 0) {
+    str level = level_at(filter, pos);
+    pos += level.len;
+    node = find_child(trie, node, level);
+    if (pos == filter.len) {
+      break;
+    }
+    pos++;
+  }
+
+  if (node < 0 || trie->nodes[node].handler == nullptr) {
+    return -1;
+  }
+  return node;
+}
+
+bool owl_topic_trie_find(const owl_topic_trie *trie, str filter, owl_topic_handler_f *out_handler, void **out_priv) {
+  int node = find_filter(trie, filter);
+  if (node < 0) {
+    return false;
+  }
+  *out_handler = trie->nodes[node].handler;
+  *out_priv    = trie->nodes[node].priv;
+  return true;
+}
+
+bool owl_topic_trie_remove(owl_topic_trie *trie, str filter) {
+  int node = find_filter(trie, filter);
+  if (node < 0) {
+    return false;
+  }
+  trie->nodes[node].handler = nullptr;
+  trie->nodes[node].priv    = nullptr;
+  return true;
+}
+
+static int call_handler(const owl_topic_node *node, str topic, str payload) {
+  if (node->handler == nullptr) {
+    return 0;
+  }
+  node->handler(topic, payload, node->priv);
+  return 1;
+}
+
+/* Match the children of a node against the topic level at pos, or against the end of the topic if done */
+static int match_children(const owl_topic_trie *trie, int node, str topic, unsigned int pos, bool done,
+                          str payload) {
+  bool system = (pos == 0 && topic.len > 0 && topic.s[0] == '$');
+  str level   = done ? str{.s = nullptr, .len = 0} : level_at(topic, pos);
+  int matched = 0;
+
+  for (int child = trie->nodes[node].first_child; child >= 0; child = trie->nodes[child].next_sibling) {
+    const owl_topic_node *entry = &trie->nodes[child];
+    str entry_level             = node_level(trie, entry);
+
+    if (str_equal(entry_level, wildcard_multi)) {
+      // Also matches the parent level itself
+      if (!system) {
+        matched += call_handler(entry, topic, payload);
+      }
+      continue;
+    }
+    if (done || (str_equal(entry_level, wildcard_one) ? system : !str_equal(entry_level, level))) {
+      continue;
+    }
+
+    unsigned int next = pos + level.len;
+    if (next == topic.len) {
+      matched += call_handler(entry, topic, payload);
+      matched += match_children(trie, child, topic, next, true, payload);
+    } else {
+      matched += match_children(trie, child, topic, next + 1, false, payload);
+    }
+  }
+
+  return matched;
+}
+
+int owl_topic_trie_match(const owl_topic_trie *trie, str topic, str payload) {
+  return match_children(trie, 0, topic, 0, false, payload);
+}
@@ -0,0 +1,103 @@
+/*
+ * topic_trie.h
+ * Twilio Breakout SDK
+ *
+ * Copyright (c) 2018 Twilio, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file topic_trie.h - routing of MQTT topics to handlers by topic filter, over caller-provided storage
+ */
+
+#ifndef __OWL_UTILS_TOPIC_TRIE_H__
+#define __OWL_UTILS_TOPIC_TRIE_H__
+
+#include <stdint.h>
+
+#include "str.h"
+
+/*
+ * The topic filters are split into levels at '/' and stored as a tree of levels, with the '+' (one level) and '#'
+ * (any number of levels, last only) wildcards as regular levels. A topic is matched by walking the tree once, level
+ * by level, so the cost depends on the depth of the topic and not on the number of filters. As in MQTT, wildcards at
+ * the first level don't match topics starting with '$'.
+ *
+ * Nodes are never freed: removing a filter only drops its handler, and adding it again reuses its nodes.
+ */
+
+/*
+ * Handler of the messages matching a filter
+ * @param str - topic of the message
+ * @param str - payload
+ * @param void* - private data given with the filter
+ */
+typedef void (*owl_topic_handler_f)(str, str, void *);
+
+typedef struct {
+  uint32_t level_offset;  // in the pool
+  uint16_t level_len;
+  int16_t first_child;
+  int16_t next_sibling;
+  owl_topic_handler_f handler;  // of the filter ending here, nullptr if none
+  void *priv;
+} owl_topic_node;
+
+typedef struct {
+  owl_topic_node *nodes;
+  uint16_t max_nodes;
+  uint16_t num_nodes;
+  char *pool;  // levels of all the nodes
+  uint32_t pool_size;
+  uint32_t pool_len;
+} owl_topic_trie;
+
+/**
+ * Initialize an empty trie on the given storage
+ * @param trie - trie to initialize
+ * @param nodes - node storage, one per distinct level prefix of the filters plus the root. At least 1
+ * @param max_nodes - number of nodes in the storage, at most 32767
+ * @param pool - storage for the level names
+ * @param pool_size - size of the pool
+ */
+void owl_topic_trie_init(owl_topic_trie *trie, owl_topic_node *nodes, uint16_t max_nodes, char *pool,
+                         uint32_t pool_size);
+
+/**
+ * Add a topic filter, or replace the handler of a filter already added
+ * @return - false if the filter is not valid or the storage is full
+ */
+bool owl_topic_trie_add(owl_topic_trie *trie, str filter, owl_topic_handler_f handler, void *priv);
+
+/**
+ * Remove a topic filter
+ * @return - false if the filter was not there
+ */
+bool owl_topic_trie_remove(owl_topic_trie *trie, str filter);
+
+/**
+ * Look up the handler of a topic filter
+ * @param out_handler - handler of the filter
+ * @param out_priv - private data given with the filter
+ * @return - false if the filter is not there
+ */
+bool owl_topic_trie_find(const owl_topic_trie *trie, str filter, owl_topic_handler_f *out_handler, void **out_priv);
+
+/**
+ * Pass a message to the handlers of all the filters matching its topic
+ * @return - number of handlers called
+ */
+int owl_topic_trie_match(const owl_topic_trie *trie, str topic, str payload);
+
+#endif
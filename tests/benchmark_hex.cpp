@@ -0,0 +1,129 @@
+#ifndef ARDUINO  // arduino tries to compile everything in src directory, but this is not intended for the target
+
+/*
+ * Throughput of the HEX conversions against the original byte-at-a-time implementation.
+ * Configure with e.g. -DCMAKE_CXX_FLAGS="-O2 -mavx2" to benchmark the AVX2 kernels, or with -DOWL_HEX_SCALAR for
+ * the scalar tables.
+ */
+
+#include "utils/str.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <vector>
+
+static int reference_hex_to_int(char c) {
+  switch (c) {
+    case '0':
+      return 0;
+    case '1':
+      return 1;
+    case '2':
+      return 2;
+    case '3':
+      return 3;
+    case '4':
+      return 4;
+    case '5':
+      return 5;
+    case '6':
+      return 6;
+    case '7':
+      return 7;
+    case '8':
+      return 8;
+    case '9':
+      return 9;
+    case 'A':
+    case 'a':
+      return 10;
+    case 'B':
+    case 'b':
+      return 11;
+    case 'C':
+    case 'c':
+      return 12;
+    case 'D':
+    case 'd':
+      return 13;
+    case 'E':
+    case 'e':
+      return 14;
+    case 'F':
+    case 'f':
+      return 15;
+    default:
+      return -1;
+  }
+}
+
+static unsigned int reference_hex_to_str(char *dst, unsigned int max_dst_len, str src) {
+  unsigned int len = 0;
+  int hn, ln;
+  unsigned int i;
+  if (src.len % 2 != 0) return 0;
+  for (i = 0; i < src.len && i < max_dst_len * 2; i += 2) {
+    hn = reference_hex_to_int(src.s[i]) * 16;
+    if (hn < 0) return 0;
+    ln = reference_hex_to_int(src.s[i + 1]);
+    if (ln < 0) return 0;
+    *((uint8_t *)(dst + len)) = hn + ln;
+    len++;
+  }
+  return len;
+}
+
+static char reference_hex_char[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
+
+static unsigned int reference_str_to_hex(char *dst, unsigned int max_dst_len, str src) {
+  unsigned int len = 0;
+  unsigned int i;
+  for (i = 0; i < src.len && len < max_dst_len; i++) {
+    dst[len++] = reference_hex_char[(*((uint8_t *)src.s + i) >> 4) & 0x0F];
+    dst[len++] = reference_hex_char[(*((uint8_t *)src.s + i)) & 0x0F];
+  }
+  return len;
+}
+
+typedef unsigned int (*convert_t)(char *, unsigned int, str);
+
+static double megabytes_per_second(convert_t convert, char *dst, unsigned int dst_len, str src, int rounds) {
+  volatile unsigned int sink = 0;
+  auto start                 = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < rounds; i++) {
+    sink += convert(dst, dst_len, src);
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  (void)sink;
+  return (double)src.len * rounds / elapsed.count() / 1e6;
+}
+
+int main() {
+  const int rounds = 20000;
+
+  printf("%8s %14s %14s %14s %14s\n", "bytes", "encode ref", "encode", "decode ref", "decode");
+  for (unsigned int len : {16u, 64u, 512u, 4096u}) {
+    std::vector<char> binary(len);
+    std::vector<char> hex(2 * len);
+    std::vector<char> out(2 * len);
+
+    for (unsigned int i = 0; i < len; i++) {
+      binary[i] = (char)(i * 37 + 11);
+    }
+    str src = {.s = binary.data(), .len = len};
+    str_to_hex(hex.data(), 2 * len, src);
+    str hex_src = {.s = hex.data(), .len = 2 * len};
+
+    printf("%8u %11.1f MB/s %9.1f MB/s %9.1f MB/s %9.1f MB/s\n", len,
+           megabytes_per_second(reference_str_to_hex, out.data(), 2 * len, src, rounds),
+           megabytes_per_second(str_to_hex, out.data(), 2 * len, src, rounds),
+           megabytes_per_second(reference_hex_to_str, out.data(), len, hex_src, rounds),
+           megabytes_per_second(hex_to_str, out.data(), len, hex_src, rounds));
+  }
+
+  return 0;
+}
+
+#endif  // ARDUINO
@@ -0,0 +1,121 @@
+#ifndef ARDUINO  // arduino tries to compile everything in src directory, but this is not intended for the target
+
+/*
+ * Field splitting of typical AT responses: the original str_tok loops, str_tok over a separator set and str_split.
+ */
+
+#include "utils/str.h"
+
+#include <chrono>
+#include <stdio.h>
+
+static int reference_str_tok(str src, const char *sep, str *dst) {
+  unsigned int i, j, is_sep, sep_len;
+  unsigned int start;
+  if (!src.len || !sep || !dst) return 0;
+  sep_len = strlen(sep);
+  if (!sep_len) return 0;
+  if (dst->s) {
+    if (dst->s < src.s || dst->s > src.s + src.len || dst->s + dst->len > src.s + src.len) {
+      return 0;
+    }
+  }
+  if (!dst->s)
+    start = 0;
+  else
+    start = dst->s + dst->len - src.s;
+  for (i = start; i < src.len; i++) {
+    is_sep = 0;
+    for (j = 0; j < sep_len; j++)
+      if (src.s[i] == sep[j]) {
+        is_sep = 1;
+        break;
+      }
+    if (!is_sep) {
+      dst->s = src.s + i;
+      for (i = i + 1; i < src.len; i++) {
+        is_sep = 0;
+        for (j = 0; j < sep_len; j++)
+          if (src.s[i] == sep[j]) {
+            is_sep = 1;
+            break;
+          }
+        if (is_sep) break;
+      }
+      dst->len = src.s + i - dst->s;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+struct parser_case {
+  const char *name;
+  const char *input;
+  const char *sep;
+};
+
+static const parser_case cases[] = {
+    {"CEREG", "2,5,\"1A2B\",\"01A2B3C4\",7\r\n", ",\r\n"},
+    {"USORF", "0,\"192.168.1.1\",5683,64,\"000102030405060708090a0b0c0d0e0f\"\r\n", ",\r\n"},
+    {"QMTRECV", "0,1,\"devices/owl/messages\",\"{\\\"temperature\\\":21.5}\"", ","},
+    {"RMC", "123519.000,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W,A*6A", ","},
+};
+
+template <typename F>
+static double nanoseconds_per_call(F parse, int rounds) {
+  volatile unsigned int sink = 0;
+  auto start                 = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < rounds; i++) {
+    sink += parse();
+  }
+
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  (void)sink;
+  return elapsed.count() / rounds;
+}
+
+int main() {
+  const int rounds = 1000000;
+
+  printf("%8s %16s %16s %16s %16s\n", "response", "str_tok ref", "str_tok", "str_tok_set", "str_split");
+  for (const parser_case &c : cases) {
+    str src          = {.s = c.input, .len = (unsigned int)strlen(c.input)};
+    str_sepset set   = str_sepset_make(c.sep);
+    auto tok_loop    = [&](int (*tok)(str, const char *, str *)) {
+      str token        = {0};
+      unsigned int sum = 0;
+      for (int i = 0; tok(src, c.sep, &token); i++) {
+        sum += token.len + i;
+      }
+      return sum;
+    };
+    auto tok_set_loop = [&]() {
+      str token        = {0};
+      unsigned int sum = 0;
+      for (int i = 0; str_tok_set(src, &set, &token); i++) {
+        sum += token.len + i;
+      }
+      return sum;
+    };
+    auto split_fields = [&]() {
+      str fields[16];
+      unsigned int sum = 0;
+      int num_fields   = str_split(src, &set, 0, fields, 16);
+      for (int i = 0; i < num_fields; i++) {
+        sum += fields[i].len + i;
+      }
+      return sum;
+    };
+
+    printf("%8s %13.1f ns %13.1f ns %13.1f ns %13.1f ns\n", c.name,
+           nanoseconds_per_call([&]() { return tok_loop(reference_str_tok); }, rounds),
+           nanoseconds_per_call([&]() { return tok_loop(str_tok); }, rounds), nanoseconds_per_call(tok_set_loop, rounds),
+           nanoseconds_per_call(split_fields, rounds));
+  }
+
+  return 0;
+}
+
+#endif  // ARDUINO
@@ -3,14 +3,24 @@
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
 #include "modem/OwlModemAT.h"
+#include "modem/OwlModemATSchema.h"
+#include "modem/OwlModemSocketRN4.h"
+#include "modem/OwlModemMQTTBG96.h"
+#include "shims/sockets/RN4Sockets.h"
+#include "shims/paho-mqtt/RN4PahoIPStack.h"
 #include "utils/md5.h"
 #include "utils/base64.h"
+#include "utils/ring.h"
+#include "utils/outbox.h"
+#include "utils/topic_trie.h"
 #include <openssl/md5.h>
 #include <openssl/evp.h>
 #include <string>
 
 std::vector<std::string> received_strings;
 
+extern owl_time_t test_time_offset;
+
 void spinProcessLineTestpoint(str line) {
   received_strings.push_back(std::string(line.s, line.len));
 }
@@ -40,6 +50,37 @@ class TestSerial : public IOwlSerial {
   std::string te_to_mt;
 };
 
+/* Serial answering the commands of blocking calls: a reply is made available once its trigger has been written */
+class ScriptedSerial : public TestSerial {
+ public:
+  int32_t available() {
+    while (!script.empty()) {
+      size_t found = te_to_mt.find(script.front().first, written_pos);
+      if (found == std::string::npos) {
+        break;
+      }
+      written_pos = found + script.front().first.length();
+      mt_to_te += script.front().second;
+      script.erase(script.begin());
+    }
+    return TestSerial::available();
+  }
+  int32_t read(uint8_t* buf, uint32_t count) {
+    available();
+    return TestSerial::read(buf, count);
+  }
+  bool waitReadable(uint32_t timeout_ms) {
+    return available() > 0;
+  }
+
+  void expect(const std::string& written, const std::string& reply) {
+    script.push_back({written, reply});
+  }
+
+  std::vector<std::pair<std::string, std::string>> script;
+  size_t written_pos = 0;
+};
+
 TEST_CASE("OwlModemAT breaks input into lines correctly", "[linesplit]") {
   SECTION("simple case") {
     INFO("Testing simple case");
@@ -113,6 +154,57 @@ TEST_CASE("OwlModemAT breaks input into lines correctly", "[linesplit]") {
     REQUIRE(received_strings.size() == 1);
     REQUIRE(received_strings[0] == "LINE0");
   }
+
+  SECTION("drain") {
+    INFO("Testing input longer than a single read is consumed in one spin");
+    TestSerial serial;
+    OwlModemAT modem(&serial);
+
+    received_strings.clear();
+    std::vector<std::string> expected;
+    for (int i = 0; i < 20; i++) {
+      std::string line = "LINE" + std::to_string(i) + "-0123456789";
+      serial.mt_to_te += "\r\n" + line + "\r\n";
+      expected.push_back(line);
+    }
+    int input_len = serial.mt_to_te.length();
+
+    REQUIRE(modem.spin() == input_len);
+    REQUIRE(received_strings == expected);
+  }
+
+  SECTION("drain budget") {
+    INFO("Testing spin budget limits the input processed in one spin");
+    TestSerial serial;
+    OwlModemAT modem(&serial);
+
+    received_strings.clear();
+    modem.setSpinBudget(20, 0);
+    serial.mt_to_te = "\r\nLINE0\r\n\r\nLINE1\r\n\r\nLINE2\r\n";
+
+    REQUIRE(modem.spin() == 20);
+    REQUIRE(received_strings == std::vector<std::string>({"LINE0", "LINE1"}));
+
+    REQUIRE(modem.spin() == 7);
+    REQUIRE(received_strings == std::vector<std::string>({"LINE0", "LINE1", "LINE2"}));
+  }
+
+  SECTION("long line") {
+    INFO("Testing lines longer than AT_MAX_LINE_SIZE are truncated without losing the following lines");
+    TestSerial serial;
+    OwlModemAT modem(&serial);
+
+    received_strings.clear();
+    std::string long_line(AT_MAX_LINE_SIZE + 200, 'x');
+    serial.mt_to_te = "\r\n" + long_line + "\r\n\r\nLINE1\r\n";
+    modem.setSpinBudget(0, 0);  // one chunk per spin, so that the long line straddles many reads
+
+    for (int i = 0; i < 20; i++) {
+      modem.spin();
+    }
+
+    REQUIRE(received_strings == std::vector<std::string>({std::string(AT_MAX_LINE_SIZE, 'x'), "LINE1"}));
+  }
 }
 
 std::vector<std::pair<std::string, std::string>> test_urcs;
@@ -161,6 +253,48 @@ TEST_CASE("OwlModemAT calls URC handlers", "[urc]") {
   REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::idle);
 }
 
+std::vector<std::pair<std::string, std::string>> test_named_urcs;
+
+bool test_named_urc_handler(str urc, str data, void* priv) {
+  test_named_urcs.push_back({std::string(urc.s, urc.len), std::string(data.s, data.len)});
+  return priv != nullptr;
+}
+
+TEST_CASE("OwlModemAT dispatches URCs by name", "[urc-name]") {
+  INFO("Testing URC name handlers");
+
+  TestSerial serial;
+  OwlModemAT modem(&serial);
+  int handled = 1;
+
+  test_urcs.clear();
+  test_named_urcs.clear();
+
+  REQUIRE(modem.registerUrcHandler("Test", test_urc_handler, nullptr));
+  REQUIRE(modem.registerUrcNameHandler("+UUSORD", test_named_urc_handler, &handled));
+  REQUIRE(modem.registerUrcNameHandler("+UUSORF", test_named_urc_handler, &handled));
+  // Not handled by the name handler, falls back to the generic handlers
+  REQUIRE(modem.registerUrcNameHandler("+CPIN", test_named_urc_handler, nullptr));
+
+  serial.mt_to_te += "\r\n+UUSORD: 0,12\r\n\r\n+CPIN: READY\r\n\r\n+UUSORF: 1,5\r\n\r\n+UUSOCL: 0\r\n";
+  modem.spin();
+
+  REQUIRE(test_named_urcs == std::vector<std::pair<std::string, std::string>>(
+                                 {{"+UUSORD", "0,12"}, {"+CPIN", "READY"}, {"+UUSORF", "1,5"}}));
+  REQUIRE(test_urcs.size() == 1);
+  REQUIRE(test_urcs[0].second == "READY");
+
+  // Table is limited to MaxUrcNames entries, re-registering an existing name doesn't take a new one
+  static char names[OwlModemAT::MaxUrcNames][8];
+  int registered = 3;
+  for (int i = 0; registered < OwlModemAT::MaxUrcNames; i++, registered++) {
+    snprintf(names[i], sizeof(names[i]), "+URC%d", i);
+    REQUIRE(modem.registerUrcNameHandler(names[i], test_named_urc_handler, &handled));
+  }
+  REQUIRE(modem.registerUrcNameHandler("+UUSORD", test_named_urc_handler, &handled));
+  REQUIRE_FALSE(modem.registerUrcNameHandler("+UUSOCL", test_named_urc_handler, &handled));
+}
+
 TEST_CASE("OwlModemAT processes simple commands correctly", "[command]") {
   INFO("Testing simple command");
   TestSerial serial;
@@ -361,6 +495,522 @@ TEST_CASE("OwlModemAT processes commands with data", "[command-data]") {
   REQUIRE(std::string(response.s, response.len) == "");
 }
 
+class FlowControlSerial : public TestSerial {
+ public:
+  int32_t write(const uint8_t* buf, uint32_t count) {
+    if (stalls > 0 && te_to_mt.length() >= stall_from) {
+      --stalls;
+      return 0;
+    }
+    return TestSerial::write(buf, (count > accept) ? accept : count);
+  }
+  bool flowControlEnabled() {
+    return true;
+  }
+  uint32_t accept{48};
+  int stalls{0};  // writes taking nothing once stall_from bytes went out
+  size_t stall_from{0};
+};
+
+TEST_CASE("OwlModemAT sends data as fast as a flow-controlled port accepts it", "[command-data-flow]") {
+  FlowControlSerial serial;
+  OwlModemAT modem(&serial);
+  std::string data_string(1000, 'x');
+  str data = {.s = data_string.c_str(), .len = static_cast<unsigned int>(data_string.length())};
+
+  REQUIRE(modem.startATCommand("AT+USOWR=0,1000", 1000, data));
+  serial.te_to_mt.clear();
+
+  SECTION("partial writes") {
+    serial.mt_to_te += "\r\nCONNECT\r\n";
+    modem.spin();
+
+    REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::wait_result);
+    REQUIRE(serial.te_to_mt == data_string);
+  }
+
+  SECTION("port stalled") {
+    serial.accept = 0;
+    serial.mt_to_te += "\r\nCONNECT\r\n";
+    modem.spin();
+
+    REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::send_data);
+    REQUIRE(serial.te_to_mt == "");
+
+    serial.accept = 100;
+    for (int i = 0; i < 300 && modem.getModemState() == OwlModemAT::modem_state_t::send_data; i++) {
+      modem.spin();
+      owl_delay(10);
+    }
+
+    REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::wait_result);
+    REQUIRE(serial.te_to_mt == data_string);
+  }
+
+  SECTION("fixed pacing") {
+    modem.setDataPacing(OwlModemAT::data_pacing_t::fixed);
+    serial.accept = 100;
+    serial.mt_to_te += "\r\nCONNECT\r\n";
+    modem.spin();
+
+    REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::send_data);
+    REQUIRE(serial.te_to_mt == data_string.substr(0, AT_DATA_CHUNK_SIZE));
+  }
+}
+
+TEST_CASE("OwlModemAT retries the writes a flow-controlled port holds back", "[command-data-flow]") {
+  FlowControlSerial serial;
+  OwlModemAT modem(&serial);
+  str data = STRDECL("abc");
+
+  SECTION("command line") {
+    serial.stalls = 3;
+    REQUIRE(modem.startATCommand("AT+CSQ", 1000));
+    REQUIRE(serial.te_to_mt == "AT+CSQ\r\n");
+    REQUIRE(serial.stalls == 0);
+  }
+
+  SECTION("data terminator") {
+    REQUIRE(modem.startATCommand("AT+QMTPUB=0,1,1,0,\"t\"", 1000, data, 0x1A));
+    serial.te_to_mt.clear();
+    serial.stalls     = 3;
+    serial.stall_from = data.len;
+
+    serial.mt_to_te += "\r\n>";
+    for (int i = 0; i < 100 && modem.getModemState() != OwlModemAT::modem_state_t::wait_result; i++) {
+      modem.spin();
+      owl_delay(10);
+    }
+
+    REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::wait_result);
+    REQUIRE(serial.te_to_mt == "abc\x1A");
+  }
+
+  SECTION("data terminator never taken") {
+    REQUIRE(modem.startATCommand("AT+QMTPUB=0,1,1,0,\"t\"", 1000, data, 0x1A));
+    serial.te_to_mt.clear();
+    serial.stalls     = 1000;
+    serial.stall_from = data.len;
+
+    serial.mt_to_te += "\r\n>";
+    modem.spin();
+    REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::send_data);
+
+    test_time_offset += 2000;
+    modem.spin();
+    test_time_offset -= 2000;
+
+    REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::response_ready);
+    REQUIRE(modem.getLastCommandResponse(nullptr) == at_result_code::failure);
+    REQUIRE(serial.te_to_mt == "abc");
+  }
+}
+
+std::vector<std::pair<at_result_code, std::string>> queued_results;
+
+void test_queued_command_callback(at_result_code code, str response, void* priv) {
+  queued_results.push_back({code, std::string(response.s, response.len)});
+}
+
+TEST_CASE("OwlModemAT pipelines queued commands", "[command-queue]") {
+  INFO("Testing command queue");
+
+  TestSerial serial;
+  OwlModemAT modem(&serial);
+
+  queued_results.clear();
+
+  REQUIRE(modem.enqueueATCommand("AT+COPS?", 1000, test_queued_command_callback, nullptr));
+  REQUIRE(modem.enqueueATCommand("AT+CSQ", 1000, test_queued_command_callback, nullptr));
+  REQUIRE(modem.commandSprintf("AT+CGMI"));
+  REQUIRE(modem.enqueueATCommand(1000, test_queued_command_callback, nullptr));
+
+  // Only the first command is sent right away, the rest waits for its result
+  REQUIRE(serial.te_to_mt == "AT+COPS?\r\n");
+  REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::wait_result);
+  REQUIRE(modem.getQueuedCommandsCount() == 3);
+
+  // A blocking command can't sneak in between the queued ones
+  REQUIRE_FALSE(modem.startATCommand("AT", 1000));
+
+  serial.te_to_mt.clear();
+  serial.mt_to_te += "\r\n+COPS: 1\r\n\r\nOK\r\n";
+  modem.spin();
+
+  // The next command is sent the moment the result of the previous one is there
+  REQUIRE(queued_results.size() == 1);
+  REQUIRE(queued_results[0].first == at_result_code::OK);
+  REQUIRE(queued_results[0].second == "+COPS: 1\n");
+  REQUIRE(serial.te_to_mt == "AT+CSQ\r\n");
+
+  serial.te_to_mt.clear();
+  serial.mt_to_te += "\r\nERROR\r\n";
+  modem.spin();
+
+  REQUIRE(queued_results.size() == 2);
+  REQUIRE(queued_results[1].first == at_result_code::ERROR);
+  REQUIRE(serial.te_to_mt == "AT+CGMI\r\n");
+
+  serial.mt_to_te += "\r\nu-blox\r\n\r\nOK\r\n";
+  modem.spin();
+
+  REQUIRE(queued_results.size() == 3);
+  REQUIRE(queued_results[2].first == at_result_code::OK);
+  REQUIRE(queued_results[2].second == "u-blox\n");
+
+  // Queued commands never leave the modem in response_ready state
+  REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::idle);
+  REQUIRE(modem.getQueuedCommandsCount() == 0);
+}
+
+static int requeued_commands = 0;
+
+void test_requeueing_callback(at_result_code code, str response, void* priv) {
+  // Like a stream writer, each completion queues the next command
+  if (++requeued_commands < 3) {
+    static_cast<OwlModemAT*>(priv)->enqueueATCommand("AT+NEXT", 1000, test_requeueing_callback, priv);
+  }
+}
+
+TEST_CASE("OwlModemAT blocking commands wait only for the commands queued before them", "[command-queue-wait]") {
+  SECTION("self-requeueing queue") {
+    ScriptedSerial serial;
+    OwlModemAT modem(&serial);
+
+    requeued_commands = 0;
+    serial.expect("AT+FIRST\r\n", "\r\nOK\r\n");
+    serial.expect("AT+BLOCK\r\n", "\r\nOK\r\n");
+    serial.expect("AT+NEXT\r\n", "\r\nOK\r\n");
+    serial.expect("AT+NEXT\r\n", "\r\nOK\r\n");
+
+    REQUIRE(modem.enqueueATCommand("AT+FIRST", 1000, test_requeueing_callback, &modem));
+    REQUIRE(modem.commandStrcpy("AT+BLOCK"));
+    REQUIRE(modem.doCommandBlocking(1000, nullptr) == at_result_code::OK);
+
+    // The command queued by the completion of the earlier one went after the blocking command
+    REQUIRE(serial.te_to_mt == "AT+FIRST\r\nAT+BLOCK\r\n");
+    REQUIRE(modem.getQueuedCommandsCount() == 1);
+
+    modem.spin();
+    modem.spin();
+    REQUIRE(serial.te_to_mt == "AT+FIRST\r\nAT+BLOCK\r\nAT+NEXT\r\nAT+NEXT\r\n");
+    REQUIRE(modem.getQueuedCommandsCount() == 0);
+  }
+
+  SECTION("queue not progressing") {
+    OwlModemAT modem(nullptr);
+
+    REQUIRE(modem.enqueueATCommand("AT+CSQ", 1000));
+    REQUIRE_FALSE(modem.waitCommandQueueBlocking());
+    REQUIRE(modem.commandStrcpy("AT"));
+    REQUIRE(modem.doCommandBlocking(1000, nullptr) == at_result_code::timeout);
+  }
+}
+
+TEST_CASE("OwlModemAT drops queued commands on request", "[command-queue-cancel]") {
+  INFO("Testing command queue cancellation");
+
+  TestSerial serial;
+  OwlModemAT modem(&serial);
+  int other = 0;
+
+  queued_results.clear();
+
+  REQUIRE(modem.enqueueATCommand("AT+USOWR=0,1", 1000, test_queued_command_callback, nullptr));
+  REQUIRE(modem.enqueueATCommand("AT+USOWR=0,2", 1000, test_queued_command_callback, nullptr));
+  REQUIRE(modem.enqueueATCommand("AT+CSQ", 1000, test_queued_command_callback, &other));
+  REQUIRE(modem.enqueueATCommand("AT+USOWR=0,3", 1000, test_queued_command_callback, nullptr));
+  REQUIRE(modem.getQueuedCommandsCount() == 4);
+
+  // The command being executed stays, the matching queued ones go, the others keep their order
+  REQUIRE(modem.cancelQueuedCommands(test_queued_command_callback, nullptr) == 2);
+  REQUIRE(modem.getQueuedCommandsCount() == 2);
+
+  serial.te_to_mt.clear();
+  serial.mt_to_te += "\r\nOK\r\n";
+  modem.spin();
+  REQUIRE(serial.te_to_mt == "AT+CSQ\r\n");
+
+  serial.mt_to_te += "\r\nOK\r\n";
+  modem.spin();
+  REQUIRE(queued_results.size() == 2);
+  REQUIRE(modem.getQueuedCommandsCount() == 0);
+}
+
+TEST_CASE("OwlModemAT writes referenced command data without staging it", "[command-segments]") {
+  TestSerial serial;
+  OwlModemATT<OwlModemATLeanTraits> modem(&serial);
+  std::string payload;
+  std::string payload_hex;
+
+  for (int i = 0; i < 512; i++) {
+    char hex[3];
+    snprintf(hex, sizeof(hex), "%02x", i & 0xFF);
+    payload += (char)(i & 0xFF);
+    payload_hex += hex;
+  }
+  str data = {.s = payload.c_str(), .len = static_cast<unsigned int>(payload.length())};
+
+  // 1024 HEX characters don't fit into the 300 byte command buffer of the lean profile
+  REQUIRE(modem.commandSprintf("AT+USOWR=0,%u,\"", data.len));
+  REQUIRE_FALSE(modem.commandAppendHex(data));
+
+  REQUIRE(modem.commandSprintf("AT+USOWR=0,%u,\"", data.len));
+  REQUIRE(modem.commandAppendRef(data, true));
+  REQUIRE(modem.commandStrcat("\""));
+  REQUIRE_FALSE(modem.enqueueATCommand(1000));
+
+  REQUIRE(modem.startATCommand(1000));
+  REQUIRE(serial.te_to_mt == "AT+USOWR=0,512,\"" + payload_hex + "\"\r\n");
+
+  serial.mt_to_te += "\r\n+USOWR: 0,512\r\n\r\nOK\r\n";
+  modem.spin();
+
+  str response;
+  REQUIRE(modem.getLastCommandResponse(&response) == at_result_code::OK);
+  REQUIRE(std::string(response.s, response.len) == "+USOWR: 0,512\n");
+
+  // The next command starts from a clean slate
+  REQUIRE(modem.startATCommand("AT", 1000));
+  REQUIRE(serial.te_to_mt.substr(serial.te_to_mt.length() - 4) == "AT\r\n");
+}
+
+TEST_CASE("OwlModemAT buffers are sized by the traits", "[traits]") {
+  INFO("Testing lean profile");
+
+  TestSerial serial;
+  OwlModemATT<OwlModemATLeanTraits> modem(&serial);
+
+  REQUIRE(sizeof(modem) < sizeof(OwlModemAT));
+
+  // Lines are truncated to the profile line size
+  received_strings.clear();
+  std::string long_line(AT_MAX_LINE_SIZE, 'x');
+  serial.mt_to_te = "\r\n" + long_line + "\r\n\r\nLINE1\r\n";
+  for (int i = 0; i < 20; i++) {
+    modem.spin();
+  }
+  REQUIRE(received_strings ==
+          std::vector<std::string>({std::string(OwlModemATLeanTraits::MaxLineSize, 'x'), "LINE1"}));
+
+  // Commands are limited by the profile command and queue slot sizes
+  std::string long_command = "AT+" + std::string(OwlModemATLeanTraits::QueuedCommandSize, 'A');
+  REQUIRE_FALSE(modem.enqueueATCommand(long_command.c_str(), 1000));
+  REQUIRE(modem.commandStrcpy(long_command.c_str()));
+  REQUIRE_FALSE(modem.commandStrcpy(std::string(OwlModemATLeanTraits::CommandBufferSize + 1, 'A').c_str()));
+
+  // The first command is sent right away, the rest waits in the queue
+  for (int i = 0; i < OwlModemATLeanTraits::MaxQueuedCommands + 1; i++) {
+    REQUIRE(modem.enqueueATCommand("AT", 1000));
+  }
+  REQUIRE_FALSE(modem.enqueueATCommand("AT", 1000));
+}
+
+TEST_CASE("OwlModemAT initializes the terminal with a small command queue", "[traits]") {
+  ScriptedSerial serial;
+  OwlModemATT<OwlModemATLeanTraits> modem(&serial);
+
+  const char* commands[] = {"ATV1", "ATQ0", "ATE0", "AT+CMEE=2", "ATS3=13", "ATS4=10"};
+  std::string sent;
+  for (const char* command : commands) {
+    serial.expect(std::string(command) + "\r\n", "\r\nOK\r\n");
+    sent += std::string(command) + "\r\n";
+  }
+
+  REQUIRE(modem.initTerminal());
+
+  // More commands than queue slots, still none of them left out
+  REQUIRE(serial.te_to_mt == sent);
+  REQUIRE(serial.script.empty());
+  REQUIRE(modem.getQueuedCommandsCount() == 0);
+}
+
+std::string payload_header;
+std::string payload_data;
+int payload_chunks = 0;
+bool payload_done  = false;
+
+void test_payload_handler(str header, str chunk, bool last, void* priv) {
+  payload_header = std::string(header.s, header.len);
+  payload_data += std::string(chunk.s, chunk.len);
+  payload_chunks++;
+  payload_done = last;
+}
+
+TEST_CASE("OwlModemAT streams payload lines longer than the line buffer", "[payload-line]") {
+  INFO("Testing payload lines");
+
+  TestSerial serial;
+  OwlModemAT modem(&serial);
+
+  payload_header.clear();
+  payload_data.clear();
+  payload_chunks = 0;
+  payload_done   = false;
+  received_strings.clear();
+
+  REQUIRE(modem.registerPayloadLine("+USORD: ", 2, true, test_payload_handler, nullptr));
+
+  std::string expected;
+  std::string hex;
+  for (int i = 0; i < 512; i++) {
+    char byte[3];
+    snprintf(byte, sizeof(byte), "%02X", i & 0xFF);
+    expected += (char)(i & 0xFF);
+    hex += byte;
+  }
+
+  REQUIRE(modem.startATCommand("AT+USORD=0,512", 1000));
+  serial.mt_to_te += "\r\n+USORD: 0,512,\"" + hex + "\"\r\n\r\nOK\r\n";
+  modem.setSpinBudget(0, 0);  // one chunk per spin, so that the payload is streamed in many chunks
+
+  for (int i = 0; i < 40; i++) {
+    modem.spin();
+  }
+
+  REQUIRE(payload_done);
+  REQUIRE(payload_chunks > 1);
+  REQUIRE(payload_header == "0,512");
+  REQUIRE(payload_data == expected);
+
+  // Payload line is not a part of the response
+  REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::response_ready);
+  str response;
+  REQUIRE(modem.getLastCommandResponse(&response) == at_result_code::OK);
+  REQUIRE(std::string(response.s, response.len) == "");
+
+  // Lines without the payload are processed as usual
+  REQUIRE(modem.startATCommand("AT+USORD=0,0", 1000));
+  serial.mt_to_te += "\r\n+USORD: 0,23\r\n\r\nOK\r\n";
+  modem.spin();
+
+  REQUIRE(modem.getLastCommandResponse(&response) == at_result_code::OK);
+  REQUIRE(std::string(response.s, response.len) == "+USORD: 0,23\n");
+}
+
+TEST_CASE("OwlModemAT streams length-delimited binary payloads", "[payload-binary]") {
+  INFO("Testing binary payload lines");
+
+  TestSerial serial;
+  OwlModemAT modem(&serial);
+
+  payload_header.clear();
+  payload_data.clear();
+  payload_chunks = 0;
+  payload_done   = false;
+
+  REQUIRE(modem.registerPayloadLine("+USORF: ", 4, false, test_payload_handler, nullptr, 3));
+
+  // Line ends, quotes and commas are payload bytes, not delimiters
+  std::string payload = std::string("a\r\n\"b,\0c\n", 10);
+  for (int i = 0; i < 300; i++) {
+    payload += (char)(i & 0xFF);
+  }
+
+  REQUIRE(modem.startATCommand("AT+USORF=0,310", 1000));
+  serial.mt_to_te += "\r\n+USORF: 0,\"10.0.0.1\",5683,310,\"" + payload + "\"\r\n\r\nOK\r\n";
+  modem.setSpinBudget(0, 0);
+
+  for (int i = 0; i < 40; i++) {
+    modem.spin();
+  }
+
+  REQUIRE(payload_done);
+  REQUIRE(payload_chunks > 1);
+  REQUIRE(payload_header == "0,\"10.0.0.1\",5683,310");
+  REQUIRE(payload_data == payload);
+
+  REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::response_ready);
+  str response;
+  REQUIRE(modem.getLastCommandResponse(&response) == at_result_code::OK);
+  REQUIRE(std::string(response.s, response.len) == "");
+
+  // Commas within quoted header fields don't end the header
+  REQUIRE(modem.registerPayloadLine("+QMTRECV: ", 4, false, test_payload_handler, nullptr, 3));
+  payload_data.clear();
+  payload_done = false;
+  serial.mt_to_te += "\r\n+QMTRECV: 0,1,\"a,b\",4,\"\x1a,\r\n\"\r\n";
+  for (int i = 0; i < 10; i++) {
+    modem.spin();
+  }
+
+  REQUIRE(payload_done);
+  REQUIRE(payload_header == "0,1,\"a,b\",4");
+  REQUIRE(payload_data == "\x1a,\r\n");
+
+  // Binary data is written after the '@' prompt
+  std::string data_string = std::string("\x01\r\n\x02", 4);
+  str data                = {.s = data_string.c_str(), .len = static_cast<unsigned int>(data_string.length())};
+  REQUIRE(modem.startATCommand("AT+USOWR=0,4", 1000, data));
+  REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::wait_prompt);
+
+  serial.te_to_mt.clear();
+  serial.mt_to_te += "\r\n@";
+  for (int i = 0; i < 5; i++) {
+    modem.spin();
+  }
+
+  REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::wait_result);
+  REQUIRE(serial.te_to_mt == data_string);
+}
+
+TEST_CASE("OwlModemAT switches to a raw byte pipe in data mode", "[data-mode]") {
+  INFO("Testing data mode");
+
+  TestSerial serial;
+  OwlModemAT modem(&serial);
+
+  // The pipe data comes right after CONNECT and must not be parsed as lines
+  std::string pipe_in = std::string("\r\nOK\r\n+UUSORD: 0,3\r\n\0\xff", 22);
+  for (int i = 0; i < 200; i++) {
+    pipe_in += (char)(i & 0xFF);
+  }
+  serial.mt_to_te += "\r\nCONNECT\r\n" + pipe_in;
+
+  modem.commandStrcpy("AT+USODL=0");
+  REQUIRE(modem.enterDataMode(1000));
+  REQUIRE(modem.inDataMode());
+  REQUIRE(serial.te_to_mt == "AT+USODL=0\r\n");
+
+  modem.spin();
+  std::string received;
+  uint8_t buf[50];
+  while (modem.dataWaitReadable(0)) {
+    int32_t len = modem.dataRead(buf, sizeof(buf));
+    REQUIRE(len > 0);
+    received += std::string((char*)buf, len);
+  }
+  REQUIRE(received == pipe_in);
+
+  serial.te_to_mt.clear();
+  REQUIRE(modem.dataWrite((const uint8_t*)"\r\nAT\r\n", 6) == 6);
+  REQUIRE(serial.te_to_mt == "\r\nAT\r\n");
+
+  // No commands while the pipe is open
+  REQUIRE(!modem.startATCommand("AT", 1000));
+
+  serial.te_to_mt.clear();
+  serial.mt_to_te += "\r\nOK\r\n";
+  REQUIRE(modem.exitDataMode(10));
+  REQUIRE(serial.te_to_mt == "+++");
+  REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::idle);
+  REQUIRE(modem.dataRead(buf, sizeof(buf)) < 0);
+
+  // SARA-R4 confirms the end of a direct link with DISCONNECT
+  serial.mt_to_te += "\r\nCONNECT\r\n";
+  modem.commandStrcpy("AT+USODL=0");
+  REQUIRE(modem.enterDataMode(1000));
+  serial.mt_to_te += "\r\nDISCONNECT\r\n";
+  REQUIRE(modem.exitDataMode(10));
+  REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::idle);
+
+  // A failed switch leaves the modem in command mode
+  serial.mt_to_te += "\r\nERROR\r\n";
+  modem.commandStrcpy("AT+USODL=0");
+  REQUIRE(!modem.enterDataMode(1000));
+  REQUIRE(modem.getModemState() == OwlModemAT::modem_state_t::idle);
+}
+
 TEST_CASE("MD5 hash is calculated correctly", "[md5]") {
   std::string data =
       "Beware the Jabberwock, my son!\nThe jaws that bite, the claws that catch!\nBeware the Jubjub bird, and "
@@ -462,4 +1112,826 @@ TEST_CASE("Ensure conversion from uint8_t to binary string occurs correctly", "[
   REQUIRE(str_equal(supernine_8, output) == 1);
 }
 
+static std::vector<std::string> split(const char* input, const char* sep, unsigned int flags, int max_fields = 8) {
+  str src               = {.s = input, .len = static_cast<unsigned int>(strlen(input))};
+  str_sepset separators = str_sepset_make(sep);
+  std::vector<str> fields(max_fields);
+  std::vector<std::string> result;
+
+  int num_fields = str_split(src, &separators, flags, fields.data(), max_fields);
+  for (int i = 0; i < num_fields; i++) {
+    result.push_back(std::string(fields[i].s, fields[i].len));
+  }
+  return result;
+}
+
+static std::vector<std::string> tokenize(const char* input, const char* sep, bool empty_tokens) {
+  str src   = {.s = input, .len = static_cast<unsigned int>(strlen(input))};
+  str token = {0};
+  std::vector<std::string> result;
+
+  while (empty_tokens ? str_tok_with_empty_tokens(src, sep, &token) : str_tok(src, sep, &token)) {
+    result.push_back(std::string(token.s, token.len));
+  }
+  return result;
+}
+
+TEST_CASE("Strings are split into fields correctly", "[str-split]") {
+  using fields = std::vector<std::string>;
+
+  REQUIRE(tokenize("\r\n+CEREG: 2,5\r\n\r\nOK\r\n", "\r\n", false) == fields({"+CEREG: 2,5", "OK"}));
+  REQUIRE(tokenize("1,,2,", ",", true) == fields({"1", "", "2"}));
+  REQUIRE(tokenize(",,", ",", false) == fields());
+
+  REQUIRE(split("2,5,\"1A2B\",\"01A2B3C4\",7", ",", 0) == fields({"2", "5", "\"1A2B\"", "\"01A2B3C4\"", "7"}));
+  REQUIRE(split("\r\nA\r\n\r\nB\r\n", "\r\n", 0) == fields({"A", "B"}));
+  REQUIRE(split("123519,A,,N,", ",", STR_SPLIT_EMPTY_TOKENS) == fields({"123519", "A", "", "N", ""}));
+  REQUIRE(split("0,1,\"a/b\",\"x,y\"", ",", 0) == fields({"0", "1", "\"a/b\"", "\"x", "y\""}));
+  REQUIRE(split("0,1,\"a/b\",\"x,y\"", ",", STR_SPLIT_QUOTES) == fields({"0", "1", "\"a/b\"", "\"x,y\""}));
+  REQUIRE(split("1,2,3,4", ",", 0, 2) == fields({"1", "2"}));
+  REQUIRE(split("", ",", STR_SPLIT_EMPTY_TOKENS) == fields());
+}
+
+static str to_str(const char* s) {
+  return {.s = s, .len = static_cast<unsigned int>(strlen(s))};
+}
+
+TEST_CASE("Numbers are parsed in place", "[str-number]") {
+  long int l = -1;
+  uint32_t u = 0;
+  double d   = 0;
+
+  REQUIRE(str_parse_long(to_str("1234,5"), 10, &l) == 4);
+  REQUIRE(l == 1234);
+  REQUIRE(str_parse_long(to_str("-42"), 10, &l) == 3);
+  REQUIRE(l == -42);
+  REQUIRE(str_parse_long(to_str("\"1A2B\",7"), 16, &l) == 6);
+  REQUIRE(l == 0x1A2B);
+  REQUIRE(str_parse_long(to_str("0x1f"), 0, &l) == 4);
+  REQUIRE(l == 31);
+  REQUIRE(str_parse_long(to_str(" 0101"), 2, &l) == 5);
+  REQUIRE(l == 5);
+  REQUIRE(str_parse_long(to_str("9223372036854775807"), 10, &l) == 19);
+  REQUIRE(l == LONG_MAX);
+
+  l = 7;
+  REQUIRE(str_parse_long(to_str(""), 10, &l) == 0);
+  REQUIRE(str_parse_long(to_str("x1"), 10, &l) == 0);
+  REQUIRE(str_parse_long(to_str("\"\""), 10, &l) == 0);
+  REQUIRE(str_parse_long(to_str("99999999999999999999"), 10, &l) == 0);
+  REQUIRE(l == 7);
+
+  REQUIRE(str_parse_uint32(to_str("\"01A2B3C4\""), 16, &u) == 10);
+  REQUIRE(u == 0x01A2B3C4);
+  REQUIRE(str_parse_uint32(to_str("4294967295"), 10, &u) == 10);
+  REQUIRE(u == UINT32_MAX);
+  REQUIRE(str_parse_uint32(to_str("4294967296"), 10, &u) == 0);
+  REQUIRE(str_parse_uint32(to_str("-1"), 10, &u) == 0);
+
+  // NMEA fixed-point values convert like strtod
+  for (const char* value : {"4807.038", "01131.000", "022.4", "0.000001", "-12.5", "123456789.123456789", "1e3",
+                            "2.5E-3", ".5", "7."}) {
+    INFO(value);
+    REQUIRE(str_parse_double(to_str(value), &d) == strlen(value));
+    REQUIRE(d == strtod(value, nullptr));
+  }
+  REQUIRE(str_parse_double(to_str("12.5,N"), &d) == 4);
+  REQUIRE(str_parse_double(to_str("3e,"), &d) == 1);
+  REQUIRE(d == 3);
+  REQUIRE(str_parse_double(to_str("."), &d) == 0);
+  REQUIRE(str_parse_double(to_str("N"), &d) == 0);
+
+  REQUIRE(str_to_long_int(to_str("\"-17\""), 10) == -17);
+  REQUIRE(str_to_uint32_t(to_str("ff"), 16) == 255);
+  REQUIRE(str_to_double(to_str("4807.038")) == 4807.038);
+  REQUIRE(str_to_long_int(to_str("bad"), 10) == 0);
+}
+
+TEST_CASE("AT response parameters are parsed by schema", "[schema]") {
+  enum class reg_stat { Not_Registered = 0, Registered_Home = 1 };
+  struct reg_t {
+    int n;
+    reg_stat stat;
+    uint16_t lac;
+    uint32_t ci;
+    str oper;
+    uint8_t mode;
+  };
+  using Schema = OwlATSchema<reg_t, AT_INT(&reg_t::n), AT_INT(&reg_t::stat), AT_HEX(&reg_t::lac), AT_HEX(&reg_t::ci),
+                             AT_STR(&reg_t::oper), AT_BIN(&reg_t::mode)>;
+  using SkipSchema = OwlATSchema<reg_t, AT_SKIP, AT_INT(&reg_t::stat)>;
+
+  reg_t reg = {-1, reg_stat::Not_Registered, 0, 0xFFFFFFFFu, {0}, 0};
+  REQUIRE(Schema::parse(to_str("2,1,\"1A2B\",\"01A2B3C4\",\"a,b\",\"0101\""), &reg) == 6);
+  REQUIRE(reg.n == 2);
+  REQUIRE(reg.stat == reg_stat::Registered_Home);
+  REQUIRE(reg.lac == 0x1A2B);
+  REQUIRE(reg.ci == 0x01A2B3C4);
+  REQUIRE(std::string(reg.oper.s, reg.oper.len) == "a,b");
+  REQUIRE(reg.mode == 5);
+
+  // missing and empty parameters keep their defaults, the line ends at CR/LF
+  reg = {-1, reg_stat::Not_Registered, 0, 0xFFFFFFFFu, {0}, 0};
+  REQUIRE(Schema::parse(to_str("1,,\"00FF\"\r\n3,4"), &reg) == 3);
+  REQUIRE(reg.n == 1);
+  REQUIRE(reg.stat == reg_stat::Not_Registered);
+  REQUIRE(reg.lac == 0xFF);
+  REQUIRE(reg.ci == 0xFFFFFFFFu);
+  REQUIRE(reg.oper.len == 0);
+
+  REQUIRE(Schema::parse(to_str(""), &reg) == 0);
+  REQUIRE(SkipSchema::parse(to_str("9,1,5"), &reg) == 2);
+  REQUIRE(reg.n == 1);
+  REQUIRE(reg.stat == reg_stat::Registered_Home);
+
+  // values out of range for their member are not wrapped
+  reg = {-1, reg_stat::Not_Registered, 0x1234, 0, {0}, 7};
+  REQUIRE(Schema::parse(to_str("-5,1,\"12345\",\"-1\",\"\",\"100000000\""), &reg) == 6);
+  REQUIRE(reg.n == -5);
+  REQUIRE(reg.lac == 0x1234);
+  REQUIRE(reg.ci == 0);
+  REQUIRE(reg.mode == 7);
+  REQUIRE(Schema::parse(to_str("2,1,\"FFFF\",\"FFFFFFFF\",\"\",\"11111111\""), &reg) == 6);
+  REQUIRE(reg.lac == 0xFFFF);
+  REQUIRE(reg.mode == 0xFF);
+
+  // the line with the prefix is picked out of a multi-line response
+  reg = {-1, reg_stat::Not_Registered, 0, 0xFFFFFFFFu, {0}, 0};
+  str response = to_str("+CSQ: 9,9\r\n+CEREG: 0,1,\"ABCD\"\r\n");
+  REQUIRE(Schema::parseResponse(response, to_str("+CEREG: "), &reg) == 3);
+  REQUIRE(reg.n == 0);
+  REQUIRE(reg.lac == 0xABCD);
+  REQUIRE(Schema::parseResponse(response, to_str("+COPS: "), &reg) == -1);
+}
+
+TEST_CASE("Ring buffer wraps around correctly", "[ring]") {
+  uint8_t storage[8];
+  uint8_t out[16];
+  owl_ring ring;
+
+  owl_ring_init(&ring, storage, sizeof(storage));
+  REQUIRE(owl_ring_free(&ring) == 8);
+
+  REQUIRE(owl_ring_write(&ring, (const uint8_t*)"abcdef", 6) == 6);
+  REQUIRE(owl_ring_read(&ring, out, 4) == 4);
+  REQUIRE(std::string((char*)out, 4) == "abcd");
+
+  // Crosses the end of the storage, and only what fits is taken
+  REQUIRE(owl_ring_write(&ring, (const uint8_t*)"ghijklmnop", 10) == 6);
+  REQUIRE(owl_ring_used(&ring) == 8);
+  REQUIRE(owl_ring_free(&ring) == 0);
+  REQUIRE(owl_ring_write(&ring, (const uint8_t*)"x", 1) == 0);
+
+  REQUIRE(owl_ring_read(&ring, nullptr, 1) == 1);  // dropped
+  REQUIRE(owl_ring_read(&ring, out, sizeof(out)) == 7);
+  REQUIRE(std::string((char*)out, 7) == "fghijkl");
+  REQUIRE(owl_ring_read(&ring, out, sizeof(out)) == 0);
+
+  owl_ring_init(&ring, nullptr, 8);
+  REQUIRE(owl_ring_free(&ring) == 0);
+  REQUIRE(owl_ring_write(&ring, (const uint8_t*)"a", 1) == 0);
+}
+
+static std::string outbox_topic(const owl_outbox* outbox, int index) {
+  str topic;
+  REQUIRE(owl_outbox_get(outbox, index, &topic, nullptr, nullptr, nullptr));
+  return std::string(topic.s, topic.len);
+}
+
+TEST_CASE("Outbox keeps messages in order across reopening", "[outbox]") {
+  uint32_t storage[(sizeof(owl_outbox_header) + 4 * 64) / 4] = {0};
+  owl_outbox outbox;
+
+  REQUIRE(owl_outbox_init(&outbox, (uint8_t*)storage, sizeof(storage), 64, owl_outbox_retention::DropOldest));
+  REQUIRE(owl_outbox_count(&outbox) == 0);
+  REQUIRE(owl_outbox_next(&outbox) == -1);
+
+  str data = STRDECL("payload");
+  REQUIRE(owl_outbox_push(&outbox, STRDECL("a"), data, 1, false));
+  REQUIRE(owl_outbox_push(&outbox, STRDECL("b"), data, 1, true, 1));
+  REQUIRE(owl_outbox_push(&outbox, STRDECL("c"), data, 1, false));
+  REQUIRE(!owl_outbox_push(&outbox, STRDECL("too-long"), {.s = data.s, .len = owl_outbox_max_message(&outbox)}, 1,
+                           false));
+
+  // Higher priority first, then the oldest
+  int index = owl_outbox_next(&outbox);
+  REQUIRE(outbox_topic(&outbox, index) == "b");
+  str out_data;
+  uint8_t qos;
+  bool retain;
+  REQUIRE(owl_outbox_get(&outbox, index, nullptr, &out_data, &qos, &retain));
+  REQUIRE(std::string(out_data.s, out_data.len) == "payload");
+  REQUIRE(qos == 1);
+  REQUIRE(retain);
+
+  owl_outbox_set_sending(&outbox, index, true);
+  REQUIRE(outbox_topic(&outbox, owl_outbox_next(&outbox)) == "a");
+  owl_outbox_remove(&outbox, owl_outbox_next(&outbox));
+  REQUIRE(outbox.tail == 1);
+
+  // Reopening keeps the intact records, the one being sent is pending again and a corrupted one is dropped
+  REQUIRE(owl_outbox_push(&outbox, STRDECL("d"), data, 1, false));
+  index = owl_outbox_next(&outbox);
+  REQUIRE(outbox_topic(&outbox, index) == "c");
+  ((uint8_t*)storage)[sizeof(owl_outbox_header) + index * 64 + sizeof(owl_outbox_record) + 3] ^= 0xFF;
+
+  REQUIRE(owl_outbox_init(&outbox, (uint8_t*)storage, sizeof(storage), 64, owl_outbox_retention::DropOldest));
+  REQUIRE(owl_outbox_count(&outbox) == 2);
+  REQUIRE(outbox.tail == 1);
+  REQUIRE(outbox.head == 4);
+  REQUIRE(outbox_topic(&outbox, owl_outbox_next(&outbox)) == "b");
+
+  // When full, the oldest of the lowest priority goes, never a higher priority one
+  REQUIRE(owl_outbox_push(&outbox, STRDECL("e"), data, 1, false));
+  REQUIRE(owl_outbox_push(&outbox, STRDECL("f"), data, 1, false));
+  REQUIRE(owl_outbox_count(&outbox) == 4);
+  REQUIRE(owl_outbox_push(&outbox, STRDECL("g"), data, 1, false));
+  REQUIRE(owl_outbox_count(&outbox) == 4);
+  REQUIRE(outbox.tail == 1);
+
+  owl_outbox_remove(&outbox, owl_outbox_next(&outbox));
+  REQUIRE(outbox_topic(&outbox, owl_outbox_next(&outbox)) == "e");
+  REQUIRE(owl_outbox_push(&outbox, STRDECL("h"), data, 1, false));
+  REQUIRE(owl_outbox_push(&outbox, STRDECL("i"), data, 1, false));
+  REQUIRE(outbox_topic(&outbox, owl_outbox_next(&outbox)) == "f");
+  owl_outbox_set_sending(&outbox, owl_outbox_next(&outbox), true);
+  REQUIRE(outbox_topic(&outbox, owl_outbox_next(&outbox)) == "g");
+
+  // A different geometry starts over
+  REQUIRE(owl_outbox_init(&outbox, (uint8_t*)storage, sizeof(storage), 32, owl_outbox_retention::RejectNew));
+  REQUIRE(owl_outbox_count(&outbox) == 0);
+  for (int i = 0; i < 8; i++) {
+    REQUIRE(owl_outbox_push(&outbox, STRDECL("x"), data, 0, false));
+  }
+  REQUIRE(!owl_outbox_push(&outbox, STRDECL("y"), data, 0, false, 1));
+  REQUIRE(owl_outbox_count(&outbox) == 8);
+}
+
+std::string topic_matches;
+
+void test_topic_handler(str topic, str payload, void* priv) {
+  topic_matches += std::string((const char*)priv) + ";";
+}
+
+static int match_topic(owl_topic_trie* trie, const char* topic) {
+  topic_matches.clear();
+  return owl_topic_trie_match(trie, STRDECL(topic), STRDECL("payload"));
+}
+
+TEST_CASE("Topic trie routes topics to the matching filters", "[topic-trie]") {
+  owl_topic_node nodes[16];
+  char pool[64];
+  owl_topic_trie trie;
+  owl_topic_trie_init(&trie, nodes, 16, pool, sizeof(pool));
+
+  REQUIRE(owl_topic_trie_add(&trie, STRDECL("dev/1/cmd"), test_topic_handler, (void*)"exact"));
+  REQUIRE(owl_topic_trie_add(&trie, STRDECL("dev/+/cmd"), test_topic_handler, (void*)"one"));
+  REQUIRE(owl_topic_trie_add(&trie, STRDECL("dev/#"), test_topic_handler, (void*)"multi"));
+  REQUIRE(owl_topic_trie_add(&trie, STRDECL("#"), test_topic_handler, (void*)"all"));
+  REQUIRE(!owl_topic_trie_add(&trie, STRDECL("dev/#/cmd"), test_topic_handler, nullptr));
+  REQUIRE(!owl_topic_trie_add(&trie, STRDECL("dev/a+"), test_topic_handler, nullptr));
+
+  REQUIRE(match_topic(&trie, "dev/1/cmd") == 4);
+  REQUIRE(match_topic(&trie, "dev/2/cmd") == 3);
+  REQUIRE(topic_matches.find("exact") == std::string::npos);
+  REQUIRE(match_topic(&trie, "dev/2/cmd/x") == 2);
+  REQUIRE(match_topic(&trie, "dev") == 2);  // '#' matches the parent level too
+  REQUIRE(match_topic(&trie, "other") == 1);
+  REQUIRE(match_topic(&trie, "$SYS/dev") == 0);  // wildcards don't match '$' topics at the first level
+
+  // Adding again replaces the handler, removing keeps the other filters
+  REQUIRE(owl_topic_trie_add(&trie, STRDECL("dev/+/cmd"), test_topic_handler, (void*)"two"));
+  REQUIRE(match_topic(&trie, "dev/2/cmd") == 3);
+  REQUIRE(topic_matches.find("two") != std::string::npos);
+  owl_topic_handler_f handler = nullptr;
+  void* priv                  = nullptr;
+  REQUIRE(owl_topic_trie_find(&trie, STRDECL("dev/+/cmd"), &handler, &priv));
+  REQUIRE((handler == test_topic_handler && std::string((const char*)priv) == "two"));
+  REQUIRE(!owl_topic_trie_find(&trie, STRDECL("dev/+"), &handler, &priv));
+  REQUIRE(owl_topic_trie_remove(&trie, STRDECL("#")));
+  REQUIRE(!owl_topic_trie_remove(&trie, STRDECL("#")));
+  REQUIRE(!owl_topic_trie_remove(&trie, STRDECL("dev/1")));
+  REQUIRE(match_topic(&trie, "dev/1/cmd") == 3);
+  REQUIRE(match_topic(&trie, "other") == 0);
+
+  // Full storage
+  REQUIRE(!owl_topic_trie_add(&trie, STRDECL("a/b/c/d/e/f/g/h/i/j/k/l/m"), test_topic_handler, nullptr));
+}
+
+TEST_CASE("RN4 receive rings and blocking receives don't mix up their data", "[socket-ring]") {
+  ScriptedSerial serial;
+  OwlModemAT modem(&serial);
+  OwlModemSocketRN4 socket(&modem);
+
+  uint8_t tcp, udp;
+  serial.expect("AT+USOCR=6\r\n", "\r\n+USOCR: 0\r\n\r\nOK\r\n");
+  serial.expect("AT+USOCO=0,\"10.0.0.1\",80,0\r\n", "\r\nOK\r\n");
+  serial.expect("AT+USOCR=17\r\n", "\r\n+USOCR: 1\r\n\r\nOK\r\n");
+  serial.expect("AT+USOCO=1,\"10.0.0.1\",53\r\n", "\r\nOK\r\n");
+  REQUIRE(socket.open(uso_protocol::TCP, 0, &tcp));
+  REQUIRE(socket.connect(tcp, to_str("10.0.0.1"), 80, nullptr, nullptr));
+  REQUIRE(socket.open(uso_protocol::UDP, 0, &udp));
+  REQUIRE(socket.connect(udp, to_str("10.0.0.1"), 53, nullptr, nullptr));
+
+  uint8_t ring[64];
+  REQUIRE(socket.setReceiveBuffer(tcp, ring, sizeof(ring)));
+
+  // The read for the ring is still running when the blocking receive on the other socket starts
+  serial.mt_to_te += "\r\n+UUSORD: 0,5\r\n";
+  modem.spin();
+  REQUIRE(modem.getQueuedCommandsCount() == 1);
+  serial.expect("AT+USORD=0,5\r\n", "\r\n+USORD: 0,5,\"68656C6C6F\"\r\n\r\nOK\r\n");
+  serial.expect("AT+USORD=1,3\r\n", "\r\n+USORD: 1,3,\"616263\"\r\n\r\nOK\r\n");
+
+  char buf[64];
+  str_mut out = {.s = buf, .len = 0};
+  REQUIRE(socket.receiveUDP(udp, 3, &out, sizeof(buf)));
+  REQUIRE(std::string(out.s, out.len) == "abc");
+  REQUIRE(socket.getReceiveBuffered(tcp) == 5);
+  uint8_t read_buf[8];
+  REQUIRE(socket.readBuffered(tcp, read_buf, sizeof(read_buf)) == 5);
+  REQUIRE(std::string((char*)read_buf, 5) == "hello");
+
+  // A read that could not be queued is retried by the next readBuffered()
+  for (int i = 0; i < 9; i++) {
+    REQUIRE(modem.enqueueATCommand("AT", 1000));
+  }
+  serial.mt_to_te += "\r\n+UUSORD: 0,2\r\n";
+  modem.spin();
+  for (int i = 0; i < 9; i++) {
+    serial.expect("AT\r\n", "\r\nOK\r\n");
+  }
+  REQUIRE(modem.waitCommandQueueBlocking(1000));
+  REQUIRE(serial.te_to_mt.find("AT+USORD=0,2") == std::string::npos);
+
+  serial.expect("AT+USORD=0,2\r\n", "\r\n+USORD: 0,2,\"6869\"\r\n\r\nOK\r\n");
+  REQUIRE(socket.readBuffered(tcp, read_buf, sizeof(read_buf)) == 0);
+  REQUIRE(socket.waitReceiveBuffered(tcp, 2, 1000));
+  REQUIRE(socket.readBuffered(tcp, read_buf, sizeof(read_buf)) == 2);
+  REQUIRE(std::string((char*)read_buf, 2) == "hi");
+}
+
+TEST_CASE("RN4Sockets reports readiness from the URCs", "[rn4-sockets]") {
+  ScriptedSerial serial;
+  OwlModemAT modem(&serial);
+  OwlModemSocketRN4 socket(&modem);
+  RN4Sockets sockets(&socket, &modem);
+
+  serial.expect("AT+USOCR=6\r\n", "\r\n+USOCR: 0\r\n\r\nOK\r\n");
+  serial.expect("AT+USOCO=0,\"10.0.0.1\",80,0\r\n", "\r\nOK\r\n");
+  int fd = sockets.socket(uso_protocol::TCP);
+  REQUIRE(fd == 0);
+  REQUIRE(sockets.connect(fd, to_str("10.0.0.1"), 80) == 0);
+
+  rn4_pollfd pfd = {.fd = fd, .events = RN4_POLLIN | RN4_POLLOUT, .revents = 0};
+  REQUIRE(sockets.poll(&pfd, 1, 0) == 1);
+  REQUIRE(pfd.revents == RN4_POLLOUT);
+
+  uint8_t buf[16];
+  REQUIRE(sockets.recv(fd, buf, sizeof(buf)) == RN4_SOCKET_WOULD_BLOCK);
+
+  // The data is read ahead as soon as it is announced
+  serial.expect("AT+USORD=0,5\r\n", "\r\n+USORD: 0,5,\"68656C6C6F\"\r\n\r\nOK\r\n");
+  serial.mt_to_te += "\r\n+UUSORD: 0,5\r\n";
+  pfd.events = RN4_POLLIN;
+  REQUIRE(sockets.poll(&pfd, 1, 1000) == 1);
+  REQUIRE(pfd.revents == RN4_POLLIN);
+  REQUIRE(sockets.recv(fd, buf, sizeof(buf)) == 5);
+  REQUIRE(std::string((char*)buf, 5) == "hello");
+
+  // A closed connection is readable, and reads the end of the stream
+  serial.mt_to_te += "\r\n+UUSOCL: 0\r\n";
+  REQUIRE(sockets.poll(&pfd, 1, 1000) == 1);
+  REQUIRE(pfd.revents == (RN4_POLLIN | RN4_POLLHUP));
+  REQUIRE(sockets.recv(fd, buf, sizeof(buf)) == 0);
+  REQUIRE(sockets.send(fd, buf, 1) == RN4_SOCKET_ERROR);
+}
+
+TEST_CASE("RN4Sockets closes the connections its accept backlog can't take", "[rn4-sockets]") {
+  ScriptedSerial serial;
+  OwlModemAT modem(&serial);
+  OwlModemSocketRN4 socket(&modem);
+  RN4Sockets sockets(&socket, &modem);
+
+  serial.expect("AT+USOCR=6\r\n", "\r\n+USOCR: 0\r\n\r\nOK\r\n");
+  serial.expect("AT+USOLI=0,8080\r\n", "\r\nOK\r\n");
+  int fd = sockets.socket(uso_protocol::TCP);
+  REQUIRE(sockets.listen(fd, 8080) == 0);
+
+  rn4_pollfd pfd = {.fd = fd, .events = RN4_POLLIN, .revents = 0};
+  REQUIRE(sockets.poll(&pfd, 1, 0) == 0);
+
+  for (int i = 1; i <= RN4_SOCKETS_ACCEPT_BACKLOG + 1; i++) {
+    serial.mt_to_te +=
+        "\r\n+UUSOLI: " + std::to_string(i) + ",\"10.0.0." + std::to_string(i) + "\",4000,0,\"10.0.0.100\",8080\r\n";
+  }
+  modem.spin();
+  REQUIRE(serial.te_to_mt.find("AT+USOCL=") == std::string::npos);
+
+  serial.expect("AT+USOCL=3,0\r\n", "\r\nOK\r\n");
+  REQUIRE(sockets.poll(&pfd, 1, 0) == 1);
+  REQUIRE(pfd.revents == RN4_POLLIN);
+  REQUIRE(serial.te_to_mt.find("AT+USOCL=3,0\r\n") != std::string::npos);
+
+  char ip_buf[40];
+  str_mut remote_ip    = {.s = ip_buf, .len = 0};
+  uint16_t remote_port = 0;
+  REQUIRE(sockets.accept(fd, &remote_ip, &remote_port) == 1);
+  REQUIRE(std::string(remote_ip.s, remote_ip.len) == "10.0.0.1");
+  REQUIRE(remote_port == 4000);
+  REQUIRE(sockets.accept(fd, nullptr, nullptr) == 2);
+  REQUIRE(sockets.accept(fd, nullptr, nullptr) == RN4_SOCKET_WOULD_BLOCK);
+}
+
+TEST_CASE("RN4PahoIPStack coalesces the writes of an MQTT packet", "[rn4-paho]") {
+  ScriptedSerial serial;
+  OwlModemAT modem(&serial);
+  OwlModemSocketRN4 socket(&modem);
+  RN4PahoIPStack stack(&socket);
+
+  serial.expect("AT+USOCR=6,8883\r\n", "\r\n+USOCR: 0\r\n\r\nOK\r\n");
+  serial.expect("AT+USOSEC=0,0\r\n", "\r\nOK\r\n");
+  serial.expect("AT+USOCO=0,\"10.0.0.1\",1883,0\r\n", "\r\nOK\r\n");
+  REQUIRE(stack.connect("10.0.0.1", 1883));
+  stack.setWriteCoalescing(true);
+
+  auto writes = [&serial]() {
+    size_t count = 0;
+    for (size_t pos = serial.te_to_mt.find("AT+USOWR="); pos != std::string::npos;
+         pos        = serial.te_to_mt.find("AT+USOWR=", pos + 1)) {
+      count++;
+    }
+    return count;
+  };
+
+  // Fixed header first, then the rest of the packet
+  uint8_t connect_header[] = {0x10, 0x04};
+  uint8_t connect_body[]   = {0x00, 0x04, 'M', 'Q'};
+  REQUIRE(stack.write(connect_header, sizeof(connect_header), 1000) == 2);
+  REQUIRE(writes() == 0);
+  serial.expect("AT+USOWR=0,6,\"", "\r\n+USOWR: 0,6\r\n\r\nOK\r\n");
+  REQUIRE(stack.write(connect_body, sizeof(connect_body), 1000) == 4);
+  REQUIRE(writes() == 1);
+  REQUIRE(serial.te_to_mt.find("AT+USOWR=0,6,\"100400044d51\"") != std::string::npos);
+
+  // Remaining length over two bytes, split in the middle of it
+  std::vector<uint8_t> publish = {0x30, 0x80, 0x01};
+  publish.resize(3 + 128, 'x');
+  REQUIRE(stack.write(&publish[0], 2, 1000) == 2);
+  REQUIRE(stack.write(&publish[2], 64, 1000) == 64);
+  REQUIRE(writes() == 1);
+  serial.expect("AT+USOWR=0,131,\"", "\r\n+USOWR: 0,131\r\n\r\nOK\r\n");
+  REQUIRE(stack.write(&publish[66], 65, 1000) == 65);
+  REQUIRE(writes() == 2);
+
+  // A packet and the start of the next one wait for the rest, until flushed
+  uint8_t pingreq_and_more[] = {0xC0, 0x00, 0xE0};
+  REQUIRE(stack.write(pingreq_and_more, sizeof(pingreq_and_more), 1000) == 3);
+  REQUIRE(writes() == 2);
+  serial.expect("AT+USOWR=0,3,\"", "\r\n+USOWR: 0,3\r\n\r\nOK\r\n");
+  REQUIRE(stack.flush());
+  REQUIRE(writes() == 3);
+}
+
+static std::vector<std::pair<uint16_t, bool>> published;
+
+static void test_publish_callback(uint16_t msg_id, bool success, void* priv) {
+  published.push_back({msg_id, success});
+  if (priv != nullptr) {
+    *(int*)priv = published.size();
+  }
+}
+
+TEST_CASE("BG96 asynchronous publishes are matched to their acknowledgements", "[mqtt-publish]") {
+  ScriptedSerial serial;
+  OwlModemAT modem(&serial);
+  OwlModemMQTTBG96 mqtt(&modem);
+  published.clear();
+
+  // Each publish gets its own id while in flight, QoS 0 ones all use 0
+  for (const char* data : {"one", "two", "three"}) {
+    serial.expect("AT+QMTPUB=0,", "\r\n>");
+    serial.expect(std::string(data) + "\x1a", "\r\nOK\r\n");
+  }
+  REQUIRE(mqtt.publishAsync("t", to_str("one"), false, OwlModemMQTTBG96::qos_t::atLeastOnce, test_publish_callback));
+  REQUIRE(mqtt.publishAsync("t", to_str("two"), false, OwlModemMQTTBG96::qos_t::atLeastOnce, test_publish_callback));
+  REQUIRE(mqtt.publishAsync("t", to_str("three"), true, OwlModemMQTTBG96::qos_t::atMostOnce, test_publish_callback));
+  REQUIRE(modem.waitCommandQueueBlocking(1000));
+  REQUIRE(serial.te_to_mt.find("AT+QMTPUB=0,1,1,0,\"t\"\r\n") != std::string::npos);
+  REQUIRE(serial.te_to_mt.find("AT+QMTPUB=0,2,1,0,\"t\"\r\n") != std::string::npos);
+  REQUIRE(serial.te_to_mt.find("AT+QMTPUB=0,0,0,1,\"t\"\r\n") != std::string::npos);
+  REQUIRE(mqtt.getPublishInFlight() == 3);
+
+  // A retransmission is not a completion
+  serial.mt_to_te += "\r\n+QMTPUB: 0,2,1,1\r\n\r\n+QMTPUB: 0,1,2\r\n";
+  modem.spin();
+  REQUIRE(published == std::vector<std::pair<uint16_t, bool>>({{1, false}}));
+  serial.mt_to_te += "\r\n+QMTPUB: 0,2,0\r\n\r\n+QMTPUB: 0,0,0\r\n";
+  modem.spin();
+  REQUIRE(published == std::vector<std::pair<uint16_t, bool>>({{1, false}, {2, true}, {0, true}}));
+  REQUIRE(mqtt.getPublishInFlight() == 0);
+
+  // The QoS 0 acknowledgements complete the oldest QoS 0 publish
+  published.clear();
+  int first = 0, second = 0;
+  serial.expect("AT+QMTPUB=0,0,0,0,\"t\"\r\n", "\r\n>");
+  serial.expect("a\x1a", "\r\nOK\r\n");
+  serial.expect("AT+QMTPUB=0,0,0,0,\"t\"\r\n", "\r\n>");
+  serial.expect("b\x1a", "\r\nOK\r\n");
+  REQUIRE(mqtt.publishAsync("t", to_str("a"), false, OwlModemMQTTBG96::qos_t::atMostOnce, test_publish_callback,
+                            &first));
+  REQUIRE(mqtt.publishAsync("t", to_str("b"), false, OwlModemMQTTBG96::qos_t::atMostOnce, test_publish_callback,
+                            &second));
+  REQUIRE(modem.waitCommandQueueBlocking(1000));
+  serial.mt_to_te += "\r\n+QMTPUB: 0,0,0\r\n";
+  modem.spin();
+  REQUIRE(first == 1);
+  REQUIRE(second == 0);
+  serial.mt_to_te += "\r\n+QMTPUB: 0,0,0\r\n";
+  modem.spin();
+  REQUIRE(second == 2);
+
+  // Ids are not reused before their publish completes
+  serial.expect("AT+QMTPUB=0,3,1,0,\"t\"\r\n", "\r\n>");
+  serial.expect("c\x1a", "\r\nOK\r\n");
+  REQUIRE(mqtt.publishAsync("t", to_str("c"), false, OwlModemMQTTBG96::qos_t::atLeastOnce, test_publish_callback));
+  REQUIRE(modem.waitCommandQueueBlocking(1000));
+  REQUIRE(mqtt.getPublishInFlight() == 1);
+}
+
+TEST_CASE("BG96 publishes timing out don't leave their command queued", "[mqtt-publish]") {
+  ScriptedSerial serial;
+  OwlModemAT modem(&serial);
+  OwlModemMQTTBG96 mqtt(&modem);
+  published.clear();
+
+  // The publish waits behind a command which is not answered yet
+  REQUIRE(modem.enqueueATCommand("AT", 120 * 1000));
+  REQUIRE(mqtt.publishAsync("t", to_str("late"), false, OwlModemMQTTBG96::qos_t::atLeastOnce,
+                            test_publish_callback));
+  REQUIRE(modem.getQueuedCommandsCount() == 2);
+
+  test_time_offset += MQTT_PUBLISH_TIMEOUT + 1000;
+  mqtt.handlePublishTimeouts();
+  REQUIRE(published == std::vector<std::pair<uint16_t, bool>>({{1, false}}));
+  REQUIRE(modem.getQueuedCommandsCount() == 1);
+
+  serial.mt_to_te += "\r\nOK\r\n";
+  REQUIRE(modem.waitCommandQueueBlocking(1000));
+  REQUIRE(serial.te_to_mt.find("AT+QMTPUB") == std::string::npos);
+}
+
+TEST_CASE("BG96 publishes timing out while their command runs are reported once it completes", "[mqtt-publish]") {
+  ScriptedSerial serial;
+  OwlModemAT modem(&serial);
+  OwlModemMQTTBG96 mqtt(&modem);
+  published.clear();
+
+  REQUIRE(mqtt.publishAsync("t", to_str("late"), false, OwlModemMQTTBG96::qos_t::atLeastOnce,
+                            test_publish_callback));
+  REQUIRE(serial.te_to_mt.find("AT+QMTPUB") != std::string::npos);
+
+  test_time_offset += MQTT_PUBLISH_TIMEOUT + 1000;
+  mqtt.handlePublishTimeouts();
+  mqtt.handlePublishTimeouts();
+  test_time_offset -= MQTT_PUBLISH_TIMEOUT + 1000;
+  REQUIRE(published.empty());
+  REQUIRE(mqtt.getPublishInFlight() == 1);
+
+  serial.mt_to_te += "\r\n>";
+  modem.spin();
+  serial.mt_to_te += "\r\nOK\r\n";
+  modem.spin();
+  REQUIRE(serial.te_to_mt.find("late") != std::string::npos);
+  REQUIRE(published == std::vector<std::pair<uint16_t, bool>>({{1, false}}));
+  REQUIRE(mqtt.getPublishInFlight() == 0);
+}
+
+TEST_CASE("BG96 outbox publishes leave the command buffer alone and survive connection losses", "[mqtt-publish]") {
+  ScriptedSerial serial;
+  OwlModemAT modem(&serial);
+  OwlModemMQTTBG96 mqtt(&modem);
+  uint32_t storage[(sizeof(owl_outbox_header) + 4 * 64) / 4] = {0};
+  owl_outbox outbox;
+  REQUIRE(owl_outbox_init(&outbox, (uint8_t*)storage, sizeof(storage), 64));
+  mqtt.setOutbox(&outbox);
+
+  serial.expect("AT+QMTCONN=0,\"c\"\r\n", "\r\nOK\r\n\r\n+QMTCONN: 0,0,0\r\n");
+  REQUIRE(mqtt.login("c", nullptr, nullptr));
+
+  serial.expect("AT+QMTPUB=0,1,1,0,\"t/1\"\r\n", "\r\n>");
+  serial.expect("m1\x1a", "\r\nOK\r\n");
+  REQUIRE(mqtt.publishStored("t/1", to_str("m1")));
+  REQUIRE(modem.waitCommandQueueBlocking(1000));
+
+  // No room in the command queue, the next message waits in the outbox for the acknowledgement of the first one
+  int filler = 0;
+  while (modem.enqueueATCommand("AT", 1000)) {
+    serial.expect("AT\r\n", "\r\nOK\r\n");
+    filler++;
+  }
+  REQUIRE(mqtt.publishStored("t/2", to_str("m2")));
+  REQUIRE(modem.waitCommandQueueBlocking(1000));
+  REQUIRE(serial.te_to_mt.find("\"t/2\"") == std::string::npos);
+
+  // It is started from the URC while a blocking command is being prepared. Message ids aren't checked here, the
+  // failed start took one
+  REQUIRE(modem.commandSprintf("AT+QMTSUB=0,5,\"x\",1"));
+  serial.mt_to_te += "\r\n+QMTPUB: 0,1,0\r\n";
+  modem.spin();
+  serial.expect(",1,0,\"t/2\"\r\n", "\r\n>");
+  serial.expect("m2\x1a", "\r\nOK\r\n");
+  serial.expect("AT+QMTSUB=0,5,\"x\",1\r\n", "\r\nOK\r\n");
+  REQUIRE(modem.doCommandBlocking(1000, nullptr) == at_result_code::OK);
+  REQUIRE(owl_outbox_count(&outbox) == 1);
+  REQUIRE(mqtt.getPublishInFlight() == 1);
+
+  // Connection lost with a publish waiting for its acknowledgement and one still queued
+  REQUIRE(modem.enqueueATCommand("AT", 120 * 1000));
+  REQUIRE(mqtt.publishStored("t/3", to_str("m3")));
+  REQUIRE(modem.getQueuedCommandsCount() == 2);
+  serial.mt_to_te += "\r\n+QMTSTAT: 0,1\r\n";
+  modem.spin();
+  REQUIRE(mqtt.getPublishInFlight() == 0);
+  REQUIRE(modem.getQueuedCommandsCount() == 1);
+  REQUIRE(owl_outbox_count(&outbox) == 2);
+  serial.mt_to_te += "\r\nOK\r\n";
+  REQUIRE(modem.waitCommandQueueBlocking(1000));
+  REQUIRE(serial.te_to_mt.find("\"t/3\"") == std::string::npos);
+
+  // Both are sent again once logged in
+  serial.expect("AT+QMTCONN=0,\"c\"\r\n", "\r\nOK\r\n\r\n+QMTCONN: 0,0,0\r\n");
+  serial.expect(",1,0,\"t/2\"\r\n", "\r\n>");
+  serial.expect("m2\x1a", "\r\nOK\r\n");
+  serial.expect(",1,0,\"t/3\"\r\n", "\r\n>");
+  serial.expect("m3\x1a", "\r\nOK\r\n");
+  REQUIRE(mqtt.login("c", nullptr, nullptr));
+  REQUIRE(modem.waitCommandQueueBlocking(1000));
+  REQUIRE(mqtt.getPublishInFlight() == 2);
+  REQUIRE(serial.script.empty());
+}
+
+static std::vector<std::pair<std::string, std::string>> mqtt_messages;
+
+static void test_mqtt_message(str topic, str payload) {
+  mqtt_messages.push_back({std::string(topic.s, topic.len), std::string(payload.s, payload.len)});
+}
+
+TEST_CASE("BG96 receives messages with and without their length", "[mqtt-recv]") {
+  ScriptedSerial serial;
+  OwlModemAT modem(&serial);
+  OwlModemMQTTBG96 mqtt(&modem);
+  mqtt.setMessageCallback(test_mqtt_message);
+  mqtt_messages.clear();
+
+  // Default mode: the comma in the payload is outside of the quotes, but there is no length to take it for
+  serial.mt_to_te += "\r\n+QMTRECV: 0,1,\"t\",\"{\"msg\":\"a,b\"}\"\r\n";
+  modem.spin();
+  REQUIRE(mqtt_messages == std::vector<std::pair<std::string, std::string>>({{"t", "{\"msg\":\"a,b\"}"}}));
+
+  // With the length, the payload is taken as it is, line ends included
+  serial.expect("AT+QMTCFG=\"recv/mode\",0,0,1\r\n", "\r\nOK\r\n");
+  REQUIRE(mqtt.setReceiveMode(false));
+  mqtt_messages.clear();
+  serial.mt_to_te += "\r\n+QMTRECV: 0,2,\"t\",15,\"{\"msg\":\"a,b\"}\r\n\"\r\n";
+  modem.spin();
+  REQUIRE(mqtt_messages == std::vector<std::pair<std::string, std::string>>({{"t", "{\"msg\":\"a,b\"}\r\n"}}));
+
+  // Messages of the other clients go to them
+  OwlModemMQTTClientBG96 second(&mqtt, 1);
+  second.setMessageCallback(nullptr);
+  mqtt_messages.clear();
+  serial.mt_to_te += "\r\n+QMTRECV: 1,3,\"t\",1,\"x\"\r\n\r\n+QMTRECV: 0,4,\"u\",1,\"y\"\r\n";
+  modem.spin();
+  REQUIRE(mqtt_messages == std::vector<std::pair<std::string, std::string>>({{"u", "y"}}));
+}
+
+TEST_CASE("BG96 failed subscriptions leave the earlier handlers in place", "[mqtt-subscribe]") {
+  ScriptedSerial serial;
+  OwlModemAT modem(&serial);
+  OwlModemMQTTBG96 mqtt(&modem);
+  mqtt.setMessageCallback(nullptr);
+
+  serial.expect("AT+QMTSUB=0,1,\"t/#\",1\r\n", "\r\nOK\r\n\r\n+QMTSUB: 0,1,0,1\r\n");
+  REQUIRE(mqtt.subscribe("t/#", 1, OwlModemMQTTBG96::qos_t::atLeastOnce, test_topic_handler, (void*)"first"));
+
+  serial.expect("AT+QMTSUB=0,2,\"t/#\",1\r\n", "\r\nERROR\r\n");
+  REQUIRE(!mqtt.subscribe("t/#", 2, OwlModemMQTTBG96::qos_t::atLeastOnce, test_topic_handler, (void*)"second"));
+  serial.expect("AT+QMTSUB=0,3,\"u\",1\r\n", "\r\nERROR\r\n");
+  REQUIRE(!mqtt.subscribe("u", 3, OwlModemMQTTBG96::qos_t::atLeastOnce, test_topic_handler, (void*)"third"));
+
+  topic_matches.clear();
+  serial.mt_to_te += "\r\n+QMTRECV: 0,4,\"t/1\",1,\"x\"\r\n\r\n+QMTRECV: 0,5,\"u\",1,\"y\"\r\n";
+  modem.spin();
+  REQUIRE(topic_matches == "first;");
+}
+
+TEST_CASE("BG96 MQTT URCs are routed to their client", "[mqtt-clients]") {
+  ScriptedSerial serial;
+  OwlModemAT modem(&serial);
+  OwlModemMQTTBG96 mqtt(&modem);
+  OwlModemMQTTClientBG96 second(&mqtt, 2);
+  REQUIRE(mqtt.isValid());
+  REQUIRE(second.isValid());
+  REQUIRE(second.getConnectId() == 2);
+
+  // Ids out of range or taken are refused, and the client does nothing
+  {
+    OwlModemMQTTClientBG96 taken(&mqtt, 2);
+    OwlModemMQTTClientBG96 zero(&mqtt, 0);
+    OwlModemMQTTClientBG96 out_of_range(&mqtt, MQTT_MAX_CLIENTS);
+    REQUIRE(!taken.isValid());
+    REQUIRE(!zero.isValid());
+    REQUIRE(!out_of_range.isValid());
+    REQUIRE(!taken.login("c", nullptr, nullptr));
+    REQUIRE(!zero.publishAsync("t", to_str("x")));
+    REQUIRE(serial.te_to_mt.empty());
+  }
+  // ... and their destruction leaves the valid client registered
+  serial.expect("AT+QMTCONN=2,\"c\"\r\n", "\r\nOK\r\n\r\n+QMTCONN: 0,0,0\r\n\r\n+QMTCONN: 2,0,0\r\n");
+  REQUIRE(second.login("c", nullptr, nullptr));
+
+  // Both clients publish with message id 1, each acknowledgement completes the publish of its client
+  published.clear();
+  int first_done = 0, second_done = 0;
+  serial.expect("AT+QMTPUB=0,1,1,0,\"t\"\r\n", "\r\n>");
+  serial.expect("a\x1a", "\r\nOK\r\n");
+  serial.expect("AT+QMTPUB=2,1,1,0,\"t\"\r\n", "\r\n>");
+  serial.expect("b\x1a", "\r\nOK\r\n");
+  REQUIRE(mqtt.publishAsync("t", to_str("a"), false, OwlModemMQTTBG96::qos_t::atLeastOnce, test_publish_callback,
+                            &first_done));
+  REQUIRE(second.publishAsync("t", to_str("b"), false, OwlModemMQTTBG96::qos_t::atLeastOnce, test_publish_callback,
+                              &second_done));
+  REQUIRE(modem.waitCommandQueueBlocking(1000));
+
+  serial.mt_to_te += "\r\n+QMTPUB: 2,1,0\r\n";
+  modem.spin();
+  REQUIRE(second_done == 1);
+  REQUIRE(first_done == 0);
+
+  // A connection lost on one client leaves the other one alone, URCs for unknown clients are dropped
+  serial.mt_to_te += "\r\n+QMTSTAT: 2,1\r\n\r\n+QMTPUB: 4,1,0\r\n";
+  modem.spin();
+  REQUIRE(first_done == 0);
+  REQUIRE(mqtt.getPublishInFlight() == 1);
+  serial.mt_to_te += "\r\n+QMTPUB: 0,1,0\r\n";
+  modem.spin();
+  REQUIRE(first_done == 2);
+  REQUIRE(published == std::vector<std::pair<uint16_t, bool>>({{1, true}, {1, true}}));
+}
+
+TEST_CASE("HEX encoding/decoding works correctly", "[hex]") {
+  // lengths around the vector block sizes, so that both the blocks and the scalar tails are covered
+  for (unsigned int len : {0u, 1u, 15u, 16u, 17u, 31u, 32u, 33u, 63u, 64u, 65u, 200u}) {
+    std::string binary;
+    std::string expected;
+    for (unsigned int i = 0; i < len; i++) {
+      char hex[3];
+      binary += (char)((i * 37 + 11) & 0xFF);
+      snprintf(hex, sizeof(hex), "%02x", (i * 37 + 11) & 0xFF);
+      expected += hex;
+    }
+    INFO("Length " << len);
+
+    std::vector<char> encoded(2 * len + 1);
+    str src = {.s = binary.data(), .len = len};
+    REQUIRE(str_to_hex(encoded.data(), encoded.size(), src) == 2 * len);
+    REQUIRE(std::string(encoded.data(), 2 * len) == expected);
+
+    std::vector<char> decoded(len + 1);
+    str hex = {.s = expected.data(), .len = 2 * len};
+    REQUIRE(hex_to_str(decoded.data(), decoded.size(), hex) == len);
+    REQUIRE(std::string(decoded.data(), len) == binary);
+
+    // upper case and in place
+    std::string upper = expected;
+    for (auto& c : upper) {
+      c = toupper(c);
+    }
+    str upper_hex = {.s = &upper[0], .len = 2 * len};
+    REQUIRE(hex_to_str(&upper[0], len, upper_hex) == len);
+    REQUIRE(upper.substr(0, len) == binary);
+
+    if (len > 0) {
+      // a bad character anywhere fails the whole conversion
+      for (unsigned int pos : {0u, len, 2 * len - 1}) {
+        std::string bad = expected;
+        bad[pos]        = 'g';
+        str bad_hex     = {.s = bad.data(), .len = 2 * len};
+        REQUIRE(hex_to_str(decoded.data(), decoded.size(), bad_hex) == 0);
+      }
+
+      // output is limited by the destination size
+      REQUIRE(str_to_hex(encoded.data(), len, src) == (len / 2) * 2);
+      REQUIRE(hex_to_str(decoded.data(), len / 2, hex) == len / 2);
+    }
+  }
+
+  REQUIRE(hex_to_int('0') == 0);
+  REQUIRE(hex_to_int('f') == 15);
+  REQUIRE(hex_to_int('F') == 15);
+  REQUIRE(hex_to_int('g') == -1);
+  REQUIRE(hex_to_int('\xB0') == -1);
+}
+
 #endif  // ARDUINO
@@ -11,6 +11,9 @@
 
 static time_t initial_time = time(NULL);
 
+/* Moved forward by the tests waiting for timeouts */
+owl_time_t test_time_offset = 0;
+
 void owl_log(log_level_t ll, const char* format, ...) {
   char buf[2048];
 
@@ -27,7 +30,7 @@ void owl_log_str(log_level_t ll, str data) {
 }
 
 owl_time_t owl_time() {
-  return (time(NULL) - initial_time) * 1000;
+  return (time(NULL) - initial_time) * 1000 + test_time_offset;
 }
 
 void owl_delay(uint32_t ms) {